@@ -111,6 +111,50 @@ JXL_EXPORT JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager);
  */
 JXL_EXPORT void JxlDecoderReset(JxlDecoder* dec);
 
+/**
+ * Rewinds the decoder to the beginning of the image, so that the same input
+ * can be given again from the start of the file, and the decoder emits the
+ * events from the beginning again. Unlike JxlDecoderReset, the settings, the
+ * subscribed events and the parallel runner are kept, as well as the index of
+ * the frames that the decoder built so far, which JxlDecoderSkipFrames uses to
+ * skip to a frame without parsing the frames before it again. The output
+ * buffers and callbacks must be set again.
+ *
+ * @param dec decoder object
+ */
+JXL_EXPORT void JxlDecoderRewind(JxlDecoder* dec);
+
+/**
+ * Makes the decoder skip the next `amount` frames, as counted by the
+ * JXL_DEC_FRAME event. The skipped frames produce no events. Only the frames
+ * that are needed to composite the frame after the skipped ones are decoded,
+ * such as the frames it is blended onto and the frames its patches are taken
+ * from, back to the nearest frame that does not depend on earlier frames. The
+ * other frames are passed over using their table of contents only. To find
+ * out which frames are needed, the decoder indexes the headers of the frames
+ * up to the target first, so it may request more input before decoding
+ * anything.
+ *
+ * Calling this function again adds to the amount of frames to skip. If the
+ * decoder is processing a frame, skipping starts at the next frame. If the
+ * amount is larger than the number of remaining frames, all of them are
+ * skipped.
+ *
+ * To seek to an arbitrary frame, e.g. backwards, use JxlDecoderRewind first
+ * and provide the input from the beginning again: the frame index is kept, so
+ * this only decodes the frames needed for the requested one. Skipping forward
+ * from a frame that was reached by skipping can fail with JXL_DEC_ERROR from
+ * JxlDecoderProcessInput if a frame needed for the new target was already
+ * skipped; rewinding first avoids this. The same error is returned when a
+ * frame after the target reads from a frame that was skipped, e.g. when it is
+ * blended onto a frame before the target. To decode such a frame, rewind and
+ * skip to it directly instead.
+ *
+ * @param dec decoder object
+ * @param amount the amount of frames to skip
+ */
+JXL_EXPORT void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount);
+
 /**
  * Deinitializes and frees JxlDecoder instance.
  *
@@ -159,8 +203,9 @@ typedef enum {
   JXL_DEC_NEED_DC_OUT_BUFFER = 4,
 
   /** The decoder requests and output buffer to store the full resolution image,
-   * which can be set with JxlDecoderSetImageOutBuffer. This event re-occurs for
-   * new frames if there are multiple animation frames.
+   * which can be set with JxlDecoderSetImageOutBuffer or
+   * JxlDecoderSetImageOutCallback. This event re-occurs for new frames if
+   * there are multiple animation frames.
    */
   JXL_DEC_NEED_IMAGE_OUT_BUFFER = 5,
 
@@ -172,6 +217,31 @@ typedef enum {
    */
   JXL_DEC_JPEG_NEED_MORE_OUTPUT = 6,
 
+  /** Decoding the next frame would need more memory than the limit set with
+   * JxlDecoderSetMemoryLimit allows. This is returned before the pixel
+   * buffers of the frame are allocated. The decoder cannot continue with this
+   * image, and must be reset with JxlDecoderReset or destroyed.
+   */
+  JXL_DEC_MEMORY_LIMIT_EXCEEDED = 7,
+
+  /** Only returned if an executor is set with JxlDecoderSetAsyncExecutor: the
+   * decoding step was submitted to the executor, or is still running. The
+   * decoder, its input and its output buffers must not be used nor modified
+   * until the step is done. Call JxlDecoderProcessInput again after the work
+   * function returned to get the result of the step.
+   */
+  JXL_DEC_WORK_PENDING = 8,
+
+  /** Decoding stopped early because the deadline set with
+   * JxlDecoderSetDeadline passed, or because JxlDecoderCancel was called.
+   * If the image out buffer or callback is set and the DC of the current
+   * frame was decoded, the best rendering available is output to it, as with
+   * JxlDecoderFlushImage: the DC only, or the passes decoded so far.
+   * Decoding can continue with the same input after setting a later deadline,
+   * but not after JxlDecoderCancel, which lasts until JxlDecoderReset.
+   */
+  JXL_DEC_CANCELLED = 9,
+
   /** Informative event by JxlDecoderProcessInput: basic information such as
    * image dimensions and extra channels. This event occurs max once per image.
    */
@@ -272,6 +342,74 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Makes JxlDecoderProcessInput non-blocking. Each call that starts a decoding
+ * step submits the step to @p executor and returns JXL_DEC_WORK_PENDING, and
+ * the next call after the step is done returns its result instead of
+ * JXL_DEC_WORK_PENDING. Calls while the step is running return
+ * JXL_DEC_WORK_PENDING again. Callbacks, such as the image out callback, are
+ * called from the thread running the step. May only be set before starting
+ * decoding.
+ *
+ * @param dec decoder object
+ * @param executor function submitting decoding steps, see JxlAsyncExecutor,
+ *        or NULL to make JxlDecoderProcessInput block again.
+ * @param executor_opaque opaque pointer for executor.
+ * @return JXL_DEC_SUCCESS if the executor was set, JXL_DEC_ERROR
+ * otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetAsyncExecutor(
+    JxlDecoder* dec, JxlAsyncExecutor executor, void* executor_opaque);
+
+/**
+ * Enables pipelined decoding of animations. When the sections of a frame are
+ * decoded, its finalization (filters, blending with earlier frames) and its
+ * conversion to the image out buffer are submitted to @p executor, and the
+ * decoder continues with the next frames while it runs. A later frame that
+ * reads from a frame that the submitted one is saved as or reads from, e.g.
+ * to blend onto it, waits for it to be done before starting; other frames are
+ * decoded in the meantime. The events are still returned in order:
+ * JXL_DEC_FULL_IMAGE of a frame is returned once it is done, then the
+ * JXL_DEC_FRAME of the next frame, whose pixels may then already be decoded.
+ * The submitted work uses the parallel runner set with
+ * JxlDecoderSetFramePipeliningRunner, or a single thread if there is none, from
+ * which the image out callback, if any, is called. Frames decoded while a
+ * submitted frame is running are not streamed to their image out buffer while
+ * decoding, but converted when done.
+ *
+ * Each JxlDecoderProcessInput call waits for the work it submitted before
+ * returning. Pipelining keeps one more frame in memory, and is not used when a
+ * memory limit is set or when JXL_DEC_DC_IMAGE or JXL_DEC_JPEG_RECONSTRUCTION
+ * events are subscribed to. May only be set before starting decoding.
+ *
+ * @param dec decoder object
+ * @param executor function running the finalization and conversion of a
+ *        frame, see JxlAsyncExecutor, or NULL to decode the frames one after
+ *        the other.
+ * @param executor_opaque opaque pointer for executor.
+ * @return JXL_DEC_SUCCESS if the executor was set, JXL_DEC_ERROR
+ * otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetFramePipelining(
+    JxlDecoder* dec, JxlAsyncExecutor executor, void* executor_opaque);
+
+/**
+ * Sets the parallel runner for the work submitted by the frame pipelining, see
+ * JxlDecoderSetFramePipelining. It runs concurrently with the parallel runner
+ * set with JxlDecoderSetParallelRunner, which decodes the next frames, so it
+ * must be a different runner, with its own threads. May only be set before
+ * starting decoding.
+ *
+ * @param dec decoder object
+ * @param parallel_runner function pointer to runner for multithreading
+ * @param parallel_runner_opaque opaque pointer for parallel_runner.
+ * @return JXL_DEC_SUCCESS if the runner was set, JXL_DEC_ERROR
+ * otherwise (the previous runner remains set).
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetFramePipeliningRunner(
+    JxlDecoder* dec, JxlParallelRunner parallel_runner,
+    void* parallel_runner_opaque);
+
 /**
  * Returns a hint indicating how many more bytes the decoder is expected to
  * need to make JxlDecoderGetBasicInfo available after the next
@@ -335,6 +473,196 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSubscribeEvents(JxlDecoder* dec,
 JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetKeepOrientation(JxlDecoder* dec, JXL_BOOL keep_orientation);
 
+/**
+ * Enables or disables reading the input in place. When enabled, the caller
+ * guarantees that all bytes passed with JxlDecoderSetInput stay valid and
+ * unchanged at their address until the decoder is reset or destroyed, even
+ * after JxlDecoderReleaseInput. The decoder then reads the codestream directly
+ * from the memory of the caller, also when it is split over multiple jxlp
+ * boxes or arrives over multiple calls to JxlDecoderSetInput, instead of
+ * copying the bytes it still needs into an internal buffer. Only headers and
+ * the rare sections that straddle two separate input buffers or codestream
+ * boxes are copied.
+ *
+ * With this option, JxlDecoderProcessInput always takes in all input that was
+ * set, so JxlDecoderReleaseInput returns 0, and the next input must continue
+ * right after it.
+ *
+ * Must be called before the first call to JxlDecoderProcessInput. By default,
+ * this option is disabled. It is disabled again by JxlDecoderReset.
+ *
+ * @param dec decoder object
+ * @param input_borrowed JXL_TRUE to enable, JXL_FALSE to disable.
+ * @return JXL_DEC_SUCCESS if no error, JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetInputBorrowed(JxlDecoder* dec,
+                                                       JXL_BOOL input_borrowed);
+
+/**
+ * Restricts decoding to a rectangular region of the image, for example the
+ * viewport of a large image. Only the parts of the codestream needed for the
+ * region, and the border around it needed by the image filters, are decoded,
+ * so the decoding time scales with the size of the region rather than with
+ * the size of the image. Groups of the codestream that are not needed are
+ * also not waited for when the input is streamed.
+ *
+ * Only the region is output: the image output buffer holds the region, with
+ * the orientation undone, starting at its first byte, see
+ * JxlDecoderImageOutBufferSize. Likewise, the coordinates passed to the
+ * callback set with JxlDecoderSetImageOutCallback are relative to the region.
+ * Frames that are displayed directly and not blended are also only kept in
+ * memory for the region.
+ *
+ * The coordinates are in pixels of the image as stored in the codestream,
+ * that is, before the orientation is undone, as if JxlDecoderSetKeepOrientation
+ * was set to JXL_TRUE.
+ *
+ * Only the frames that are displayed directly are restricted to the region,
+ * frames that are referenced by later frames are always decoded in full.
+ *
+ * Can be called after JXL_DEC_BASIC_INFO is returned, and applies to the
+ * frames whose decoding starts afterwards.
+ *
+ * @param dec decoder object
+ * @param x0 left edge of the region
+ * @param y0 top edge of the region
+ * @param xsize width of the region, or 0 to decode the whole image
+ * @param ysize height of the region, or 0 to decode the whole image
+ * @return JXL_DEC_SUCCESS if no error, JXL_DEC_ERROR if the basic info is not
+ * yet known or the region is outside of the image.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec,
+                                                    size_t x0, size_t y0,
+                                                    size_t xsize, size_t ysize);
+
+/**
+ * Requests a reduced resolution image, for example for thumbnails. The image
+ * returned in the image out buffer or callback is downsampled by the given
+ * factor in both dimensions, so it has a size of xsize / downsampling by
+ * ysize / downsampling of the JxlBasicInfo, rounded up.
+ *
+ * Only the progressive passes of the codestream that are needed at that scale
+ * are decoded, and the decoder does not wait for the input bytes of the other
+ * passes. With a factor of 8, only the DC of VarDCT frames is decoded, which
+ * costs a fraction of a full decode, and frames without patches, splines,
+ * noise or extra channels are rendered directly from it at 1/8 of the size.
+ * Smaller factors save work only if the image was encoded with progressive
+ * passes for them.
+ *
+ * A crop region set with JxlDecoderSetCropRegion remains in pixels of the full
+ * resolution image. The preview and DC images are not affected.
+ *
+ * Can be called at any time before or between frames, and applies to the
+ * frames whose decoding starts afterwards.
+ *
+ * @param dec decoder object
+ * @param downsampling factor: 1 (default, full resolution), 2, 4 or 8.
+ * @return JXL_DEC_SUCCESS if no error, JXL_DEC_ERROR for an unsupported
+ * factor or if a frame is being decoded.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetDownsampling(JxlDecoder* dec,
+                                                      uint32_t downsampling);
+
+/**
+ * Sets a budget for the memory used by the decoder. Before the pixel buffers
+ * of a frame are allocated, the decoder estimates the memory it needs for them
+ * on top of what it already holds: the stored input bytes, the buffers of the
+ * frames kept as reference for later frames, and the decoder object itself.
+ * If that exceeds the limit, JxlDecoderProcessInput returns
+ * JXL_DEC_MEMORY_LIMIT_EXCEEDED instead of decoding the frame. An image whose
+ * dimensions alone make it exceed the limit is rejected as soon as the basic
+ * info is read. The limit also bounds the size of the ICC profile.
+ *
+ * The estimate covers the large buffers, which scale with the number of
+ * pixels, not small allocations nor the output buffers owned by the user.
+ *
+ * Can be called at any time before or between frames, and is reset by
+ * JxlDecoderReset.
+ *
+ * @param dec decoder object
+ * @param bytes maximum memory in bytes, or 0 for no limit (default).
+ * @return JXL_DEC_SUCCESS if no error, JXL_DEC_ERROR if a frame is being
+ * decoded.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetMemoryLimit(JxlDecoder* dec,
+                                                     size_t bytes);
+
+/**
+ * Sets a time budget for decoding. Once @p seconds have passed since this
+ * call, JxlDecoderProcessInput stops decoding the current frame: the groups
+ * being decoded are completed, no new ones are started, and
+ * JXL_DEC_CANCELLED is returned with the best rendering of the frame
+ * available so far. The deadline is checked between the groups of a frame,
+ * so decoding may overshoot it by the time needed to decode a group.
+ *
+ * Can be called at any time except during JxlDecoderProcessInput, and is
+ * reset by JxlDecoderReset.
+ *
+ * @param dec decoder object
+ * @param seconds time budget from now on, or 0 or less for no deadline
+ * (default).
+ * @return JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetDeadline(JxlDecoder* dec,
+                                                  double seconds);
+
+/**
+ * Stops decoding as soon as possible, as if the deadline of
+ * JxlDecoderSetDeadline passed, except that decoding cannot continue. Unlike
+ * all the other functions, this may be called from any thread, including
+ * while JxlDecoderProcessInput runs on another thread, which then returns
+ * JXL_DEC_CANCELLED. The cancellation lasts until JxlDecoderReset.
+ *
+ * @param dec decoder object
+ */
+JXL_EXPORT void JxlDecoderCancel(JxlDecoder* dec);
+
+/**
+ * Enables keeping the internal buffers of the decoder when it is reset with
+ * JxlDecoderReset, to reuse them for the next image. This avoids reallocating
+ * them for each image when many images of similar dimensions are decoded one
+ * after the other with the same decoder. The buffers are only reallocated when
+ * they are too small for a frame of the next image. Pixels of the frames of the
+ * previous image are never used for the next one.
+ *
+ * Unlike the other settings, this one is not reset by JxlDecoderReset. The
+ * buffers are released by JxlDecoderDestroy, or by JxlDecoderReset after this
+ * is disabled again.
+ *
+ * @param dec decoder object
+ * @param keep_buffers JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetKeepBuffers(JxlDecoder* dec,
+                                                     JXL_BOOL keep_buffers);
+
+/** Memory used by a decoder, see JxlDecoderGetMemoryStats. */
+typedef struct {
+  /** Bytes currently held by the decoder. */
+  size_t current_bytes;
+  /** Maximum of current_bytes since the decoder was created or last reset. */
+  size_t peak_bytes;
+  /** Bytes of the internal buffers currently allocated by the decoder from
+   * its memory manager. */
+  size_t allocated_bytes;
+  /** Maximum of allocated_bytes since the decoder was created or last reset.
+   */
+  size_t peak_allocated_bytes;
+} JxlDecoderMemoryStats;
+
+/**
+ * Outputs the memory used by the decoder, as accounted for
+ * JxlDecoderSetMemoryLimit, and the memory actually allocated for its internal
+ * buffers. This allows to schedule decodes by their memory use. The peaks are
+ * reset by JxlDecoderReset.
+ *
+ * @param dec decoder object
+ * @param stats output memory statistics
+ * @return JXL_DEC_SUCCESS
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetMemoryStats(
+    const JxlDecoder* dec, JxlDecoderMemoryStats* stats);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with JxlDecoderSetInput. After JxlDecoderProcessInput, input can
@@ -654,7 +982,9 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetDCOutBuffer(
 /**
  * Returns the minimum size in bytes of the image output pixel buffer for the
  * given format. This is the buffer for JxlDecoderSetImageOutBuffer. Requires
- * the basic image information is available in the decoder.
+ * the basic image information is available in the decoder. The size takes
+ * into account the factor set with JxlDecoderSetDownsampling and the region
+ * set with JxlDecoderSetCropRegion.
  *
  * @param dec decoder object
  * @param format format of pixelsformat of pixels.
@@ -705,6 +1035,14 @@ JXL_EXPORT size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec);
  * The buffer follows the format described by JxlPixelFormat. The buffer is
  * owned by the caller.
  *
+ * When the buffer is set before the frame is decoded, e.g. after
+ * JXL_DEC_BASIC_INFO or JXL_DEC_FRAME, the decoder writes the pixels to it
+ * while the frame is being decoded, under the same conditions as for
+ * JxlDecoderSetImageOutCallback. This avoids an extra pass over the full
+ * frame, in particular for 8-bit output of lossy images, which is converted
+ * straight from the internal color space. The buffer must then stay valid
+ * until JXL_DEC_FULL_IMAGE is returned.
+ *
  * @param dec decoder object
  * @param format format of pixelsformat of pixels. Object owned by user and its
  * contents are copied internally.
@@ -716,12 +1054,69 @@ JXL_EXPORT size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetImageOutBuffer(
     JxlDecoder* dec, const JxlPixelFormat* format, void* buffer, size_t size);
 
+/**
+ * Callback that receives rows of pixels of the full resolution image, see
+ * JxlDecoderSetImageOutCallback.
+ *
+ * The pixels are in the format given to JxlDecoderSetImageOutCallback, with
+ * the channels of each pixel interleaved. The pixel data is owned by the
+ * decoder and only valid during the call, the callback must copy what it needs
+ * to keep.
+ *
+ * @param opaque optional user data, as given to JxlDecoderSetImageOutCallback.
+ * @param x horizontal position of the first pixel of the row segment.
+ * @param y vertical position of the row segment.
+ * @param num_pixels amount of pixels in the row segment.
+ * @param pixels pixel data of the row segment, num_pixels pixels in total.
+ */
+typedef void (*JxlImageOutCallback)(void* opaque, size_t x, size_t y,
+                                    size_t num_pixels, const void* pixels);
+
+/**
+ * Sets a callback that receives the full resolution image row by row, as an
+ * alternative to JxlDecoderSetImageOutBuffer. This avoids allocating a buffer
+ * for the whole interleaved image, and allows the application to consume the
+ * rows while they are still in cache.
+ *
+ * When the callback is set before the frame is decoded, e.g. after
+ * JXL_DEC_BASIC_INFO or JXL_DEC_FRAME, pixels are delivered while the frame
+ * is being decoded, in row segments of parts of the image and in arbitrary
+ * order. Otherwise, or if the frame needs compositing, orientation or alpha
+ * that is only known once the frame is complete, the rows are delivered once
+ * the frame is complete, before JXL_DEC_FULL_IMAGE is returned. In both cases
+ * every pixel of the image is delivered by the time JXL_DEC_FULL_IMAGE is
+ * returned. Pixels may be delivered again with updated values if
+ * JxlDecoderFlushImage is used.
+ *
+ * The callback may be called simultaneously from different threads of the
+ * parallel runner, for different pixels. Like the image out buffer, the
+ * callback must be set again for every frame.
+ *
+ * The align field of the format is ignored, since rows are passed
+ * individually. Setting a callback replaces an image out buffer set with
+ * JxlDecoderSetImageOutBuffer and vice versa.
+ *
+ * @param dec decoder object
+ * @param format format of the pixels. Object owned by user and its contents
+ * are copied internally.
+ * @param callback the callback function receiving row segments of pixels.
+ * @param opaque optional user data, which will be passed on to the callback,
+ * may be NULL.
+ * @return JXL_DEC_SUCCESS on success, JXL_DEC_ERROR on error, such as
+ * an unsupported format or callback being NULL.
+ */
+JXL_EXPORT JxlDecoderStatus
+JxlDecoderSetImageOutCallback(JxlDecoder* dec, const JxlPixelFormat* format,
+                              JxlImageOutCallback callback, void* opaque);
+
 /* TODO(lode): add way to output extra channels */
 
 /**
  * Outputs progressive step towards the decoded image so far when only partial
  * input was received. If the flush was successful, the buffer set with
- * JxlDecoderSetImageOutBuffer will contain partial image data.
+ * JxlDecoderSetImageOutBuffer will contain partial image data, or the partial
+ * image data was passed to the callback set with
+ * JxlDecoderSetImageOutCallback.
  *
  * Can be called when JxlDecoderProcessInput returns JXL_DEC_NEED_MORE_INPUT,
  * after the JXL_DEC_FRAME event already occured and before the
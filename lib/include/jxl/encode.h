@@ -77,6 +77,11 @@ typedef enum {
    */
   JXL_ENC_NOT_SUPPORTED = 3,
 
+  /** Only returned if an executor is set with JxlEncoderSetAsyncExecutor: the
+   * encoding step was submitted to the executor, or is still running.
+   */
+  JXL_ENC_WORK_PENDING = 4,
+
 } JxlEncoderStatus;
 
 /**
@@ -125,6 +130,46 @@ JXL_EXPORT JxlEncoderStatus
 JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Makes JxlEncoderProcessOutput non-blocking. Each call that starts an
+ * encoding step submits the step to @p executor and returns
+ * JXL_ENC_WORK_PENDING. The step writes to the output buffer and updates
+ * *next_out and *avail_out of that call, so the encoder, the output buffer and
+ * both variables must not be used nor modified until the step is done. The
+ * next JxlEncoderProcessOutput call after the work function returned, which
+ * must pass the same next_out and avail_out, returns the result of the step.
+ * Calls while the step is running return JXL_ENC_WORK_PENDING again.
+ *
+ * @param enc encoder object.
+ * @param executor function submitting encoding steps, see JxlAsyncExecutor,
+ *        or NULL to make JxlEncoderProcessOutput block again.
+ * @param executor_opaque opaque pointer for executor.
+ * @return JXL_ENC_SUCCESS if the executor was set, JXL_ENC_ERROR if an
+ * encoding step is in progress.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetAsyncExecutor(
+    JxlEncoder* enc, JxlAsyncExecutor executor, void* executor_opaque);
+
+/**
+ * Sets how many of the frames added so far JxlEncoderProcessOutput may encode
+ * at the same time. The frames of the encoder do not reference each other, so
+ * with a value above 1 and a multithreaded parallel runner, up to @p
+ * max_frames queued frames are encoded concurrently, each on a single thread,
+ * and their codestreams are then output in order. This speeds up the encoding
+ * of animations with many small frames, which do not have enough groups to
+ * keep all threads busy. Frames are only encoded concurrently if they were
+ * added before the JxlEncoderProcessOutput call, and the memory used while
+ * encoding grows with the number of frames encoded at the same time.
+ *
+ * @param enc encoder object.
+ * @param max_frames maximum number of frames encoded at the same time. The
+ *        default, 1, encodes the frames one after the other, each using all
+ *        threads of the parallel runner.
+ * @return JXL_ENC_SUCCESS if the value was set, JXL_ENC_ERROR if it is 0.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetFrameParallelism(JxlEncoder* enc,
+                                                          size_t max_frames);
+
 /**
  * Encodes JPEG XL file using the available bytes. @p *avail_out indicates how
  * many output bytes are available, and @p *next_out points to the input bytes.
@@ -143,6 +188,8 @@ JxlEncoderSetParallelRunner(JxlEncoder* enc, JxlParallelRunner parallel_runner,
  * @return JXL_ENC_SUCCESS when encoding finished and all events handled.
  * @return JXL_ENC_ERROR when encoding failed, e.g. invalid input.
  * @return JXL_ENC_NEED_MORE_OUTPUT more output buffer is necessary.
+ * @return JXL_ENC_WORK_PENDING the encoding step runs on the executor set with
+ * JxlEncoderSetAsyncExecutor.
  */
 JXL_EXPORT JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc,
                                                     uint8_t** next_out,
@@ -185,6 +232,56 @@ JXL_EXPORT JxlEncoderStatus JxlEncoderAddImageFrame(
     const JxlEncoderOptions* options, const JxlPixelFormat* pixel_format,
     const void* buffer, size_t size);
 
+/**
+ * Callback providing the pixels of one strip of an image added with
+ * JxlEncoderAddImageStrips.
+ *
+ * @param opaque user data passed to JxlEncoderAddImageStrips.
+ * @param y0 first row of the strip.
+ * @param ysize number of rows of the strip.
+ * @param buffer buffer to write the pixels of rows [y0, y0 + ysize) to, in the
+ * pixel format passed to JxlEncoderAddImageStrips, with rows tightly packed.
+ * Owned by the encoder and only valid during the call.
+ * @param size size of buffer in bytes.
+ * @return JXL_TRUE on success, JXL_FALSE to abort encoding with an error.
+ */
+typedef JXL_BOOL (*JxlEncoderStripCallback)(void* opaque, size_t y0,
+                                            size_t ysize, void* buffer,
+                                            size_t size);
+
+/**
+ * Adds the next image to encode, whose pixels are requested from the callback
+ * one horizontal strip at a time while JxlEncoderProcessOutput encodes it,
+ * instead of being given in a single buffer. Must call JxlEncoderSetBasicInfo
+ * before JxlEncoderAddImageStrips. Supports the same pixel formats as
+ * JxlEncoderAddImageFrame. Only lossless encoding is supported, see
+ * JxlEncoderOptionsSetLossless: lossy strips would show seams at the strip
+ * boundaries, which the encoding filters do not cross.
+ *
+ * Each strip is encoded as a separate frame covering the full width of the
+ * image, which replaces its rows of the previous strips, so that the encoder
+ * only holds the pixels and encoded bytes of a single strip at a time, as long
+ * as the output is consumed with JxlEncoderProcessOutput. The image is
+ * displayed once all its strips are decoded. The strips before the last one
+ * are saved as reference frame 1 of the codestream, replacing the frame saved
+ * there before, and decoders hold that reference frame at the full image size
+ * until the last strip.
+ *
+ * @param options set of encoder options to use when encoding the image.
+ * @param pixel_format format for pixels. Object owned by the caller and its
+ * contents are copied internally.
+ * @param strip_height number of rows of each strip but the last one. Must be a
+ * nonzero multiple of 256; multiples of 2048 also keep the DC groups aligned.
+ * @param callback callback providing the pixels of each strip. It is called
+ * from JxlEncoderProcessOutput, so it and opaque must remain valid until the
+ * whole image is encoded.
+ * @param opaque user data passed to the callback.
+ * @return JXL_ENC_SUCCESS on success, JXL_ENC_ERROR on error
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderAddImageStrips(
+    const JxlEncoderOptions* options, const JxlPixelFormat* pixel_format,
+    uint32_t strip_height, JxlEncoderStripCallback callback, void* opaque);
+
 /**
  * Declares that this encoder will not encode anything further.
  *
@@ -267,7 +364,8 @@ JxlEncoderOptionsSetLossless(JxlEncoderOptions* options, JXL_BOOL lossless);
 /**
  * Sets encoder effort/speed level. Valid values are, from faster to slower
  * speed:
- * 3:falcon 4:cheetah 5:hare 6:wombat 7:squirrel 8:kitten 9:tortoise
+ * 2:lightning 3:falcon 4:cheetah 5:hare 6:wombat 7:squirrel 8:kitten
+ * 9:tortoise
  * Default: squirrel (7).
  *
  * @param options set of encoder options to update with the new mode.
@@ -126,6 +126,33 @@ typedef JxlParallelRetCode (*JxlParallelRunner)(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
     JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
 
+/**
+ * Function running one step of decoding or encoding, submitted to a
+ * JxlAsyncExecutor. It may block while it runs the step, including calls to
+ * the JxlParallelRunner of the decoder or encoder.
+ *
+ * @param work_opaque the @p work_opaque handle provided to the
+ * JxlAsyncExecutor must be passed here.
+ */
+typedef void (*JxlAsyncWorkFunction)(void* work_opaque);
+
+/**
+ * JxlAsyncExecutor function type. An executor can be provided by a JPEG XL
+ * caller with JxlDecoderSetAsyncExecutor or JxlEncoderSetAsyncExecutor, so
+ * that JxlDecoderProcessInput and JxlEncoderProcessOutput return immediately
+ * instead of blocking while the image is decoded or encoded. This allows an
+ * application with an event loop to drive many decoders and encoders from a
+ * few threads that never block on them.
+ *
+ * This function must call @p work once with @p work_opaque, from any thread,
+ * either before returning or at any later time. Once @p work returns, the
+ * result of the step is available to the next JxlDecoderProcessInput or
+ * JxlEncoderProcessOutput call, so the executor typically notifies the event
+ * loop at that point.
+ */
+typedef void (*JxlAsyncExecutor)(void* executor_opaque,
+                                 JxlAsyncWorkFunction work, void* work_opaque);
+
 /* The following is an example of a JxlParallelRunner that doesn't use any
  * multi-threading. Note that this implementation doesn't store any state
  * between multiple calls of the ExampleSequentialRunner function, so the
@@ -0,0 +1,96 @@
+/* Copyright (c) the JPEG XL Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file shared_runner.h
+ * @brief thread pool shared by many ::JxlParallelRunner clients.
+ */
+
+/** Implementation of JxlParallelRunner for applications that run many
+ * decoders and encoders concurrently. Instead of creating a
+ * JxlThreadParallelRunner with its own threads for each of them, the
+ * application creates one pool with a fixed number of worker threads, and one
+ * client of the pool for each decoder or encoder. The client is used as the
+ * opaque runner of JxlSharedRunner.
+ *
+ * Workers share their time in turns between the JxlSharedRunner calls in
+ * progress, so that concurrent decoders and encoders progress at the same
+ * rate. Calls of clients with JXL_SHARED_RUNNER_PRIORITY_INTERACTIVE are
+ * always served before those with JXL_SHARED_RUNNER_PRIORITY_BATCH. The thread
+ * calling JxlSharedRunner also runs tasks of its own call, so every call makes
+ * progress even when all the workers are busy.
+ */
+
+#ifndef JXL_SHARED_RUNNER_H_
+#define JXL_SHARED_RUNNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jxl/jxl_threads_export.h"
+#include "jxl/memory_manager.h"
+#include "jxl/parallel_runner.h"
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/** Priority of the calls of a client of the shared pool.
+ */
+typedef enum {
+  /** Served first, for latency-sensitive work.
+   */
+  JXL_SHARED_RUNNER_PRIORITY_INTERACTIVE = 0,
+
+  /** Served when no interactive call has tasks left to start.
+   */
+  JXL_SHARED_RUNNER_PRIORITY_BATCH = 1,
+} JxlSharedRunnerPriority;
+
+/** Parallel runner using the workers of a shared pool. Use as
+ * JxlParallelRunner, with a client created by JxlSharedRunnerClientCreate as
+ * the opaque runner. Several clients of the same pool, and the same client,
+ * may be used concurrently from different threads.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlSharedRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates a pool of num_worker_threads worker threads shared by all its
+ * clients. If zero, all tasks run on the threads calling JxlSharedRunner.
+ */
+JXL_THREADS_EXPORT void* JxlSharedRunnerPoolCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the pool created by JxlSharedRunnerPoolCreate. All its clients
+ * must be destroyed first.
+ */
+JXL_THREADS_EXPORT void JxlSharedRunnerPoolDestroy(void* pool);
+
+/** Creates a client of the pool, to use as the opaque runner of
+ * JxlSharedRunner, typically one per decoder or encoder.
+ */
+JXL_THREADS_EXPORT void* JxlSharedRunnerClientCreate(
+    void* pool, JxlSharedRunnerPriority priority);
+
+/** Destroys the client created by JxlSharedRunnerClientCreate. There must be
+ * no JxlSharedRunner call in progress with it.
+ */
+JXL_THREADS_EXPORT void JxlSharedRunnerClientDestroy(void* client);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_SHARED_RUNNER_H_ */
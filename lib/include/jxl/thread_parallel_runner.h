@@ -66,6 +66,33 @@ JXL_THREADS_EXPORT void* JxlThreadParallelRunnerCreate(
  */
 JXL_THREADS_EXPORT void JxlThreadParallelRunnerDestroy(void* runner_opaque);
 
+/** Restricts the worker threads of the runner to the given CPUs, identified
+ * by their operating system index. Must not be called while the runner is
+ * in use.
+ *
+ * @param runner_opaque runner created by JxlThreadParallelRunnerCreate.
+ * @param cpus array of num_cpus CPU indices.
+ * @param num_cpus number of CPUs in the array, must be at least 1.
+ * @return 0 on success, -1 if the set is invalid or if the platform does not
+ * support thread affinity.
+ */
+JXL_THREADS_EXPORT int JxlThreadParallelRunnerSetAffinity(void* runner_opaque,
+                                                          const size_t* cpus,
+                                                          size_t num_cpus);
+
+/** Restricts the worker threads of the runner to the CPUs of the given NUMA
+ * node. The library allocates the per-group buffers without touching their
+ * memory, so that the operating system places it on the node of the worker
+ * that first writes to it. Must not be called while the runner is in use.
+ *
+ * @param runner_opaque runner created by JxlThreadParallelRunnerCreate.
+ * @param node index of the NUMA node.
+ * @return 0 on success, -1 if the node does not exist or if the platform does
+ * not support thread affinity. Only supported on Linux.
+ */
+JXL_THREADS_EXPORT int JxlThreadParallelRunnerSetNumaNode(void* runner_opaque,
+                                                          size_t node);
+
 /** Returns a default num_worker_threads value for
  * JxlThreadParallelRunnerCreate.
  */
@@ -0,0 +1,76 @@
+/* Copyright (c) the JPEG XL Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file work_stealing_runner.h
+ * @brief work-stealing implementation using std::thread of a
+ * ::JxlParallelRunner.
+ */
+
+/** Implementation of JxlParallelRunner that can be used to enable
+ * multithreading when using the JPEG XL library, as an alternative to
+ * JxlThreadParallelRunner. The number of threads created is fixed at
+ * construction time and the threads are re-used for every JxlWorkStealingRunner
+ * call.
+ *
+ * Each worker thread keeps its own queue of tasks, and idle workers steal
+ * tasks from the queues of busy ones. Only as many workers as there are tasks
+ * are woken up by each call, which reduces the overhead of calls with few
+ * short tasks.
+ *
+ * Unlike JxlThreadParallelRunner, JxlWorkStealingRunner may be called
+ * concurrently from several threads on the same runner, and from within a
+ * task run by the runner itself (nested parallelism). A nested call returns
+ * once all of its tasks are done, which the calling worker thread helps with,
+ * so nested calls do not deadlock.
+ */
+
+#ifndef JXL_WORK_STEALING_RUNNER_H_
+#define JXL_WORK_STEALING_RUNNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jxl/jxl_threads_export.h"
+#include "jxl/memory_manager.h"
+#include "jxl/parallel_runner.h"
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/** Work-stealing parallel runner internally using std::thread. Use as
+ * JxlParallelRunner.
+ */
+JXL_THREADS_EXPORT JxlParallelRetCode JxlWorkStealingRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range);
+
+/** Creates the runner for JxlWorkStealingRunner. Use as the opaque runner.
+ * JxlThreadParallelRunnerDefaultNumWorkerThreads() is a good default for
+ * num_worker_threads. If zero, all tasks run on the calling thread.
+ */
+JXL_THREADS_EXPORT void* JxlWorkStealingRunnerCreate(
+    const JxlMemoryManager* memory_manager, size_t num_worker_threads);
+
+/** Destroys the runner created by JxlWorkStealingRunnerCreate. There must be
+ * no JxlWorkStealingRunner call in progress on it.
+ */
+JXL_THREADS_EXPORT void JxlWorkStealingRunnerDestroy(void* runner_opaque);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_WORK_STEALING_RUNNER_H_ */
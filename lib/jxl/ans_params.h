@@ -72,9 +72,13 @@ struct HistogramParams {
   HistogramParams() = default;
 
   HistogramParams(SpeedTier tier, size_t num_ctx) {
-    if (tier == SpeedTier::kFalcon) {
+    if (tier >= SpeedTier::kFalcon) {
       clustering = ClusteringType::kFastest;
       lz77_method = LZ77Method::kNone;
+      if (tier >= SpeedTier::kLightning) {
+        // Prefix codes avoid the reverse pass of ANS when writing the tokens.
+        force_huffman = true;
+      }
     } else if (tier > SpeedTier::kTortoise) {
       clustering = ClusteringType::kFast;
     } else {
@@ -83,7 +87,9 @@ struct HistogramParams {
     if (tier > SpeedTier::kTortoise) {
       uint_method = HybridUintMethod::kNone;
     }
-    if (tier >= SpeedTier::kSquirrel) {
+    if (tier >= SpeedTier::kLightning) {
+      ans_histogram_strategy = ANSHistogramStrategy::kFast;
+    } else if (tier >= SpeedTier::kSquirrel) {
       ans_histogram_strategy = ANSHistogramStrategy::kApproximate;
     }
   }
@@ -15,6 +15,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <random>
 #include <vector>
 
@@ -31,7 +32,9 @@ namespace jxl {
 namespace {
 
 void RoundtripTestcase(int n_histograms, int alphabet_size,
-                       const std::vector<Token>& input_values) {
+                       const std::vector<Token>& input_values,
+                       const HistogramParams& params = HistogramParams(),
+                       CacheAlignedUniquePtr* lz77_window_storage = nullptr) {
   constexpr uint16_t kMagic1 = 0x9e33;
   constexpr uint16_t kMagic2 = 0x8b04;
 
@@ -46,8 +49,8 @@ void RoundtripTestcase(int n_histograms, int alphabet_size,
   std::vector<std::vector<Token>> input_values_vec;
   input_values_vec.push_back(input_values);
 
-  BuildAndEncodeHistograms(HistogramParams(), n_histograms, input_values_vec,
-                           &codes, &context_map, &writer, 0, nullptr);
+  BuildAndEncodeHistograms(params, n_histograms, input_values_vec, &codes,
+                           &context_map, &writer, 0, nullptr);
   WriteTokens(input_values_vec[0], codes, context_map, &writer, 0, nullptr);
 
   // Magic bytes + padding
@@ -67,7 +70,8 @@ void RoundtripTestcase(int n_histograms, int alphabet_size,
   ASSERT_TRUE(
       DecodeHistograms(&br, n_histograms, &decoded_codes, &dec_context_map));
   ASSERT_EQ(dec_context_map, context_map);
-  ANSSymbolReader reader(&decoded_codes, &br);
+  ANSSymbolReader reader(&decoded_codes, &br, /*distance_multiplier=*/0,
+                         lz77_window_storage);
 
   for (const Token& symbol : input_values) {
     uint32_t read_symbol =
@@ -167,6 +171,32 @@ TEST(ANSTest, RandomUnbalancedStreamRoundtripBig) {
   RoundtripRandomUnbalancedStream(ANS_MAX_ALPHABET_SIZE);
 }
 
+TEST(ANSTest, LZ77WindowStorageReused) {
+  // Long runs of different values, which RLE compresses well.
+  std::vector<Token> symbols;
+  for (uint32_t run = 0; run < 128; run++) {
+    symbols.insert(symbols.end(), 32, Token(0, run * 7 % 16));
+  }
+  HistogramParams no_lz77;
+  no_lz77.lz77_method = HistogramParams::LZ77Method::kNone;
+  CacheAlignedUniquePtr storage;
+  RoundtripTestcase(2, ANS_MAX_ALPHABET_SIZE, symbols, no_lz77, &storage);
+  // The window is not allocated for streams that do not use LZ77.
+  EXPECT_EQ(nullptr, storage.get());
+
+  HistogramParams rle;
+  rle.lz77_method = HistogramParams::LZ77Method::kRLE;
+  RoundtripTestcase(2, ANS_MAX_ALPHABET_SIZE, symbols, rle, &storage);
+  const uint8_t* window = storage.get();
+  ASSERT_NE(nullptr, window);
+  // The next streams reuse the same window, whose previous content does not
+  // affect decoding.
+  RoundtripTestcase(2, ANS_MAX_ALPHABET_SIZE, symbols, rle, &storage);
+  std::reverse(symbols.begin(), symbols.end());
+  RoundtripTestcase(2, ANS_MAX_ALPHABET_SIZE, symbols, rle, &storage);
+  EXPECT_EQ(window, storage.get());
+}
+
 TEST(ANSTest, UintConfigRoundtrip) {
   for (size_t log_alpha_size = 5; log_alpha_size <= 8; log_alpha_size++) {
     std::vector<HybridUintConfig> uint_config, uint_config_dec;
@@ -28,6 +28,9 @@
 #include <atomic>
 #include <hwy/base.h>  // kMaxVectorSize
 #include <limits>
+#include <mutex>  //NOLINT
+#include <unordered_map>
+#include <vector>
 
 #include "lib/jxl/base/status.h"
 
@@ -38,6 +41,9 @@ namespace {
 struct AllocationHeader {
   void* allocated;
   size_t allocated_size;
+  // CacheAlignedArena::State of the arena that provided `allocated`, or null
+  // if it comes from malloc.
+  void* arena_state;
   uint8_t left_padding[hwy::kMaxVectorSize];
 };
 #pragma pack(pop)
@@ -46,8 +52,126 @@ std::atomic<uint64_t> num_allocations{0};
 std::atomic<uint64_t> bytes_in_use{0};
 std::atomic<uint64_t> max_bytes_in_use{0};
 
+thread_local CacheAlignedArena* current_arena = nullptr;
+
+void UpdateMaxBytesInUse(std::atomic<uint64_t>* max_bytes, uint64_t bytes) {
+  uint64_t expected_max = max_bytes->load(std::memory_order_acquire);
+  for (;;) {
+    const uint64_t desired = std::max(expected_max, bytes);
+    if (max_bytes->compare_exchange_strong(expected_max, desired,
+                                           std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+}
+
 }  // namespace
 
+struct CacheAlignedArena::State {
+  explicit State(const JxlMemoryManager& memory_manager)
+      : memory_manager(memory_manager) {}
+
+  // Returns a block of `size` bytes, or null.
+  void* AllocateBlock(size_t size) {
+    void* block = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = unused.find(size);
+      if (it != unused.end() && !it->second.empty()) {
+        block = it->second.back();
+        it->second.pop_back();
+      } else {
+        block = memory_manager.alloc(memory_manager.opaque, size);
+        if (block == nullptr) return nullptr;
+      }
+      ++num_refs;
+    }
+    const uint64_t prev_bytes =
+        bytes_in_use.fetch_add(size, std::memory_order_acq_rel);
+    UpdateMaxBytesInUse(&max_bytes_in_use, prev_bytes + size);
+    return block;
+  }
+
+  void FreeBlock(void* block, size_t size) {
+    bytes_in_use.fetch_sub(size, std::memory_order_acq_rel);
+    bool last_ref;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closed) {
+        memory_manager.free(memory_manager.opaque, block);
+      } else {
+        unused[size].push_back(block);
+      }
+      last_ref = --num_refs == 0;
+    }
+    if (last_ref) delete this;
+  }
+
+  void ReleaseUnused() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& blocks : unused) {
+      for (void* block : blocks.second) {
+        memory_manager.free(memory_manager.opaque, block);
+      }
+    }
+    unused.clear();
+  }
+
+  const JxlMemoryManager memory_manager;
+  std::atomic<uint64_t> bytes_in_use{0};
+  std::atomic<uint64_t> max_bytes_in_use{0};
+
+  std::mutex mutex;
+  // Freed blocks by size. Guarded by mutex, like the fields below.
+  std::unordered_map<size_t, std::vector<void*>> unused;
+  // Set when the arena is destroyed.
+  bool closed = false;
+  // The arena and each block handed out hold a reference.
+  size_t num_refs = 1;
+};
+
+CacheAlignedArena::CacheAlignedArena(const JxlMemoryManager& memory_manager)
+    : state_(new State(memory_manager)) {}
+
+CacheAlignedArena::~CacheAlignedArena() {
+  JXL_ASSERT(current_arena != this);
+  state_->ReleaseUnused();
+  bool last_ref;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    last_ref = --state_->num_refs == 0;
+  }
+  if (last_ref) delete state_;
+}
+
+void CacheAlignedArena::ReleaseUnused() { state_->ReleaseUnused(); }
+
+uint64_t CacheAlignedArena::BytesInUse() const {
+  return state_->bytes_in_use.load(std::memory_order_relaxed);
+}
+
+uint64_t CacheAlignedArena::MaxBytesInUse() const {
+  return state_->max_bytes_in_use.load(std::memory_order_relaxed);
+}
+
+void CacheAlignedArena::ResetMaxBytesInUse() {
+  state_->max_bytes_in_use.store(
+      state_->bytes_in_use.load(std::memory_order_acquire),
+      std::memory_order_release);
+}
+
+CacheAlignedArena* CacheAlignedArena::Current() { return current_arena; }
+
+CacheAlignedArenaScope::CacheAlignedArenaScope(CacheAlignedArena* arena)
+    : previous_(current_arena) {
+  current_arena = arena;
+}
+
+CacheAlignedArenaScope::~CacheAlignedArenaScope() {
+  current_arena = previous_;
+}
+
 // Avoids linker errors in pre-C++17 builds.
 constexpr size_t CacheAligned::kPointerSize;
 constexpr size_t CacheAligned::kCacheLineSize;
@@ -60,6 +184,10 @@ void CacheAligned::PrintStats() {
          double(max_bytes_in_use.load(std::memory_order_relaxed)));
 }
 
+uint64_t CacheAligned::NumAllocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
 size_t CacheAligned::NextOffset() {
   static std::atomic<uint32_t> next{0};
   constexpr uint32_t kGroups = CacheAligned::kAlias / CacheAligned::kAlignment;
@@ -90,8 +218,18 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
   if (allocated == MAP_FAILED) return nullptr;
   const uintptr_t aligned = reinterpret_cast<uintptr_t>(allocated);
 #else
-  const size_t allocated_size = kAlias + offset + payload_size;
-  void* allocated = malloc(allocated_size);
+  CacheAlignedArena::State* arena_state =
+      current_arena != nullptr ? current_arena->state_ : nullptr;
+  size_t allocated_size = kAlias + offset + payload_size;
+  void* allocated;
+  if (arena_state != nullptr) {
+    // Same block size for all offsets, rounded up so that the blocks of
+    // images with similar sizes can be reused for each other.
+    allocated_size = (2 * kAlias + payload_size + kAlias - 1) & ~(kAlias - 1);
+    allocated = arena_state->AllocateBlock(allocated_size);
+  } else {
+    allocated = malloc(allocated_size);
+  }
   if (allocated == nullptr) return nullptr;
   // Always round up even if already aligned - we already asked for kAlias
   // extra bytes and there's no way to give them back.
@@ -120,15 +258,7 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
   num_allocations.fetch_add(1, std::memory_order_relaxed);
   const uint64_t prev_bytes =
       bytes_in_use.fetch_add(allocated_size, std::memory_order_acq_rel);
-  uint64_t expected_max = max_bytes_in_use.load(std::memory_order_acquire);
-  for (;;) {
-    const uint64_t desired =
-        std::max(expected_max, prev_bytes + allocated_size);
-    if (max_bytes_in_use.compare_exchange_strong(expected_max, desired,
-                                                 std::memory_order_acq_rel)) {
-      break;
-    }
-  }
+  UpdateMaxBytesInUse(&max_bytes_in_use, prev_bytes + allocated_size);
 
   const uintptr_t payload = aligned + offset;  // still aligned
 
@@ -136,6 +266,11 @@ void* CacheAligned::Allocate(const size_t payload_size, size_t offset) {
   AllocationHeader* header = reinterpret_cast<AllocationHeader*>(payload) - 1;
   header->allocated = allocated;
   header->allocated_size = allocated_size;
+#if JXL_USE_MMAP
+  header->arena_state = nullptr;
+#else
+  header->arena_state = arena_state;
+#endif
 
   return JXL_ASSUME_ALIGNED(reinterpret_cast<void*>(payload), 64);
 }
@@ -156,7 +291,12 @@ void CacheAligned::Free(const void* aligned_pointer) {
 #if JXL_USE_MMAP
   munmap(header->allocated, header->allocated_size);
 #else
-  free(header->allocated);
+  if (header->arena_state != nullptr) {
+    static_cast<CacheAlignedArena::State*>(header->arena_state)
+        ->FreeBlock(header->allocated, header->allocated_size);
+  } else {
+    free(header->allocated);
+  }
 #endif
 }
 
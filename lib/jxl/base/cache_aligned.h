@@ -22,14 +22,73 @@
 
 #include <memory>
 
+#include "jxl/memory_manager.h"
 #include "lib/jxl/base/compiler_specific.h"
 
 namespace jxl {
 
+// Source of the memory of CacheAligned::Allocate on top of a JxlMemoryManager,
+// used instead of malloc on the threads where it is installed with a
+// CacheAlignedArenaScope. Freed blocks are kept for reuse by allocations of
+// the same size until ReleaseUnused, which the codecs call at the end of each
+// frame, so that the temporary buffers of a frame do not go back to the memory
+// manager each time they are freed.
+//
+// Thread-safe; the memory manager is only called by one thread at a time.
+// Blocks may outlive the arena: they are then returned to the memory manager
+// as soon as they are freed.
+class CacheAlignedArena {
+ public:
+  explicit CacheAlignedArena(const JxlMemoryManager& memory_manager);
+  ~CacheAlignedArena();
+
+  CacheAlignedArena(const CacheAlignedArena&) = delete;
+  CacheAlignedArena& operator=(const CacheAlignedArena&) = delete;
+
+  // Returns the blocks kept for reuse to the memory manager. Called at the end
+  // of each frame.
+  void ReleaseUnused();
+
+  // Bytes of the blocks currently handed out by the arena, and the maximum
+  // of that value so far.
+  uint64_t BytesInUse() const;
+  uint64_t MaxBytesInUse() const;
+  // Restarts the maximum from the bytes currently in use.
+  void ResetMaxBytesInUse();
+
+  // Returns the arena installed on the calling thread, if any.
+  static CacheAlignedArena* Current();
+
+ private:
+  friend class CacheAligned;
+  friend class CacheAlignedArenaScope;
+
+  // Shared with the blocks handed out, so that they can be freed after the
+  // arena is destroyed.
+  struct State;
+  State* state_;
+};
+
+// Installs `arena` for the CacheAligned allocations of the calling thread
+// until the end of the scope. A null `arena` restores malloc.
+class CacheAlignedArenaScope {
+ public:
+  explicit CacheAlignedArenaScope(CacheAlignedArena* arena);
+  ~CacheAlignedArenaScope();
+
+  CacheAlignedArenaScope(const CacheAlignedArenaScope&) = delete;
+  CacheAlignedArenaScope& operator=(const CacheAlignedArenaScope&) = delete;
+
+ private:
+  CacheAlignedArena* previous_;
+};
+
 // Functions that depend on the cache line size.
 class CacheAligned {
  public:
   static void PrintStats();
+  // Returns the number of allocations made so far.
+  static uint64_t NumAllocations();
 
   static constexpr size_t kPointerSize = sizeof(void*);
   static constexpr size_t kCacheLineSize = 64;
@@ -23,6 +23,7 @@
 
 #include "jxl/parallel_runner.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/status.h"
 
 namespace jxl {
@@ -78,12 +79,15 @@ class ThreadPool {
   class RunCallState final {
    public:
     RunCallState(const InitFunc& init_func, const DataFunc& data_func)
-        : init_func_(init_func), data_func_(data_func) {}
+        : init_func_(init_func),
+          data_func_(data_func),
+          arena_(CacheAlignedArena::Current()) {}
 
     // JxlParallelRunInit interface.
     static int CallInitFunc(void* jpegxl_opaque, size_t num_threads) {
       const auto* self =
           static_cast<RunCallState<InitFunc, DataFunc>*>(jpegxl_opaque);
+      CacheAlignedArenaScope arena_scope(self->arena_);
       // Returns -1 when the internal init function returns false Status to
       // indicate an error.
       return self->init_func_(num_threads) ? 0 : -1;
@@ -94,12 +98,16 @@ class ThreadPool {
                              size_t thread_id) {
       const auto* self =
           static_cast<RunCallState<InitFunc, DataFunc>*>(jpegxl_opaque);
+      CacheAlignedArenaScope arena_scope(self->arena_);
       return self->data_func_(value, thread_id);
     }
 
    private:
     const InitFunc& init_func_;
     const DataFunc& data_func_;
+    // Arena of the thread calling Run(), also used by the tasks running on
+    // the threads of the runner.
+    CacheAlignedArena* const arena_;
   };
 
   // Default JxlParallelRunner used when no runner is provided by the
@@ -47,6 +47,8 @@ class ThreadPoolInternal : public ThreadPool {
   size_t NumThreads() const { return runner_.NumThreads(); }
   size_t NumWorkerThreads() const { return runner_.NumWorkerThreads(); }
 
+  void SetAdaptiveChunks(bool enabled) { runner_.SetAdaptiveChunks(enabled); }
+
   template <class Func>
   void RunOnEachThread(const Func& func) {
     runner_.RunOnEachThread(func);
@@ -16,6 +16,7 @@
 #define LIB_JXL_DCT_UTIL_H_
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -53,7 +54,13 @@ class ACImage {
   virtual size_t PixelsPerRow() const = 0;
   virtual void ZeroFill() = 0;
   virtual void ZeroFillPlane(size_t c) = 0;
+  // Zero-fills row `y` of all planes, e.g. on the thread that will use it, so
+  // that its memory is first touched there.
+  virtual void ZeroFillRow(size_t y) = 0;
   virtual bool IsEmpty() const = 0;
+  // Sets the dimensions to xsize x ysize if the storage is large enough, see
+  // ShrinkTo, and returns whether it was.
+  virtual bool TryShrinkTo(size_t xsize, size_t ysize) = 0;
 };
 
 template <typename T>
@@ -82,10 +89,22 @@ class ACImageT final : public ACImage {
 
   void ZeroFillPlane(size_t c) override { ZeroFillImage(&img_.Plane(c)); }
 
+  void ZeroFillRow(size_t y) override {
+    for (size_t c = 0; c < 3; c++) {
+      memset(img_.PlaneRow(c, y), 0, img_.xsize() * sizeof(T));
+    }
+  }
+
   bool IsEmpty() const override {
     return img_.xsize() == 0 || img_.ysize() == 0;
   }
 
+  bool TryShrinkTo(size_t xsize, size_t ysize) override {
+    if (!img_.CanShrinkTo(xsize, ysize)) return false;
+    img_.ShrinkTo(xsize, ysize);
+    return true;
+  }
+
  private:
   Image3<T> img_;
 };
@@ -159,8 +159,14 @@ class ANSSymbolReader {
  public:
   // Invalid symbol reader, to be overwritten.
   ANSSymbolReader() = default;
+  // The LZ77 window is only allocated if `code` uses LZ77. If
+  // `lz77_window_storage` is not null, the window is taken from it instead of
+  // being owned by the reader, and allocated into it on first use, so that
+  // callers decoding many streams can reuse the same window. The storage must
+  // outlive the reader and must not be used by two readers at the same time.
   ANSSymbolReader(const ANSCode* code, BitReader* JXL_RESTRICT br,
-                  size_t distance_multiplier = 0)
+                  size_t distance_multiplier = 0,
+                  CacheAlignedUniquePtr* lz77_window_storage = nullptr)
       : alias_tables_(
             reinterpret_cast<AliasTable::Entry*>(code->alias_tables.get())),
         huffman_data_(code->huffman_data.data()),
@@ -174,11 +180,16 @@ class ANSSymbolReader {
     } else {
       state_ = (ANS_SIGNATURE << 16u);
     }
+    if (!code->lz77.enabled) return;
     // a std::vector incurs unacceptable decoding speed loss because of
     // initialization.
-    lz77_window_storage_ = AllocateArray(kWindowSize * sizeof(uint32_t));
-    lz77_window_ = reinterpret_cast<uint32_t*>(lz77_window_storage_.get());
-    if (!code->lz77.enabled) return;
+    if (lz77_window_storage == nullptr) {
+      lz77_window_storage = &lz77_window_storage_;
+    }
+    if (!*lz77_window_storage) {
+      *lz77_window_storage = AllocateArray(kWindowSize * sizeof(uint32_t));
+    }
+    lz77_window_ = reinterpret_cast<uint32_t*>(lz77_window_storage->get());
     lz77_ctx_ = code->lz77.nonserialized_distance_context;
     lz77_length_uint_ = code->lz77.length_uint_config;
     lz77_threshold_ = code->lz77.min_symbol;
@@ -316,7 +327,9 @@ class ANSSymbolReader {
       return ReadHybridUintClustered(ctx, br);  // will trigger a copy.
     }
     size_t ret = ReadHybridUintConfig(configs[ctx], token, br);
-    lz77_window_[(num_decoded_++) & kWindowMask] = ret;
+    if (lz77_window_ != nullptr) {
+      lz77_window_[(num_decoded_++) & kWindowMask] = ret;
+    }
     return ret;
   }
 
@@ -338,6 +351,7 @@ class ANSSymbolReader {
     if (configs[ctx].split_token <= symbol.value) return false;
     if (symbol.value >= lz77_threshold_) return false;
     *value = symbol.value;
+    if (lz77_window_ == nullptr) return true;
     for (size_t i = 0; i < count; i++) {
       lz77_window_[(num_decoded_++) & kWindowMask] = symbol.value;
     }
@@ -356,8 +370,11 @@ class ANSSymbolReader {
 
   // LZ77 structures and constants.
   static constexpr size_t kWindowMask = kWindowSize - 1;
+  // Only used if no external storage is given to the constructor.
   CacheAlignedUniquePtr lz77_window_storage_;
-  uint32_t* lz77_window_;
+  // Null if LZ77 is not used, in which case the decoded symbols are not
+  // recorded.
+  uint32_t* lz77_window_ = nullptr;
   uint32_t num_decoded_ = 0;
   uint32_t num_to_copy_ = 0;
   uint32_t copy_pos_ = 0;
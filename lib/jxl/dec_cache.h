@@ -17,13 +17,18 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <utility>
+
 #include <hwy/base.h>  // HWY_ALIGN_MAX
 
 #include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/convolve.h"
+#include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_upsample.h"
 #include "lib/jxl/filters.h"
@@ -33,6 +38,73 @@
 
 namespace jxl {
 
+// Temp images required for decoding a single group. Reduces memory allocations
+// for large images because we only initialize min(#threads, #groups) instances.
+struct GroupDecCache {
+  void InitOnce(size_t num_passes, size_t used_acs) {
+    PROFILER_FUNC;
+
+    for (size_t i = 0; i < num_passes; i++) {
+      if (num_nzeroes[i].xsize() == 0) {
+        // Allocate enough for a whole group - partial groups on the
+        // right/bottom border just use a subset. The valid size is passed via
+        // Rect.
+
+        num_nzeroes[i] = Image3I(kGroupDimInBlocks, kGroupDimInBlocks);
+      }
+    }
+    size_t max_block_area = 0;
+
+    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
+      AcStrategy acs = AcStrategy::FromRawStrategy(o);
+      if ((used_acs & (1 << o)) == 0) continue;
+      size_t area =
+          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
+      max_block_area = std::max(area, max_block_area);
+    }
+
+    if (max_block_area > max_block_area_) {
+      max_block_area_ = max_block_area;
+      // We need 3x float blocks for dequantized coefficients and 1x for scratch
+      // space for transforms.
+      float_memory_ = AllocateArray(max_block_area_ * 4 * sizeof(float));
+      // We need 3x int32 or int16 blocks for quantized coefficients.
+      int32_memory_ = AllocateArray(max_block_area_ * 3 * sizeof(int32_t));
+      int16_memory_ = AllocateArray(max_block_area_ * 3 * sizeof(int16_t));
+    }
+
+    dec_group_block = reinterpret_cast<float*>(float_memory_.get());
+    scratch_space = dec_group_block + max_block_area_ * 3;
+    dec_group_qblock = reinterpret_cast<int32_t*>(int32_memory_.get());
+    dec_group_qblock16 = reinterpret_cast<int16_t*>(int16_memory_.get());
+  }
+
+  // Scratch space used by DecGroupImpl().
+  float* dec_group_block;
+  int32_t* dec_group_qblock;
+  int16_t* dec_group_qblock16;
+
+  // For TransformToPixels.
+  float* scratch_space;
+  // Note that scratch_space is never used at the same time as dec_group_qblock.
+  // Moreover, only one of dec_group_qblock16 is ever used.
+  // TODO(veluca): figure out if we can save allocations.
+
+  // AC decoding
+  Image3I num_nzeroes[kMaxNumPasses];
+
+  // LZ77 windows of the entropy decoders of each pass, only allocated if a
+  // stream decoded by this thread uses LZ77, and then reused for the next
+  // groups instead of allocating 4 MiB per pass per group.
+  CacheAlignedUniquePtr lz77_windows[kMaxNumPasses];
+
+ private:
+  CacheAlignedUniquePtr float_memory_;
+  CacheAlignedUniquePtr int32_memory_;
+  CacheAlignedUniquePtr int16_memory_;
+  size_t max_block_area_ = 0;
+};
+
 // Per-frame decoder state. All the images here should be accessed through a
 // group rect (either with block units or pixel units).
 struct PassesDecoderState {
@@ -100,6 +172,47 @@ struct PassesDecoderState {
   std::vector<Image3F> padded_upsampling_input_storage;
   std::vector<Image3F> upsampling_input_storage;
 
+  // If present, finished rows are converted and passed to the output callback
+  // by FinalizeImageRect, instead of being converted from the whole frame
+  // afterwards. Only set for frames that are output without further changes.
+  ExternalRowOutput image_out;
+  std::vector<ExternalRowStorage> image_out_storage;
+
+  // If not empty, only this rect of the frame, in pixels before upsampling,
+  // needs to be rendered by FinalizeFrameDecoding.
+  Rect render_rect;
+
+  // If not empty, only this rect of the frame, in pixels after upsampling, is
+  // stored in the output image, see FrameDecoder::SetRenderRect. It is only
+  // restricted for frames without upsampling, so the coordinates are the same
+  // as the ones before upsampling.
+  Rect output_area;
+
+  // Returns the part of `rect`, in pixels of the frame, that is stored in the
+  // output image. The result is empty if there is none.
+  Rect ClipToOutputArea(const Rect& rect) const {
+    if (output_area.xsize() == 0) return rect;
+    const size_t x0 = std::max(rect.x0(), output_area.x0());
+    const size_t y0 = std::max(rect.y0(), output_area.y0());
+    const size_t x1 = std::min(rect.x0() + rect.xsize(),
+                               output_area.x0() + output_area.xsize());
+    const size_t y1 = std::min(rect.y0() + rect.ysize(),
+                               output_area.y0() + output_area.ysize());
+    if (x1 <= x0 || y1 <= y0) return Rect();
+    return Rect(x0, y0, x1 - x0, y1 - y0);
+  }
+
+  // Returns where the pixels of `rect`, in pixels of the frame after
+  // upsampling, are stored in the output image.
+  Rect OutputImageRect(const Rect& rect) const {
+    return Rect(rect.x0() - output_area.x0(), rect.y0() - output_area.y0(),
+                rect.xsize(), rect.ysize());
+  }
+
+  // Scratch storage for decoding AC groups, one per thread. Kept across frames
+  // like the other buffers of this state.
+  std::vector<GroupDecCache> group_dec_caches;
+
   void EnsureStorage(size_t num_threads) {
     // We need one filter_storage per thread, ensure we have at least that many.
     if (shared->frame_header.loop_filter.epf_iters != 0 ||
@@ -128,6 +241,9 @@ struct PassesDecoderState {
                                                      kGroupDim + 4);
       }
     }
+    if (image_out.IsPresent() && image_out_storage.size() < num_threads) {
+      image_out_storage.resize(num_threads);
+    }
   }
 
   // Color encoding that will be used for output.
@@ -154,8 +270,8 @@ struct PassesDecoderState {
     used_acs = 0;
 
     if (shared->frame_header.flags & FrameHeader::kNoise) {
-      noise = Image3F(shared->frame_dim.xsize_upsampled_padded,
-                      shared->frame_dim.ysize_upsampled_padded);
+      ReuseOrAllocateImage(shared->frame_dim.xsize_upsampled_padded,
+                           shared->frame_dim.ysize_upsampled_padded, &noise);
       size_t num_x_groups = DivCeil(noise.xsize(), kGroupDim);
       size_t num_y_groups = DivCeil(noise.ysize(), kGroupDim);
       PROFILER_ZONE("GenerateNoise");
@@ -188,8 +304,8 @@ struct PassesDecoderState {
     // decoded must be padded to a multiple of kBlockDim rows since the last
     // rows may be used by the filters even if they are outside the frame
     // dimension.
-    decoded =
-        Image3F(shared->frame_dim.xsize_padded, shared->frame_dim.ysize_padded);
+    ReuseOrAllocateImage(shared->frame_dim.xsize_padded,
+                         shared->frame_dim.ysize_padded, &decoded);
 #if MEMORY_SANITIZER
     // Avoid errors due to loading vectors on the outermost padding.
     ZeroFillImage(&decoded);
@@ -202,6 +318,45 @@ struct PassesDecoderState {
     }
   }
 
+  // Prepares the state for decoding the frames of another image. The buffers
+  // that only hold data of the current frame are kept to be reused, but the
+  // frames saved for use by later frames of the previous image are released.
+  void ResetForNextImage() {
+    noise_seed = 0;
+    image_out = ExternalRowOutput();
+    for (Image3F& dc_frame : shared_storage.dc_frames) {
+      dc_frame = Image3F();
+    }
+    for (auto& reference_frame : shared_storage.reference_frames) {
+      reference_frame.storage = ImageBundle();
+      reference_frame.frame = &reference_frame.storage;
+      reference_frame.ib_is_in_xyb = true;
+    }
+  }
+
+  // Moves the frames saved for use by later frames from `other`, for the slots
+  // in the bitmask `slots`: bits 0-3 for the reference frames and bits 4-7 for
+  // the DC frames. Allows decoding the next frames with this state while the
+  // frame of `other` is still being finalized.
+  void TakeSavedFrames(PassesDecoderState* other, int slots) {
+    for (size_t i = 0; i < 4; i++) {
+      if (slots & (1 << i)) {
+        auto& from = other->shared_storage.reference_frames[i];
+        auto& to = shared_storage.reference_frames[i];
+        to.storage = std::move(from.storage);
+        to.frame = (from.frame == &from.storage) ? &to.storage : from.frame;
+        to.ib_is_in_xyb = from.ib_is_in_xyb;
+        from.storage = ImageBundle();
+        from.frame = &from.storage;
+        from.ib_is_in_xyb = true;
+      }
+      if (slots & (1 << (4 + i))) {
+        shared_storage.dc_frames[i] =
+            std::move(other->shared_storage.dc_frames[i]);
+      }
+    }
+  }
+
   // Initialize the decoder state after all of DC is decoded.
   void InitForAC() {
     shared_storage.coeff_order_size = 0;
@@ -220,68 +375,6 @@ struct PassesDecoderState {
   }
 };
 
-// Temp images required for decoding a single group. Reduces memory allocations
-// for large images because we only initialize min(#threads, #groups) instances.
-struct GroupDecCache {
-  void InitOnce(size_t num_passes, size_t used_acs) {
-    PROFILER_FUNC;
-
-    for (size_t i = 0; i < num_passes; i++) {
-      if (num_nzeroes[i].xsize() == 0) {
-        // Allocate enough for a whole group - partial groups on the
-        // right/bottom border just use a subset. The valid size is passed via
-        // Rect.
-
-        num_nzeroes[i] = Image3I(kGroupDimInBlocks, kGroupDimInBlocks);
-      }
-    }
-    size_t max_block_area = 0;
-
-    for (uint8_t o = 0; o < AcStrategy::kNumValidStrategies; ++o) {
-      AcStrategy acs = AcStrategy::FromRawStrategy(o);
-      if ((used_acs & (1 << o)) == 0) continue;
-      size_t area =
-          acs.covered_blocks_x() * acs.covered_blocks_y() * kDCTBlockSize;
-      max_block_area = std::max(area, max_block_area);
-    }
-
-    if (max_block_area > max_block_area_) {
-      max_block_area_ = max_block_area;
-      // We need 3x float blocks for dequantized coefficients and 1x for scratch
-      // space for transforms.
-      float_memory_ = hwy::AllocateAligned<float>(max_block_area_ * 4);
-      // We need 3x int32 or int16 blocks for quantized coefficients.
-      int32_memory_ = hwy::AllocateAligned<int32_t>(max_block_area_ * 3);
-      int16_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
-    }
-
-    dec_group_block = float_memory_.get();
-    scratch_space = dec_group_block + max_block_area_ * 3;
-    dec_group_qblock = int32_memory_.get();
-    dec_group_qblock16 = int16_memory_.get();
-  }
-
-  // Scratch space used by DecGroupImpl().
-  float* dec_group_block;
-  int32_t* dec_group_qblock;
-  int16_t* dec_group_qblock16;
-
-  // For TransformToPixels.
-  float* scratch_space;
-  // Note that scratch_space is never used at the same time as dec_group_qblock.
-  // Moreover, only one of dec_group_qblock16 is ever used.
-  // TODO(veluca): figure out if we can save allocations.
-
-  // AC decoding
-  Image3I num_nzeroes[kMaxNumPasses];
-
- private:
-  hwy::AlignedFreeUniquePtr<float[]> float_memory_;
-  hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
-  hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
-  size_t max_block_area_ = 0;
-};
-
 }  // namespace jxl
 
 #endif  // LIB_JXL_DEC_CACHE_H_
@@ -65,6 +65,14 @@ void LinearToSRGBInPlace(jxl::ThreadPool* pool, Image3F* image,
   }
 }
 
+void LinearToSRGBRow(const float* JXL_RESTRICT in, float* JXL_RESTRICT out,
+                     size_t xsize) {
+  const HWY_FULL(float) d;
+  for (size_t x = 0; x < xsize; x += Lanes(d)) {
+    Store(LinearToSRGB(LoadU(d, in + x)), d, out + x);
+  }
+}
+
 void FloatToU32(const float* in, uint32_t* out, size_t num, float mul,
                 size_t bits_per_sample) {
   const HWY_FULL(float) d;
@@ -82,7 +90,7 @@ void FloatToU32(const float* in, uint32_t* out, size_t num, float mul,
   const auto one = Set(d, 1.0f);
   const auto scale = Set(d, mul);
   for (size_t x = 0; x < vec_num; x += Lanes(d)) {
-    auto v = Load(d, in + x);
+    auto v = LoadU(d, in + x);
     // Check for NaNs.
     JXL_DASSERT(AllTrue(v == v));
     // Clamp turns NaN to 'min'.
@@ -123,13 +131,15 @@ void StoreLEFloat(float value, uint8_t* p) {
   StoreLE32(u, p);
 }
 
-// The orientation may not be identity.
+// Undoes the orientation of `rect` of `image` into `out`, which gets the
+// (possibly transposed) size of `rect`. The orientation may not be identity.
 // TODO(lode): SIMDify where possible
 template <typename T>
-void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
-                     Plane<T>& out, jxl::ThreadPool* pool) {
-  const size_t xsize = image.xsize();
-  const size_t ysize = image.ysize();
+void UndoOrientation(jxl::Orientation undo_orientation, const Rect& rect,
+                     const Plane<T>& image, Plane<T>& out,
+                     jxl::ThreadPool* pool) {
+  const size_t xsize = rect.xsize();
+  const size_t ysize = rect.ysize();
 
   if (undo_orientation == Orientation::kFlipHorizontal) {
     out = Plane<T>(xsize, ysize);
@@ -137,7 +147,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           T* JXL_RESTRICT row_out = out.Row(y);
           for (size_t x = 0; x < xsize; ++x) {
             row_out[xsize - x - 1] = row_in[x];
@@ -150,7 +160,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           T* JXL_RESTRICT row_out = out.Row(ysize - y - 1);
           for (size_t x = 0; x < xsize; ++x) {
             row_out[xsize - x - 1] = row_in[x];
@@ -163,7 +173,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           T* JXL_RESTRICT row_out = out.Row(ysize - y - 1);
           for (size_t x = 0; x < xsize; ++x) {
             row_out[x] = row_in[x];
@@ -176,7 +186,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           for (size_t x = 0; x < xsize; ++x) {
             out.Row(x)[y] = row_in[x];
           }
@@ -188,7 +198,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           for (size_t x = 0; x < xsize; ++x) {
             out.Row(x)[ysize - y - 1] = row_in[x];
           }
@@ -200,7 +210,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           for (size_t x = 0; x < xsize; ++x) {
             out.Row(xsize - x - 1)[ysize - y - 1] = row_in[x];
           }
@@ -212,7 +222,7 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
         pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
         [&](const int task, int /*thread*/) {
           const int64_t y = task;
-          const T* JXL_RESTRICT row_in = image.Row(y);
+          const T* JXL_RESTRICT row_in = rect.ConstRow(image, y);
           for (size_t x = 0; x < xsize; ++x) {
             out.Row(xsize - x - 1)[y] = row_in[x];
           }
@@ -223,8 +233,14 @@ void UndoOrientation(jxl::Orientation undo_orientation, const Plane<T>& image,
 }  // namespace
 
 HWY_EXPORT(LinearToSRGBInPlace);
+HWY_EXPORT(LinearToSRGBRow);
 HWY_EXPORT(FloatToU32);
 
+void LinearToSRGBInPlace(jxl::ThreadPool* pool, Image3F* image,
+                         size_t color_channels) {
+  return HWY_DYNAMIC_DISPATCH(LinearToSRGBInPlace)(pool, image, color_channels);
+}
+
 namespace {
 
 using StoreFuncType = void(uint32_t value, uint8_t* dest);
@@ -252,18 +268,68 @@ void StoreFloatRow(const float* JXL_RESTRICT* rows_in, size_t num_channels,
 
 void JXL_INLINE Store8(uint32_t value, uint8_t* dest) { *dest = value & 0xff; }
 
-}  // namespace
+// Converts one row of `num_channels` planar channels to interleaved external
+// format. `rows_u32` is scratch memory for each of the channels and is only
+// used for integer output.
+void StoreExternalRow(const float* JXL_RESTRICT* rows_in, size_t num_channels,
+                      size_t xsize, size_t bits_per_sample, bool float_out,
+                      bool little_endian, uint32_t* JXL_RESTRICT* rows_u32,
+                      uint8_t* JXL_RESTRICT out) {
+  if (float_out) {
+    if (little_endian) {
+      StoreFloatRow<StoreLEFloat>(rows_in, num_channels, xsize, out);
+    } else {
+      StoreFloatRow<StoreBEFloat>(rows_in, num_channels, xsize, out);
+    }
+    return;
+  }
+  // Multiplier to convert from floating point 0-1 range to the integer
+  // range.
+  float mul = (1ull << bits_per_sample) - 1;
+  for (size_t c = 0; c < num_channels; c++) {
+    HWY_DYNAMIC_DISPATCH(FloatToU32)
+    (rows_in[c], rows_u32[c], xsize, mul, bits_per_sample);
+  }
+  // TODO(deymo): add bits_per_sample == 1 case here.
+  if (bits_per_sample <= 8) {
+    StoreUintRow<Store8>(rows_u32, num_channels, xsize, 1, out);
+  } else if (bits_per_sample <= 16) {
+    if (little_endian) {
+      StoreUintRow<StoreLE16>(rows_u32, num_channels, xsize, 2, out);
+    } else {
+      StoreUintRow<StoreBE16>(rows_u32, num_channels, xsize, 2, out);
+    }
+  } else if (bits_per_sample <= 24) {
+    if (little_endian) {
+      StoreUintRow<StoreLE24>(rows_u32, num_channels, xsize, 3, out);
+    } else {
+      StoreUintRow<StoreBE24>(rows_u32, num_channels, xsize, 3, out);
+    }
+  } else {
+    if (little_endian) {
+      StoreUintRow<StoreLE32>(rows_u32, num_channels, xsize, 4, out);
+    } else {
+      StoreUintRow<StoreBE32>(rows_u32, num_channels, xsize, 4, out);
+    }
+  }
+}
 
-void LinearToSRGBInPlace(jxl::ThreadPool* pool, Image3F* image,
-                         size_t color_channels) {
-  return HWY_DYNAMIC_DISPATCH(LinearToSRGBInPlace)(pool, image, color_channels);
+bool IsLittleEndianOutput(JxlEndianness endianness) {
+  return endianness == JXL_LITTLE_ENDIAN ||
+         (endianness == JXL_NATIVE_ENDIAN && IsLittleEndian());
 }
 
-Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
-                         bool float_out, bool apply_srgb_tf,
-                         size_t num_channels, JxlEndianness endianness,
-                         size_t stride, jxl::ThreadPool* pool, void* out_image,
-                         size_t out_size, jxl::Orientation undo_orientation) {
+// Common implementation of both ConvertToExternal variants: exactly one of
+// `out_image` and `out_callback` is used.
+Status ConvertToExternalImpl(const jxl::ImageBundle& ib,
+                             size_t bits_per_sample, bool float_out,
+                             bool apply_srgb_tf, size_t num_channels,
+                             JxlEndianness endianness, size_t stride,
+                             jxl::ThreadPool* pool, void* out_image,
+                             size_t out_size, JxlImageOutCallback out_callback,
+                             void* out_opaque,
+                             jxl::Orientation undo_orientation,
+                             const Rect* rect) {
   if (bits_per_sample < 1 || bits_per_sample > 32) {
     return JXL_FAILURE("Invalid bits_per_sample value.");
   }
@@ -271,8 +337,13 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
   if (bits_per_sample == 1) {
     return JXL_FAILURE("packed 1-bit per sample is not yet supported");
   }
-  size_t xsize = ib.xsize();
-  size_t ysize = ib.ysize();
+  if (float_out && bits_per_sample != 32) {
+    return JXL_FAILURE("non-32-bit float not supported");
+  }
+  // Only the pixels of `rect` are read and converted, the output image has
+  // the size of `rect` with the orientation undone.
+  const Rect in_rect = rect ? rect->Crop(ib) : Rect(ib);
+  Rect out_rect(0, 0, in_rect.xsize(), in_rect.ysize());
 
   uint8_t* out = reinterpret_cast<uint8_t*>(out_image);
 
@@ -283,42 +354,53 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
   const size_t bytes_per_channel = DivCeil(bits_per_sample, jxl::kBitsPerByte);
   const size_t bytes_per_pixel = num_channels * bytes_per_channel;
 
-  if (stride < bytes_per_pixel * xsize) {
-    return JXL_FAILURE(
-        "stride is smaller than scanline width in bytes: %zu vs %zu", stride,
-        bytes_per_pixel * xsize);
-  }
-
   const Image3F* color = &ib.color();
+  Rect color_rect = in_rect;
   Image3F temp_color;
   const ImageF* alpha = ib.HasAlpha() ? &ib.alpha() : nullptr;
+  Rect alpha_rect = in_rect;
   ImageF temp_alpha;
   if (apply_srgb_tf) {
-    temp_color = CopyImage(*color);
+    temp_color = Image3F(in_rect.xsize(), in_rect.ysize());
+    CopyImageTo(in_rect, *color, &temp_color);
     LinearToSRGBInPlace(pool, &temp_color, color_channels);
     color = &temp_color;
+    color_rect = Rect(temp_color);
   }
 
   if (undo_orientation != Orientation::kIdentity) {
     Image3F transformed;
     for (size_t c = 0; c < color_channels; ++c) {
-      UndoOrientation(undo_orientation, color->Plane(c), transformed.Plane(c),
-                      pool);
+      UndoOrientation(undo_orientation, color_rect, color->Plane(c),
+                      transformed.Plane(c), pool);
     }
     transformed.Swap(temp_color);
     color = &temp_color;
+    color_rect = Rect(temp_color);
     if (ib.HasAlpha()) {
-      UndoOrientation(undo_orientation, *alpha, temp_alpha, pool);
+      UndoOrientation(undo_orientation, alpha_rect, *alpha, temp_alpha, pool);
       alpha = &temp_alpha;
+      alpha_rect = Rect(temp_alpha);
+    }
+
+    if (static_cast<uint32_t>(undo_orientation) > 4) {
+      // The orientation transposes the image.
+      out_rect = Rect(0, 0, in_rect.ysize(), in_rect.xsize());
     }
+  }
+  const size_t xsize = out_rect.xsize();
+  const size_t ysize = out_rect.ysize();
 
-    xsize = color->xsize();
-    ysize = color->ysize();
+  if (out_callback) {
+    // Rows are converted to per-thread storage before being passed on.
+    stride = bytes_per_pixel * xsize;
+  } else if (stride < bytes_per_pixel * xsize) {
+    return JXL_FAILURE(
+        "stride is smaller than scanline width in bytes: %zu vs %zu", stride,
+        bytes_per_pixel * xsize);
   }
 
-  const bool little_endian =
-      endianness == JXL_LITTLE_ENDIAN ||
-      (endianness == JXL_NATIVE_ENDIAN && IsLittleEndian());
+  const bool little_endian = IsLittleEndianOutput(endianness);
 
   ImageF ones;
   if (want_alpha && !ib.HasAlpha()) {
@@ -326,86 +408,126 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
     FillImage(1.0f, &ones);
   }
 
-  if (float_out) {
-    if (bits_per_sample != 32) {
-      return JXL_FAILURE("non-32-bit float not supported");
-    }
-    RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize), ThreadPool::SkipInit(),
-        [&](const int task, int /*thread*/) {
-          const int64_t y = task;
-          size_t i = stride * y;
-          const float* JXL_RESTRICT row_in[4];
-          size_t c = 0;
-          for (; c < color_channels; c++) {
-            row_in[c] = color->PlaneRow(c, y);
-          }
-          if (want_alpha) {
-            row_in[c++] = ib.HasAlpha() ? alpha->Row(y) : ones.Row(0);
-          }
-          JXL_ASSERT(c == num_channels);
-          if (little_endian) {
-            StoreFloatRow<StoreLEFloat>(row_in, c, xsize, out + i);
-          } else {
-            StoreFloatRow<StoreBEFloat>(row_in, c, xsize, out + i);
-          }
-        },
-        "ConvertFloat");
-  } else {
-    // Multiplier to convert from floating point 0-1 range to the integer
-    // range.
-    float mul = (1ull << bits_per_sample) - 1;
-    Plane<uint32_t> u32_cache;
-    RunOnPool(
-        pool, 0, static_cast<uint32_t>(ysize),
-        [&](size_t num_threads) {
+  Plane<uint32_t> u32_cache;
+  ImageB out_rows;
+  RunOnPool(
+      pool, 0, static_cast<uint32_t>(ysize),
+      [&](size_t num_threads) {
+        if (!float_out) {
           u32_cache = Plane<uint32_t>(xsize, num_channels * num_threads);
-          return true;
-        },
-        [&](const int task, int thread) {
-          const int64_t y = task;
-          size_t i = stride * y;
-          const float* JXL_RESTRICT row_in[4];
-          size_t c = 0;
-          for (; c < color_channels; c++) {
-            row_in[c] = color->PlaneRow(c, y);
-          }
-          if (want_alpha) {
-            row_in[c++] = ib.HasAlpha() ? alpha->Row(y) : ones.Row(0);
-          }
-          JXL_ASSERT(c == num_channels);
-          uint32_t* JXL_RESTRICT row_u32[4];
+        }
+        if (out_callback) {
+          out_rows = ImageB(stride, num_threads);
+        }
+        return true;
+      },
+      [&](const int task, int thread) {
+        const int64_t y = task;
+        const float* JXL_RESTRICT row_in[4];
+        size_t c = 0;
+        for (; c < color_channels; c++) {
+          row_in[c] = color_rect.ConstPlaneRow(*color, c, y);
+        }
+        if (want_alpha) {
+          row_in[c++] =
+              ib.HasAlpha() ? alpha_rect.ConstRow(*alpha, y) : ones.Row(0);
+        }
+        JXL_ASSERT(c == num_channels);
+        uint32_t* JXL_RESTRICT row_u32[4] = {};
+        if (!float_out) {
           for (size_t r = 0; r < c; r++) {
             row_u32[r] = u32_cache.Row(r + thread * num_channels);
-            HWY_DYNAMIC_DISPATCH(FloatToU32)
-            (row_in[r], row_u32[r], xsize, mul, bits_per_sample);
           }
-          // TODO(deymo): add bits_per_sample == 1 case here.
-          if (bits_per_sample <= 8) {
-            StoreUintRow<Store8>(row_u32, c, xsize, 1, out + i);
-          } else if (bits_per_sample <= 16) {
-            if (little_endian) {
-              StoreUintRow<StoreLE16>(row_u32, c, xsize, 2, out + i);
-            } else {
-              StoreUintRow<StoreBE16>(row_u32, c, xsize, 2, out + i);
-            }
-          } else if (bits_per_sample <= 24) {
-            if (little_endian) {
-              StoreUintRow<StoreLE24>(row_u32, c, xsize, 3, out + i);
-            } else {
-              StoreUintRow<StoreBE24>(row_u32, c, xsize, 3, out + i);
-            }
-          } else {
-            if (little_endian) {
-              StoreUintRow<StoreLE32>(row_u32, c, xsize, 4, out + i);
-            } else {
-              StoreUintRow<StoreBE32>(row_u32, c, xsize, 4, out + i);
-            }
-          }
-        },
-        "ConvertUint");
+        }
+        uint8_t* JXL_RESTRICT row_out =
+            out_callback ? out_rows.Row(thread) : out + stride * y;
+        StoreExternalRow(row_in, c, xsize, bits_per_sample, float_out,
+                         little_endian, row_u32, row_out);
+        if (out_callback) {
+          out_callback(out_opaque, 0, y, xsize, row_out);
+        }
+      },
+      float_out ? "ConvertFloat" : "ConvertUint");
+
+  return true;
+}
+
+}  // namespace
+
+Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
+                         bool float_out, bool apply_srgb_tf,
+                         size_t num_channels, JxlEndianness endianness,
+                         size_t stride, jxl::ThreadPool* pool, void* out_image,
+                         size_t out_size, jxl::Orientation undo_orientation,
+                         const Rect* rect) {
+  return ConvertToExternalImpl(ib, bits_per_sample, float_out, apply_srgb_tf,
+                               num_channels, endianness, stride, pool,
+                               out_image, out_size, /*out_callback=*/nullptr,
+                               /*out_opaque=*/nullptr, undo_orientation, rect);
+}
+
+Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
+                         bool float_out, bool apply_srgb_tf,
+                         size_t num_channels, JxlEndianness endianness,
+                         jxl::ThreadPool* pool,
+                         JxlImageOutCallback out_callback, void* out_opaque,
+                         jxl::Orientation undo_orientation, const Rect* rect) {
+  JXL_ASSERT(out_callback != nullptr);
+  return ConvertToExternalImpl(ib, bits_per_sample, float_out, apply_srgb_tf,
+                               num_channels, endianness, /*stride=*/0, pool,
+                               /*out_image=*/nullptr, /*out_size=*/0,
+                               out_callback, out_opaque, undo_orientation,
+                               rect);
+}
+
+Status ConvertRectToExternal(const Image3F& color, const Rect& rect,
+                             const ExternalRowOutput& output,
+                             ExternalRowStorage* JXL_RESTRICT storage) {
+  JXL_DASSERT(output.IsPresent());
+  const size_t num_channels = output.num_channels;
+  const size_t color_channels = num_channels <= 2 ? 1 : 3;
+  const bool want_alpha = num_channels == 2 || num_channels == 4;
+  const size_t xsize = rect.xsize();
+  if (xsize == 0) return true;
+
+  const size_t bytes_per_pixel =
+      num_channels * DivCeil(output.bits_per_sample, jxl::kBitsPerByte);
+  if (storage->float_rows.xsize() < xsize ||
+      storage->out_row.xsize() < bytes_per_pixel * xsize) {
+    // The last of the float rows holds the alpha values, which are all opaque.
+    storage->float_rows = ImageF(xsize, 4);
+    FillImage(1.0f, &storage->float_rows);
+    storage->u32_rows = Plane<uint32_t>(xsize, 4);
+    storage->out_row = ImageB(bytes_per_pixel * xsize, 1);
   }
 
+  const bool little_endian = IsLittleEndianOutput(output.endianness);
+  for (size_t y = 0; y < rect.ysize(); y++) {
+    const float* JXL_RESTRICT row_in[4];
+    uint32_t* JXL_RESTRICT row_u32[4];
+    for (size_t c = 0; c < color_channels; c++) {
+      row_in[c] = rect.ConstPlaneRow(color, c, y);
+      if (output.apply_srgb_tf) {
+        float* JXL_RESTRICT row_srgb = storage->float_rows.Row(c);
+        HWY_DYNAMIC_DISPATCH(LinearToSRGBRow)(row_in[c], row_srgb, xsize);
+        row_in[c] = row_srgb;
+      }
+    }
+    if (want_alpha) {
+      row_in[color_channels] = storage->float_rows.ConstRow(3);
+    }
+    for (size_t c = 0; c < num_channels; c++) {
+      row_u32[c] = storage->u32_rows.Row(c);
+    }
+    uint8_t* JXL_RESTRICT row_out =
+        output.callback ? storage->out_row.Row(0)
+                        : output.BufferPixel(rect.x0(), rect.y0() + y);
+    StoreExternalRow(row_in, num_channels, xsize, output.bits_per_sample,
+                     output.float_out, little_endian, row_u32, row_out);
+    if (output.callback) {
+      output.callback(output.opaque, rect.x0(), rect.y0() + y, xsize, row_out);
+    }
+  }
   return true;
 }
 
@@ -20,9 +20,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "jxl/decode.h"
 #include "jxl/types.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 
@@ -35,7 +37,6 @@ namespace jxl {
 // This supports the features needed for the C API and does not perform
 // color space conversion.
 // TODO(lode): support 1-bit output (bits_per_sample == 1)
-// TODO(lode): support rectangle crop.
 // apply_srgb_tf applies conversion from linear sRGB to nonlinear sRGB. This
 // requires that the ImageBundle is in linear sRGB.
 // stride_out is output scanline size in bytes, must be >=
@@ -43,12 +44,66 @@ namespace jxl {
 // undo_orientation is an EXIF orientation to undo. Depending on the
 // orientation, the output xsize and ysize are swapped compared to input
 // xsize and ysize.
+// If rect is not null, only the pixels of ib inside of it are converted, and
+// the output has the (oriented) size of rect rather than that of ib.
 Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                          bool float_out, bool apply_srgb_tf,
                          size_t num_channels, JxlEndianness endianness,
                          size_t stride_out, jxl::ThreadPool* thread_pool,
                          void* out_image, size_t out_size,
-                         jxl::Orientation undo_orientation);
+                         jxl::Orientation undo_orientation,
+                         const Rect* rect = nullptr);
+
+// Same as above, but instead of writing to a buffer, passes each converted row
+// of the output to `out_callback`. The callback may be called concurrently
+// from different threads of `thread_pool`.
+Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
+                         bool float_out, bool apply_srgb_tf,
+                         size_t num_channels, JxlEndianness endianness,
+                         jxl::ThreadPool* thread_pool,
+                         JxlImageOutCallback out_callback, void* out_opaque,
+                         jxl::Orientation undo_orientation,
+                         const Rect* rect = nullptr);
+
+// Destination for pixels that are converted to the external format while the
+// frame is being reconstructed: either the image out callback, see
+// JxlDecoderSetImageOutCallback, or the image out buffer.
+struct ExternalRowOutput {
+  bool IsPresent() const { return callback != nullptr || buffer != nullptr; }
+
+  // Returns where to write the pixel at (x, y) if the output is a buffer.
+  uint8_t* BufferPixel(size_t x, size_t y) const {
+    return buffer + y * stride +
+           x * num_channels * DivCeil(bits_per_sample, kBitsPerByte);
+  }
+
+  JxlImageOutCallback callback = nullptr;
+  void* opaque = nullptr;
+  // Only used if callback is not set.
+  uint8_t* buffer = nullptr;
+  size_t stride = 0;
+  size_t bits_per_sample = 8;
+  bool float_out = false;
+  // Converts from linear sRGB to nonlinear sRGB before the output.
+  bool apply_srgb_tf = false;
+  // Alpha, if requested, is output as fully opaque.
+  size_t num_channels = 3;
+  JxlEndianness endianness = JXL_NATIVE_ENDIAN;
+};
+
+// Scratch memory for ConvertRectToExternal, one instance is needed per thread.
+struct ExternalRowStorage {
+  ImageF float_rows;
+  Plane<uint32_t> u32_rows;
+  ImageB out_row;
+};
+
+// Converts `rect` of `color` to the format of `output` and writes it to the
+// buffer or passes it on to the callback row by row. `rect` is in image
+// coordinates.
+Status ConvertRectToExternal(const Image3F& color, const Rect& rect,
+                             const ExternalRowOutput& output,
+                             ExternalRowStorage* JXL_RESTRICT storage);
 
 }  // namespace jxl
 
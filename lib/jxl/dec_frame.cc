@@ -68,6 +68,9 @@
 namespace jxl {
 
 namespace {
+// Value of FrameDecoder::drawn_passes_ for groups that were not drawn yet.
+constexpr uint8_t kNotDrawn = 0xFF;
+
 Status DecodeGlobalDCInfo(BitReader* reader, bool is_jpeg,
                           PassesDecoderState* state, ThreadPool* pool) {
   PROFILER_FUNC;
@@ -169,36 +172,10 @@ Status DecodeFrame(const DecompressParams& dparams,
       dparams.allow_partial_files && dparams.allow_more_progressive_steps));
 
   // Handling of progressive decoding.
-  {
-    const FrameHeader& frame_header = frame_decoder.GetFrameHeader();
-    size_t downsampling;
-    size_t max_passes = dparams.max_passes;
-    size_t max_downsampling = std::max(
-        dparams.max_downsampling >> (frame_header.dc_level * 3), size_t(1));
-    // TODO(veluca): deal with downsamplings >= 8.
-    if (max_downsampling >= 8) {
-      downsampling = 8;
-      max_passes = 0;
-    } else {
-      downsampling = 1;
-      for (uint32_t i = 0; i < frame_header.passes.num_downsample; ++i) {
-        if (max_downsampling >= frame_header.passes.downsample[i] &&
-            max_passes > frame_header.passes.last_pass[i]) {
-          downsampling = frame_header.passes.downsample[i];
-          max_passes = frame_header.passes.last_pass[i] + 1;
-        }
-      }
-    }
-    // Do not use downsampling for kReferenceOnly frames.
-    if (frame_header.frame_type == FrameType::kReferenceOnly) {
-      downsampling = 1;
-      max_passes = frame_header.passes.num_passes;
-    }
-    if (aux_out != nullptr) {
-      aux_out->downsampling = downsampling;
-    }
-    max_passes = std::min<size_t>(max_passes, frame_header.passes.num_passes);
-    frame_decoder.SetMaxPasses(max_passes);
+  size_t downsampling = frame_decoder.SetMaxDownsampling(
+      dparams.max_downsampling, dparams.max_passes);
+  if (aux_out != nullptr) {
+    aux_out->downsampling = downsampling;
   }
 
   size_t processed_bytes = reader->TotalBitsConsumed() / kBitsPerByte;
@@ -365,14 +342,151 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
   decoded_dc_groups_.resize(frame_dim_.num_dc_groups);
   decoded_passes_per_ac_group_.clear();
   decoded_passes_per_ac_group_.resize(frame_dim_.num_groups, 0);
+  drawn_passes_.clear();
+  drawn_passes_.resize(frame_dim_.num_groups, kNotDrawn);
+  group_changed_.clear();
+  group_changed_.resize(frame_dim_.num_groups, 0);
+  ac_group_needed_.clear();
+  ac_group_needed_.resize(frame_dim_.num_groups, 1);
   processed_section_.clear();
   processed_section_.resize(section_offsets_.size());
   max_passes_ = frame_header_.passes.num_passes;
   num_renders_ = 0;
+  dec_state_->render_rect = Rect();
+  dec_state_->output_area = Rect();
+  render_from_dc_ = false;
 
   return true;
 }
 
+size_t FrameDecoder::SetMaxDownsampling(size_t max_downsampling,
+                                        size_t max_passes) {
+  size_t downsampling;
+  max_downsampling = std::max(
+      max_downsampling >> (frame_header_.dc_level * 3), size_t(1));
+  // TODO(veluca): deal with downsamplings >= 8.
+  if (max_downsampling >= 8) {
+    downsampling = 8;
+    max_passes = 0;
+  } else {
+    downsampling = 1;
+    for (uint32_t i = 0; i < frame_header_.passes.num_downsample; ++i) {
+      if (max_downsampling >= frame_header_.passes.downsample[i] &&
+          max_passes > frame_header_.passes.last_pass[i]) {
+        downsampling = frame_header_.passes.downsample[i];
+        max_passes = frame_header_.passes.last_pass[i] + 1;
+      }
+    }
+  }
+  // Do not use downsampling for kReferenceOnly frames.
+  if (frame_header_.frame_type == FrameType::kReferenceOnly) {
+    downsampling = 1;
+    max_passes = frame_header_.passes.num_passes;
+  }
+  // Without AC, there is nothing to render at full resolution, if the frame is
+  // output as is: the DC already has the pixels at 1/8 of the size.
+  if (downsampling == 8 && CanRenderFromDC()) {
+    render_from_dc_ = true;
+  }
+  max_passes_ = std::min<size_t>(max_passes, frame_header_.passes.num_passes);
+  return downsampling;
+}
+
+bool FrameDecoder::CanRenderFromDC() const {
+  if (frame_header_.encoding != FrameEncoding::kVarDCT || decoded_->IsJPEG()) {
+    return false;
+  }
+  // Frames that are referenced or blended are needed at full resolution.
+  if (frame_header_.frame_type != FrameType::kRegularFrame ||
+      frame_header_.CanBeReferenced() || frame_header_.custom_size_or_origin ||
+      frame_header_.blending_info.mode != BlendMode::kReplace) {
+    return false;
+  }
+  // Each pixel of the DC must be one pixel of the output.
+  if (frame_header_.upsampling != 1 ||
+      !frame_header_.chroma_subsampling.Is444()) {
+    return false;
+  }
+  // Image features and extra channels are only rendered at full resolution.
+  if (frame_header_.flags & (FrameHeader::kNoise | FrameHeader::kPatches |
+                             FrameHeader::kSplines)) {
+    return false;
+  }
+  return frame_header_.nonserialized_metadata->m.num_extra_channels == 0;
+}
+
+void FrameDecoder::SetRenderRect(const Rect& rect) {
+  // Frames that later frames depend on must be rendered in full.
+  if (frame_header_.CanBeReferenced() ||
+      frame_header_.frame_type != FrameType::kRegularFrame) {
+    return;
+  }
+  dec_state_->render_rect = rect;
+  // The whole DC is rendered, it is small.
+  if (render_from_dc_) return;
+  // The output image only needs to hold the render rect if the frame is output
+  // as is. The filters read their border from the frame before filtering, and
+  // FinalizeImageRect works on whole blocks.
+  bool replace_all =
+      frame_header_.blending_info.mode == BlendMode::kReplace &&
+      !frame_header_.custom_size_or_origin;
+  for (const auto& info : frame_header_.extra_channel_blending_info) {
+    if (info.mode != BlendMode::kReplace) replace_all = false;
+  }
+  if (replace_all && frame_header_.upsampling == 1 && !decoded_->IsJPEG() &&
+      !frame_header_.save_before_color_transform) {
+    const size_t x0 = rect.x0() / kBlockDim * kBlockDim;
+    const size_t y0 = rect.y0() / kBlockDim * kBlockDim;
+    const size_t x1 = std::min(RoundUpToBlockDim(rect.x0() + rect.xsize()),
+                               frame_dim_.xsize_upsampled_padded);
+    const size_t y1 = std::min(RoundUpToBlockDim(rect.y0() + rect.ysize()),
+                               frame_dim_.ysize_upsampled_padded);
+    dec_state_->output_area = Rect(x0, y0, x1 - x0, y1 - y0);
+  }
+  // Only VarDCT groups can be skipped: modular frames may use global
+  // transforms, such as squeeze, that mix pixels from the whole frame.
+  if (frame_header_.encoding != FrameEncoding::kVarDCT || decoded_->IsJPEG() ||
+      section_offsets_.size() == 1) {
+    return;
+  }
+  // FinalizeImageRect accesses pixels around the rendered area for the
+  // filters and upsampling, and rounds rects to whole blocks.
+  const size_t padding = PassesDecoderState::kMaxFinalizeRectPadding;
+  const size_t border = kBlockDim + RoundUpToBlockDim(padding);
+  const size_t x0 = rect.x0() > border ? rect.x0() - border : 0;
+  const size_t y0 = rect.y0() > border ? rect.y0() - border : 0;
+  const size_t x1 = rect.x0() + rect.xsize() + border;
+  const size_t y1 = rect.y0() + rect.ysize() + border;
+  const size_t group_dim = frame_dim_.group_dim;
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  for (size_t g = 0; g < frame_dim_.num_groups; g++) {
+    const size_t gx = g % frame_dim_.xsize_groups;
+    const size_t gy = g / frame_dim_.xsize_groups;
+    if (gx * group_dim < x1 && (gx + 1) * group_dim > x0 &&
+        gy * group_dim < y1 && (gy + 1) * group_dim > y0) {
+      continue;
+    }
+    ac_group_needed_[g] = 0;
+    // Pretend all passes of the group were decoded, so that it is neither
+    // waited for nor drawn, and its sections are ignored.
+    decoded_passes_per_ac_group_[g] = frame_header_.passes.num_passes;
+    for (size_t i = 0; i < frame_header_.passes.num_passes; i++) {
+      processed_section_[ac_global_index + 1 + i * frame_dim_.num_groups + g] =
+          true;
+    }
+  }
+}
+
+bool FrameDecoder::IsSectionNeeded(size_t section_id) const {
+  const size_t ac_global_index = frame_dim_.num_dc_groups + 1;
+  if (section_offsets_.size() == 1 || section_id <= ac_global_index) {
+    return true;
+  }
+  size_t ac_idx = section_id - ac_global_index - 1;
+  return ac_idx / frame_dim_.num_groups < max_passes_ &&
+         ac_group_needed_[ac_idx % frame_dim_.num_groups];
+}
+
 Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
   PROFILER_FUNC;
   PassesSharedState& shared = dec_state_->shared_storage;
@@ -443,11 +557,18 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
   JXL_CHECK(finalized_dc_);
   dec_state_->InitForAC();
 
-  // Allocate output image.
+  // Allocate output image, unless it is rendered from the DC at the end.
   const CodecMetadata& metadata = *frame_header_.nonserialized_metadata;
-  decoded_->SetFromImage(Image3F(frame_dim_.xsize_upsampled_padded,
-                                 frame_dim_.ysize_upsampled_padded),
-                         dec_state_->output_encoding);
+  const Rect& output_area = dec_state_->output_area;
+  const bool whole_frame = output_area.xsize() == 0;
+  if (!render_from_dc_) {
+    decoded_->SetFromImage(
+        Image3F(whole_frame ? frame_dim_.xsize_upsampled_padded
+                            : output_area.xsize(),
+                whole_frame ? frame_dim_.ysize_upsampled_padded
+                            : output_area.ysize()),
+        dec_state_->output_encoding);
+  }
   if (metadata.m.num_extra_channels > 0) {
     std::vector<ImageF> ecv;
     for (size_t i = 0; i < metadata.m.num_extra_channels; i++) {
@@ -501,14 +622,16 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
     bool store = frame_header_.passes.num_passes > 1;
     size_t xs = store ? kGroupDim * kGroupDim : 0;
     size_t ys = store ? frame_dim_.num_groups : 0;
-    if (use_16_bit) {
-      dec_state_->coefficients = make_unique<ACImageT<int16_t>>(xs, ys);
-    } else {
-      dec_state_->coefficients = make_unique<ACImageT<int32_t>>(xs, ys);
-    }
-    if (store) {
-      dec_state_->coefficients->ZeroFill();
+    ACType type = use_16_bit ? ACType::k16 : ACType::k32;
+    if (dec_state_->coefficients->Type() != type ||
+        !dec_state_->coefficients->TryShrinkTo(xs, ys)) {
+      if (use_16_bit) {
+        dec_state_->coefficients = make_unique<ACImageT<int16_t>>(xs, ys);
+      } else {
+        dec_state_->coefficients = make_unique<ACImageT<int32_t>>(xs, ys);
+      }
     }
+    // The rows of `coefficients` are zero-filled by ProcessACGroup.
   }
 
   // Set JPEG decoding data.
@@ -564,13 +687,26 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
   const size_t y = gy * frame_dim_.group_dim;
 
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
-    group_dec_caches_[thread].InitOnce(frame_header_.passes.num_passes,
-                                       dec_state_->used_acs);
+    if (decoded_passes_per_ac_group_[ac_group_id] == 0 &&
+        !dec_state_->coefficients->IsEmpty()) {
+      // Zero-filled here rather than in InitFrame, so that the memory of each
+      // group is first touched by the thread that decodes it, which places it
+      // on the NUMA node of that thread.
+      dec_state_->coefficients->ZeroFillRow(ac_group_id);
+    }
+    dec_state_->group_dec_caches[thread].InitOnce(
+        frame_header_.passes.num_passes, dec_state_->used_acs);
     JXL_RETURN_IF_ERROR(
         DecodeGroup(br, num_passes, ac_group_id, dec_state_,
-                    &group_dec_caches_[thread], thread, decoded_,
+                    &dec_state_->group_dec_caches[thread], thread, decoded_,
                     decoded_passes_per_ac_group_[ac_group_id], force_draw));
   }
+  // Same condition as in DecodeGroup for drawing the group.
+  size_t passes = decoded_passes_per_ac_group_[ac_group_id] + num_passes;
+  if (force_draw || passes == frame_header_.passes.num_passes) {
+    drawn_passes_[ac_group_id] = passes;
+    group_changed_[ac_group_id] = 1;
+  }
 
   // don't limit to image dimensions here (is done in DecodeGroup)
   const Rect mrect(x, y, frame_dim_.group_dim, frame_dim_.group_dim);
@@ -582,7 +718,8 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
       JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
           mrect, br[i - decoded_passes_per_ac_group_[ac_group_id]], minShift,
           maxShift, ModularStreamId::ModularAC(ac_group_id, i),
-          /*zerofill=*/false));
+          /*zerofill=*/false,
+          &dec_state_->group_dec_caches[thread].lz77_windows[0]));
     } else if (i >= decoded_passes_per_ac_group_[ac_group_id] + num_passes &&
                force_draw) {
       JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
@@ -655,7 +792,17 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
       num_ac_passes[g] = j;
     }
   }
-  if (dc_global_sec != num) {
+  // Checked before each group: groups that already started are completed. A
+  // frame with a single section is decoded either in full or not at all.
+  const bool single_section =
+      frame_dim_.num_groups == 1 && frame_header_.passes.num_passes == 1;
+  const bool stopped_at_start = stop_ && stop_->Stopped();
+  const auto stopped = [this, single_section, stopped_at_start]() {
+    if (single_section) return stopped_at_start;
+    return stop_ && stop_->Stopped();
+  };
+
+  if (dc_global_sec != num && !stopped()) {
     Status dc_global_status = ProcessDCGlobal(sections[dc_global_sec].br);
     if (dc_global_status.IsFatalError()) return dc_global_status;
     if (dc_global_status) {
@@ -669,9 +816,9 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
   if (decoded_dc_global_) {
     RunOnPool(
         pool_, 0, dc_group_sec.size(), ThreadPool::SkipInit(),
-        [this, &dc_group_sec, &num, &sections, &section_status, &has_error](
-            size_t i, size_t thread) {
-          if (dc_group_sec[i] != num) {
+        [this, &dc_group_sec, &num, &sections, &section_status, &has_error,
+         &stopped](size_t i, size_t thread) {
+          if (dc_group_sec[i] != num && !stopped()) {
             if (!ProcessDCGroup(i, sections[dc_group_sec[i]].br)) {
               has_error = true;
             } else {
@@ -689,20 +836,26 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
     FinalizeDC();
   }
 
-  if (finalized_dc_ && ac_global_sec != num && !decoded_ac_global_) {
+  if (finalized_dc_ && ac_global_sec != num && !decoded_ac_global_ &&
+      !stopped()) {
     JXL_RETURN_IF_ERROR(ProcessACGlobal(sections[ac_global_sec].br));
     section_status[ac_global_sec] = SectionStatus::kDone;
   }
 
-  if (decoded_ac_global_) {
+  if (decoded_ac_global_ && !render_from_dc_) {
     // The decoded image requires padding for filtering. ProcessACGlobal added
     // the padding, however when Flush is used, the image is shrunk to the
     // output size. Add the padding back here. This is a cheap opeartion
     // since the image has the original allocated size. The memory and original
     // size are already there, but for safety we require the indicated xsize and
     // ysize dimensions match the working area, see PlaneRowBoundsCheck.
-    decoded_->ShrinkTo(frame_dim_.xsize_upsampled_padded,
-                       frame_dim_.ysize_upsampled_padded);
+    if (dec_state_->output_area.xsize() == 0) {
+      decoded_->ShrinkTo(frame_dim_.xsize_upsampled_padded,
+                         frame_dim_.ysize_upsampled_padded);
+    } else {
+      decoded_->ShrinkTo(dec_state_->output_area.xsize(),
+                         dec_state_->output_area.ysize());
+    }
 
     RunOnPool(
         pool_, 0, ac_group_sec.size(),
@@ -711,10 +864,11 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
           return true;
         },
         [this, &ac_group_sec, &num_ac_passes, &num, &sections, &section_status,
-         &has_error](size_t g, size_t thread) {
+         &has_error, &stopped](size_t g, size_t thread) {
           if (num_ac_passes[g] == 0) {  // no new AC pass, nothing to do.
             return;
           }
+          if (stopped()) return;
           (void)num;
           size_t first_pass = decoded_passes_per_ac_group_[g];
           BitReader* JXL_RESTRICT readers[kMaxNumPasses];
@@ -751,6 +905,9 @@ Status FrameDecoder::Flush() {
     // Nothing to do.
     return true;
   }
+  if (render_from_dc_) {
+    return FinalizeFrameDecodingFromDC(decoded_, dec_state_, pool_);
+  }
   if (*std::min_element(decoded_passes_per_ac_group_.begin(),
                         decoded_passes_per_ac_group_.end()) <
       frame_header_.passes.num_passes) {
@@ -766,8 +923,10 @@ Status FrameDecoder::Flush() {
         },
         [this, &has_error](size_t g, size_t thread) {
           if (decoded_passes_per_ac_group_[g] ==
-              frame_header_.passes.num_passes) {
-            // This group was drawn already, nothing to do.
+                  frame_header_.passes.num_passes ||
+              decoded_passes_per_ac_group_[g] == drawn_passes_[g]) {
+            // This group was drawn already with all the passes decoded so
+            // far, nothing to do.
             return;
           }
           BitReader* JXL_RESTRICT readers[kMaxNumPasses] = {};
@@ -785,18 +944,73 @@ Status FrameDecoder::Flush() {
   // TODO(veluca): the rest of this function should be removed once we have full
   // support for per-group decoding.
 
+  // Groups outside of the render rect may still have modular data, such as
+  // extra channels, which must be defined for the global transforms.
+  for (size_t g = 0; g < ac_group_needed_.size(); g++) {
+    if (ac_group_needed_[g]) continue;
+    const Rect mrect((g % frame_dim_.xsize_groups) * frame_dim_.group_dim,
+                     (g / frame_dim_.xsize_groups) * frame_dim_.group_dim,
+                     frame_dim_.group_dim, frame_dim_.group_dim);
+    for (size_t i = 0; i < frame_header_.passes.num_passes; i++) {
+      int minShift, maxShift;
+      frame_header_.passes.GetDownsamplingBracket(i, minShift, maxShift);
+      JXL_RETURN_IF_ERROR(modular_frame_decoder_.DecodeGroup(
+          mrect, nullptr, minShift, maxShift,
+          ModularStreamId::ModularAC(g, i), /*zerofill=*/true));
+    }
+  }
+
   // undo global modular transforms and copy int pixel buffers to float ones
   JXL_RETURN_IF_ERROR(
       modular_frame_decoder_.FinalizeDecoding(dec_state_, pool_, decoded_));
 
-  JXL_RETURN_IF_ERROR(FinalizeFrameDecoding(decoded_, dec_state_, pool_,
-                                            /*rerender=*/num_renders_ != 0,
-                                            /*skip_blending=*/false));
+  // Rendering again is only needed around the groups that changed, since the
+  // filters and upsampling only access pixels of the neighbouring groups.
+  std::vector<uint8_t> rerender_groups;
+  if (num_renders_ != 0 && CanRenderIncrementally()) {
+    const size_t xsize_groups = frame_dim_.xsize_groups;
+    const size_t ysize_groups = frame_dim_.ysize_groups;
+    rerender_groups.resize(frame_dim_.num_groups);
+    for (size_t gy = 0; gy < ysize_groups; gy++) {
+      for (size_t gx = 0; gx < xsize_groups; gx++) {
+        if (!group_changed_[gy * xsize_groups + gx]) continue;
+        for (size_t y = (gy == 0 ? 0 : gy - 1);
+             y < std::min(gy + 2, ysize_groups); y++) {
+          for (size_t x = (gx == 0 ? 0 : gx - 1);
+               x < std::min(gx + 2, xsize_groups); x++) {
+            rerender_groups[y * xsize_groups + x] = 1;
+          }
+        }
+      }
+    }
+  }
 
+  JXL_RETURN_IF_ERROR(FinalizeFrameDecoding(
+      decoded_, dec_state_, pool_,
+      /*rerender=*/num_renders_ != 0, /*skip_blending=*/false,
+      rerender_groups.empty() ? nullptr : &rerender_groups));
+
+  group_changed_.assign(group_changed_.size(), 0);
   num_renders_++;
   return true;
 }
 
+bool FrameDecoder::CanRenderIncrementally() const {
+  // Groups drawn before all of DC was decoded may still change.
+  if (frame_header_.encoding != FrameEncoding::kVarDCT || !finalized_dc_) {
+    return false;
+  }
+  if (frame_header_.nonserialized_metadata->m.num_extra_channels != 0) {
+    return false;
+  }
+  // Same conditions as in DoBlending for leaving the frame as is.
+  if (frame_header_.custom_size_or_origin ||
+      frame_header_.blending_info.mode != BlendMode::kReplace) {
+    return false;
+  }
+  return true;
+}
+
 Status FrameDecoder::FinalizeFrame() {
   if (is_finalized_) {
     return JXL_FAILURE("FinalizeFrame called multiple times");
@@ -822,6 +1036,8 @@ Status FrameDecoder::FinalizeFrame() {
   }
 
   JXL_RETURN_IF_ERROR(Flush());
+  // The frame is neither referenced nor resized, see CanRenderFromDC.
+  if (render_from_dc_) return true;
 
   if (dec_state_->shared->frame_header.CanBeReferenced()) {
     size_t id = dec_state_->shared->frame_header.save_as_reference;
@@ -865,8 +1081,16 @@ Status FrameDecoder::FinalizeFrame() {
     // coalesced frame of size equal to image dimensions. Other frames are not
     // blended, thus their final size is the size that was defined in the
     // frame_header.
-    if (frame_header_.frame_type == kRegularFrame ||
-        frame_header_.frame_type == kSkipProgressive) {
+    const Rect& output_area = dec_state_->output_area;
+    if (output_area.xsize() != 0) {
+      // Only frames that are not blended hold just the output area, so the
+      // frame has the size of the image.
+      const CodecMetadata& metadata = *frame_header_.nonserialized_metadata;
+      const Rect rect(output_area.x0(), output_area.y0(), output_area.xsize(),
+                      output_area.ysize(), metadata.xsize(), metadata.ysize());
+      decoded_->ShrinkTo(rect.xsize(), rect.ysize());
+    } else if (frame_header_.frame_type == kRegularFrame ||
+               frame_header_.frame_type == kSkipProgressive) {
       decoded_->ShrinkTo(
           dec_state_->shared->frame_header.nonserialized_metadata->xsize(),
           dec_state_->shared->frame_header.nonserialized_metadata->ysize());
@@ -17,12 +17,15 @@
 
 #include <stdint.h>
 
+#include <atomic>
+
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
+#include "lib/jxl/base/time.h"
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dec_bit_reader.h"
@@ -59,6 +62,20 @@ Status DecodeFrame(const DecompressParams& dparams,
 Status SkipFrame(const CodecMetadata& metadata, BitReader* JXL_RESTRICT reader,
                  bool is_preview = false);
 
+// Tells a FrameDecoder to stop decoding sections early, see
+// FrameDecoder::SetStopSignal.
+struct StopSignal {
+  // May be set from any thread.
+  std::atomic<bool> cancelled{false};
+  // Value of Now() from which on decoding stops, or 0 for no deadline.
+  double deadline = 0;
+
+  bool Stopped() const {
+    return cancelled.load(std::memory_order_relaxed) ||
+           (deadline != 0 && Now() >= deadline);
+  }
+};
+
 // TODO(veluca): implement "forced drawing".
 class FrameDecoder {
  public:
@@ -73,6 +90,15 @@ class FrameDecoder {
     constraints_ = constraints;
   }
 
+  // Sets the thread pool for the remaining calls, e.g. to finalize the frame on
+  // another thread than the one that processed its sections.
+  void SetThreadPool(ThreadPool* pool) { pool_ = pool; }
+
+  // `stop` must outlive the FrameDecoder if not null. Once it is stopped,
+  // ProcessSections does not start decoding any more groups, and returns the
+  // sections it did not decode as kSkipped, to be processed again later.
+  void SetStopSignal(const StopSignal* stop) { stop_ = stop; }
+
   // Read FrameHeader and table of contents from the given BitReader.
   // Also checks frame dimensions for their limits, and sets the output
   // image buffer.
@@ -106,9 +132,19 @@ class FrameDecoder {
   Status ProcessSections(const SectionInfo* sections, size_t num,
                          SectionStatus* section_status);
 
-  // Flushes all the data decoded so far to pixels.
+  // Flushes all the data decoded so far to pixels. After the first call, only
+  // the groups that changed since the previous call are drawn and rendered
+  // again, when possible, see CanRenderIncrementally.
   Status Flush();
 
+  // Makes the next Flush or FinalizeFrame render the whole frame again, e.g.
+  // because the pixels rendered so far were only written to the image output
+  // and not kept in the decoded image.
+  void InvalidateRenderedPixels() {
+    if (num_renders_ == 0) num_renders_ = 1;
+    group_changed_.assign(group_changed_.size(), 1);
+  }
+
   // Runs final operations once a frame data is decoded.
   // Must be called exactly once per frame, after all calls to ProcessSections.
   Status FinalizeFrame();
@@ -121,8 +157,38 @@ class FrameDecoder {
   const std::vector<uint32_t>& SectionSizes() const { return section_sizes_; }
   size_t NumSections() const { return section_sizes_.size(); }
 
-  // TODO(veluca): remove once we remove --downsampling flag.
-  void SetMaxPasses(size_t max_passes) { max_passes_ = max_passes; }
+  // Limits decoding to the passes that are needed to render the frame at a
+  // downsampling factor of at most `max_downsampling`, and to at most
+  // `max_passes` passes. The sections of the other passes are not needed, see
+  // IsSectionNeeded. Returns the downsampling factor of the frame that the
+  // decoded passes are good for. With a factor of 8, frames that are output
+  // as is are rendered from the DC straight at 1/8 of their size, see
+  // OutputDownsampling. Must be called after InitFrame and before
+  // ProcessSections.
+  size_t SetMaxDownsampling(size_t max_downsampling, size_t max_passes);
+
+  // Returns the factor by which the output image is smaller than the frame.
+  size_t OutputDownsampling() const { return render_from_dc_ ? 8 : 1; }
+
+  // Restricts rendering to `rect` of the frame, in pixels of the frame before
+  // upsampling. The rest of the output image is left undefined. For VarDCT
+  // frames, AC groups that do not contribute to `rect`, taking into account
+  // the border needed by the filters, are not decoded at all, see
+  // IsSectionNeeded. If the frame is not blended or upsampled, the output
+  // image only holds `rect` rounded to whole blocks, see OutputArea. Frames
+  // that can be referenced by later frames are always rendered in full. Must
+  // be called after InitFrame and before ProcessSections.
+  void SetRenderRect(const Rect& rect);
+
+  // Returns the rect of the frame, in pixels after upsampling, that the output
+  // image holds. Its origin is where the output image starts. If empty, the
+  // output image holds the whole frame.
+  const Rect& OutputArea() const { return dec_state_->output_area; }
+
+  // Returns whether the section with the given TOC index needs to be passed to
+  // ProcessSections for the frame to be complete.
+  bool IsSectionNeeded(size_t section_id) const;
+
   const FrameHeader& GetFrameHeader() const { return frame_header_; }
 
   // Returns whether a DC image has been decoded, accessible at low resolution
@@ -139,6 +205,17 @@ class FrameDecoder {
   Status ProcessACGroup(size_t ac_group_id, BitReader* JXL_RESTRICT* br,
                         size_t num_passes, size_t thread, bool force_draw);
 
+  // Returns whether the frame may be rendered from its DC alone at 1/8 of its
+  // size: it is output as is, and has no pixels that only exist at full
+  // resolution.
+  bool CanRenderFromDC() const;
+
+  // Returns whether rendering the frame again can be limited to the groups
+  // that changed since the previous render and their neighbours. This is not
+  // the case if rendering depends on data outside of the groups, such as
+  // modular extra channels, or modifies the whole frame, such as blending.
+  bool CanRenderIncrementally() const;
+
   // Allocates storage for parallel decoding using up to `num_threads` threads
   // of up to `num_tasks` tasks. The value of `thread` passed to
   // `GetStorageLocation` must be smaller than the `num_threads` value passed
@@ -146,8 +223,8 @@ class FrameDecoder {
   // than the value of `num_tasks` passed here.
   void PrepareStorage(size_t num_threads, size_t num_tasks) {
     size_t storage_size = std::min(num_threads, num_tasks);
-    if (storage_size > group_dec_caches_.size()) {
-      group_dec_caches_.resize(storage_size);
+    if (storage_size > dec_state_->group_dec_caches.size()) {
+      dec_state_->group_dec_caches.resize(storage_size);
     }
     dec_state_->EnsureStorage(storage_size);
     use_task_id_ = num_threads > num_tasks;
@@ -174,17 +251,27 @@ class FrameDecoder {
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
   std::vector<uint8_t> decoded_dc_groups_;
+  // AC groups outside of the render rect are not needed, see SetRenderRect.
+  std::vector<uint8_t> ac_group_needed_;
   bool decoded_dc_global_;
   bool decoded_ac_global_;
   bool finalized_dc_ = true;
   bool is_finalized_ = true;
+  // Whether the output image is rendered from the DC alone, see
+  // SetMaxDownsampling.
+  bool render_from_dc_ = false;
   size_t num_renders_ = 0;
-
-  std::vector<GroupDecCache> group_dec_caches_;
+  // Number of passes each AC group was last drawn with, or kNotDrawn, and
+  // whether its pixels changed since the last render. Used by Flush to only
+  // draw and render again what changed.
+  std::vector<uint8_t> drawn_passes_;
+  std::vector<uint8_t> group_changed_;
 
   // Frame size limits.
   const SizeConstraints* constraints_ = nullptr;
 
+  const StopSignal* stop_ = nullptr;
+
   // Whether or not the task id should be used for storage indexing, instead of
   // the thread id.
   bool use_task_id_ = false;
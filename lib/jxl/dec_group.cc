@@ -451,11 +451,13 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
 
   static_assert(kApplyImageFeaturesTileDim >= kGroupDim,
                 "Groups are too large");
-  const Rect aif_rect(block_rect.x0() * kBlockDim + xstart,
-                      block_rect.y0() * kBlockDim + ystart, xend - xstart,
-                      yend - ystart);
+  // Groups around the render rect are also decoded, for the border of the
+  // filters, but the output image may only hold the render rect.
+  const Rect aif_rect = dec_state->ClipToOutputArea(
+      Rect(block_rect.x0() * kBlockDim + xstart,
+           block_rect.y0() * kBlockDim + ystart, xend - xstart, yend - ystart));
 
-  if (JXL_LIKELY(run_apply_image_features)) {
+  if (JXL_LIKELY(run_apply_image_features) && aif_rect.xsize() != 0) {
     return FinalizeImageRect(dec_state->decoded, aif_rect, dec_state, thread,
                              decoded, aif_rect);
   }
@@ -625,8 +627,9 @@ struct GetBlockFromBitstream : public GetBlock {
       }
       ctx_offset[pass] = cur_histogram * block_ctx_map->NumACContexts();
 
-      decoders[pass] =
-          ANSSymbolReader(&dec_state->code[pass + first_pass], readers[pass]);
+      decoders[pass] = ANSSymbolReader(
+          &dec_state->code[pass + first_pass], readers[pass],
+          /*distance_multiplier=*/0, &group_dec_cache->lz77_windows[pass]);
     }
     nzeros_stride = group_dec_cache->num_nzeroes[0].PixelsPerRow();
     for (size_t i = 0; i < num_passes; i++) {
@@ -16,6 +16,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "lib/jxl/frame_header.h"
@@ -227,10 +228,10 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
   return dec_status;
 }
 
-Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
-                                        size_t minShift, size_t maxShift,
-                                        const ModularStreamId& stream,
-                                        bool zerofill) {
+Status ModularFrameDecoder::DecodeGroup(
+    const Rect& rect, BitReader* reader, size_t minShift, size_t maxShift,
+    const ModularStreamId& stream, bool zerofill,
+    CacheAlignedUniquePtr* lz77_window_storage) {
   JXL_DASSERT(stream.kind == ModularStreamId::kModularDC ||
               stream.kind == ModularStreamId::kModularAC);
   const size_t xsize = rect.xsize();
@@ -280,7 +281,8 @@ Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
   ModularOptions options;
   if (!ModularGenericDecompress(
           reader, gi, /*header=*/nullptr, stream.ID(frame_dim), &options,
-          /*undo_transforms=*/-1, &tree, &code, &context_map))
+          /*undo_transforms=*/-1, &tree, &code, &context_map,
+          /*allow_truncated_group=*/false, lz77_window_storage))
     return JXL_FAILURE("Failed to decode modular group");
   int gic = 0;
   for (c = beginc; c < full_image.channel.size(); c++) {
@@ -520,11 +522,21 @@ Status ModularFrameDecoder::FinalizeDecoding(PassesDecoderState* dec_state,
       bool fp = eci.bit_depth.floating_point_sample;
       JXL_ASSERT(fp || bits < 32);
       const float mul = fp ? 0 : (1.0f / ((1u << bits) - 1));
-      const size_t ec_xsize = eci.Size(xsize);  // includes shift
-      const size_t ec_ysize = eci.Size(ysize);
+      size_t ec_xsize = eci.Size(xsize);  // includes shift
+      size_t ec_ysize = eci.Size(ysize);
+      // Only the output area of the frame is stored, it starts at a multiple
+      // of kBlockDim, so at a whole pixel of the extra channel.
+      const Rect& area = dec_state->output_area;
+      const size_t ec_x0 = area.x0() >> eci.dim_shift;
+      const size_t ec_y0 = area.y0() >> eci.dim_shift;
+      if (area.xsize() != 0) {
+        ec_xsize = std::min(ec_xsize - ec_x0, eci.Size(area.xsize()));
+        ec_ysize = std::min(ec_ysize - ec_y0, eci.Size(area.ysize()));
+      }
       for (size_t y = 0; y < ec_ysize; ++y) {
         float* const JXL_RESTRICT row_out = output->extra_channels()[ec].Row(y);
-        const pixel_type* const JXL_RESTRICT row_in = gi.channel[c].Row(y);
+        const pixel_type* const JXL_RESTRICT row_in =
+            gi.channel[c].Row(ec_y0 + y) + ec_x0;
         if (fp) {
           int_to_float(row_in, row_out, ec_xsize, bits, exp_bits);
         } else {
@@ -98,9 +98,12 @@ class ModularFrameDecoder {
   void Init(const FrameDimensions& frame_dim) { this->frame_dim = frame_dim; }
   Status DecodeGlobalInfo(BitReader* reader, const FrameHeader& frame_header,
                           bool allow_truncated_group = false);
+  // If not null, `lz77_window_storage` holds the LZ77 window reused by the
+  // entropy decoder of the group.
   Status DecodeGroup(const Rect& rect, BitReader* reader, size_t minShift,
                      size_t maxShift, const ModularStreamId& stream,
-                     bool zerofill);
+                     bool zerofill,
+                     CacheAlignedUniquePtr* lz77_window_storage = nullptr);
   // Decodes a VarDCT DC group (`group_id`) from the given `reader`.
   Status DecodeVarDCTDC(size_t group_id, BitReader* reader,
                         PassesDecoderState* dec_state);
@@ -14,6 +14,7 @@
 
 #include "lib/jxl/dec_reconstruct.h"
 
+#include <algorithm>
 #include <atomic>
 #include <utility>
 
@@ -31,6 +32,7 @@
 #include "lib/jxl/blending.h"
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/common.h"
+#include "lib/jxl/dec_external_image.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_upsample.h"
 #include "lib/jxl/dec_xyb-inl.h"
@@ -102,6 +104,83 @@ Status UndoXYBInPlace(Image3F* idct, const OpsinParams& opsin_params,
   return true;
 }
 
+// Converts `rect` of `idct` from XYB straight to interleaved 8-bit nonlinear
+// sRGB in `output`, in a single pass that does not write back float pixels.
+// Produces the same values as UndoXYBInPlace followed by
+// ConvertRectToExternal. `rect` must be within the frame, but the rows of
+// `idct` must be readable up to a multiple of kBlockDim past its end.
+Status UndoXYBToExternal8(const Image3F& idct, const OpsinParams& opsin_params,
+                          const Rect& rect, const ColorEncoding& xyb_encoding,
+                          const ExternalRowOutput& output,
+                          ExternalRowStorage* JXL_RESTRICT storage) {
+  PROFILER_ZONE("UndoXYBToExternal8");
+  JXL_DASSERT(output.bits_per_sample == 8 && !output.float_out);
+  const size_t num_channels = output.num_channels;
+  const size_t color_channels = num_channels <= 2 ? 1 : 3;
+  const bool want_alpha = num_channels == 2 || num_channels == 4;
+  const bool linear = xyb_encoding.IsLinearSRGB();
+  if (!linear && !xyb_encoding.IsSRGB()) {
+    return JXL_FAILURE("Invalid target encoding");
+  }
+  if (output.callback &&
+      storage->out_row.xsize() < num_channels * rect.xsize()) {
+    storage->out_row = ImageB(num_channels * rect.xsize(), 1);
+  }
+
+  // Same transfer function as the float path: UndoXYBInPlace for sRGB frames,
+  // LinearToSRGBRow for linear ones.
+#if JXL_HIGH_PRECISION
+  const bool fast_tf = false;
+#else
+  const bool fast_tf = !linear;
+#endif
+
+  const HWY_CAPPED(float, kBlockDim) d;
+  const hwy::HWY_NAMESPACE::Rebind<int32_t, decltype(d)> di;
+  using V = decltype(Zero(d));
+  const auto zero = Zero(d);
+  const auto one = Set(d, 1.0f);
+  const auto mul = Set(d, 255.0f);
+  const auto to_u8 = [&](V v, int32_t* JXL_RESTRICT out) {
+    const V encoded =
+        fast_tf ? FastLinearToSRGB(d, v) : TF_SRGB().EncodedFromDisplay(d, v);
+    // Clamp turns NaN to 'min', like FloatToU32.
+    Store(NearestInt(Clamp(encoded, zero, one) * mul), di, out);
+  };
+  HWY_ALIGN int32_t values[3][kBlockDim];
+  for (size_t y = 0; y < rect.ysize(); y++) {
+    const float* JXL_RESTRICT row0 = rect.ConstPlaneRow(idct, 0, y);
+    const float* JXL_RESTRICT row1 = rect.ConstPlaneRow(idct, 1, y);
+    const float* JXL_RESTRICT row2 = rect.ConstPlaneRow(idct, 2, y);
+    uint8_t* JXL_RESTRICT row_out =
+        output.callback ? storage->out_row.Row(0)
+                        : output.BufferPixel(rect.x0(), rect.y0() + y);
+    for (size_t x = 0; x < rect.xsize(); x += Lanes(d)) {
+      auto linear_r = Undefined(d);
+      auto linear_g = Undefined(d);
+      auto linear_b = Undefined(d);
+      XybToRgb(d, Load(d, row0 + x), Load(d, row1 + x), Load(d, row2 + x),
+               opsin_params, &linear_r, &linear_g, &linear_b);
+      to_u8(linear_r, values[0]);
+      to_u8(linear_g, values[1]);
+      to_u8(linear_b, values[2]);
+      const size_t num = std::min(Lanes(d), rect.xsize() - x);
+      uint8_t* JXL_RESTRICT out = row_out + x * num_channels;
+      for (size_t i = 0; i < num; i++) {
+        for (size_t c = 0; c < color_channels; c++) {
+          *out++ = values[c][i];
+        }
+        if (want_alpha) *out++ = 255;
+      }
+    }
+    if (output.callback) {
+      output.callback(output.opaque, rect.x0(), rect.y0() + y, rect.xsize(),
+                      row_out);
+    }
+  }
+  return true;
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -111,6 +190,7 @@ HWY_AFTER_NAMESPACE();
 namespace jxl {
 
 HWY_EXPORT(UndoXYBInPlace);
+HWY_EXPORT(UndoXYBToExternal8);
 
 namespace {
 // Implements EnsurePadding, but processes the image one row at a time.
@@ -273,7 +353,7 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
 
   Image3F* storage_for_if = output_image->color();
   Rect rect_for_if = output_rect;
-  Rect rect_for_if_storage = output_rect;
+  Rect rect_for_if_storage = dec_state->OutputImageRect(output_rect);
   Rect rect_for_upsampling = output_rect;
   Rect rect_for_if_input = input_rect;
   size_t extra_rows_t = 0;
@@ -383,11 +463,35 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
                                  output_rect.xsize() * frame_header.upsampling,
                                  output_rect.ysize() * frame_header.upsampling);
   }
+  // Where the pixels of `upsampled_output_rect` are stored in `output_image`.
+  const Rect upsampled_image_rect =
+      dec_state->OutputImageRect(upsampled_output_rect);
+  // The external output reads the pixels at their position in the frame.
+  JXL_DASSERT(!dec_state->image_out.IsPresent() ||
+              dec_state->output_area.xsize() == 0);
 
   // Also prepare rect for memorizing the pre-color-transform frame.
   const Rect pre_color_output_rect =
       upsampled_output_rect.Crop(dec_state->pre_color_transform_frame);
 
+  // For 8-bit output, XYB is converted straight to the output format, without
+  // storing the result of the color transform. This is not possible if the
+  // frame is needed again later, as a reference for other frames.
+  const bool fused_xyb_output =
+      dec_state->image_out.IsPresent() &&
+      dec_state->image_out.bits_per_sample == 8 &&
+      !dec_state->image_out.float_out && frame_header.needs_color_transform() &&
+      frame_header.color_transform == ColorTransform::kXYB &&
+      !frame_header.CanBeReferenced();
+  // Returns the given rows of `upsampled_output_rect`, limited to the pixels
+  // inside of the frame, for the image output.
+  const auto image_out_rows = [&](size_t y, size_t num_rows) {
+    const FrameDimensions& frame_dim = dec_state->shared->frame_dim;
+    const Rect rows = upsampled_output_rect.Lines(y, num_rows);
+    return Rect(rows.x0(), rows.y0(), rows.xsize(), rows.ysize(),
+                frame_dim.xsize_upsampled, frame_dim.ysize_upsampled);
+  };
+
   // +----------------------------- STEP 4 ------------------------------+
   // | Run the prepared pipeline of operations.                          |
   // +-------------------------------------------------------------------+
@@ -459,18 +563,18 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
           *upsampling_input,
           upsampling_input_rect.Lines(input_y, num_input_rows),
           output_image->color(),
-          upsampled_output_rect.Lines(upsampled_available_y, num_ys));
+          upsampled_image_rect.Lines(upsampled_available_y, num_ys));
       available_y = upsampled_available_y;
     }
 
     // The image data is now unconditionally in
-    // `output_image:upsampled_output_rect`.
+    // `output_image:upsampled_image_rect`.
     if (frame_header.flags & FrameHeader::kNoise) {
       PROFILER_ZONE("AddNoise");
       AddNoise(image_features.noise_params,
                upsampled_output_rect.Lines(available_y, num_ys),
                dec_state->noise,
-               upsampled_output_rect.Lines(available_y, num_ys),
+               upsampled_image_rect.Lines(available_y, num_ys),
                dec_state->shared_storage.cmap, output_image->color());
     }
 
@@ -481,7 +585,7 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
           float* JXL_RESTRICT row_out = pre_color_output_rect.PlaneRow(
               &dec_state->pre_color_transform_frame, c, y);
           const float* JXL_RESTRICT row_in =
-              pre_color_output_rect.ConstPlaneRow(*output_image->color(), c, y);
+              upsampled_image_rect.ConstPlaneRow(*output_image->color(), c, y);
           memcpy(row_out, row_in,
                  pre_color_output_rect.xsize() * sizeof(*row_in));
         }
@@ -491,18 +595,32 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
     // We skip the color transform entirely if save_before_color_transform and
     // the frame is not supposed to be displayed.
 
-    if (frame_header.needs_color_transform()) {
+    if (fused_xyb_output) {
+      // The float pixels stay in XYB, they are not used after this.
+      JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(UndoXYBToExternal8)(
+          *output_image->color(), opsin_params,
+          image_out_rows(available_y, num_ys),
+          dec_state->output_encoding, dec_state->image_out,
+          &dec_state->image_out_storage[thread]));
+    } else if (frame_header.needs_color_transform()) {
       if (frame_header.color_transform == ColorTransform::kXYB) {
         JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(UndoXYBInPlace)(
             output_image->color(), opsin_params,
-            upsampled_output_rect.Lines(available_y, num_ys),
+            upsampled_image_rect.Lines(available_y, num_ys),
             dec_state->output_encoding));
       } else if (frame_header.color_transform == ColorTransform::kYCbCr) {
         YcbcrToRgb(*output_image->color(), output_image->color(),
-                   upsampled_output_rect.Lines(available_y, num_ys));
+                   upsampled_image_rect.Lines(available_y, num_ys));
       }
     }
 
+    if (dec_state->image_out.IsPresent() && !fused_xyb_output) {
+      // Rows are final at this point.
+      JXL_RETURN_IF_ERROR(ConvertRectToExternal(
+          *output_image->color(), image_out_rows(available_y, num_ys),
+          dec_state->image_out, &dec_state->image_out_storage[thread]));
+    }
+
     // TODO(veluca): all blending should happen here.
   }
 
@@ -511,7 +629,8 @@ Status FinalizeImageRect(const Image3F& input_image, const Rect& input_rect,
 
 Status FinalizeFrameDecoding(ImageBundle* decoded,
                              PassesDecoderState* dec_state, ThreadPool* pool,
-                             bool rerender, bool skip_blending) {
+                             bool rerender, bool skip_blending,
+                             const std::vector<uint8_t>* rerender_groups) {
   std::vector<Rect> rects_to_process;
 
   const LoopFilter& lf = dec_state->shared->frame_header.loop_filter;
@@ -595,14 +714,54 @@ Status FinalizeFrameDecoding(ImageBundle* decoded,
       FillImage(kInvSigmaNum / lf.epf_sigma_for_modular,
                 &dec_state->filter_weights.sigma);
     }
-    for (size_t y = 0; y < decoded->ysize(); y += kGroupDim) {
-      for (size_t x = 0; x < decoded->xsize(); x += kGroupDim) {
+    for (size_t y = 0; y < frame_dim.ysize; y += kGroupDim) {
+      for (size_t x = 0; x < frame_dim.xsize; x += kGroupDim) {
         Rect rect(x, y, kGroupDim, kGroupDim, frame_dim.xsize, frame_dim.ysize);
         if (rect.xsize() == 0 || rect.ysize() == 0) continue;
         rects_to_process.push_back(rect);
       }
     }
   }
+  const Rect& render_rect = dec_state->render_rect;
+  if (render_rect.xsize() != 0 && render_rect.ysize() != 0) {
+    const auto outside_render_rect = [&render_rect](const Rect& rect) {
+      return rect.x0() >= render_rect.x0() + render_rect.xsize() ||
+             rect.x0() + rect.xsize() <= render_rect.x0() ||
+             rect.y0() >= render_rect.y0() + render_rect.ysize() ||
+             rect.y0() + rect.ysize() <= render_rect.y0();
+    };
+    rects_to_process.erase(
+        std::remove_if(rects_to_process.begin(), rects_to_process.end(),
+                       outside_render_rect),
+        rects_to_process.end());
+  }
+  if (dec_state->output_area.xsize() != 0) {
+    for (Rect& rect : rects_to_process) {
+      rect = dec_state->ClipToOutputArea(rect);
+    }
+    rects_to_process.erase(
+        std::remove_if(rects_to_process.begin(), rects_to_process.end(),
+                       [](const Rect& rect) { return rect.xsize() == 0; }),
+        rects_to_process.end());
+  }
+  if (rerender && rerender_groups != nullptr) {
+    const size_t group_dim = frame_dim.group_dim;
+    const auto unchanged = [&](const Rect& rect) {
+      for (size_t gy = rect.y0() / group_dim;
+           gy * group_dim < rect.y0() + rect.ysize(); gy++) {
+        for (size_t gx = rect.x0() / group_dim;
+             gx * group_dim < rect.x0() + rect.xsize(); gx++) {
+          if ((*rerender_groups)[gy * frame_dim.xsize_groups + gx]) {
+            return false;
+          }
+        }
+      }
+      return true;
+    };
+    rects_to_process.erase(std::remove_if(rects_to_process.begin(),
+                                          rects_to_process.end(), unchanged),
+                           rects_to_process.end());
+  }
   const auto allocate_storage = [&](size_t num_threads) {
     dec_state->EnsureStorage(num_threads);
     return true;
@@ -627,7 +786,14 @@ Status FinalizeFrameDecoding(ImageBundle* decoded,
   const size_t xsize = frame_dim.xsize_upsampled;
   const size_t ysize = frame_dim.ysize_upsampled;
 
-  decoded->ShrinkTo(xsize, ysize);
+  if (dec_state->output_area.xsize() != 0) {
+    const Rect& area = dec_state->output_area;
+    const Rect rect(area.x0(), area.y0(), area.xsize(), area.ysize(), xsize,
+                    ysize);
+    decoded->ShrinkTo(rect.xsize(), rect.ysize());
+  } else {
+    decoded->ShrinkTo(xsize, ysize);
+  }
   if (dec_state->pre_color_transform_frame.xsize() != 0) {
     dec_state->pre_color_transform_frame.ShrinkTo(xsize, ysize);
   }
@@ -639,5 +805,37 @@ Status FinalizeFrameDecoding(ImageBundle* decoded,
   return true;
 }
 
+Status FinalizeFrameDecodingFromDC(ImageBundle* JXL_RESTRICT decoded,
+                                   PassesDecoderState* dec_state,
+                                   ThreadPool* pool) {
+  const FrameHeader& frame_header = dec_state->shared->frame_header;
+  const FrameDimensions& frame_dim = dec_state->shared->frame_dim;
+  // The DC holds the average of each block, which is the pixel of the frame
+  // at 1/8 of its size.
+  Image3F color(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+  const Rect rect(color);
+  CopyImageTo(rect, *dec_state->shared->dc, &color);
+  if (frame_header.needs_color_transform()) {
+    if (frame_header.color_transform == ColorTransform::kXYB) {
+      std::atomic<bool> undo_xyb_ok{true};
+      RunOnPool(
+          pool, 0, rect.ysize(), ThreadPool::SkipInit(),
+          [&](const int task, const int thread) {
+            if (!HWY_DYNAMIC_DISPATCH(UndoXYBInPlace)(
+                    &color, dec_state->shared->opsin_params, rect.Line(task),
+                    dec_state->output_encoding)) {
+              undo_xyb_ok = false;
+            }
+          },
+          "UndoXYBFromDC");
+      if (!undo_xyb_ok) return JXL_FAILURE("UndoXYB failed");
+    } else if (frame_header.color_transform == ColorTransform::kYCbCr) {
+      YcbcrToRgb(color, &color, rect);
+    }
+  }
+  decoded->SetFromImage(std::move(color), dec_state->output_encoding);
+  return true;
+}
+
 }  // namespace jxl
 #endif  // HWY_ONCE
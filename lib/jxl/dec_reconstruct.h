@@ -16,6 +16,9 @@
 #define LIB_JXL_DEC_RECONSTRUCT_H_
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
 
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
@@ -40,9 +43,21 @@ namespace jxl {
 // necessary.
 // `skip_blending` is necessary because the encoder butteraugli loop does not
 // (yet) handle blending.
-Status FinalizeFrameDecoding(ImageBundle* JXL_RESTRICT decoded,
-                             PassesDecoderState* dec_state, ThreadPool* pool,
-                             bool rerender, bool skip_blending);
+// If `rerender` and `rerender_groups` is not null, only the parts of the frame
+// that overlap the groups set in `rerender_groups`, indexed like the AC
+// groups, are rendered again; the rest of `decoded` is left as is.
+Status FinalizeFrameDecoding(
+    ImageBundle* JXL_RESTRICT decoded, PassesDecoderState* dec_state,
+    ThreadPool* pool, bool rerender, bool skip_blending,
+    const std::vector<uint8_t>* rerender_groups = nullptr);
+
+// Renders the frame at 1/8 of its size from the DC of a VarDCT frame alone,
+// one pixel per block, to `decoded`. The pixels are in the same colorspace as
+// the ones of FinalizeFrameDecoding, but neither the filters nor the image
+// features are applied, and the frame is not blended.
+Status FinalizeFrameDecodingFromDC(ImageBundle* JXL_RESTRICT decoded,
+                                   PassesDecoderState* dec_state,
+                                   ThreadPool* pool);
 
 // Renders the `output_rect` portion of the final image to `output_image`
 // (unless the frame is upsampled - in which case, `output_rect` is scaled
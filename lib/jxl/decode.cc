@@ -14,7 +14,14 @@
 
 #include "jxl/decode.h"
 
+#include <atomic>
+#include <condition_variable>  //NOLINT
+#include <deque>
+#include <limits>
+#include <mutex>  //NOLINT
+
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_external_image.h"
@@ -24,28 +31,13 @@
 #include "lib/jxl/fields.h"
 #include "lib/jxl/headers.h"
 #include "lib/jxl/icc_codec.h"
+#include "lib/jxl/image_ops.h"
 #include "lib/jxl/loop_filter.h"
 #include "lib/jxl/memory_manager_internal.h"
 #include "lib/jxl/toc.h"
 
 namespace {
 
-// If set (by fuzzer) then some operations will fail, if those would require
-// allocating large objects. Actual memory usage might be two orders of
-// magnitude bigger.
-// TODO(eustas): this is a poor-mans replacement for memory-manager approach;
-//               remove, once memory-manager actually works.
-size_t memory_limit_base_ = 0;
-
-bool CheckSizeLimit(size_t xsize, size_t ysize) {
-  if (!memory_limit_base_) return true;
-  if (xsize == 0 || ysize == 0) return true;
-  size_t num_pixels = xsize * ysize;
-  if (num_pixels / xsize != ysize) return false;  // overflow
-  if (num_pixels > memory_limit_base_) return false;
-  return true;
-}
-
 // Checks if a + b > size, taking possible integer overflow into account.
 bool OutOfBounds(size_t a, size_t b, size_t size) {
   size_t pos = a + b;
@@ -187,6 +179,67 @@ enum class FrameStage : uint32_t {
   kFullOutput,  // Must output full pixels
 };
 
+enum class AsyncState : uint32_t {
+  kIdle,     // No decoding step submitted to the async executor
+  kRunning,  // A decoding step is running on the async executor
+  kDone,     // The step finished, its result is in async_result
+};
+
+// Finalization of a full frame and its conversion to the image out buffer,
+// submitted to the executor set with JxlDecoderSetFramePipelining.
+struct PipelinedOutput {
+  const JxlDecoder* dec;
+  // State of the frame, which the next frames no longer use. Declared before
+  // frame_dec, which refers to it.
+  std::unique_ptr<jxl::PassesDecoderState> passes_state;
+  std::unique_ptr<jxl::FrameDecoder> frame_dec;
+  std::unique_ptr<jxl::ImageBundle> ib;
+  // Set by JxlDecoderSetFramePipeliningRunner, or nullptr.
+  jxl::ThreadPool* pool;
+  // Reported by JxlDecoderGetFrameHeader along with the JXL_DEC_FULL_IMAGE
+  // event of this frame.
+  std::unique_ptr<jxl::FrameHeader> frame_header;
+  size_t downsampling;
+  jxl::Rect rect;
+  JxlPixelFormat format;
+  void* buffer;
+  size_t size;
+  JxlImageOutCallback callback;
+  void* opaque;
+  JxlDecoderStatus status = JXL_DEC_SUCCESS;
+
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  bool done = false;  // guarded by mutex.
+};
+
+// Part of the codestream that is read in place from the memory of the caller,
+// see JxlDecoderSetInputBorrowed. `pos` is the position of `data` in the
+// codestream.
+struct CodestreamPart {
+  const uint8_t* data;
+  size_t pos;
+  size_t size;
+};
+
+// Entry of the index of the frames of a codestream, with what is needed to
+// skip the frame or to find out which earlier frames it depends on. Slots are
+// bitmasks of the frames kept for later frames, like saved_frame_memory: bits
+// 0-3 for the reference frames by save_as_reference, bits 4-7 for the DC
+// frames by dc_level - 1.
+struct FrameIndexEntry {
+  // Position of the frame in the codestream, and its size in bytes.
+  size_t start;
+  size_t size;
+  bool is_last;
+  // Whether the frame is returned by the JXL_DEC_FRAME event, rather than
+  // only being part of the composite still of a later frame.
+  bool displayed;
+  // Slots the frame is saved to, and slots it may read from.
+  int saved_as;
+  int references;
+};
+
 // Manages the sections for the FrameDecoder based on input bytes received.
 struct Sections {
   // sections_begin = position in the frame where the sections begin, after
@@ -212,6 +265,17 @@ struct Sections {
   // frame_dec_ must have been Inited already, but not yet done ProcessSections.
   JxlDecoderStatus Init() {
     section_received.resize(frame_dec_->NumSections(), 0);
+    section_done.resize(frame_dec_->NumSections(), 0);
+
+    // Sections that the FrameDecoder does not need, e.g. outside of the crop
+    // region, are never waited for and their bytes can be released.
+    for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
+      if (frame_dec_->IsSectionNeeded(i)) continue;
+      section_received[i] = 1;
+      section_done[i] = 1;
+      num_received++;
+      num_done++;
+    }
 
     const auto& offsets = frame_dec_->SectionOffsets();
     const auto& sizes = frame_dec_->SectionSizes();
@@ -226,33 +290,129 @@ struct Sections {
     return JXL_DEC_SUCCESS;
   }
 
-  // Sets the input data for the frame. The frame pointer must point to the
-  // beginning of the frame, size is the amount of bytes gotten so far and
-  // should increase with next calls until the full frame is loaded.
-  // TODO(lode): allow caller to provide only later chunks of memory when
-  // earlier sections are fully processed already.
-  void SetInput(const uint8_t* frame, size_t size) {
+  // Sets the input data for the frame. The `in` pointer must point to the byte
+  // at offset `in_offset` from the beginning of the frame, size is the amount
+  // of bytes gotten so far starting from `in` and should increase with next
+  // calls until the full frame is loaded. Bytes before `in_offset` may only be
+  // missing if they belong to sections that are already processed, see
+  // FirstNeededByte.
+  void SetInput(const uint8_t* in, size_t in_offset, size_t size) {
     const auto& offsets = frame_dec_->SectionOffsets();
     const auto& sizes = frame_dec_->SectionSizes();
 
     for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
       if (section_received[i]) continue;
-      if (!OutOfBounds(sections_begin_, offsets[i], sizes[i], size)) {
+      size_t begin = sections_begin_ + offsets[i];
+      JXL_DASSERT(begin >= in_offset);
+      if (!OutOfBounds(begin - in_offset, sizes[i], size)) {
         section_received[i] = 1;
-        section_info.emplace_back(jxl::FrameDecoder::SectionInfo{nullptr, i});
-        section_status.emplace_back();
+        num_received++;
       }
     }
-    // Reset all the bitreaders, because the address of the frame pointer may
-    // change, even if it always represents the same frame start.
+    // Only the sections that were received but not yet processed are given to
+    // the FrameDecoder. The bit readers are recreated every time, because the
+    // address of the input may change, even if it always represents the same
+    // bytes of the frame.
+    section_info.clear();
+    section_status.clear();
+    for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
+      if (!section_received[i] || section_done[i]) continue;
+      size_t begin = sections_begin_ + offsets[i] - in_offset;
+      section_info.emplace_back(jxl::FrameDecoder::SectionInfo{
+          new jxl::BitReader(jxl::Span<const uint8_t>(in + begin, sizes[i])),
+          i});
+      section_status.emplace_back();
+    }
+  }
+
+  // Sets the input data for the frame from the parts of a borrowed codestream,
+  // which contain all bytes of the codestream received so far, in order.
+  // `frame_start` is the position of the frame in the codestream. Sections
+  // are read in place, except for the few that straddle two parts, which are
+  // copied.
+  void SetBorrowedInput(const std::vector<CodestreamPart>& parts,
+                        size_t frame_start) {
+    const auto& offsets = frame_dec_->SectionOffsets();
+    const auto& sizes = frame_dec_->SectionSizes();
+    const size_t total =
+        parts.empty() ? 0 : parts.back().pos + parts.back().size;
+
+    for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
+      if (section_received[i]) continue;
+      size_t begin = frame_start + sections_begin_ + offsets[i];
+      if (!OutOfBounds(begin, sizes[i], total)) {
+        section_received[i] = 1;
+        num_received++;
+      }
+    }
+
+    section_info.clear();
+    section_status.clear();
+    section_copies.clear();
+    size_t part = 0;
+    for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
+      if (!section_received[i] || section_done[i]) continue;
+      size_t begin = frame_start + sections_begin_ + offsets[i];
+      size_t end = begin + sizes[i];
+      // Sections are in increasing order in most codestreams, so the search
+      // continues from the part of the previous section if possible.
+      if (parts[part].pos > begin) part = 0;
+      while (parts[part].pos + parts[part].size <= begin &&
+             part + 1 < parts.size()) {
+        part++;
+      }
+      const uint8_t* data;
+      if (end <= parts[part].pos + parts[part].size) {
+        data = parts[part].data + (begin - parts[part].pos);
+      } else {
+        section_copies.emplace_back();
+        std::vector<uint8_t>& copy = section_copies.back();
+        copy.reserve(sizes[i]);
+        for (size_t p = part; copy.size() < sizes[i]; p++) {
+          const CodestreamPart& src = parts[p];
+          size_t from = std::max(begin, src.pos) - src.pos;
+          size_t to = std::min(end, src.pos + src.size) - src.pos;
+          copy.insert(copy.end(), src.data + from, src.data + to);
+        }
+        data = copy.data();
+      }
+      section_info.emplace_back(jxl::FrameDecoder::SectionInfo{
+          new jxl::BitReader(jxl::Span<const uint8_t>(data, sizes[i])), i});
+      section_status.emplace_back();
+    }
+  }
+
+  // Records which sections the FrameDecoder finished with during the last
+  // ProcessSections call. The bytes of those are never needed again.
+  void MarkProcessed() {
     for (size_t i = 0; i < section_info.size(); i++) {
-      size_t id = section_info[i].id;
-      JXL_ASSERT(section_info[i].br == nullptr);
-      section_info[i].br = new jxl::BitReader(jxl::Span<const uint8_t>(
-          frame + sections_begin_ + offsets[id], sizes[id]));
+      if (section_status[i] != jxl::FrameDecoder::kDone &&
+          section_status[i] != jxl::FrameDecoder::kDuplicate) {
+        continue;
+      }
+      char& done = section_done[section_info[i].id];
+      if (!done) num_done++;
+      done = 1;
     }
   }
 
+  bool AllReceived() const { return num_received == frame_dec_->NumSections(); }
+  bool AllDone() const { return num_done == frame_dec_->NumSections(); }
+
+  // Returns the offset, from the beginning of the frame, of the first byte
+  // that still belongs to a section not yet processed, or the frame size if
+  // all sections are done. The frame header and TOC are never needed again
+  // once the sections are set up.
+  size_t FirstNeededByte() const {
+    const auto& offsets = frame_dec_->SectionOffsets();
+    size_t result = frame_size_;
+    for (size_t i = 0; i < frame_dec_->NumSections(); i++) {
+      if (section_done[i]) continue;
+      result = std::min<size_t>(result, sections_begin_ + offsets[i]);
+    }
+    return result;
+  }
+
   JxlDecoderStatus CloseInput() {
     bool out_of_bounds = false;
     for (size_t i = 0; i < section_info.size(); i++) {
@@ -284,14 +444,62 @@ struct Sections {
   std::vector<jxl::FrameDecoder::SectionInfo> section_info;
   std::vector<jxl::FrameDecoder::SectionStatus> section_status;
   std::vector<char> section_received;
+  std::vector<char> section_done;
+  size_t num_received = 0;
+  size_t num_done = 0;
+  // Sections of a borrowed codestream that straddle two of its parts, copied
+  // to be contiguous, see SetBorrowedInput. The bit readers of section_info
+  // may point into them.
+  std::deque<std::vector<uint8_t>> section_copies;
 };
 
 struct JxlDecoderStruct {
   JxlDecoderStruct() = default;
 
   JxlMemoryManager memory_manager;
+  // Provides the image buffers and other internal allocations from
+  // memory_manager while the decoder runs. Unused blocks are released at the
+  // end of each frame.
+  jxl::MemoryManagerUniquePtr<jxl::CacheAlignedArena> arena{
+      nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
   std::unique_ptr<jxl::ThreadPool> thread_pool;
 
+  // Set by JxlDecoderSetAsyncExecutor. When set, JxlDecoderProcessInput runs
+  // on the executor and async_state tells whether async_result is ready.
+  JxlAsyncExecutor async_executor;
+  void* async_executor_opaque;
+  std::atomic<AsyncState> async_state{AsyncState::kIdle};
+  JxlDecoderStatus async_result;
+
+  // Set by JxlDecoderSetFramePipelining.
+  JxlAsyncExecutor pipeline_executor;
+  void* pipeline_executor_opaque;
+  // Set by JxlDecoderSetFramePipeliningRunner.
+  std::unique_ptr<jxl::ThreadPool> pipeline_pool;
+  // Finalization and conversion of the previous frame running while the
+  // current JxlDecoderProcessInput call decodes the next frames, if any.
+  std::unique_ptr<PipelinedOutput> pipelined_output;
+  // Whether finalizing the frame that was just decoded is left to the output
+  // stage, where it is pipelined if possible, see CanPipelineOutput.
+  bool finalize_deferred;
+  // Slots, see FrameIndexEntry, whose saved frames are still held by the
+  // state of pipelined_output. Frames that read from them wait for it.
+  int pipeline_held_slots;
+  // State of an earlier pipelined_output, reused for the frames after the
+  // next one that is pipelined.
+  std::unique_ptr<jxl::PassesDecoderState> spare_passes_state;
+  // Header of the frame whose pipelined JXL_DEC_FULL_IMAGE was returned last,
+  // if no other event was returned since. Reported instead of frame_header,
+  // which already belongs to the next frame.
+  std::unique_ptr<jxl::FrameHeader> output_frame_header;
+  // The JXL_DEC_FRAME event of a frame whose decoding started while
+  // pipelined_output was running, returned after its JXL_DEC_FULL_IMAGE.
+  bool frame_event_postponed;
+  // Result of the decoding that ran along pipelined_output, returned after
+  // its JXL_DEC_FULL_IMAGE, and after frame_event_postponed.
+  bool has_deferred_status;
+  JxlDecoderStatus deferred_status;
+
   DecoderStage stage;
 
   // Status of progression, internal.
@@ -332,6 +540,27 @@ struct JxlDecoderStruct {
 
   // Settings
   bool keep_orientation;
+  // Whether the input bytes stay valid until the decoder is reset or
+  // destroyed, so that they can be read in place, see
+  // JxlDecoderSetInputBorrowed.
+  bool input_borrowed;
+  // Region of the image to decode, see JxlDecoderSetCropRegion. Empty if the
+  // whole image is decoded.
+  size_t crop_x0;
+  size_t crop_y0;
+  size_t crop_xsize;
+  size_t crop_ysize;
+  // Factor by which the output image is downsampled, see
+  // JxlDecoderSetDownsampling.
+  size_t downsampling;
+  // Memory budget in bytes, see JxlDecoderSetMemoryLimit. 0 if unlimited.
+  size_t memory_limit;
+  // Deadline and cancellation, see JxlDecoderSetDeadline and JxlDecoderCancel.
+  jxl::StopSignal stop;
+  // Whether JxlDecoderReset keeps the buffers of passes_state for the next
+  // image, see JxlDecoderSetKeepBuffers. Unlike the other settings, this one is
+  // not reset by JxlDecoderReset.
+  bool keep_buffers;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
   // decoder returns a status. By default, do not return for any of the events,
@@ -349,7 +578,7 @@ struct JxlDecoderStruct {
   // set to nullptr.
   bool preview_out_buffer_set;
   bool dc_out_buffer_set;
-  // Idem for the image buffer.
+  // Idem for the image buffer, or the image callback.
   bool image_out_buffer_set;
 
   // Owned by the caller, buffers for DC image and full resolution images
@@ -357,6 +586,13 @@ struct JxlDecoderStruct {
   void* dc_out_buffer;
   void* image_out_buffer;
 
+  // Alternative to image_out_buffer, receives the image row by row.
+  JxlImageOutCallback image_out_callback;
+  void* image_out_opaque;
+  // Whether the pixels of the current frame are passed to image_out_callback
+  // by the FrameDecoder while decoding, rather than after the frame is done.
+  bool image_out_streamed;
+
   size_t preview_out_size;
   size_t dc_out_size;
   size_t image_out_size;
@@ -393,21 +629,69 @@ struct JxlDecoderStruct {
   // The currently processed frame is the last of the codestream
   bool is_last_total;
 
+  // Index of the frames of the codestream after the preview, in codestream
+  // order, see JxlDecoderSkipFrames. Kept by JxlDecoderRewind.
+  std::vector<FrameIndexEntry> frame_index;
+  // Number of frames whose header was passed so far, counting all frames like
+  // frame_index, and counting only the frames returned by JXL_DEC_FRAME.
+  size_t internal_frames;
+  size_t external_frames;
+  // Number of displayed frames still to skip, see JxlDecoderSkipFrames.
+  size_t skip_frames;
+  // Which frames of frame_index must be decoded while skipping. Empty if not
+  // computed yet for the current value of skip_frames.
+  std::vector<char> frame_required;
+  // Slots that were last saved to by a frame that was skipped, and so do not
+  // hold the content that later frames expect.
+  int skipped_slots;
+
   // Codestream input data is stored here, when the decoder takes in and stores
   // the user input bytes. If the decoder does not do that (e.g. in one-shot
-  // case), this field is unused.
-  // TODO(lode): avoid needing this field once the C++ decoder doesn't need
-  // all bytes at once, to save memory. Find alternative to std::vector doubling
-  // strategy to prevent some memory usage.
+  // case), this field is unused. Bytes of headers, finished frames and
+  // processed sections of the current frame are released from the front, so
+  // only the bytes of sections that could not be processed yet are kept.
   std::vector<uint8_t> codestream;
+  // Whether the decoder takes in the user input bytes into codestream. The
+  // vector itself can be empty while this is true, when all bytes stored so
+  // far were released already.
+  bool codestream_stored;
 
   // Position in the actual codestream, which codestream.begin() points to.
   // Non-zero once earlier parts of the codestream vector have been erased.
   size_t codestream_pos;
 
+  // With input_borrowed, the parts of the input that contain the codestream,
+  // in order. Parts that are adjacent in memory are merged.
+  std::vector<CodestreamPart> borrowed_parts;
+  // With input_borrowed, the size of the window of the codestream that is
+  // passed to JxlDecoderProcessInternal to parse headers from, and the
+  // codestream position it begins at. The window grows until the headers it
+  // begins with are complete.
+  size_t borrowed_window;
+  size_t borrowed_window_start;
+  // With input_borrowed, the state of the box parser: the bytes of the header
+  // of the next box received so far, or if in_box, whether the current box
+  // contains codestream and how many bytes of it remain, unless it is the last
+  // box and extends until the end of the file.
+  std::vector<uint8_t> box_header;
+  bool in_box;
+  bool box_is_codestream;
+  bool box_unbounded;
+  uint64_t box_remaining;
+
   // Statistics which CodecInOut can keep
   uint64_t dec_pixels;
 
+  // Estimated bytes of the pixel buffers of the current frame, see
+  // EstimateFrameMemory.
+  size_t frame_memory;
+  // Estimated bytes of the frames kept for later frames: the reference frames
+  // indexed by save_as_reference, followed by the DC frames indexed by
+  // dc_level - 1.
+  size_t saved_frame_memory[8];
+  // Maximum of CurrentMemory seen so far, see JxlDecoderGetMemoryStats.
+  size_t peak_memory;
+
   const uint8_t* next_in;
   size_t avail_in;
 };
@@ -422,6 +706,19 @@ JxlDecoderStatus JxlDecoderDefaultPixelFormat(const JxlDecoder* dec,
 
 void JxlDecoderReset(JxlDecoder* dec) {
   dec->thread_pool.reset();
+  dec->async_executor = nullptr;
+  dec->async_executor_opaque = nullptr;
+  dec->async_state.store(AsyncState::kIdle, std::memory_order_relaxed);
+  dec->pipeline_executor = nullptr;
+  dec->pipeline_executor_opaque = nullptr;
+  dec->pipeline_pool.reset();
+  dec->pipelined_output.reset();
+  dec->finalize_deferred = false;
+  dec->pipeline_held_slots = 0;
+  dec->spare_passes_state.reset();
+  dec->output_frame_header.reset();
+  dec->frame_event_postponed = false;
+  dec->has_deferred_status = false;
   dec->stage = DecoderStage::kInited;
   dec->got_signature = false;
   dec->first_codestream_seen = false;
@@ -435,9 +732,19 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->last_frame_reached = false;
   dec->file_pos = 0;
   dec->codestream_pos = 0;
+  dec->codestream_stored = false;
   dec->codestream_begin = 0;
   dec->codestream_end = 0;
   dec->keep_orientation = false;
+  dec->input_borrowed = false;
+  dec->crop_x0 = 0;
+  dec->crop_y0 = 0;
+  dec->crop_xsize = 0;
+  dec->crop_ysize = 0;
+  dec->downsampling = 1;
+  dec->memory_limit = 0;
+  dec->stop.deadline = 0;
+  dec->stop.cancelled.store(false, std::memory_order_relaxed);
   dec->events_wanted = 0;
   dec->orig_events_wanted = 0;
   dec->basic_info_size_hint = InitialBasicInfoSizeHint();
@@ -448,14 +755,25 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->preview_out_buffer = nullptr;
   dec->dc_out_buffer = nullptr;
   dec->image_out_buffer = nullptr;
+  dec->image_out_callback = nullptr;
+  dec->image_out_opaque = nullptr;
+  dec->image_out_streamed = false;
   dec->preview_out_size = 0;
   dec->dc_out_size = 0;
   dec->image_out_size = 0;
   dec->dec_pixels = 0;
+  // The buffers of the current frame are kept along with passes_state.
+  if (!dec->keep_buffers) dec->frame_memory = 0;
+  for (size_t& bytes : dec->saved_frame_memory) bytes = 0;
+  dec->peak_memory = 0;
   dec->next_in = 0;
   dec->avail_in = 0;
 
-  dec->passes_state.reset(nullptr);
+  if (dec->keep_buffers && dec->passes_state) {
+    dec->passes_state->ResetForNextImage();
+  } else {
+    dec->passes_state.reset(nullptr);
+  }
   dec->frame_dec.reset(nullptr);
   dec->sections.reset(nullptr);
   dec->frame_dec_in_progress = false;
@@ -465,6 +783,14 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->frame_header.reset(new jxl::FrameHeader(&dec->metadata));
   dec->frame_dim = jxl::FrameDimensions();
   dec->codestream.clear();
+  dec->borrowed_parts.clear();
+  dec->borrowed_window = 0;
+  dec->borrowed_window_start = 0;
+  dec->box_header.clear();
+  dec->in_box = false;
+  dec->box_is_codestream = false;
+  dec->box_unbounded = false;
+  dec->box_remaining = 0;
 
   dec->frame_stage = FrameStage::kHeader;
   dec->frame_start = 0;
@@ -472,6 +798,63 @@ void JxlDecoderReset(JxlDecoder* dec) {
   dec->dc_size = 0;
   dec->is_last_of_still = false;
   dec->is_last_total = false;
+  dec->frame_index.clear();
+  dec->internal_frames = 0;
+  dec->external_frames = 0;
+  dec->skip_frames = 0;
+  dec->frame_required.clear();
+  dec->skipped_slots = 0;
+  if (dec->arena) {
+    dec->arena->ReleaseUnused();
+    dec->arena->ResetMaxBytesInUse();
+  }
+}
+
+void JxlDecoderRewind(JxlDecoder* dec) {
+  std::unique_ptr<jxl::ThreadPool> thread_pool = std::move(dec->thread_pool);
+  JxlAsyncExecutor async_executor = dec->async_executor;
+  void* async_executor_opaque = dec->async_executor_opaque;
+  JxlAsyncExecutor pipeline_executor = dec->pipeline_executor;
+  void* pipeline_executor_opaque = dec->pipeline_executor_opaque;
+  std::unique_ptr<jxl::ThreadPool> pipeline_pool =
+      std::move(dec->pipeline_pool);
+  bool keep_orientation = dec->keep_orientation;
+  bool input_borrowed = dec->input_borrowed;
+  size_t crop_x0 = dec->crop_x0;
+  size_t crop_y0 = dec->crop_y0;
+  size_t crop_xsize = dec->crop_xsize;
+  size_t crop_ysize = dec->crop_ysize;
+  size_t downsampling = dec->downsampling;
+  size_t memory_limit = dec->memory_limit;
+  double deadline = dec->stop.deadline;
+  int orig_events_wanted = dec->orig_events_wanted;
+  std::vector<FrameIndexEntry> frame_index = std::move(dec->frame_index);
+
+  JxlDecoderReset(dec);
+
+  dec->thread_pool = std::move(thread_pool);
+  dec->async_executor = async_executor;
+  dec->async_executor_opaque = async_executor_opaque;
+  dec->pipeline_executor = pipeline_executor;
+  dec->pipeline_executor_opaque = pipeline_executor_opaque;
+  dec->pipeline_pool = std::move(pipeline_pool);
+  dec->keep_orientation = keep_orientation;
+  dec->input_borrowed = input_borrowed;
+  dec->crop_x0 = crop_x0;
+  dec->crop_y0 = crop_y0;
+  dec->crop_xsize = crop_xsize;
+  dec->crop_ysize = crop_ysize;
+  dec->downsampling = downsampling;
+  dec->memory_limit = memory_limit;
+  dec->stop.deadline = deadline;
+  dec->events_wanted = orig_events_wanted;
+  dec->orig_events_wanted = orig_events_wanted;
+  dec->frame_index = std::move(frame_index);
+}
+
+void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount) {
+  dec->skip_frames += amount;
+  dec->frame_required.clear();
 }
 
 JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
@@ -485,6 +868,13 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
   // Placement new constructor on allocated memory
   JxlDecoder* dec = new (alloc) JxlDecoder();
   dec->memory_manager = local_memory_manager;
+  dec->arena = jxl::MemoryManagerMakeUnique<jxl::CacheAlignedArena>(
+      &dec->memory_manager, dec->memory_manager);
+  if (!dec->arena) {
+    JxlDecoderDestroy(dec);
+    return nullptr;
+  }
+  dec->keep_buffers = false;
 
   JxlDecoderReset(dec);
 
@@ -508,6 +898,42 @@ JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetAsyncExecutor(JxlDecoder* dec,
+                                            JxlAsyncExecutor executor,
+                                            void* executor_opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set async executor before starting");
+  }
+  dec->async_executor = executor;
+  dec->async_executor_opaque = executor_opaque;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetFramePipelining(JxlDecoder* dec,
+                                              JxlAsyncExecutor executor,
+                                              void* executor_opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set frame pipelining before starting");
+  }
+  dec->pipeline_executor = executor;
+  dec->pipeline_executor_opaque = executor_opaque;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetFramePipeliningRunner(
+    JxlDecoder* dec, JxlParallelRunner parallel_runner,
+    void* parallel_runner_opaque) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set frame pipelining before starting");
+  }
+  if (dec->pipeline_pool) {
+    return JXL_API_ERROR("pipelining parallel runner already set");
+  }
+  dec->pipeline_pool.reset(
+      new jxl::ThreadPool(parallel_runner, parallel_runner_opaque));
+  return JXL_DEC_SUCCESS;
+}
+
 size_t JxlDecoderSizeHintBasicInfo(const JxlDecoder* dec) {
   if (dec->got_basic_info) return 0;
   return dec->basic_info_size_hint;
@@ -534,9 +960,66 @@ JxlDecoderStatus JxlDecoderSetKeepOrientation(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetInputBorrowed(JxlDecoder* dec,
+                                            JXL_BOOL input_borrowed) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set input_borrowed option before starting");
+  }
+  dec->input_borrowed = !!input_borrowed;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetCropRegion(JxlDecoder* dec, size_t x0, size_t y0,
+                                         size_t xsize, size_t ysize) {
+  if (!dec->got_basic_info) {
+    return JXL_API_ERROR("Basic info must be known to set the crop region");
+  }
+  if (xsize == 0 || ysize == 0) {
+    xsize = ysize = x0 = y0 = 0;
+  } else if (x0 >= dec->metadata.size.xsize() ||
+             y0 >= dec->metadata.size.ysize() ||
+             xsize > dec->metadata.size.xsize() - x0 ||
+             ysize > dec->metadata.size.ysize() - y0) {
+    return JXL_API_ERROR("Crop region out of image bounds");
+  }
+  dec->crop_x0 = x0;
+  dec->crop_y0 = y0;
+  dec->crop_xsize = xsize;
+  dec->crop_ysize = ysize;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetDownsampling(JxlDecoder* dec,
+                                           uint32_t downsampling) {
+  if (downsampling != 1 && downsampling != 2 && downsampling != 4 &&
+      downsampling != 8) {
+    return JXL_API_ERROR("Invalid downsampling factor");
+  }
+  if (dec->frame_dec_in_progress) {
+    return JXL_API_ERROR("Cannot change downsampling while decoding a frame");
+  }
+  dec->downsampling = downsampling;
+  return JXL_DEC_SUCCESS;
+}
+
 namespace jxl {
 namespace {
 
+// Returns a * b, or SIZE_MAX if that overflows.
+size_t SaturatingMul(size_t a, size_t b) {
+  if (a != 0 && b > std::numeric_limits<size_t>::max() / a) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return a * b;
+}
+
+// Returns a + b, or SIZE_MAX if that overflows.
+size_t SaturatingAdd(size_t a, size_t b) {
+  size_t sum = a + b;
+  if (sum < a) return std::numeric_limits<size_t>::max();
+  return sum;
+}
+
 template <class T>
 bool CanRead(Span<const uint8_t> data, BitReader* reader, T* JXL_RESTRICT t) {
   // Use a copy of the bit reader because CanRead advances bits.
@@ -582,6 +1065,88 @@ std::unique_ptr<BitReader, std::function<void(BitReader*)>> GetBitReader(
       });
 }
 
+// Returns an estimate of the bytes of the pixel buffers allocated to decode a
+// frame with the given header: the frame in the decoder state, the channels of
+// the modular image, the coefficients of progressive passes and the upsampled
+// image bundle.
+size_t EstimateFrameMemory(const FrameHeader& frame_header,
+                           size_t num_extra_channels) {
+  FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+  size_t bytes_per_pixel = 3 * sizeof(float);
+  if (frame_header.encoding == FrameEncoding::kModular) {
+    bytes_per_pixel += (3 + num_extra_channels) * sizeof(int32_t);
+  } else {
+    bytes_per_pixel += num_extra_channels * sizeof(int32_t);
+    if (frame_header.passes.num_passes > 1) {
+      bytes_per_pixel += 3 * sizeof(int32_t);
+    }
+  }
+  size_t pixels = SaturatingMul(frame_dim.xsize_padded, frame_dim.ysize_padded);
+  size_t output_pixels = SaturatingMul(frame_dim.xsize_upsampled_padded,
+                                       frame_dim.ysize_upsampled_padded);
+  return SaturatingAdd(
+      SaturatingMul(pixels, bytes_per_pixel),
+      SaturatingMul(output_pixels, (3 + num_extra_channels) * sizeof(float)));
+}
+
+// Returns the bytes accounted to the decoder, see JxlDecoderGetMemoryStats.
+size_t CurrentMemory(const JxlDecoder* dec) {
+  size_t bytes = SaturatingAdd(sizeof(JxlDecoder), dec->codestream.capacity());
+  bytes = SaturatingAdd(bytes, dec->frame_memory);
+  for (size_t saved : dec->saved_frame_memory) {
+    bytes = SaturatingAdd(bytes, saved);
+  }
+  return bytes;
+}
+
+void UpdatePeakMemory(JxlDecoder* dec) {
+  dec->peak_memory = std::max(dec->peak_memory, CurrentMemory(dec));
+}
+
+// Accounts the pixel buffers needed to decode the frame with the given header,
+// including the frame kept for later frames if any. If they do not fit in the
+// memory limit, leaves the accounting unchanged and returns
+// JXL_DEC_MEMORY_LIMIT_EXCEEDED, before any of the buffers are allocated.
+JxlDecoderStatus ReserveFrameMemory(JxlDecoder* dec,
+                                    const FrameHeader& frame_header) {
+  const size_t num_extra_channels = dec->metadata.m.num_extra_channels;
+  const FrameDimensions frame_dim = frame_header.ToFrameDimensions();
+  size_t slot = 0;
+  size_t saved_bytes = 0;
+  bool saved = false;
+  if (frame_header.frame_type == FrameType::kDCFrame) {
+    if (frame_header.dc_level < 1 || frame_header.dc_level > 4) {
+      return JXL_API_ERROR("invalid DC level");
+    }
+    slot = 4 + frame_header.dc_level - 1;
+    saved_bytes = SaturatingMul(SaturatingMul(frame_dim.xsize, frame_dim.ysize),
+                                3 * sizeof(float));
+    saved = true;
+  } else if (frame_header.CanBeReferenced()) {
+    slot = frame_header.save_as_reference;
+    saved_bytes = SaturatingMul(
+        SaturatingMul(frame_dim.xsize_upsampled, frame_dim.ysize_upsampled),
+        (3 + num_extra_channels) * sizeof(float));
+    saved = true;
+  }
+
+  const size_t old_frame_memory = dec->frame_memory;
+  const size_t old_saved_bytes = dec->saved_frame_memory[slot];
+  // The buffers of the decoder state are reused from frame to frame, and only
+  // grow.
+  dec->frame_memory =
+      std::max(old_frame_memory,
+               EstimateFrameMemory(frame_header, num_extra_channels));
+  if (saved) dec->saved_frame_memory[slot] = saved_bytes;
+  if (dec->memory_limit != 0 && CurrentMemory(dec) > dec->memory_limit) {
+    dec->frame_memory = old_frame_memory;
+    dec->saved_frame_memory[slot] = old_saved_bytes;
+    return JXL_DEC_MEMORY_LIMIT_EXCEEDED;
+  }
+  UpdatePeakMemory(dec);
+  return JXL_DEC_SUCCESS;
+}
+
 JxlDecoderStatus JxlDecoderReadBasicInfo(JxlDecoder* dec, const uint8_t* in,
                                          size_t size) {
   size_t pos = 0;
@@ -610,8 +1175,15 @@ JxlDecoderStatus JxlDecoderReadBasicInfo(JxlDecoder* dec, const uint8_t* in,
   dec->got_basic_info = true;
   dec->basic_info_size_hint = 0;
 
-  if (!CheckSizeLimit(dec->metadata.size.xsize(), dec->metadata.size.ysize())) {
-    return JXL_API_ERROR("image is too large");
+  // The decoded image alone, without any of the other buffers, must already
+  // fit in the memory limit.
+  if (dec->memory_limit != 0) {
+    size_t pixels =
+        SaturatingMul(dec->metadata.size.xsize(), dec->metadata.size.ysize());
+    size_t channels = 3 + dec->metadata.m.num_extra_channels;
+    if (SaturatingMul(pixels, channels * sizeof(float)) > dec->memory_limit) {
+      return JXL_DEC_MEMORY_LIMIT_EXCEEDED;
+    }
   }
 
   return JXL_DEC_SUCCESS;
@@ -646,7 +1218,7 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec, const uint8_t* in,
 
   if (dec->metadata.m.color_encoding.WantICC()) {
     PaddedBytes icc;
-    jxl::Status status = ReadICC(reader.get(), &icc, memory_limit_base_);
+    jxl::Status status = ReadICC(reader.get(), &icc, dec->memory_limit);
     // Always check AllReadsWithinBounds, not all the C++ decoder implementation
     // handles reader out of bounds correctly  yet (e.g. context map). Not
     // checking AllReadsWithinBounds can cause reader->Close() to trigger an
@@ -674,19 +1246,37 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec, const uint8_t* in,
   return JXL_DEC_SUCCESS;
 }
 
-static JxlDecoderStatus ConvertImageInternal(const JxlDecoder* dec,
-                                             const jxl::ImageBundle& frame,
-                                             const JxlPixelFormat& format,
-                                             void* out_image, size_t out_size) {
+// Returns the size in bytes of a row of `xsize` pixels in the image out buffer.
+static size_t GetStride(size_t xsize, const JxlPixelFormat& format) {
+  size_t stride = xsize * (BitsPerChannel(format.data_type) *
+                           format.num_channels / jxl::kBitsPerByte);
+  if (format.align > 1) {
+    stride = jxl::DivCeil(stride, format.align) * format.align;
+  }
+  return stride;
+}
+
+// Converts `frame` to `out_image`, or, if `out_callback` is not null, passes
+// it to `out_callback` row by row. If `rect` is not null, only the pixels of
+// `frame` inside of it are converted, the output then has the size of `rect`.
+static JxlDecoderStatus ConvertImageInternal(
+    const JxlDecoder* dec, const jxl::ImageBundle& frame,
+    const JxlPixelFormat& format, void* out_image, size_t out_size,
+    JxlImageOutCallback out_callback, void* out_opaque, jxl::ThreadPool* pool,
+    const jxl::Rect* rect) {
   // TODO(lode): handle mismatch of RGB/grayscale color profiles and pixel data
   // color/grayscale format
   const auto& metadata = dec->metadata.m;
+  jxl::Orientation undo_orientation = dec->keep_orientation
+                                          ? jxl::Orientation::kIdentity
+                                          : metadata.GetOrientation();
 
-  size_t stride = frame.xsize() * (BitsPerChannel(format.data_type) *
-                                   format.num_channels / jxl::kBitsPerByte);
-  if (format.align > 1) {
-    stride = jxl::DivCeil(stride, format.align) * format.align;
-  }
+  // The output has the size of `rect`, with the orientation undone.
+  const jxl::Rect out_rect = rect ? rect->Crop(frame) : jxl::Rect(frame);
+  size_t stride = GetStride(static_cast<uint32_t>(undo_orientation) > 4
+                                ? out_rect.ysize()
+                                : out_rect.xsize(),
+                            format);
 
   bool apply_srgb_tf = false;
   if (metadata.xyb_encoded) {
@@ -701,18 +1291,303 @@ static JxlDecoderStatus ConvertImageInternal(const JxlDecoder* dec,
       apply_srgb_tf = true;
     }
   }
-  jxl::Orientation undo_orientation = dec->keep_orientation
-                                          ? jxl::Orientation::kIdentity
-                                          : metadata.GetOrientation();
-  jxl::Status status = jxl::ConvertToExternal(
-      frame, BitsPerChannel(format.data_type),
-      format.data_type == JXL_TYPE_FLOAT, apply_srgb_tf, format.num_channels,
-      format.endianness, stride, dec->thread_pool.get(), out_image, out_size,
-      undo_orientation);
+  jxl::Status status =
+      out_callback
+          ? jxl::ConvertToExternal(
+                frame, BitsPerChannel(format.data_type),
+                format.data_type == JXL_TYPE_FLOAT, apply_srgb_tf,
+                format.num_channels, format.endianness, pool, out_callback,
+                out_opaque, undo_orientation, rect)
+          : jxl::ConvertToExternal(
+                frame, BitsPerChannel(format.data_type),
+                format.data_type == JXL_TYPE_FLOAT, apply_srgb_tf,
+                format.num_channels, format.endianness, stride, pool,
+                out_image, out_size, undo_orientation, rect);
 
   return status ? JXL_DEC_SUCCESS : JXL_DEC_ERROR;
 }
 
+// Returns the part of the image, downsampled by `downsampling`, that is
+// output: the crop region if any, see JxlDecoderSetCropRegion, otherwise
+// everything.
+static jxl::Rect OutputRect(const JxlDecoder* dec, size_t downsampling) {
+  if (dec->crop_xsize == 0) {
+    return jxl::Rect(0, 0,
+                     jxl::DivCeil(dec->metadata.size.xsize(), downsampling),
+                     jxl::DivCeil(dec->metadata.size.ysize(), downsampling));
+  }
+  const size_t x0 = dec->crop_x0 / downsampling;
+  const size_t y0 = dec->crop_y0 / downsampling;
+  const size_t x1 = jxl::DivCeil(dec->crop_x0 + dec->crop_xsize, downsampling);
+  const size_t y1 = jxl::DivCeil(dec->crop_y0 + dec->crop_ysize, downsampling);
+  return jxl::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Returns the output rect, see OutputRect, in pixels of the frame that was
+// just decoded, which may only hold the part of the image around the crop
+// region, see jxl::FrameDecoder::OutputArea.
+static jxl::Rect OutputRectInFrame(const JxlDecoder* dec,
+                                   size_t downsampling) {
+  const jxl::Rect rect = OutputRect(dec, downsampling);
+  // The area starts at a multiple of kBlockDim, so at a whole pixel of the
+  // downsampled frame.
+  const jxl::Rect& area = dec->frame_dec->OutputArea();
+  return jxl::Rect(rect.x0() - area.x0() / downsampling,
+                   rect.y0() - area.y0() / downsampling, rect.xsize(),
+                   rect.ysize());
+}
+
+// Returns `rect` of `plane` downsampled by `factor`, with `rect` in pixels of
+// the downsampled plane. Same as jxl::DownsampleImage, but only for the pixels
+// that are output.
+static jxl::ImageF DownsampleRect(const jxl::ImageF& plane, size_t factor,
+                                  const jxl::Rect& rect, jxl::ThreadPool* pool) {
+  jxl::ImageF downsampled(rect.xsize(), rect.ysize());
+  jxl::RunOnPool(
+      pool, 0, rect.ysize(), jxl::ThreadPool::SkipInit(),
+      [&](const int task, const int thread) {
+        const size_t y = task;
+        const size_t in_y0 = (rect.y0() + y) * factor;
+        const size_t in_y1 = std::min(in_y0 + factor, plane.ysize());
+        float* JXL_RESTRICT row_out = downsampled.Row(y);
+        for (size_t x = 0; x < rect.xsize(); x++) {
+          const size_t in_x0 = (rect.x0() + x) * factor;
+          const size_t in_x1 = std::min(in_x0 + factor, plane.xsize());
+          float sum = 0;
+          for (size_t iy = in_y0; iy < in_y1; iy++) {
+            const float* JXL_RESTRICT row_in = plane.ConstRow(iy);
+            for (size_t ix = in_x0; ix < in_x1; ix++) {
+              sum += row_in[ix];
+            }
+          }
+          row_out[x] = sum / ((in_y1 - in_y0) * (in_x1 - in_x0));
+        }
+      },
+      "DownsampleRect");
+  return downsampled;
+}
+
+// Returns the color and extra channels of `frame` inside of `rect` downsampled
+// by `factor`, for JxlDecoderSetDownsampling. `rect` is in pixels of the
+// downsampled frame, the rest of the frame is neither copied nor downsampled.
+static jxl::ImageBundle DownsampleFrame(size_t factor,
+                                        const jxl::ImageBundle& frame,
+                                        const jxl::Rect& rect,
+                                        jxl::ThreadPool* pool) {
+  jxl::ImageBundle downsampled(frame.metadata());
+  const jxl::Image3F& color = frame.color();
+  downsampled.SetFromImage(
+      jxl::Image3F(DownsampleRect(color.Plane(0), factor, rect, pool),
+                   DownsampleRect(color.Plane(1), factor, rect, pool),
+                   DownsampleRect(color.Plane(2), factor, rect, pool)),
+      frame.c_current());
+  if (frame.HasExtraChannels()) {
+    std::vector<jxl::ImageF> extra_channels;
+    for (const jxl::ImageF& extra_channel : frame.extra_channels()) {
+      extra_channels.push_back(
+          DownsampleRect(extra_channel, factor, rect, pool));
+    }
+    downsampled.SetExtraChannels(std::move(extra_channels));
+  }
+  return downsampled;
+}
+
+// Converts `rect` of `frame` downsampled by `downsampling`, with `rect` in
+// pixels of the downsampled frame, to the given image out buffer or callback.
+static JxlDecoderStatus ConvertOutputRect(
+    const JxlDecoder* dec, const jxl::ImageBundle& frame, size_t downsampling,
+    const jxl::Rect& rect, const JxlPixelFormat& format, void* out_image,
+    size_t out_size, JxlImageOutCallback out_callback, void* out_opaque,
+    jxl::ThreadPool* pool) {
+  if (downsampling == 1) {
+    return ConvertImageInternal(dec, frame, format, out_image, out_size,
+                                out_callback, out_opaque, pool, &rect);
+  }
+  const jxl::ImageBundle downsampled =
+      DownsampleFrame(downsampling, frame, rect, pool);
+  return ConvertImageInternal(dec, downsampled, format, out_image, out_size,
+                              out_callback, out_opaque, pool,
+                              /*rect=*/nullptr);
+}
+
+// Returns the factor by which the frame that was just decoded still needs to
+// be downsampled for the output. Frames rendered from the DC are already
+// smaller, see jxl::FrameDecoder::OutputDownsampling.
+static size_t RemainingDownsampling(const JxlDecoder* dec) {
+  return dec->downsampling / dec->frame_dec->OutputDownsampling();
+}
+
+// Returns whether the displayed frame that was just decoded may be finalized
+// and converted to the image out buffer on the pipeline executor while the
+// next frame is decoded.
+static bool CanPipelineOutput(const JxlDecoder* dec) {
+  if (!dec->pipeline_executor || dec->pipelined_output) return false;
+  // Already output while decoding.
+  if (dec->image_out_streamed) return false;
+  // Nothing to overlap the last frame with.
+  if (dec->is_last_total) return false;
+  // The pipelined frame is kept in memory on top of the next one.
+  if (dec->memory_limit != 0) return false;
+  // These events need the state of the frame being decoded to stay in order
+  // with the output of the previous one.
+  return !(dec->orig_events_wanted &
+           (JXL_DEC_DC_IMAGE | JXL_DEC_JPEG_RECONSTRUCTION));
+}
+
+static void RunPipelinedOutput(void* work_opaque) {
+  PipelinedOutput* output = static_cast<PipelinedOutput*>(work_opaque);
+  const JxlDecoder* dec = output->dec;
+  jxl::CacheAlignedArenaScope arena_scope(dec->arena.get());
+  JxlDecoderStatus status = JXL_DEC_SUCCESS;
+  if (!output->frame_dec->FinalizeFrame()) {
+    status = JXL_API_ERROR("decoding frame failed");
+  }
+  if (status == JXL_DEC_SUCCESS) {
+    status = ConvertOutputRect(dec, *output->ib, output->downsampling,
+                               output->rect, output->format, output->buffer,
+                               output->size, output->callback, output->opaque,
+                               output->pool);
+  }
+  output->ib.reset();
+  std::lock_guard<std::mutex> lock(output->mutex);
+  output->status = status;
+  output->done = true;
+  output->done_cv.notify_all();
+}
+
+// Moves the current frame, along with its state, to a PipelinedOutput and
+// submits its finalization and conversion to the image out buffer, which is
+// consumed, to the pipeline executor. The next frames are decoded with
+// another state, see WaitPipelinedOutput.
+static void SubmitPipelinedOutput(JxlDecoder* dec) {
+  dec->pipelined_output.reset(new PipelinedOutput());
+  PipelinedOutput* output = dec->pipelined_output.get();
+  output->dec = dec;
+  output->frame_header.reset(new jxl::FrameHeader(*dec->frame_header));
+  output->downsampling = RemainingDownsampling(dec);
+  output->rect = OutputRectInFrame(dec, dec->downsampling);
+  output->passes_state = std::move(dec->passes_state);
+  output->frame_dec = std::move(dec->frame_dec);
+  output->ib = std::move(dec->ib);
+  output->pool = dec->pipeline_pool.get();
+  output->frame_dec->SetThreadPool(output->pool);
+  output->format = dec->image_out_format;
+  output->buffer = dec->image_out_buffer;
+  output->size = dec->image_out_size;
+  output->callback = dec->image_out_callback;
+  output->opaque = dec->image_out_opaque;
+
+  // The saved frames that the frame neither writes nor reads while it is
+  // finalized move to the state of the next frames right away, the others
+  // once it is done.
+  const FrameIndexEntry& entry = dec->frame_index[dec->internal_frames - 1];
+  dec->pipeline_held_slots = entry.saved_as | entry.references;
+  dec->passes_state = std::move(dec->spare_passes_state);
+  if (!dec->passes_state) {
+    dec->passes_state.reset(new jxl::PassesDecoderState());
+  }
+  dec->passes_state->noise_seed = output->passes_state->noise_seed;
+  dec->passes_state->TakeSavedFrames(output->passes_state.get(),
+                                     0xFF & ~dec->pipeline_held_slots);
+
+  dec->pipeline_executor(dec->pipeline_executor_opaque, &RunPipelinedOutput,
+                         output);
+}
+
+// Waits for the work submitted by SubmitPipelinedOutput, and moves the saved
+// frames that its state still held to the state of the next frames.
+static void WaitPipelinedOutput(JxlDecoder* dec) {
+  PipelinedOutput* output = dec->pipelined_output.get();
+  {
+    std::unique_lock<std::mutex> lock(output->mutex);
+    while (!output->done) {
+      output->done_cv.wait(lock);
+    }
+  }
+  if (!output->passes_state) return;
+  dec->passes_state->TakeSavedFrames(output->passes_state.get(),
+                                     dec->pipeline_held_slots);
+  dec->pipeline_held_slots = 0;
+  output->frame_dec.reset();
+  dec->spare_passes_state = std::move(output->passes_state);
+}
+
+// Waits for the work submitted by SubmitPipelinedOutput and returns its
+// result.
+static JxlDecoderStatus FinishPipelinedOutput(JxlDecoder* dec) {
+  WaitPipelinedOutput(dec);
+  PipelinedOutput* output = dec->pipelined_output.get();
+  JxlDecoderStatus status = output->status;
+  dec->output_frame_header = std::move(output->frame_header);
+  dec->pipelined_output.reset();
+  return status;
+}
+
+// Returns the output for passing the pixels of the current frame to the image
+// out callback, or writing them to the image out buffer, while the frame is
+// being decoded. The result is not present if no output is set yet, or if the
+// frame is not output as it is decoded, e.g. due to blending, orientation or
+// alpha which is only available at the end.
+static jxl::ExternalRowOutput GetStreamingImageOutput(const JxlDecoder* dec) {
+  jxl::ExternalRowOutput output;
+  if (!dec->image_out_buffer_set) return output;
+  if (!dec->image_out_callback && !dec->image_out_buffer) return output;
+  // Rows are produced at full resolution, and for whole groups rather than
+  // only the crop region.
+  if (dec->downsampling != 1 || dec->crop_xsize != 0) return output;
+  if (!dec->is_last_of_still || !(dec->events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return output;
+  }
+  const auto& metadata = dec->metadata.m;
+  const jxl::FrameHeader& frame_header = *dec->frame_header;
+  if (frame_header.frame_type != jxl::FrameType::kRegularFrame ||
+      frame_header.custom_size_or_origin ||
+      frame_header.blending_info.mode != jxl::BlendMode::kReplace) {
+    return output;
+  }
+  for (const auto& ec_info : frame_header.extra_channel_blending_info) {
+    if (ec_info.mode != jxl::BlendMode::kReplace) return output;
+  }
+  if (!dec->keep_orientation &&
+      metadata.GetOrientation() != jxl::Orientation::kIdentity) {
+    return output;
+  }
+  const JxlPixelFormat& format = dec->image_out_format;
+  bool want_alpha = format.num_channels == 2 || format.num_channels == 4;
+  if (want_alpha && metadata.HasAlpha()) return output;
+
+  output.callback = dec->image_out_callback;
+  output.opaque = dec->image_out_opaque;
+  if (!output.callback) {
+    output.buffer = reinterpret_cast<uint8_t*>(dec->image_out_buffer);
+    output.stride = GetStride(dec->metadata.size.xsize(), format);
+  }
+  output.bits_per_sample = BitsPerChannel(format.data_type);
+  output.float_out = format.data_type == JXL_TYPE_FLOAT;
+  // Same as ConvertImageInternal: XYB frames are decoded to linear sRGB unless
+  // the image itself is in sRGB, see PassesDecoderState::Init.
+  output.apply_srgb_tf = metadata.xyb_encoded && !output.float_out &&
+                         !metadata.color_encoding.IsSRGB();
+  output.num_channels = format.num_channels;
+  output.endianness = format.endianness;
+  return output;
+}
+
+// Restricts decoding of the current frame to the crop region, if any. Frames
+// with a custom size or origin are not restricted, their pixels do not map
+// directly to the image.
+static void SetFrameRenderRect(JxlDecoder* dec) {
+  if (dec->crop_xsize == 0 || dec->frame_header->custom_size_or_origin) return;
+  // The crop region is in pixels of the image, the render rect is in pixels of
+  // the frame before upsampling.
+  const size_t upsampling = dec->frame_header->upsampling;
+  const size_t x0 = dec->crop_x0 / upsampling;
+  const size_t y0 = dec->crop_y0 / upsampling;
+  const size_t x1 = jxl::DivCeil(dec->crop_x0 + dec->crop_xsize, upsampling);
+  const size_t y1 = jxl::DivCeil(dec->crop_y0 + dec->crop_ysize, upsampling);
+  dec->frame_dec->SetRenderRect(jxl::Rect(x0, y0, x1 - x0, y1 - y0));
+}
+
 // Reads all frame headers and computes the total size in bytes of the frame.
 // Stores information in dec->frame_header and dec->frame_dim.
 // Outputs optional variables, unless set to nullptr:
@@ -734,10 +1609,6 @@ JxlDecoderStatus ParseFrameHeader(JxlDecoder* dec,
   frame_header->nonserialized_is_preview = is_preview;
   jxl::Status status = DecodeFrameHeader(reader.get(), frame_header);
   dec->frame_dim = frame_header->ToFrameDimensions();
-  if (!CheckSizeLimit(dec->frame_dim.xsize_upsampled_padded,
-                      dec->frame_dim.ysize_upsampled_padded)) {
-    return JXL_API_ERROR("frame is too large");
-  }
 
   if (status.code() == StatusCode::kNotEnoughBytes) {
     // TODO(lode): prevent asking for way too much input bytes in case of
@@ -806,9 +1677,145 @@ JxlDecoderStatus ParseFrameHeader(JxlDecoder* dec,
   return JXL_DEC_SUCCESS;
 }
 
-// TODO(eustas): no CodecInOut -> no image size reinforcement -> possible OOM.
-JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
-                                           size_t size) {
+// Returns the slots, see FrameIndexEntry, that the frame is saved to.
+int SavedAs(const FrameHeader& header) {
+  if (header.frame_type == FrameType::kDCFrame) {
+    if (header.dc_level < 1 || header.dc_level > 4) return 0;
+    return 1 << (4 + header.dc_level - 1);
+  }
+  if (header.CanBeReferenced()) return 1 << header.save_as_reference;
+  return 0;
+}
+
+// Returns the slots, see FrameIndexEntry, that the frame may read from. This
+// is conservative: patches are assumed to use all reference frames, since
+// which ones they use is only known after decoding the patch dictionary.
+int References(const FrameHeader& header) {
+  int references = 0;
+  if (header.frame_type == FrameType::kRegularFrame ||
+      header.frame_type == FrameType::kSkipProgressive) {
+    // Parts of the canvas not covered by the frame, or that the frame is
+    // blended with, come from the source frame, see DoBlending.
+    if (header.custom_size_or_origin ||
+        header.blending_info.mode != BlendMode::kReplace) {
+      references |= 1 << header.blending_info.source;
+    }
+    for (const BlendingInfo& info : header.extra_channel_blending_info) {
+      if (header.custom_size_or_origin || info.mode != BlendMode::kReplace) {
+        references |= 1 << info.source;
+      }
+    }
+  }
+  if (header.flags & FrameHeader::kPatches) references |= 0xF;
+  if ((header.flags & FrameHeader::kUseDcFrame) && header.dc_level < 4) {
+    references |= 1 << (4 + header.dc_level);
+  }
+  return references;
+}
+
+FrameIndexEntry MakeFrameIndexEntry(const FrameHeader& header, size_t start,
+                                    size_t size) {
+  FrameIndexEntry entry;
+  entry.start = start;
+  entry.size = size;
+  entry.is_last = header.is_last;
+  entry.displayed = header.is_last || header.animation_frame.duration > 0;
+  entry.saved_as = SavedAs(header);
+  entry.references = References(header);
+  return entry;
+}
+
+// Adds the next frame after the ones in dec->frame_index to it, parsing only
+// its header and TOC from the codestream bytes in `in`, which begin at
+// codestream position dec->codestream_pos.
+JxlDecoderStatus IndexNextFrame(JxlDecoder* dec, const uint8_t* in,
+                                size_t size) {
+  size_t start = dec->frame_start;
+  if (!dec->frame_index.empty()) {
+    start = dec->frame_index.back().start + dec->frame_index.back().size;
+  }
+  if (start < dec->codestream_pos) {
+    return JXL_API_ERROR("frame to index was released already");
+  }
+  size_t pos = start - dec->codestream_pos;
+  if (pos >= size) return JXL_DEC_NEED_MORE_INPUT;
+  FrameHeader header(&dec->metadata);
+  size_t frame_size;
+  JxlDecoderStatus status =
+      ParseFrameHeader(dec, &header, in, size, pos, /*is_preview=*/false,
+                       &frame_size, /*dc_size=*/nullptr);
+  if (status != JXL_DEC_SUCCESS) return status;
+  dec->frame_index.push_back(MakeFrameIndexEntry(header, start, frame_size));
+  return JXL_DEC_SUCCESS;
+}
+
+// Computes dec->frame_required for skipping dec->skip_frames displayed frames:
+// the frame displayed after them is required, and so are, going back to the
+// current frame, the last frames saved to the slots that required frames read
+// from. Indexes the frames up to the displayed one first. Returns
+// JXL_DEC_NEED_MORE_INPUT if the input does not reach its header yet.
+JxlDecoderStatus ComputeRequiredFrames(JxlDecoder* dec, const uint8_t* in,
+                                       size_t size) {
+  size_t target = dec->internal_frames;
+  size_t remaining = dec->skip_frames;
+  bool found = false;
+  for (;; target++) {
+    if (target == dec->frame_index.size()) {
+      JxlDecoderStatus status = IndexNextFrame(dec, in, size);
+      if (status != JXL_DEC_SUCCESS) return status;
+    }
+    const FrameIndexEntry& entry = dec->frame_index[target];
+    if (entry.displayed && remaining-- == 0) {
+      found = true;
+      break;
+    }
+    // Skipping past the end of the codestream: no frame is required.
+    if (entry.is_last) break;
+  }
+
+  std::vector<char> required(dec->frame_index.size(), 0);
+  if (found) {
+    required[target] = 1;
+    int needed = dec->frame_index[target].references;
+    for (size_t i = target; i-- > dec->internal_frames;) {
+      const FrameIndexEntry& entry = dec->frame_index[i];
+      if (!(entry.saved_as & needed)) continue;
+      required[i] = 1;
+      needed = (needed & ~entry.saved_as) | entry.references;
+    }
+    if (needed & dec->skipped_slots) {
+      return JXL_API_ERROR(
+          "frames needed for the requested frame were skipped already, the "
+          "decoder must be rewound");
+    }
+  }
+  dec->frame_required.swap(required);
+  return JXL_DEC_SUCCESS;
+}
+
+// Returns the number of bytes of the borrowed codestream received so far.
+size_t BorrowedCodestreamSize(const JxlDecoder* dec) {
+  if (dec->borrowed_parts.empty()) return 0;
+  return dec->borrowed_parts.back().pos + dec->borrowed_parts.back().size;
+}
+
+// Called when the deadline passed or decoding was cancelled while the current
+// frame is not complete: outputs what it has so far to the image out buffer,
+// if any, and returns JXL_DEC_CANCELLED. The frame decoder keeps its state, so
+// that decoding can continue with a later deadline.
+static JxlDecoderStatus StopFrame(JxlDecoder* dec) {
+  if (dec->is_last_of_still && dec->image_out_buffer_set &&
+      dec->frame_dec->HasDecodedDC()) {
+    // Fails if the frame cannot be rendered partially, in which case the
+    // output is left as is.
+    (void)JxlDecoderFlushImage(dec);
+  }
+  return JXL_DEC_CANCELLED;
+}
+
+// Decodes the codestream `in`, see JxlDecoderProcessInternal.
+JxlDecoderStatus ProcessCodestream(JxlDecoder* dec, const uint8_t* in,
+                                   size_t size) {
   // If no parallel runner is set, use the default
   // TODO(lode): move this initialization to an appropriate location once the
   // runner is used to decode pixels.
@@ -868,6 +1875,8 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
           ParseFrameHeader(dec, dec->frame_header.get(), in, size, pos, true,
                            &frame_size, /*dc_size=*/nullptr);
       if (status != JXL_DEC_SUCCESS) return status;
+      status = ReserveFrameMemory(dec, *dec->frame_header);
+      if (status != JXL_DEC_SUCCESS) return status;
       if (OutOfBounds(pos, frame_size, size)) {
         return JXL_DEC_NEED_MORE_INPUT;
       }
@@ -896,7 +1905,9 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
         if (dec->preview_out_buffer) {
           JxlDecoderStatus status = ConvertImageInternal(
               dec, ib, dec->preview_out_format, dec->preview_out_buffer,
-              dec->preview_out_size);
+              dec->preview_out_size, /*out_callback=*/nullptr,
+              /*out_opaque=*/nullptr, dec->thread_pool.get(),
+              /*rect=*/nullptr);
           if (status != JXL_DEC_SUCCESS) return status;
         }
         return JXL_DEC_PREVIEW_IMAGE;
@@ -915,6 +1926,25 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
     }
 
     if (dec->frame_stage == FrameStage::kHeader) {
+      if (dec->skip_frames > 0 && dec->frame_required.empty()) {
+        JxlDecoderStatus status = ComputeRequiredFrames(dec, in, size);
+        if (status != JXL_DEC_SUCCESS) return status;
+      }
+      const size_t internal_index = dec->internal_frames;
+      if (dec->skip_frames > 0 && !dec->frame_required[internal_index]) {
+        // Not needed for the frame skipped to, pass over it using the index.
+        const FrameIndexEntry& entry = dec->frame_index[internal_index];
+        dec->frame_start += entry.size;
+        dec->internal_frames++;
+        if (entry.displayed) {
+          dec->external_frames++;
+          dec->skip_frames--;
+        }
+        dec->skipped_slots |= entry.saved_as;
+        dec->is_last_total = entry.is_last;
+        continue;
+      }
+
       size_t pos = dec->frame_start - dec->codestream_pos;
       if (pos >= size) {
         return JXL_DEC_NEED_MORE_INPUT;
@@ -924,12 +1954,45 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
           dec, dec->frame_header.get(), in, size, pos,
           /*is_preview=*/false, &dec->frame_size, &dec->dc_size);
       if (status != JXL_DEC_SUCCESS) return status;
+      status = ReserveFrameMemory(dec, *dec->frame_header);
+      if (status != JXL_DEC_SUCCESS) return status;
+
+      if (internal_index == dec->frame_index.size()) {
+        dec->frame_index.push_back(MakeFrameIndexEntry(
+            *dec->frame_header, dec->frame_start, dec->frame_size));
+      }
+      const FrameIndexEntry& entry = dec->frame_index[internal_index];
+      // Also checked for the frames after the one skipped to, which are not
+      // covered by ComputeRequiredFrames.
+      if (entry.references & dec->skipped_slots) {
+        return JXL_API_ERROR(
+            "frame reads from a frame that was skipped, the decoder must be "
+            "rewound");
+      }
+      // Frames read from the pipelined frame, or from frames it also reads
+      // from, once it is finalized.
+      if (dec->pipelined_output &&
+          (entry.references & dec->pipeline_held_slots)) {
+        WaitPipelinedOutput(dec);
+      }
+      // Saved by this frame, the state of the pipelined frame no longer has
+      // the latest one.
+      dec->pipeline_held_slots &= ~entry.saved_as;
+      dec->internal_frames++;
+      dec->skipped_slots &= ~entry.saved_as;
 
       // is last in entire codestream
       dec->is_last_total = dec->frame_header->is_last;
       // is last of current still
-      dec->is_last_of_still =
-          dec->is_last_total || dec->frame_header->animation_frame.duration > 0;
+      dec->is_last_of_still = entry.displayed;
+      if (entry.displayed) {
+        dec->external_frames++;
+        if (dec->skip_frames > 0) {
+          // Needed by the frame skipped to, but not returned itself.
+          dec->skip_frames--;
+          dec->is_last_of_still = false;
+        }
+      }
 
       dec->frame_stage = FrameStage::kTOC;
 
@@ -937,7 +2000,10 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
         // Only return this for the last of a series of stills: patches frames
         // etc... before this one do not contain the correct information such
         // as animation timing, ...
-        return JXL_DEC_FRAME;
+        if (!dec->pipelined_output) return JXL_DEC_FRAME;
+        // Returned after the JXL_DEC_FULL_IMAGE of the pipelined frame, keep
+        // decoding this one in the meantime.
+        dec->frame_event_postponed = true;
       }
     }
 
@@ -955,11 +2021,20 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
 
       dec->frame_dec.reset(new FrameDecoder(
           dec->passes_state.get(), dec->metadata, dec->thread_pool.get()));
+      dec->frame_dec->SetStopSignal(&dec->stop);
 
       jxl::Status status = dec->frame_dec->InitFrame(
           reader.get(), dec->ib.get(), /*is_preview=*/false,
           /*allow_partial_frames=*/false, /*allow_partial_dc_global=*/false);
       if (!status) JXL_API_RETURN_IF_ERROR(status);
+      // Modular frames without squeeze have no lower resolution data, they
+      // are decoded in full and downsampled afterwards.
+      if (dec->frame_header->encoding == FrameEncoding::kVarDCT) {
+        dec->frame_dec->SetMaxDownsampling(dec->downsampling, kMaxNumPasses);
+      }
+      SetFrameRenderRect(dec);
+      dec->passes_state->image_out = GetStreamingImageOutput(dec);
+      dec->image_out_streamed = dec->passes_state->image_out.IsPresent();
       size_t sections_begin =
           DivCeil(reader->TotalBitsConsumed(), kBitsPerByte);
 
@@ -981,11 +2056,24 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
 
     if (dec->frame_stage == FrameStage::kFull ||
         dec->frame_stage == FrameStage::kDC) {
-      size_t pos = dec->frame_start - dec->codestream_pos;
+      // The bytes at the start of the frame may have been released already
+      // once the sections they contain were processed, in that case `in`
+      // starts inside the frame.
+      size_t in_offset = 0;
+      size_t pos = 0;
+      if (dec->codestream_pos > dec->frame_start) {
+        in_offset = dec->codestream_pos - dec->frame_start;
+      } else {
+        pos = dec->frame_start - dec->codestream_pos;
+      }
 
       bool get_dc = dec->is_last_of_still &&
                     (dec->frame_stage == FrameStage::kDC) && dec->dc_size != 0;
-      dec->sections->SetInput(in + pos, size - pos);
+      if (dec->input_borrowed) {
+        dec->sections->SetBorrowedInput(dec->borrowed_parts, dec->frame_start);
+      } else {
+        dec->sections->SetInput(in + pos, in_offset, size - pos);
+      }
       jxl::Status status =
           dec->frame_dec->ProcessSections(dec->sections->section_info.data(),
                                           dec->sections->section_info.size(),
@@ -994,13 +2082,21 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
       if (status.IsFatalError()) {
         return JXL_API_ERROR("decoding frame failed");
       }
+      dec->sections->MarkProcessed();
 
-      // TODO(lode): allow next_in to move forward if sections from the
-      // beginning of the stream have been processed
+      // Sections may be left unprocessed when stopped, even if all were
+      // received.
+      if (!dec->sections->AllDone() && dec->stop.Stopped()) {
+        return StopFrame(dec);
+      }
 
       if (get_dc) {
         // Not all DC sections have been processed yet
-        if (OutOfBounds(pos, dec->dc_size, size)) {
+        size_t available = in_offset + (size - pos);
+        if (dec->input_borrowed) {
+          available = BorrowedCodestreamSize(dec) - dec->frame_start;
+        }
+        if (available < dec->dc_size) {
           return JXL_DEC_NEED_MORE_INPUT;
         }
 
@@ -1017,16 +2113,22 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
 
       if (!get_dc) {
         if (status.code() == StatusCode::kNotEnoughBytes ||
-            dec->sections->section_info.size() <
-                dec->frame_dec->NumSections()) {
+            !dec->sections->AllReceived()) {
           // Not all sections have been processed yet
           return JXL_DEC_NEED_MORE_INPUT;
         }
 
-        if (!dec->frame_dec->FinalizeFrame()) {
+        // Frames for the image out buffer are finalized once it is set, on
+        // the pipeline executor if possible.
+        dec->finalize_deferred = dec->pipeline_executor &&
+                                 dec->is_last_of_still &&
+                                 (dec->events_wanted & JXL_DEC_FULL_IMAGE) &&
+                                 !dec->image_out_streamed;
+        if (!dec->finalize_deferred && !dec->frame_dec->FinalizeFrame()) {
           return JXL_API_ERROR("decoding frame failed");
         }
         dec->frame_dec_in_progress = false;
+        dec->arena->ReleaseUnused();
 
         dec->frame_stage = FrameStage::kFullOutput;
       }
@@ -1053,7 +2155,10 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
           ColorEncoding::LinearSRGB(dec->metadata.m.color_encoding.IsGray()));
       JXL_API_RETURN_IF_ERROR(
           ConvertImageInternal(dec, dc_bundle, dec->dc_out_format,
-                               dec->dc_out_buffer, dec->dc_out_size));
+                               dec->dc_out_buffer, dec->dc_out_size,
+                               /*out_callback=*/nullptr,
+                               /*out_opaque=*/nullptr,
+                               dec->thread_pool.get(), /*rect=*/nullptr));
       dec->got_dc_image = true;
       dec->frame_stage = FrameStage::kFull;
       return JXL_DEC_DC_IMAGE;
@@ -1079,14 +2184,33 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
               (JXL_DEC_FULL_IMAGE | JXL_DEC_DC_IMAGE | JXL_DEC_FRAME);
         }
 
+        if (dec->finalize_deferred) {
+          dec->finalize_deferred = false;
+          if (return_full_image && dec->image_out_buffer_set &&
+              CanPipelineOutput(dec)) {
+            // Finalized and converted while decoding the next frame,
+            // JXL_DEC_FULL_IMAGE is returned once that is done.
+            SubmitPipelinedOutput(dec);
+            dec->image_out_buffer_set = false;
+            return_full_image = false;
+          } else if (!dec->frame_dec->FinalizeFrame()) {
+            return JXL_API_ERROR("decoding frame failed");
+          }
+        }
+
         // Copy pixels to output buffer if desired. If no output buffer was set,
         // we merely return the JXL_DEC_FULL_IMAGE status without outputting
         // pixels.
         if (return_full_image && dec->image_out_buffer_set) {
-          JxlDecoderStatus status =
-              ConvertImageInternal(dec, *dec->ib, dec->image_out_format,
-                                   dec->image_out_buffer, dec->image_out_size);
-          if (status != JXL_DEC_SUCCESS) return status;
+          if (!dec->image_out_streamed) {
+            const jxl::Rect rect = OutputRectInFrame(dec, dec->downsampling);
+            JxlDecoderStatus status = ConvertOutputRect(
+                dec, *dec->ib, RemainingDownsampling(dec), rect,
+                dec->image_out_format, dec->image_out_buffer,
+                dec->image_out_size, dec->image_out_callback,
+                dec->image_out_opaque, dec->thread_pool.get());
+            if (status != JXL_DEC_SUCCESS) return status;
+          }
           dec->image_out_buffer_set = false;
         }
       }
@@ -1107,7 +2231,226 @@ JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
   return JXL_DEC_SUCCESS;
 }
 
+// TODO(eustas): no CodecInOut -> no image size reinforcement -> possible OOM.
+JxlDecoderStatus JxlDecoderProcessInternal(JxlDecoder* dec, const uint8_t* in,
+                                           size_t size) {
+  JxlDecoderStatus status = ProcessCodestream(dec, in, size);
+  if (!dec->pipelined_output) return status;
+  // The next frame was decoded as far as possible with this input and image
+  // out buffer, finish the output of the pipelined one.
+  JxlDecoderStatus output_status = FinishPipelinedOutput(dec);
+  if (output_status != JXL_DEC_SUCCESS) return output_status;
+  // These are returned again by the next call, which resumes from the same
+  // state.
+  if (status != JXL_DEC_NEED_MORE_INPUT &&
+      status != JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+    dec->has_deferred_status = true;
+    dec->deferred_status = status;
+  }
+  return JXL_DEC_FULL_IMAGE;
+}
+
+// Returns the position in the codestream from which on the decoder still needs
+// the input bytes. Everything before it belongs to the headers, to frames that
+// are finished, or to sections of the current frame that the FrameDecoder is
+// done with.
+size_t CodestreamNeededPos(const JxlDecoder* dec) {
+  if (!dec->got_all_headers || !dec->got_preview_image) {
+    return dec->codestream_pos;
+  }
+  size_t needed = dec->frame_start;
+  if (dec->frame_dec_in_progress && dec->sections) {
+    needed += dec->sections->FirstNeededByte();
+  }
+  return std::max(needed, dec->codestream_pos);
+}
+
+// Erases the bytes that are no longer needed from the front of the stored
+// codestream, so that it only holds the bytes of sections not yet processed.
+void ReleaseStoredCodestream(JxlDecoder* dec) {
+  UpdatePeakMemory(dec);
+  size_t release = std::min(CodestreamNeededPos(dec) - dec->codestream_pos,
+                            dec->codestream.size());
+  if (release == 0) return;
+  dec->codestream.erase(dec->codestream.begin(),
+                        dec->codestream.begin() + release);
+  dec->codestream_pos += release;
+}
+
+// Starts storing the input bytes into the codestream vector, skipping the
+// bytes at the start of `in` that are not needed anymore. `in` must begin at
+// the codestream position dec->codestream_pos.
+void StoreCodestream(JxlDecoder* dec, const uint8_t* in, size_t size) {
+  size_t skip = std::min(CodestreamNeededPos(dec) - dec->codestream_pos, size);
+  dec->codestream.insert(dec->codestream.end(), in + skip, in + size);
+  dec->codestream_pos += skip;
+  dec->codestream_stored = true;
+}
+
+// Checks the header of a box of the container, which has type `type` and
+// `box_size` bytes including the `header_size` bytes of the header, and keeps
+// track of the codestream boxes seen. Used for both copied and borrowed input.
+JxlDecoderStatus ProcessBoxHeader(JxlDecoder* dec, const char* type,
+                                  uint64_t box_size, size_t header_size) {
+  if (box_size > 0 && box_size < header_size) {
+    return JXL_API_ERROR("invalid box size");
+  }
+  bool is_jxlc = memcmp(type, "jxlc", 4) == 0;
+  if (is_jxlc || memcmp(type, "jxlp", 4) == 0) {
+    if (dec->last_codestream_seen) {
+      return JXL_API_ERROR("codestream box after the last one");
+    }
+    dec->first_codestream_seen = true;
+    if (is_jxlc || box_size == 0) dec->last_codestream_seen = true;
+  } else if (box_size == 0 && !dec->last_codestream_seen) {
+    return JXL_API_ERROR("didn't find any codestream box");
+  }
+  return JXL_DEC_SUCCESS;
+}
+
+// Adds `size` bytes of codestream at `data` to the end of the borrowed parts.
+void AddBorrowedPart(JxlDecoder* dec, const uint8_t* data, size_t size) {
+  if (size == 0) return;
+  std::vector<CodestreamPart>& parts = dec->borrowed_parts;
+  if (!parts.empty() && parts.back().data + parts.back().size == data) {
+    parts.back().size += size;
+    return;
+  }
+  parts.push_back({data, BorrowedCodestreamSize(dec), size});
+}
+
+// Takes in all available input as borrowed, recording the parts of it that
+// contain the codestream. Without container, all input is codestream.
+// Otherwise the boxes are parsed, including box headers that are split across
+// inputs.
+JxlDecoderStatus BorrowInput(JxlDecoder* dec) {
+  const uint8_t* in = dec->next_in;
+  size_t size = dec->avail_in;
+  while (size > 0) {
+    if (!dec->have_container) {
+      AddBorrowedPart(dec, in, size);
+      break;
+    }
+    if (!dec->in_box) {
+      std::vector<uint8_t>& header = dec->box_header;
+      size_t header_size =
+          (header.size() >= 8 && LoadBE32(header.data()) == 1) ? 16 : 8;
+      size_t amount = std::min(header_size - header.size(), size);
+      header.insert(header.end(), in, in + amount);
+      in += amount;
+      size -= amount;
+      if (header.size() < header_size) continue;
+      uint64_t box_size = LoadBE32(header.data());
+      if (box_size == 1) {
+        if (header.size() < 16) continue;
+        box_size = LoadBE64(header.data() + 8);
+      }
+      const char* type = reinterpret_cast<const char*>(header.data() + 4);
+      JxlDecoderStatus status =
+          ProcessBoxHeader(dec, type, box_size, header.size());
+      if (status != JXL_DEC_SUCCESS) return status;
+      dec->box_is_codestream =
+          memcmp(type, "jxlc", 4) == 0 || memcmp(type, "jxlp", 4) == 0;
+      dec->box_unbounded = (box_size == 0);
+      dec->box_remaining = dec->box_unbounded ? 0 : box_size - header.size();
+      header.clear();
+      dec->in_box = true;
+      continue;
+    }
+    size_t amount = size;
+    if (!dec->box_unbounded && amount > dec->box_remaining) {
+      amount = dec->box_remaining;
+    }
+    if (dec->box_is_codestream) AddBorrowedPart(dec, in, amount);
+    in += amount;
+    size -= amount;
+    if (!dec->box_unbounded) {
+      dec->box_remaining -= amount;
+      if (dec->box_remaining == 0) dec->in_box = false;
+    }
+  }
+  dec->file_pos += dec->avail_in;
+  dec->next_in += dec->avail_in;
+  dec->avail_in = 0;
+  return JXL_DEC_SUCCESS;
+}
+
+// Processes the borrowed codestream. The headers are parsed from a window of
+// the codestream that begins at the headers that are still needed. The window
+// points into the input of the caller if a single part contains it, and is
+// only copied into dec->codestream otherwise, e.g. when a frame header is
+// split across two codestream boxes. The sections of frames are always read
+// from the parts directly, see Sections::SetBorrowedInput.
+JxlDecoderStatus ProcessBorrowedInput(JxlDecoder* dec) {
+  // Large enough for the headers of typical images and frames.
+  constexpr size_t kInitialWindow = 1 << 16;
+  const std::vector<CodestreamPart>& parts = dec->borrowed_parts;
+  const size_t total = BorrowedCodestreamSize(dec);
+  for (;;) {
+    // The image headers and the preview frame are parsed from the beginning
+    // of the codestream, see CodestreamNeededPos.
+    size_t start = (dec->got_all_headers && dec->got_preview_image)
+                       ? std::min(dec->frame_start, total)
+                       : 0;
+    if (start != dec->borrowed_window_start || dec->borrowed_window == 0) {
+      dec->borrowed_window_start = start;
+      dec->borrowed_window = kInitialWindow;
+    }
+    size_t end = std::min(total, start + dec->borrowed_window);
+    // While the sections of a frame are processed, the window is not used and
+    // not worth copying.
+    bool in_sections = dec->frame_dec_in_progress &&
+                       (dec->frame_stage == FrameStage::kDC ||
+                        dec->frame_stage == FrameStage::kFull);
+
+    const uint8_t* in = nullptr;
+    size_t size = 0;
+    size_t part = 0;
+    while (part < parts.size() && parts[part].pos + parts[part].size <= start) {
+      part++;
+    }
+    if (part < parts.size()) {
+      const CodestreamPart& p = parts[part];
+      in = p.data + (start - p.pos);
+      size = std::min(end, p.pos + p.size) - start;
+    }
+    if (start + size < end && !in_sections) {
+      dec->codestream.clear();
+      for (size_t i = part; i < parts.size() && parts[i].pos < end; i++) {
+        const CodestreamPart& p = parts[i];
+        size_t from = std::max(start, p.pos) - p.pos;
+        size_t to = std::min(end, p.pos + p.size) - p.pos;
+        dec->codestream.insert(dec->codestream.end(), p.data + from,
+                               p.data + to);
+      }
+      in = dec->codestream.data();
+      size = dec->codestream.size();
+    }
+    dec->codestream_pos = start;
+
+    JxlDecoderStatus result = JxlDecoderProcessInternal(dec, in, size);
+    UpdatePeakMemory(dec);
+    if (result != JXL_DEC_NEED_MORE_INPUT || dec->frame_dec_in_progress) {
+      return result;
+    }
+    // The headers did not fit in the window, or the frame that was decoded
+    // ended and the header of the next one begins outside of the window.
+    size_t next_start = (dec->got_all_headers && dec->got_preview_image)
+                            ? std::min(dec->frame_start, total)
+                            : 0;
+    if (next_start == start) {
+      if (end == total) return result;
+      dec->borrowed_window *= 2;
+    }
+  }
+}
+
 }  // namespace
+
+size_t StoredCodestreamSize(const JxlDecoder* dec) {
+  return dec->codestream.size();
+}
+
 }  // namespace jxl
 
 JxlDecoderStatus JxlDecoderSetInput(JxlDecoder* dec, const uint8_t* data,
@@ -1126,9 +2469,23 @@ size_t JxlDecoderReleaseInput(JxlDecoder* dec) {
   return result;
 }
 
-JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
+namespace {
+
+// Body of JxlDecoderProcessInput, run directly or on the async executor.
+JxlDecoderStatus ProcessInputStep(JxlDecoder* dec) {
+  jxl::CacheAlignedArenaScope arena_scope(dec->arena.get());
   const uint8_t** next_in = &dec->next_in;
   size_t* avail_in = &dec->avail_in;
+  dec->output_frame_header.reset();
+  // Events held back by the frame pipelining, in the order they occurred.
+  if (dec->frame_event_postponed) {
+    dec->frame_event_postponed = false;
+    return JXL_DEC_FRAME;
+  }
+  if (dec->has_deferred_status) {
+    dec->has_deferred_status = false;
+    return dec->deferred_status;
+  }
   if (dec->stage == DecoderStage::kInited) {
     dec->stage = DecoderStage::kStarted;
   }
@@ -1155,6 +2512,12 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
     }
   }
 
+  if (dec->input_borrowed) {
+    JxlDecoderStatus status = jxl::BorrowInput(dec);
+    if (status != JXL_DEC_SUCCESS) return status;
+    return jxl::ProcessBorrowedInput(dec);
+  }
+
   if (dec->have_container) {
     /*
     Process bytes as follows:
@@ -1181,7 +2544,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
       // Therefore, store the known codestream part, and ensure processing of
       // boxes below will trigger.
 
-      if (dec->codestream.empty()) {
+      if (!dec->codestream_stored) {
         JXL_ABORT("impossible to get in this situation");
       } else {
         // Size of the codestream, excluding potential boxes that come after it.
@@ -1232,9 +2595,9 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
           pos += 8;
         }
         size_t header_size = pos - box_start;
-        if (box_size > 0 && box_size < header_size) {
-          return JXL_API_ERROR("invalid box size");
-        }
+        JxlDecoderStatus status =
+            jxl::ProcessBoxHeader(dec, type, box_size, header_size);
+        if (status != JXL_DEC_SUCCESS) return status;
         size_t min_contents_size =
             (box_size == 0)
                 ? (size - pos)
@@ -1244,10 +2607,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
         // TODO(lode): support the case where the header is split across
         // multiple codestream boxes
         if (strcmp(type, "jxlc") == 0 || strcmp(type, "jxlp") == 0) {
-          bool last_codestream = (strcmp(type, "jxlc") == 0) || (box_size == 0);
-          dec->first_codestream_seen = true;
-          if (last_codestream) dec->last_codestream_seen = true;
-          if (dec->codestream_begin != 0 && dec->codestream.empty()) {
+          if (dec->codestream_begin != 0 && !dec->codestream_stored) {
             // We've already seen a codestream part, so it's a stream spanning
             // multiple boxes.
             // We have no choice but to copy contents to the codestream
@@ -1257,14 +2617,13 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
             }
             size_t begin = dec->codestream_begin - dec->file_pos;
             size_t end = dec->codestream_end - dec->file_pos;
-            dec->codestream.insert(dec->codestream.end(), *next_in + begin,
-                                   *next_in + end);
+            jxl::StoreCodestream(dec, *next_in + begin, end - begin);
           }
           dec->codestream_begin = dec->file_pos + pos;
           dec->codestream_end =
               (box_size == 0) ? 0 : (dec->codestream_begin + contents_size);
           // If already appending codestream, append what we have here too
-          if (!dec->codestream.empty()) {
+          if (dec->codestream_stored) {
             size_t begin = pos;
             size_t end = std::min<size_t>(*avail_in, begin + min_contents_size);
             dec->codestream.insert(dec->codestream.end(), *next_in + begin,
@@ -1292,9 +2651,6 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
           if (box_size == 0) {
             // Final box with unknown size, but it's not a codestream box, so
             // nothing more to do.
-            if (!dec->last_codestream_seen) {
-              return JXL_API_ERROR("didn't find any codestream box");
-            }
             break;
           }
           if (OutOfBounds(pos, contents_size, size)) {
@@ -1304,7 +2660,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
             return JXL_DEC_NEED_MORE_INPUT;
           }
           pos += contents_size;
-          if (!(dec->codestream.empty() && dec->first_codestream_seen)) {
+          if (dec->codestream_stored || !dec->first_codestream_seen) {
             if (box_size == 0) break;  // last box, nothing to do anymore
             // Last box no longer needed, remove from input.
             dec->file_pos += pos;
@@ -1322,7 +2678,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
       csize = dec->codestream_end - dec->file_pos;
     }
 
-    if (!dec->codestream.empty()) {
+    if (dec->codestream_stored) {
       dec->codestream.insert(dec->codestream.end(), *next_in, *next_in + csize);
       dec->file_pos += csize;
       *next_in += csize;
@@ -1330,7 +2686,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
     }
 
     JxlDecoderStatus result;
-    if (dec->codestream.empty()) {
+    if (!dec->codestream_stored) {
       // No data copied to codestream buffer yet, the user input contains the
       // full codestream.
       result = jxl::JxlDecoderProcessInternal(dec, *next_in, csize);
@@ -1343,8 +2699,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
       // start copying over the codestream bytes and allow user to free them
       // instead.
       if (dec->got_basic_info && result == JXL_DEC_NEED_MORE_INPUT) {
-        dec->codestream.insert(dec->codestream.end(), *next_in,
-                               *next_in + csize);
+        jxl::StoreCodestream(dec, *next_in, csize);
         dec->file_pos += csize;
         *next_in += csize;
         *avail_in -= csize;
@@ -1353,11 +2708,12 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
     } else {
       result = jxl::JxlDecoderProcessInternal(dec, dec->codestream.data(),
                                               dec->codestream.size());
+      jxl::ReleaseStoredCodestream(dec);
     }
 
     return result;
   } else {
-    if (!dec->codestream.empty()) {
+    if (dec->codestream_stored) {
       dec->codestream.insert(dec->codestream.end(), *next_in,
                              *next_in + *avail_in);
       dec->file_pos += *avail_in;
@@ -1366,7 +2722,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
     }
 
     JxlDecoderStatus result;
-    if (dec->codestream.empty()) {
+    if (!dec->codestream_stored) {
       // No data copied to codestream buffer yet, the user input contains the
       // full codestream.
       result = jxl::JxlDecoderProcessInternal(dec, *next_in, *avail_in);
@@ -1377,10 +2733,8 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
       // allowing one-shot. Once JXL_DEC_NEED_MORE_INPUT occured at least once,
       // start copying over the codestream bytes and allow user to free them
       // instead.
-      if ((dec->got_basic_info && result == JXL_DEC_NEED_MORE_INPUT) ||
-          !dec->codestream.empty()) {
-        dec->codestream.insert(dec->codestream.end(), *next_in,
-                               *next_in + *avail_in);
+      if (dec->got_basic_info && result == JXL_DEC_NEED_MORE_INPUT) {
+        jxl::StoreCodestream(dec, *next_in, *avail_in);
         dec->file_pos += *avail_in;
         *next_in += *avail_in;
         *avail_in = 0;
@@ -1388,6 +2742,7 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
     } else {
       result = jxl::JxlDecoderProcessInternal(dec, dec->codestream.data(),
                                               dec->codestream.size());
+      jxl::ReleaseStoredCodestream(dec);
     }
 
     return result;
@@ -1396,6 +2751,35 @@ JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
   return JXL_DEC_SUCCESS;
 }
 
+void RunAsyncProcessInput(void* work_opaque) {
+  JxlDecoder* dec = static_cast<JxlDecoder*>(work_opaque);
+  dec->async_result = ProcessInputStep(dec);
+  dec->async_state.store(AsyncState::kDone, std::memory_order_release);
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderProcessInput(JxlDecoder* dec) {
+  if (!dec->async_executor) return ProcessInputStep(dec);
+  switch (dec->async_state.load(std::memory_order_acquire)) {
+    case AsyncState::kRunning:
+      return JXL_DEC_WORK_PENDING;
+    case AsyncState::kDone:
+      dec->async_state.store(AsyncState::kIdle, std::memory_order_relaxed);
+      return dec->async_result;
+    case AsyncState::kIdle:
+      break;
+  }
+  dec->async_state.store(AsyncState::kRunning, std::memory_order_relaxed);
+  dec->async_executor(dec->async_executor_opaque, &RunAsyncProcessInput, dec);
+  // The executor may have run the step before returning.
+  if (dec->async_state.load(std::memory_order_acquire) == AsyncState::kDone) {
+    dec->async_state.store(AsyncState::kIdle, std::memory_order_relaxed);
+    return dec->async_result;
+  }
+  return JXL_DEC_WORK_PENDING;
+}
+
 JxlDecoderStatus JxlDecoderGetBasicInfo(const JxlDecoder* dec,
                                         JxlBasicInfo* info) {
   if (!dec->got_basic_info) return JXL_DEC_NEED_MORE_INPUT;
@@ -1659,10 +3043,25 @@ JxlDecoderStatus PrepareSizeCheck(const JxlDecoder* dec,
 
   return JXL_DEC_SUCCESS;
 }
+
+// Called when the image output changes while a frame may be in progress:
+// pixels that were already streamed went to the previous output, so the whole
+// frame is converted at the end instead. Streamed 8-bit pixels may not have
+// been kept in the decoded image, so the frame is rendered again.
+void StopImageOutStreaming(JxlDecoder* dec) {
+  if (dec->image_out_streamed && dec->frame_dec_in_progress) {
+    dec->frame_dec->InvalidateRenderedPixels();
+  }
+  dec->image_out_streamed = false;
+  if (dec->passes_state) {
+    dec->passes_state->image_out = jxl::ExternalRowOutput();
+  }
+}
 }  // namespace
 
 JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
-  if (!dec->image_out_buffer) return JXL_DEC_ERROR;
+  jxl::CacheAlignedArenaScope arena_scope(dec->arena.get());
+  if (!dec->image_out_buffer && !dec->image_out_callback) return JXL_DEC_ERROR;
   if (!dec->sections || dec->sections->section_info.empty()) {
     return JXL_DEC_ERROR;
   }
@@ -1688,9 +3087,19 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
     return JXL_DEC_ERROR;
   }
 
-  JxlDecoderStatus status =
-      jxl::ConvertImageInternal(dec, *dec->ib, dec->image_out_format,
-                                dec->image_out_buffer, dec->image_out_size);
+  if (dec->image_out_streamed) {
+    // The flushed pixels were already passed to the callback by Flush().
+    return JXL_DEC_SUCCESS;
+  }
+
+  // The decoder keeps working on the full resolution frame, only the output
+  // rect is downsampled.
+  const jxl::Rect rect = jxl::OutputRectInFrame(dec, dec->downsampling);
+  JxlDecoderStatus status = jxl::ConvertOutputRect(
+      dec, *dec->ib, jxl::RemainingDownsampling(dec), rect,
+      dec->image_out_format, dec->image_out_buffer, dec->image_out_size,
+      dec->image_out_callback, dec->image_out_opaque,
+      dec->thread_pool.get());
   if (status != JXL_DEC_SUCCESS) return status;
   return JXL_DEC_SUCCESS;
 }
@@ -1783,13 +3192,21 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderImageOutBufferSize(
   JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits);
   if (status != JXL_DEC_SUCCESS) return status;
 
-  size_t row_size =
-      jxl::DivCeil(dec->metadata.size.xsize() * format->num_channels * bits,
-                   jxl::kBitsPerByte);
+  // Only the crop region is output, if any.
+  const jxl::Rect rect = jxl::OutputRect(dec, dec->downsampling);
+  size_t xsize = rect.xsize();
+  size_t ysize = rect.ysize();
+  if (!dec->keep_orientation &&
+      static_cast<uint32_t>(dec->metadata.m.GetOrientation()) > 4) {
+    // The orientation transposes the image.
+    std::swap(xsize, ysize);
+  }
+  size_t row_size = jxl::DivCeil(xsize * format->num_channels * bits,
+                                 jxl::kBitsPerByte);
   if (format->align > 1) {
     row_size = jxl::DivCeil(row_size, format->align) * format->align;
   }
-  *size = row_size * dec->metadata.size.ysize();
+  *size = row_size * ysize;
 
   return JXL_DEC_SUCCESS;
 }
@@ -1813,43 +3230,108 @@ JxlDecoderStatus JxlDecoderSetImageOutBuffer(JxlDecoder* dec,
   dec->image_out_buffer = buffer;
   dec->image_out_size = size;
   dec->image_out_format = *format;
+  dec->image_out_callback = nullptr;
+  dec->image_out_opaque = nullptr;
+  StopImageOutStreaming(dec);
 
   return JXL_DEC_SUCCESS;
 }
 
-JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
-                                          JxlFrameHeader* header) {
+JxlDecoderStatus JxlDecoderSetImageOutCallback(JxlDecoder* dec,
+                                               const JxlPixelFormat* format,
+                                               JxlImageOutCallback callback,
+                                               void* opaque) {
+  if (!dec->got_basic_info || !(dec->orig_events_wanted & JXL_DEC_FULL_IMAGE)) {
+    return JXL_API_ERROR("No image out callback needed at this time");
+  }
+  if (!callback) {
+    return JXL_API_ERROR("Image out callback must not be null");
+  }
+  size_t bits_per_sample;
+  // This checks whether the format is valid and supported.
+  JxlDecoderStatus status = PrepareSizeCheck(dec, format, &bits_per_sample);
+  if (status != JXL_DEC_SUCCESS) return status;
+
+  dec->image_out_buffer_set = true;
+  dec->image_out_buffer = nullptr;
+  dec->image_out_size = 0;
+  dec->image_out_format = *format;
+  dec->image_out_callback = callback;
+  dec->image_out_opaque = opaque;
+  StopImageOutStreaming(dec);
+
+  return JXL_DEC_SUCCESS;
+}
+
+namespace {
+
+// Returns the header of the frame of the last event, or null if there is none.
+const jxl::FrameHeader* EventFrameHeader(const JxlDecoder* dec) {
+  if (dec->output_frame_header) return dec->output_frame_header.get();
   if (!dec->frame_header || dec->frame_stage == FrameStage::kHeader) {
-    return JXL_API_ERROR("no frame header available");
+    return nullptr;
   }
+  return dec->frame_header.get();
+}
+
+}  // namespace
+
+JxlDecoderStatus JxlDecoderGetFrameHeader(const JxlDecoder* dec,
+                                          JxlFrameHeader* header) {
+  const jxl::FrameHeader* frame_header = EventFrameHeader(dec);
+  if (!frame_header) return JXL_API_ERROR("no frame header available");
   const auto& metadata = dec->metadata.m;
   if (metadata.have_animation) {
-    header->duration = dec->frame_header->animation_frame.duration;
+    header->duration = frame_header->animation_frame.duration;
     if (metadata.animation.have_timecodes) {
-      header->timecode = dec->frame_header->animation_frame.timecode;
+      header->timecode = frame_header->animation_frame.timecode;
     }
   }
-  header->name_length = dec->frame_header->name.size();
+  header->name_length = frame_header->name.size();
 
   return JXL_DEC_SUCCESS;
 }
 
 JxlDecoderStatus JxlDecoderGetFrameName(const JxlDecoder* dec, char* name,
                                         size_t size) {
-  if (!dec->frame_header || dec->frame_stage == FrameStage::kHeader) {
-    return JXL_API_ERROR("no frame header available");
-  }
-  if (size < dec->frame_header->name.size() + 1) {
+  const jxl::FrameHeader* frame_header = EventFrameHeader(dec);
+  if (!frame_header) return JXL_API_ERROR("no frame header available");
+  if (size < frame_header->name.size() + 1) {
     return JXL_API_ERROR("too small frame name output buffer");
   }
-  memcpy(name, dec->frame_header->name.c_str(),
-         dec->frame_header->name.size() + 1);
+  memcpy(name, frame_header->name.c_str(), frame_header->name.size() + 1);
+
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderSetMemoryLimit(JxlDecoder* dec, size_t bytes) {
+  if (dec->frame_dec_in_progress) {
+    return JXL_API_ERROR("Cannot change memory limit while decoding a frame");
+  }
+  dec->memory_limit = bytes;
+  return JXL_DEC_SUCCESS;
+}
 
+JxlDecoderStatus JxlDecoderSetDeadline(JxlDecoder* dec, double seconds) {
+  dec->stop.deadline = seconds > 0 ? jxl::Now() + seconds : 0;
   return JXL_DEC_SUCCESS;
 }
 
-#if JXL_IS_DEBUG_BUILD
-void SetDecoderMemoryLimitBase_(size_t memory_limit_base) {
-  memory_limit_base_ = memory_limit_base;
+void JxlDecoderCancel(JxlDecoder* dec) {
+  dec->stop.cancelled.store(true, std::memory_order_relaxed);
+}
+
+JxlDecoderStatus JxlDecoderSetKeepBuffers(JxlDecoder* dec,
+                                          JXL_BOOL keep_buffers) {
+  dec->keep_buffers = !!keep_buffers;
+  return JXL_DEC_SUCCESS;
+}
+
+JxlDecoderStatus JxlDecoderGetMemoryStats(const JxlDecoder* dec,
+                                          JxlDecoderMemoryStats* stats) {
+  stats->current_bytes = jxl::CurrentMemory(dec);
+  stats->peak_bytes = std::max(dec->peak_memory, stats->current_bytes);
+  stats->allocated_bytes = dec->arena->BytesInUse();
+  stats->peak_allocated_bytes = dec->arena->MaxBytesInUse();
+  return JXL_DEC_SUCCESS;
 }
-#endif
\ No newline at end of file
@@ -17,13 +17,18 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT
 #include <string>
+#include <thread>  // NOLINT
 #include <utility>
 #include <vector>
 
 #include "gtest/gtest.h"
 #include "jxl/thread_parallel_runner.h"
 #include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/file_io.h"
 #include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
@@ -40,6 +45,11 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace jxl {
+// Defined in decode.cc: number of codestream bytes the decoder keeps a copy of.
+size_t StoredCodestreamSize(const JxlDecoder* dec);
+}  // namespace jxl
+
 namespace {
 void AppendU32BE(uint32_t u32, jxl::PaddedBytes* bytes) {
   bytes->push_back(u32 >> 24);
@@ -1397,6 +1407,617 @@ TEST(DecodeTest, PixelPartialTest) {
   }
 }
 
+TEST(DecodeTest, PixelStreamingSectionsTest) {
+  // Large enough for multiple groups, so that the sections of the frame get
+  // processed and released while the rest of the input is still arriving.
+  size_t xsize = 600, ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  for (CodeStreamBoxFormat add_container : {kCSBF_None, kCSBF_Multi}) {
+    jxl::CompressParams cparams;
+    jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+        cparams, add_container, false);
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+    std::vector<uint8_t> pixels2(xsize * ysize * 3);
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+
+    const size_t step_size = 997;
+    const uint8_t* next_in = data.data();
+    size_t avail_in = 0;
+    size_t total_in = 0;
+    size_t max_stored = 0;
+    bool seen_full_image = false;
+    for (;;) {
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, next_in, avail_in));
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      max_stored = std::max(max_stored, jxl::StoredCodestreamSize(dec));
+      size_t remaining = JxlDecoderReleaseInput(dec);
+      EXPECT_LE(remaining, avail_in);
+      next_in += avail_in - remaining;
+      avail_in = remaining;
+      if (status == JXL_DEC_NEED_MORE_INPUT) {
+        if (total_in >= data.size()) {
+          FAIL();
+          break;
+        }
+        size_t amount = std::min(step_size, data.size() - total_in);
+        avail_in += amount;
+        total_in += amount;
+      } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                              pixels2.size()));
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        seen_full_image = true;
+      } else if (status == JXL_DEC_SUCCESS) {
+        break;
+      } else {
+        FAIL();
+        break;
+      }
+    }
+    EXPECT_TRUE(seen_full_image);
+    EXPECT_EQ(expected, pixels2);
+    // Only the sections that could not be processed yet are kept, never the
+    // whole codestream, and nothing is left once the image is done.
+    EXPECT_GT(max_stored, 0u);
+    EXPECT_LT(max_stored, data.size() / 2);
+    EXPECT_EQ(0u, jxl::StoredCodestreamSize(dec));
+    JxlDecoderDestroy(dec);
+  }
+}
+
+TEST(DecodeTest, InputBorrowedTest) {
+  size_t xsize = 600, ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  for (CodeStreamBoxFormat add_container : {kCSBF_None, kCSBF_Multi}) {
+    jxl::CompressParams cparams;
+    jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+        cparams, add_container, false);
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+    // Each chunk of input is in a separate buffer, which must stay alive until
+    // the decoder is destroyed.
+    std::vector<std::vector<uint8_t>> chunks;
+    std::vector<uint8_t> pixels2(xsize * ysize * 3);
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInputBorrowed(dec, JXL_TRUE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+
+    const size_t step_size = 997;
+    size_t total_in = 0;
+    bool seen_full_image = false;
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_NEED_MORE_INPUT) {
+        EXPECT_EQ(0, JxlDecoderReleaseInput(dec));
+        if (total_in >= data.size()) {
+          FAIL();
+          break;
+        }
+        size_t amount = std::min(step_size, data.size() - total_in);
+        chunks.emplace_back(data.data() + total_in,
+                            data.data() + total_in + amount);
+        total_in += amount;
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetInput(dec, chunks.back().data(), amount));
+      } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                              pixels2.size()));
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        seen_full_image = true;
+      } else if (status == JXL_DEC_SUCCESS) {
+        break;
+      } else {
+        FAIL();
+        break;
+      }
+    }
+    EXPECT_TRUE(seen_full_image);
+    EXPECT_EQ(expected, pixels2);
+    JxlDecoderDestroy(dec);
+
+    // Must be set before starting.
+    dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetInputBorrowed(dec, JXL_TRUE));
+    JxlDecoderDestroy(dec);
+  }
+}
+
+TEST(DecodeTest, InputBorrowedInvalidTest) {
+  const uint8_t kContainerSignature[12] = {0,   0,   0,   0xc, 'J', 'X',
+                                           'L', ' ', 0xd, 0xa, 0x87, 0xa};
+  std::vector<std::vector<uint8_t>> inputs;
+  // Invalid signature.
+  inputs.push_back({0xff, 0x0b, 0, 0, 0, 0, 0, 0});
+  // Box smaller than its header.
+  inputs.push_back({0, 0, 0, 4, 'f', 't', 'y', 'p'});
+  // Box that extends to the end of the file without codestream before it.
+  inputs.push_back({0, 0, 0, 0, 'E', 'x', 'i', 'f', 0, 0, 0, 0});
+  // Codestream box after the last one.
+  inputs.push_back({0, 0, 0, 10, 'j', 'x', 'l', 'c', 0xff, 0x0a,
+                    0, 0, 0, 10, 'j', 'x', 'l', 'p', 0, 0});
+  for (size_t i = 0; i < inputs.size(); i++) {
+    std::vector<uint8_t> data = inputs[i];
+    if (i > 0) {
+      data.insert(data.begin(), kContainerSignature,
+                  kContainerSignature + sizeof(kContainerSignature));
+    }
+    // Borrowed input is validated the same way as copied input.
+    for (bool borrowed : {false, true}) {
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInputBorrowed(dec, borrowed));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, data.data(), data.size()));
+      EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderProcessInput(dec))
+          << "input " << i << ", borrowed " << borrowed;
+      JxlDecoderDestroy(dec);
+    }
+  }
+}
+
+// Runs each submitted work function on a new thread.
+struct ThreadPerWorkExecutor {
+  static void Submit(void* opaque, JxlAsyncWorkFunction work,
+                     void* work_opaque) {
+    ThreadPerWorkExecutor* self = static_cast<ThreadPerWorkExecutor*>(opaque);
+    self->threads.emplace_back(work, work_opaque);
+  }
+  ~ThreadPerWorkExecutor() {
+    for (std::thread& thread : threads) thread.join();
+  }
+  std::vector<std::thread> threads;
+};
+
+TEST(DecodeTest, AsyncExecutorTest) {
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::CompressParams cparams;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      cparams, kCSBF_None, false);
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+  ThreadPerWorkExecutor executor;
+  std::vector<uint8_t> pixels2(xsize * ysize * 3);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetAsyncExecutor(dec, &ThreadPerWorkExecutor::Submit,
+                                       &executor));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO |
+                                               JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), data.size()));
+
+  std::vector<JxlDecoderStatus> events;
+  for (;;) {
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_WORK_PENDING) {
+      // An event loop would do other work here.
+      std::this_thread::yield();
+      continue;
+    }
+    events.push_back(status);
+    if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                            pixels2.size()));
+    } else if (status != JXL_DEC_BASIC_INFO && status != JXL_DEC_FULL_IMAGE) {
+      break;
+    }
+  }
+  std::vector<JxlDecoderStatus> expected_events = {
+      JXL_DEC_BASIC_INFO, JXL_DEC_NEED_IMAGE_OUT_BUFFER, JXL_DEC_FULL_IMAGE,
+      JXL_DEC_SUCCESS};
+  EXPECT_EQ(expected_events, events);
+  EXPECT_EQ(expected, pixels2);
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, DeadlineTest) {
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::CompressParams cparams;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      cparams, kCSBF_None, false);
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+  std::vector<uint8_t> pixels2(xsize * ysize * 3);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO |
+                                               JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), data.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                        pixels2.size()));
+  // A deadline that has passed by the time the groups are decoded.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDeadline(dec, 1e-9));
+  EXPECT_EQ(JXL_DEC_CANCELLED, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_CANCELLED, JxlDecoderProcessInput(dec));
+
+  // Decoding continues from where it stopped without the deadline.
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDeadline(dec, 0));
+  EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(expected, pixels2);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+
+  // Cancelling from another thread is final until the decoder is reset.
+  JxlDecoderReset(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO |
+                                               JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), data.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                        pixels2.size()));
+  std::thread cancel_thread([dec]() { JxlDecoderCancel(dec); });
+  cancel_thread.join();
+  EXPECT_EQ(JXL_DEC_CANCELLED, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDeadline(dec, 0));
+  EXPECT_EQ(JXL_DEC_CANCELLED, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, ImageOutCallbackTest) {
+  struct CallbackData {
+    size_t xsize;
+    size_t bytes_per_pixel;
+    std::vector<uint8_t> pixels;
+    std::atomic<size_t> num_pixels{0};
+  };
+  size_t xsize = 600, ysize = 400;
+  for (bool lossless : {false, true}) {
+    for (uint32_t channels = 3; channels <= 4; ++channels) {
+      // Alpha can only be streamed once the frame is complete, so with 4
+      // channels the callback is called after decoding instead.
+      std::vector<uint8_t> pixels =
+          jxl::test::GetSomeTestImage(xsize, ysize, channels, 0);
+      JxlPixelFormat format = {channels, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+      jxl::CompressParams cparams;
+      if (lossless) cparams.SetLossless();
+      jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+          jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+          channels, cparams, kCSBF_None, false);
+      std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+          jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+      CallbackData callback_data;
+      callback_data.xsize = xsize;
+      callback_data.bytes_per_pixel = channels;
+      callback_data.pixels.resize(xsize * ysize * channels);
+      auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
+                         const void* pixels) {
+        CallbackData* data = static_cast<CallbackData*>(opaque);
+        memcpy(data->pixels.data() +
+                   (y * data->xsize + x) * data->bytes_per_pixel,
+               pixels, num_pixels * data->bytes_per_pixel);
+        data->num_pixels += num_pixels;
+      };
+
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      void* runner = JxlThreadParallelRunnerCreate(
+          NULL, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetParallelRunner(
+                                     dec, JxlThreadParallelRunner, runner));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(
+                    dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, data.data(), data.size()));
+      EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutCallback(dec, &format, callback,
+                                              &callback_data));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+      JxlThreadParallelRunnerDestroy(runner);
+      JxlDecoderDestroy(dec);
+
+      EXPECT_EQ(xsize * ysize, callback_data.num_pixels.load());
+      EXPECT_EQ(expected, callback_data.pixels);
+    }
+  }
+}
+
+TEST(DecodeTest, ImageOutBufferStreamingTest) {
+  size_t xsize = 600, ysize = 400;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::CompressParams cparams;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      cparams, kCSBF_None, false);
+  for (JxlDataType data_type : {JXL_TYPE_UINT8, JXL_TYPE_UINT16}) {
+    for (uint32_t channels = 3; channels <= 4; ++channels) {
+      JxlPixelFormat format = {channels, data_type, JXL_LITTLE_ENDIAN, 0};
+      std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+          jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+      JxlDecoder* dec = JxlDecoderCreate(nullptr);
+      void* runner = JxlThreadParallelRunnerCreate(
+          NULL, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetParallelRunner(
+                                     dec, JxlThreadParallelRunner, runner));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSubscribeEvents(
+                    dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetInput(dec, data.data(), data.size()));
+      EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+      // Setting the buffer before decoding the frame makes the decoder write
+      // the pixels while decoding, for 8-bit output straight from XYB.
+      std::vector<uint8_t> out(expected.size());
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                     dec, &format, out.data(), out.size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+      JxlThreadParallelRunnerDestroy(runner);
+      JxlDecoderDestroy(dec);
+
+      EXPECT_EQ(expected, out);
+    }
+  }
+}
+
+TEST(DecodeTest, CropRegionTest) {
+  size_t xsize = 1000, ysize = 800;
+  size_t crop_x0 = 300, crop_y0 = 260, crop_xsize = 200, crop_ysize = 150;
+  for (bool lossless : {false, true}) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+    JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+    jxl::CompressParams cparams;
+    if (lossless) cparams.SetLossless();
+    jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+        cparams, kCSBF_None, false);
+    std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetCropRegion(dec, crop_x0, crop_y0, crop_xsize,
+                                      crop_ysize));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, data.data(), data.size()));
+    EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderSetCropRegion(dec, xsize - 10, 0, 20, 20));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetCropRegion(dec, crop_x0, crop_y0, crop_xsize,
+                                      crop_ysize));
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    // The output buffer only holds the crop region.
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+    EXPECT_EQ(crop_xsize * crop_ysize * 3, buffer_size);
+    std::vector<uint8_t> out(buffer_size);
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetImageOutBuffer(
+                                 dec, &format, out.data(), out.size() - 1));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, out.data(), out.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+
+    for (size_t y = 0; y < crop_ysize; y++) {
+      size_t begin = ((crop_y0 + y) * xsize + crop_x0) * 3;
+      EXPECT_TRUE(std::equal(out.begin() + y * crop_xsize * 3,
+                             out.begin() + (y + 1) * crop_xsize * 3,
+                             expected.begin() + begin));
+    }
+  }
+}
+
+TEST(DecodeTest, DownsamplingTest) {
+  size_t xsize = 1000, ysize = 700;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::CompressParams cparams;
+  // Without patches, a factor of 8 renders the frame from the DC alone.
+  cparams.patches = jxl::Override::kOff;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      cparams, kCSBF_None, false);
+  std::vector<uint8_t> full = jxl::DecodeWithAPI(
+      jxl::Span<const uint8_t>(data.data(), data.size()), format);
+
+  // The DC image, which is what a factor of 8 outputs.
+  std::vector<uint8_t> dc;
+  {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_DC_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, data.data(), data.size()));
+    EXPECT_EQ(JXL_DEC_NEED_DC_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderDCOutBufferSize(dec, &format, &buffer_size));
+    dc.resize(buffer_size);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetDCOutBuffer(dec, &format, dc.data(), dc.size()));
+    EXPECT_EQ(JXL_DEC_DC_IMAGE, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+  }
+
+  for (uint32_t downsampling : {2u, 4u, 8u}) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetDownsampling(dec, 3));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetDownsampling(dec, downsampling));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, data.data(), data.size()));
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    size_t out_xsize = jxl::DivCeil(xsize, downsampling);
+    size_t out_ysize = jxl::DivCeil(ysize, downsampling);
+    size_t buffer_size;
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+    EXPECT_EQ(out_xsize * out_ysize * 3, buffer_size);
+    std::vector<uint8_t> out(buffer_size);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, out.data(), out.size()));
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+
+    int max_diff = 2;
+    if (downsampling == 8) {
+      // Rendered straight from the DC, at 1/8 of the size.
+      ASSERT_EQ(dc.size(), out.size());
+      for (size_t i = 0; i < out.size(); i++) {
+        ASSERT_NEAR(dc[i], out[i], max_diff);
+      }
+      continue;
+    }
+    // Compare with the average of the full resolution pixels.
+    for (size_t y = 0; y < out_ysize; y++) {
+      for (size_t x = 0; x < out_xsize; x++) {
+        for (size_t c = 0; c < 3; c++) {
+          int sum = 0, count = 0;
+          for (size_t iy = y * downsampling;
+               iy < std::min(ysize, (y + 1) * downsampling); iy++) {
+            for (size_t ix = x * downsampling;
+                 ix < std::min(xsize, (x + 1) * downsampling); ix++) {
+              sum += full[(iy * xsize + ix) * 3 + c];
+              count++;
+            }
+          }
+          int average = (sum + count / 2) / count;
+          ASSERT_NEAR(average, out[(y * out_xsize + x) * 3 + c], max_diff);
+        }
+      }
+    }
+  }
+}
+
+TEST(DecodeTest, MemoryLimitTest) {
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::CompressParams cparams;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      cparams, kCSBF_None, false);
+  jxl::Span<const uint8_t> span(data.data(), data.size());
+  // Bytes of the decoded image alone.
+  size_t image_bytes = xsize * ysize * 3 * sizeof(float);
+
+  // Without limit.
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  JxlDecoderMemoryStats stats;
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetMemoryStats(dec, &stats));
+  EXPECT_LT(stats.current_bytes, image_bytes);
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(dec, span, format);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetMemoryStats(dec, &stats));
+  EXPECT_LE(stats.current_bytes, stats.peak_bytes);
+  EXPECT_GT(stats.peak_bytes, image_bytes);
+  // The decoded image is allocated from the memory manager too.
+  EXPECT_LE(stats.allocated_bytes, stats.peak_allocated_bytes);
+  EXPECT_GT(stats.peak_allocated_bytes, image_bytes);
+  size_t peak_bytes = stats.peak_bytes;
+  JxlDecoderReset(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetMemoryStats(dec, &stats));
+  EXPECT_LT(stats.peak_bytes, image_bytes);
+  EXPECT_LT(stats.peak_allocated_bytes, image_bytes);
+  JxlDecoderDestroy(dec);
+
+  // A limit of the peak memory without limit is enough.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetMemoryLimit(dec, peak_bytes));
+  EXPECT_EQ(expected, jxl::DecodeWithAPI(dec, span, format));
+  JxlDecoderDestroy(dec);
+
+  // The image alone does not fit, fails at the basic info.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetMemoryLimit(dec, image_bytes / 2));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), data.size()));
+  EXPECT_EQ(JXL_DEC_MEMORY_LIMIT_EXCEEDED, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+
+  // The image fits, but not the buffers to decode the frame.
+  dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetMemoryLimit(dec, image_bytes));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), data.size()));
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_MEMORY_LIMIT_EXCEEDED, JxlDecoderProcessInput(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetMemoryStats(dec, &stats));
+  EXPECT_LE(stats.peak_bytes, image_bytes);
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, KeepBuffersTest) {
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+  jxl::CompressParams cparams;
+  std::vector<jxl::PaddedBytes> images;
+  std::vector<std::vector<uint8_t>> expected;
+  // Images of different sizes, so that the kept buffers are both too small
+  // and too large for the next image.
+  for (size_t size : {300, 100, 500}) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(size, size * 3 / 4, 3, size);
+    images.push_back(jxl::CreateTestJXLCodestream(
+        jxl::Span<const uint8_t>(pixels.data(), pixels.size()), size,
+        size * 3 / 4, 3, cparams, kCSBF_None, false));
+    expected.push_back(jxl::DecodeWithAPI(
+        jxl::Span<const uint8_t>(images.back().data(), images.back().size()),
+        format));
+  }
+
+  // Decodes each image `num_reps` times with the same decoder, and returns
+  // the number of buffer allocations made while doing so.
+  auto decode_all = [&](bool keep_buffers, size_t num_reps) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetKeepBuffers(dec, keep_buffers));
+    uint64_t num_allocations = jxl::CacheAligned::NumAllocations();
+    for (size_t i = 0; i < images.size(); i++) {
+      for (size_t rep = 0; rep < num_reps; rep++) {
+        jxl::Span<const uint8_t> span(images[i].data(), images[i].size());
+        EXPECT_EQ(expected[i], jxl::DecodeWithAPI(dec, span, format));
+        JxlDecoderReset(dec);
+      }
+    }
+    num_allocations = jxl::CacheAligned::NumAllocations() - num_allocations;
+    JxlDecoderDestroy(dec);
+    return num_allocations;
+  };
+
+  const size_t kNumReps = 10;
+  uint64_t without_keep = decode_all(false, kNumReps);
+  uint64_t with_keep = decode_all(true, kNumReps);
+  EXPECT_LT(with_keep, without_keep);
+}
+
 TEST(DecodeTest, DCTest) {
   using jxl::kBlockDim;
 
@@ -1786,7 +2407,456 @@ TEST(DecodeTest, AnimationTest) {
   JxlDecoderDestroy(dec);
 }
 
-TEST(DecodeTest, AnimationTestStreaming) {
+TEST(DecodeTest, AnimationTestFramePipelining) {
+  size_t xsize = 123, ysize = 77;
+  static const size_t num_frames = 3;
+  std::vector<uint8_t> frames[num_frames];
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(16);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  io.frames.reserve(num_frames);
+
+  for (size_t i = 0; i < num_frames; ++i) {
+    frames[i] = jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frames[i].data(), frames[i].size()), xsize,
+        ysize, jxl::ColorEncoding::SRGB(/*is_gray=*/false), /*has_alpha=*/false,
+        /*alpha_is_premultiplied=*/false, /*bits_per_sample=*/16,
+        JXL_BIG_ENDIAN, /*flipped_y=*/false, /*pool=*/nullptr, &bundle));
+    bundle.duration = 5 + i;
+    io.frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();  // Lossless to verify pixels exactly after roundtrip.
+  jxl::AuxOut aux_out;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed, &aux_out,
+                              nullptr));
+
+  ThreadPerWorkExecutor executor;
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetFramePipelining(dec, &ThreadPerWorkExecutor::Submit,
+                                         &executor));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec, JXL_DEC_BASIC_INFO | JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+
+  EXPECT_EQ(JXL_DEC_BASIC_INFO, JxlDecoderProcessInput(dec));
+  // Can only be set before starting.
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderSetFramePipelining(dec, &ThreadPerWorkExecutor::Submit,
+                                         &executor));
+  size_t buffer_size;
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderImageOutBufferSize(dec, &format, &buffer_size));
+
+  // The events are the same as without pipelining, and the frame header is
+  // that of the frame of the last event, even though the next frame is being
+  // decoded already.
+  for (size_t i = 0; i < num_frames; ++i) {
+    // Separate buffers, the pixels of a frame are written while the next
+    // frame is decoded.
+    std::vector<uint8_t> pixels(buffer_size);
+
+    EXPECT_EQ(JXL_DEC_FRAME, JxlDecoderProcessInput(dec));
+    JxlFrameHeader frame_header;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec, &frame_header));
+    EXPECT_EQ(5 + i, frame_header.duration);
+
+    EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetImageOutBuffer(
+                                   dec, &format, pixels.data(), pixels.size()));
+
+    EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    EXPECT_EQ(0, ComparePixels(frames[i].data(), pixels.data(), xsize, ysize,
+                               format, format));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetFrameHeader(dec, &frame_header));
+    EXPECT_EQ(5 + i, frame_header.duration);
+  }
+
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+  // All but the last frame were converted on the executor.
+  EXPECT_EQ(num_frames - 1, executor.threads.size());
+}
+
+// Parallel runner that counts how often it is called, and runs the tasks on
+// `runner`, a JxlThreadParallelRunner.
+struct CountingRunner {
+  static JxlParallelRetCode Run(void* runner_opaque, void* jpegxl_opaque,
+                                JxlParallelRunInit init,
+                                JxlParallelRunFunction func,
+                                uint32_t start_range, uint32_t end_range) {
+    CountingRunner* self = static_cast<CountingRunner*>(runner_opaque);
+    self->calls++;
+    return JxlThreadParallelRunner(self->runner, jpegxl_opaque, init, func,
+                                   start_range, end_range);
+  }
+  void* runner;
+  std::atomic<size_t> calls{0};
+};
+
+// Runs each submitted work function on a new thread, once the decoder called
+// its parallel runner again after the submission, which means that it went on
+// decoding the next frame, or after a timeout.
+struct OverlapCheckingExecutor {
+  static void Submit(void* opaque, JxlAsyncWorkFunction work,
+                     void* work_opaque) {
+    OverlapCheckingExecutor* self =
+        static_cast<OverlapCheckingExecutor*>(opaque);
+    size_t calls = self->decoder_runner->calls;
+    self->threads.emplace_back([self, work, work_opaque, calls]() {
+      for (int i = 0; i < 10000 && self->decoder_runner->calls == calls; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      if (self->decoder_runner->calls != calls) self->num_overlapped++;
+      work(work_opaque);
+    });
+  }
+  ~OverlapCheckingExecutor() {
+    for (std::thread& thread : threads) thread.join();
+  }
+  CountingRunner* decoder_runner;
+  std::atomic<size_t> num_overlapped{0};
+  std::vector<std::thread> threads;
+};
+
+TEST(DecodeTest, FramePipeliningOverlapTest) {
+  size_t xsize = 300, ysize = 200;
+  static const size_t num_frames = 3;
+  std::vector<uint8_t> frames[num_frames];
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(8);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  io.frames.reserve(num_frames);
+  for (size_t i = 0; i < num_frames; ++i) {
+    frames[i] = jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frames[i].data(), frames[i].size()), xsize,
+        ysize, jxl::ColorEncoding::SRGB(/*is_gray=*/false), /*has_alpha=*/false,
+        /*alpha_is_premultiplied=*/false, /*bits_per_sample=*/8,
+        JXL_LITTLE_ENDIAN, /*flipped_y=*/false, /*pool=*/nullptr, &bundle));
+    bundle.duration = 1;
+    io.frames.push_back(std::move(bundle));
+  }
+  jxl::CompressParams cparams;
+  // Frames with patches read from all reference frames, and would wait for
+  // the previous frame.
+  cparams.patches = jxl::Override::kOff;
+  jxl::AuxOut aux_out;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed, &aux_out,
+                              nullptr));
+  size_t buffer_size = xsize * ysize * 3;
+
+  // Decodes all frames, with pipelining if `executor` is not null, and
+  // returns their pixels.
+  auto decode = [&](CountingRunner* decoder_runner,
+                    CountingRunner* pipeline_runner,
+                    OverlapCheckingExecutor* executor) {
+    std::vector<std::vector<uint8_t>> pixels;
+    JxlDecoder* dec = JxlDecoderCreate(NULL);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelRunner(dec, &CountingRunner::Run,
+                                          decoder_runner));
+    if (executor) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetFramePipelining(
+                    dec, &OverlapCheckingExecutor::Submit, executor));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetFramePipeliningRunner(dec, &CountingRunner::Run,
+                                                   pipeline_runner));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    for (size_t i = 0; i < num_frames; ++i) {
+      pixels.emplace_back(buffer_size);
+      EXPECT_EQ(JXL_DEC_NEED_IMAGE_OUT_BUFFER, JxlDecoderProcessInput(dec));
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels.back().data(),
+                                            pixels.back().size()));
+      EXPECT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+    return pixels;
+  };
+
+  void* runner = JxlThreadParallelRunnerCreate(NULL, 2);
+  void* runner2 = JxlThreadParallelRunnerCreate(NULL, 2);
+  CountingRunner sequential_runner;
+  sequential_runner.runner = runner;
+  std::vector<std::vector<uint8_t>> expected =
+      decode(&sequential_runner, nullptr, nullptr);
+
+  CountingRunner decoder_runner;
+  decoder_runner.runner = runner;
+  CountingRunner pipeline_runner;
+  pipeline_runner.runner = runner2;
+  std::vector<std::vector<uint8_t>> pixels;
+  size_t num_overlapped;
+  size_t num_submitted;
+  {
+    OverlapCheckingExecutor executor;
+    executor.decoder_runner = &decoder_runner;
+    pixels = decode(&decoder_runner, &pipeline_runner, &executor);
+    num_submitted = executor.threads.size();
+    num_overlapped = executor.num_overlapped;
+  }
+  EXPECT_EQ(expected, pixels);
+  // All but the last frame were finalized on the executor, while the decoding
+  // of the next frame went on.
+  EXPECT_EQ(num_frames - 1, num_submitted);
+  EXPECT_EQ(num_frames - 1, num_overlapped);
+  // Their filters and conversion ran on the pipeline runner instead of the one
+  // of the decoder.
+  EXPECT_GT(pipeline_runner.calls.load(), 0u);
+  EXPECT_LT(decoder_runner.calls.load(), sequential_runner.calls.load());
+
+  JxlThreadParallelRunnerDestroy(runner2);
+  JxlThreadParallelRunnerDestroy(runner);
+}
+
+TEST(DecodeTest, SkipFramesTest) {
+  size_t xsize = 123, ysize = 77;
+  static const size_t num_frames = 6;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  size_t buffer_size = xsize * ysize * 3 * 2;
+
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(16);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  io.frames.reserve(num_frames);
+
+  // Frames 0 and 3 cover the whole image, the others are smaller and depend
+  // on the frame before them.
+  for (size_t i = 0; i < num_frames; ++i) {
+    bool full = (i % 3 == 0);
+    size_t frame_xsize = full ? xsize : 40;
+    size_t frame_ysize = full ? ysize : 30;
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(frame_xsize, frame_ysize, 3, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frame.data(), frame.size()), frame_xsize,
+        frame_ysize, jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*has_alpha=*/false, /*alpha_is_premultiplied=*/false,
+        /*bits_per_sample=*/16, JXL_BIG_ENDIAN, /*flipped_y=*/false,
+        /*pool=*/nullptr, &bundle));
+    if (!full) {
+      bundle.origin.x0 = 10 * i;
+      bundle.origin.y0 = 5 * i;
+    }
+    bundle.duration = 1;
+    bundle.use_for_next_frame = true;
+    io.frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();
+  jxl::AuxOut aux_out;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed, &aux_out,
+                              nullptr));
+
+  // Returns the pixels of the next frame.
+  auto decode_next = [&](JxlDecoder* dec) -> std::vector<uint8_t> {
+    std::vector<uint8_t> pixels(buffer_size);
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                              pixels.size()));
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        return pixels;
+      } else {
+        ADD_FAILURE();
+        return std::vector<uint8_t>();
+      }
+    }
+  };
+
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  std::vector<uint8_t> expected[num_frames];
+  for (size_t i = 0; i < num_frames; ++i) {
+    expected[i] = decode_next(dec);
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+
+  // With frame pipelining, the frames that blend onto the previous one wait
+  // for it to be finalized.
+  {
+    ThreadPerWorkExecutor executor;
+    dec = JxlDecoderCreate(NULL);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetFramePipelining(dec, &ThreadPerWorkExecutor::Submit,
+                                           &executor));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+    for (size_t i = 0; i < num_frames; ++i) {
+      EXPECT_EQ(expected[i], decode_next(dec));
+    }
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+    JxlDecoderDestroy(dec);
+  }
+
+  dec = JxlDecoderCreate(NULL);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, 4);
+  EXPECT_EQ(expected[4], decode_next(dec));
+  EXPECT_EQ(expected[5], decode_next(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+
+  // Seek back, using the frame index built so far.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, 2);
+  EXPECT_EQ(expected[2], decode_next(dec));
+  JxlDecoderSkipFrames(dec, 2);
+  EXPECT_EQ(expected[5], decode_next(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+
+  // Skipping past the end skips all frames.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, num_frames);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, SkipFramesSkippedReferenceTest) {
+  size_t xsize = 123, ysize = 77;
+  static const size_t num_frames = 3;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  size_t buffer_size = xsize * ysize * 3 * 2;
+
+  jxl::CodecInOut io;
+  io.SetSize(xsize, ysize);
+  io.metadata.m.SetUintSamples(16);
+  io.metadata.m.color_encoding = jxl::ColorEncoding::SRGB(false);
+  io.metadata.m.have_animation = true;
+  io.frames.clear();
+  io.frames.reserve(num_frames);
+
+  // Frame 0 is saved, frame 1 replaces it without being saved, and frame 2 is
+  // smaller and composited onto frame 0, which is not needed for frame 1.
+  for (size_t i = 0; i < num_frames; ++i) {
+    bool full = i < 2;
+    size_t frame_xsize = full ? xsize : 40;
+    size_t frame_ysize = full ? ysize : 30;
+    std::vector<uint8_t> frame =
+        jxl::test::GetSomeTestImage(frame_xsize, frame_ysize, 3, i);
+    jxl::ImageBundle bundle(&io.metadata.m);
+    EXPECT_TRUE(ConvertFromExternal(
+        jxl::Span<const uint8_t>(frame.data(), frame.size()), frame_xsize,
+        frame_ysize, jxl::ColorEncoding::SRGB(/*is_gray=*/false),
+        /*has_alpha=*/false, /*alpha_is_premultiplied=*/false,
+        /*bits_per_sample=*/16, JXL_BIG_ENDIAN, /*flipped_y=*/false,
+        /*pool=*/nullptr, &bundle));
+    if (!full) {
+      bundle.origin.x0 = 10;
+      bundle.origin.y0 = 5;
+    }
+    bundle.duration = 1;
+    bundle.use_for_next_frame = (i == 0);
+    io.frames.push_back(std::move(bundle));
+  }
+
+  jxl::CompressParams cparams;
+  cparams.SetLossless();
+  // Patches would make frame 1 depend on frame 0.
+  cparams.patches = jxl::Override::kOff;
+  jxl::AuxOut aux_out;
+  jxl::PaddedBytes compressed;
+  jxl::PassesEncoderState enc_state;
+  EXPECT_TRUE(jxl::EncodeFile(cparams, &io, &enc_state, &compressed, &aux_out,
+                              nullptr));
+
+  // Returns the pixels of the next frame.
+  auto decode_next = [&](JxlDecoder* dec) -> std::vector<uint8_t> {
+    std::vector<uint8_t> pixels(buffer_size);
+    for (;;) {
+      JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+      if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+        EXPECT_EQ(JXL_DEC_SUCCESS,
+                  JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                              pixels.size()));
+      } else if (status == JXL_DEC_FULL_IMAGE) {
+        return pixels;
+      } else {
+        ADD_FAILURE();
+        return std::vector<uint8_t>();
+      }
+    }
+  };
+
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE));
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  std::vector<uint8_t> expected[num_frames];
+  for (size_t i = 0; i < num_frames; ++i) {
+    expected[i] = decode_next(dec);
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+
+  // Frame 0 is passed over, so frame 2 cannot be decoded after frame 1.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, 1);
+  EXPECT_EQ(expected[1], decode_next(dec));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderProcessInput(dec));
+
+  // Skipping to frame 2 directly decodes frame 0 for it.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSetInput(dec, compressed.data(), compressed.size()));
+  JxlDecoderSkipFrames(dec, 2);
+  EXPECT_EQ(expected[2], decode_next(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderProcessInput(dec));
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, AnimationTestStreaming) {
   size_t xsize = 123, ysize = 77;
   static const size_t num_frames = 2;
   std::vector<uint8_t> frames[2];
@@ -1988,3 +3058,91 @@ TEST(DecodeTest, FlushTest) {
 
   JxlDecoderDestroy(dec);
 }
+
+TEST(DecodeTest, FlushIncrementalTest) {
+  // Large enough for several groups, so that each flush only renders some of
+  // them again.
+  size_t xsize = 900, ysize = 700;
+  uint32_t num_channels = 3;
+  std::vector<uint8_t> pixels =
+      jxl::test::GetSomeTestImage(xsize, ysize, num_channels, 0);
+  jxl::CompressParams cparams;
+  jxl::PaddedBytes data = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize,
+      num_channels, cparams, kCSBF_None, true);
+  JxlPixelFormat format = {num_channels, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  size_t buffer_size = xsize * ysize * num_channels * 2;
+
+  // Returns the pixels of a single flush after `size` bytes of input, or an
+  // empty vector if flushing is not possible yet.
+  auto flush_once = [&](size_t size) -> std::vector<uint8_t> {
+    std::vector<uint8_t> result(buffer_size);
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSubscribeEvents(
+                  dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, data.data(), size));
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    if (status == JXL_DEC_BASIC_INFO) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, result.data(),
+                                            result.size()));
+      status = JxlDecoderProcessInput(dec);
+    }
+    EXPECT_EQ(JXL_DEC_NEED_MORE_INPUT, status);
+    if (JxlDecoderFlushImage(dec) != JXL_DEC_SUCCESS) result.clear();
+    JxlDecoderDestroy(dec);
+    return result;
+  };
+
+  // Flushes after every chunk of input. Each flush must give the same pixels
+  // as a single flush of a new decoder, which renders the whole frame.
+  std::vector<uint8_t> pixels2(buffer_size);
+  JxlDecoder* dec = JxlDecoderCreate(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE));
+  const size_t step_size = data.size() / 16;
+  const uint8_t* next_in = data.data();
+  size_t avail_in = 0;
+  size_t total_in = 0;
+  size_t num_flushes = 0;
+  bool seen_full_image = false;
+  for (;;) {
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetInput(dec, next_in, avail_in));
+    JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+    size_t remaining = JxlDecoderReleaseInput(dec);
+    next_in += avail_in - remaining;
+    avail_in = remaining;
+    if (status == JXL_DEC_NEED_MORE_INPUT) {
+      if (JxlDecoderFlushImage(dec) == JXL_DEC_SUCCESS) {
+        EXPECT_EQ(flush_once(total_in), pixels2);
+        num_flushes++;
+      }
+      if (total_in >= data.size()) {
+        FAIL();
+        break;
+      }
+      size_t amount = std::min(step_size, data.size() - total_in);
+      avail_in += amount;
+      total_in += amount;
+    } else if (status == JXL_DEC_BASIC_INFO) {
+      EXPECT_EQ(JXL_DEC_SUCCESS,
+                JxlDecoderSetImageOutBuffer(dec, &format, pixels2.data(),
+                                            pixels2.size()));
+    } else if (status == JXL_DEC_FULL_IMAGE) {
+      seen_full_image = true;
+    } else if (status == JXL_DEC_SUCCESS) {
+      break;
+    } else {
+      FAIL();
+      break;
+    }
+  }
+  EXPECT_TRUE(seen_full_image);
+  EXPECT_LT(1u, num_flushes);
+  EXPECT_EQ(jxl::DecodeWithAPI(
+                jxl::Span<const uint8_t>(data.data(), data.size()), format),
+            pixels2);
+  JxlDecoderDestroy(dec);
+}
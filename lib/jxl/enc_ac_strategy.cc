@@ -594,8 +594,8 @@ void FindBestAcStrategy(const Image3F& src,
 
   const size_t xsize_blocks = enc_state->shared.frame_dim.xsize_blocks;
   const size_t ysize_blocks = enc_state->shared.frame_dim.ysize_blocks;
-  // In Falcon mode, use DCT8 everywhere and uniform quantization.
-  if (cparams.speed_tier == SpeedTier::kFalcon) {
+  // In Falcon mode and faster, use DCT8 everywhere and uniform quantization.
+  if (cparams.speed_tier >= SpeedTier::kFalcon) {
     ac_strategy->FillDCT8();
     return;
   }
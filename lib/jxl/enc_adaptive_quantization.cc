@@ -369,31 +369,6 @@ void FuzzyErosion(const ImageF& from, ImageF* to) {
   }
 }
 
-void DownsampleImage(ImageF* opsin, size_t factor) {
-  JXL_ASSERT(factor != 1);
-  ImageF downsampled(DivCeil(opsin->xsize(), factor),
-                     DivCeil(opsin->ysize(), factor));
-  size_t in_stride = opsin->PixelsPerRow();
-  for (size_t y = 0; y < downsampled.ysize(); y++) {
-    float* row_out = downsampled.Row(y);
-    const float* row_in = opsin->Row(factor * y);
-    for (size_t x = 0; x < downsampled.xsize(); x++) {
-      size_t cnt = 0;
-      float sum = 0;
-      for (size_t iy = 0; iy < factor && iy + factor * y < opsin->ysize();
-           iy++) {
-        for (size_t ix = 0; ix < factor && ix + factor * x < opsin->xsize();
-             ix++) {
-          sum += row_in[iy * in_stride + x * factor + ix];
-          cnt++;
-        }
-      }
-      row_out[x] = sum / cnt;
-    }
-  }
-  *opsin = std::move(downsampled);
-}
-
 void DownsampleX(ImageF* opsin, size_t factor) {
   JXL_ASSERT(factor != 1);
   ImageF downsampled(DivCeil(opsin->xsize(), factor), opsin->ysize());
@@ -1127,7 +1102,7 @@ void FindBestQuantizer(const ImageBundle* linear, const Image3F& opsin,
   if (cparams.max_error_mode) {
     PROFILER_ZONE("enc find best maxerr");
     FindBestQuantizationMaxError(opsin, enc_state, pool, aux_out);
-  } else if (cparams.speed_tier == SpeedTier::kFalcon) {
+  } else if (cparams.speed_tier >= SpeedTier::kFalcon) {
     const float quant_dc = InitialQuantDC(cparams.butteraugli_distance);
     // TODO(veluca): tune constant.
     const float quant_ac = kAcQuant / cparams.butteraugli_distance;
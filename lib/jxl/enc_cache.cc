@@ -43,10 +43,12 @@
 
 namespace jxl {
 
-void InitializePassesEncoder(const Image3F& opsin, ThreadPool* pool,
-                             PassesEncoderState* enc_state,
-                             ModularFrameEncoder* modular_frame_encoder,
-                             AuxOut* aux_out) {
+void InitializePassesEncoder(
+    const Image3F& opsin, ThreadPool* pool, PassesEncoderState* enc_state,
+    ModularFrameEncoder* modular_frame_encoder, AuxOut* aux_out,
+    const std::function<Status(size_t num_threads)>& process_group_init,
+    const std::function<void(size_t group_idx, size_t thread)>&
+        process_group) {
   PROFILER_FUNC;
 
   PassesSharedState& JXL_RESTRICT shared = enc_state->shared;
@@ -72,12 +74,22 @@ void InitializePassesEncoder(const Image3F& opsin, ThreadPool* pool,
   }
 
   Image3F dc(shared.frame_dim.xsize_blocks, shared.frame_dim.ysize_blocks);
-  RunOnPool(
-      pool, 0, shared.frame_dim.num_groups, ThreadPool::SkipInit(),
-      [&](size_t group_idx, size_t _) {
-        ComputeCoefficients(group_idx, enc_state, opsin, &dc);
-      },
-      "Compute coeffs");
+  if (process_group) {
+    RunOnPool(
+        pool, 0, shared.frame_dim.num_groups, process_group_init,
+        [&](size_t group_idx, size_t thread) {
+          ComputeCoefficients(group_idx, enc_state, opsin, &dc);
+          process_group(group_idx, thread);
+        },
+        "Compute coeffs");
+  } else {
+    RunOnPool(
+        pool, 0, shared.frame_dim.num_groups, ThreadPool::SkipInit(),
+        [&](size_t group_idx, size_t _) {
+          ComputeCoefficients(group_idx, enc_state, opsin, &dc);
+        },
+        "Compute coeffs");
+  }
 
   if (shared.frame_header.flags & FrameHeader::kUseDcFrame) {
     CompressParams cparams = enc_state->cparams;
@@ -167,7 +179,7 @@ void InitializePassesEncoder(const Image3F& opsin, ThreadPool* pool,
       modular_frame_encoder->AddVarDCTDC(
           dc, group_index,
           enc_state->cparams.butteraugli_distance >= 2.0f &&
-              enc_state->cparams.speed_tier != SpeedTier::kFalcon,
+              enc_state->cparams.speed_tier < SpeedTier::kFalcon,
           enc_state);
     };
     RunOnPool(pool, 0, shared.frame_dim.num_dc_groups, ThreadPool::SkipInit(),
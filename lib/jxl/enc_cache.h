@@ -18,6 +18,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <functional>
 #include <vector>
 
 #include "lib/jxl/ac_strategy.h"
@@ -82,11 +83,19 @@ struct PassesEncoderState {
 };
 
 // Initialize per-frame information.
+// If `process_group` is set, it is called for each group right after its
+// coefficients are computed, on the same thread, with the thread index of a
+// ThreadPool task; `process_group_init` is then called before any group with
+// the number of threads, after the coefficients are allocated.
 class ModularFrameEncoder;
-void InitializePassesEncoder(const Image3F& opsin, ThreadPool* pool,
-                             PassesEncoderState* passes_enc_state,
-                             ModularFrameEncoder* modular_frame_encoder,
-                             AuxOut* aux_out);
+void InitializePassesEncoder(
+    const Image3F& opsin, ThreadPool* pool,
+    PassesEncoderState* passes_enc_state,
+    ModularFrameEncoder* modular_frame_encoder, AuxOut* aux_out,
+    const std::function<Status(size_t num_threads)>& process_group_init =
+        nullptr,
+    const std::function<void(size_t group_idx, size_t thread)>&
+        process_group = nullptr);
 
 // Working area for ComputeCoefficients (per-group!)
 struct EncCache {
@@ -490,17 +490,16 @@ class LossyFrameEncoder {
     JXL_RETURN_IF_ERROR(enc_state_->heuristics->LossyFrameHeuristics(
         enc_state_, modular_frame_encoder, linear, opsin, pool_, aux_out_));
 
-    InitializePassesEncoder(*opsin, pool_, enc_state_, modular_frame_encoder,
-                            aux_out_);
-
-    enc_state_->passes.resize(enc_state_->progressive_splitter.GetNumPasses());
-    for (PassesEncoderState::PassData& pass : enc_state_->passes) {
-      pass.ac_tokens.resize(shared.frame_dim.num_groups);
-    }
-
-    ComputeAllCoeffOrders(shared.frame_dim);
-    shared.num_histograms = 1;
+    const auto prepare_tokenization = [&]() {
+      enc_state_->passes.resize(
+          enc_state_->progressive_splitter.GetNumPasses());
+      for (PassesEncoderState::PassData& pass : enc_state_->passes) {
+        pass.ac_tokens.resize(shared.frame_dim.num_groups);
+      }
 
+      ComputeAllCoeffOrders(shared.frame_dim);
+      shared.num_histograms = 1;
+    };
     const auto tokenize_group_init = [&](const size_t num_threads) {
       group_caches_.resize(num_threads);
       return true;
@@ -527,8 +526,31 @@ class LossyFrameEncoder {
             enc_state_->shared.block_ctx_map);
       }
     };
-    RunOnPool(pool_, 0, shared.frame_dim.num_groups, tokenize_group_init,
-              tokenize_group, "TokenizeGroup");
+
+    if (CanTokenizeWithCoefficients()) {
+      // Tokenize each group right after computing its coefficients, while they
+      // are still in cache.
+      // The quantized DC is only computed after all the groups, by DequantDC,
+      // and selects the DC context of the blocks. With a single DC context,
+      // it is zero everywhere, so zero-filling it in advance gives the same
+      // tokens. Block context maps with DC thresholds do not get here, see
+      // CanTokenizeWithCoefficients.
+      JXL_DASSERT(shared.block_ctx_map.num_dc_ctxs == 1);
+      ZeroFillImage(&shared.quant_dc);
+      InitializePassesEncoder(
+          *opsin, pool_, enc_state_, modular_frame_encoder, aux_out_,
+          [&](const size_t num_threads) -> Status {
+            prepare_tokenization();
+            return tokenize_group_init(num_threads);
+          },
+          tokenize_group);
+    } else {
+      InitializePassesEncoder(*opsin, pool_, enc_state_, modular_frame_encoder,
+                              aux_out_);
+      prepare_tokenization();
+      RunOnPool(pool_, 0, shared.frame_dim.num_groups, tokenize_group_init,
+                tokenize_group, "TokenizeGroup");
+    }
 
     *frame_header = shared.frame_header;
     return true;
@@ -951,14 +973,26 @@ class LossyFrameEncoder {
   PassesEncoderState* State() { return enc_state_; }
 
  private:
+  // Whether the AC tokens of a group only depend on its own coefficients and
+  // on the results of LossyFrameHeuristics, which is the case when the
+  // coefficient orders are not computed from the coefficients (Falcon and
+  // faster) and the block context map does not depend on the quantized DC.
+  bool CanTokenizeWithCoefficients() const {
+    const PassesSharedState& shared = enc_state_->shared;
+    return enc_state_->cparams.tokenize_with_coefficients &&
+           enc_state_->cparams.speed_tier >= SpeedTier::kFalcon &&
+           shared.block_ctx_map.num_dc_ctxs == 1 &&
+           !(shared.frame_header.flags & FrameHeader::kUseDcFrame);
+  }
+
   void ComputeAllCoeffOrders(const FrameDimensions& frame_dim) {
     PROFILER_FUNC;
     enc_state_->used_orders.resize(
         enc_state_->progressive_splitter.GetNumPasses());
     for (size_t i = 0; i < enc_state_->progressive_splitter.GetNumPasses();
          i++) {
-      // No coefficient reordering in Falcon mode.
-      if (enc_state_->cparams.speed_tier != SpeedTier::kFalcon) {
+      // No coefficient reordering in Falcon mode and faster.
+      if (enc_state_->cparams.speed_tier < SpeedTier::kFalcon) {
         enc_state_->used_orders[i] = ComputeUsedOrders(
             enc_state_->cparams.speed_tier, enc_state_->shared.ac_strategy,
             Rect(enc_state_->shared.raw_quant_field));
@@ -998,7 +1032,8 @@ class LossyFrameEncoder {
 Status EncodeFrame(const CompressParams& cparams_orig,
                    const FrameInfo& frame_info, const CodecMetadata* metadata,
                    const ImageBundle& ib, PassesEncoderState* passes_enc_state,
-                   ThreadPool* pool, BitWriter* writer, AuxOut* aux_out) {
+                   ThreadPool* pool, BitWriter* writer, AuxOut* aux_out,
+                   std::vector<BitWriter>* sections) {
   ib.VerifyMetadata();
 
   CompressParams cparams = cparams_orig;
@@ -1338,7 +1373,11 @@ Status EncodeFrame(const CompressParams& cparams_orig,
 
   JXL_RETURN_IF_ERROR(
       WriteGroupOffsets(group_codes, permutation_ptr, writer, aux_out));
-  writer->AppendByteAligned(group_codes);
+  if (sections != nullptr) {
+    *sections = std::move(group_codes);
+  } else {
+    writer->AppendByteAligned(group_codes);
+  }
   writer->ZeroPadToByte();  // end of frame.
 
   return true;
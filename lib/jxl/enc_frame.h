@@ -15,6 +15,8 @@
 #ifndef LIB_JXL_ENC_FRAME_H_
 #define LIB_JXL_ENC_FRAME_H_
 
+#include <vector>
+
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -49,11 +51,15 @@ struct FrameInfo {
 // Encodes a single frame (including its header) into a byte stream.  Groups may
 // be processed in parallel by `pool`. metadata is the ImageMetadata encoded in
 // the codestream, and must be used for the FrameHeaders, do not use
-// ib.metadata.
+// ib.metadata. If `sections` is not null, the byte-aligned sections of the
+// frame are moved to it in codestream order instead of being appended to
+// `writer`, which then ends with the table of contents; this saves copying
+// them when the caller outputs them one after the other anyway.
 Status EncodeFrame(const CompressParams& cparams_orig,
                    const FrameInfo& frame_info, const CodecMetadata* metadata,
                    const ImageBundle& ib, PassesEncoderState* passes_enc_state,
-                   ThreadPool* pool, BitWriter* writer, AuxOut* aux_out);
+                   ThreadPool* pool, BitWriter* writer, AuxOut* aux_out,
+                   std::vector<BitWriter>* sections = nullptr);
 
 }  // namespace jxl
 
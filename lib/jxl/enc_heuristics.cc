@@ -34,7 +34,7 @@
 namespace jxl {
 namespace {
 void FindBestBlockEntropyModel(PassesEncoderState& enc_state) {
-  if (enc_state.cparams.speed_tier == SpeedTier::kFalcon) {
+  if (enc_state.cparams.speed_tier >= SpeedTier::kFalcon) {
     return;
   }
   const ImageI& rqf = enc_state.shared.raw_quant_field;
@@ -239,7 +239,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
   }
 
   // Compute an initial estimate of the quantization field.
-  if (cparams.speed_tier != SpeedTier::kFalcon) {
+  if (cparams.speed_tier < SpeedTier::kFalcon) {
     // Call InitialQuantField only in Hare mode or slower. Otherwise, rely
     // on simple heuristics in FindBestAcStrategy.
     if (cparams.speed_tier > SpeedTier::kHare) {
@@ -308,7 +308,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
   }
 
   // Choose a context model that depends on the amount of quantization for AC.
-  if (cparams.speed_tier != SpeedTier::kFalcon) {
+  if (cparams.speed_tier < SpeedTier::kFalcon) {
     FindBestBlockEntropyModel(*enc_state);
   }
   return true;
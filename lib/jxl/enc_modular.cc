@@ -170,6 +170,14 @@ Tree PredefinedTree(ModularOptions::TreeKind tree_kind, size_t total_pixels) {
     return MakeFixedTree(kNumNonrefProperties - weighted::kNumProperties,
                          cutoffs, Predictor::Weighted, total_pixels);
   }
+  if (tree_kind == ModularOptions::TreeKind::kGradientFixed) {
+    std::vector<int32_t> cutoffs = {
+        -500, -392, -255, -191, -127, -95, -63, -47, -31, -23, -15,
+        -11,  -7,   -4,   -3,   -1,   0,   1,   3,   5,   7,   11,
+        15,   23,   31,   47,   63,   95,  127, 191, 255, 392, 500};
+    return MakeFixedTree(kGradientProp, cutoffs, Predictor::Gradient,
+                         total_pixels);
+  }
   JXL_ABORT("Unreachable");
   return {};
 }
@@ -377,9 +385,12 @@ ModularFrameEncoder::ModularFrameEncoder(const FrameHeader& frame_header,
     } else if (cparams.speed_tier < SpeedTier::kFalcon) {
       // try median and weighted predictor for anything else
       cparams.options.predictor = Predictor::Best;
-    } else {
-      // just weighted predictor in fastest mode
+    } else if (cparams.speed_tier == SpeedTier::kFalcon) {
+      // just weighted predictor in falcon mode
       cparams.options.predictor = Predictor::Weighted;
+    } else {
+      // just gradient predictor in fastest mode
+      cparams.options.predictor = Predictor::Gradient;
     }
   }
   tree_splits.push_back(0);
@@ -836,7 +847,7 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
 
   if (heuristics->CustomFixedTreeLossless(frame_dim, &tree)) {
     // Using a fixed tree.
-  } else if (cparams.speed_tier != SpeedTier::kFalcon || quality != 100 ||
+  } else if (cparams.speed_tier < SpeedTier::kFalcon || quality != 100 ||
              !cparams.modular_mode) {
     // Avoid creating a tree with leaves that don't correspond to any pixels.
     std::vector<size_t> useful_splits;
@@ -860,11 +871,15 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
 
     std::atomic_flag invalid_force_wp = ATOMIC_FLAG_INIT;
 
-    std::vector<Tree> trees(useful_splits.size() - 1);
+    size_t num_chunks = useful_splits.size() - 1;
+    std::vector<Tree> trees(num_chunks);
+    // Calls to ThreadPool::Run can not be nested: with a single chunk, run
+    // the tree learning itself on the pool instead.
+    ThreadPool* chunk_pool = num_chunks == 1 ? nullptr : pool;
+    ThreadPool* learn_pool = num_chunks == 1 ? pool : nullptr;
     RunOnPool(
-        pool, 0, useful_splits.size() - 1, ThreadPool::SkipInit(),
+        chunk_pool, 0, num_chunks, ThreadPool::SkipInit(),
         [&](size_t chunk, size_t _) {
-          // TODO(veluca): parallelize more.
           size_t total_pixels = 0;
           uint32_t start = useful_splits[chunk];
           uint32_t stop = useful_splits[chunk + 1];
@@ -917,10 +932,9 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
                 /*aux_out=*/nullptr, 0, i, &tree_samples, &total_pixels));
           }
 
-          // TODO(veluca): parallelize more.
-          trees[chunk] =
-              LearnTree(std::move(tree_samples), total_pixels,
-                        stream_options[start], local_multiplier_info, range);
+          trees[chunk] = LearnTree(std::move(tree_samples), total_pixels,
+                                   stream_options[start], local_multiplier_info,
+                                   range, learn_pool);
         },
         "LearnTrees");
     if (invalid_force_wp.test_and_set(std::memory_order_acq_rel)) {
@@ -930,19 +944,26 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
     MergeTrees(trees, useful_splits, 0, useful_splits.size() - 1, &tree);
   } else {
     // Fixed tree.
-    // TODO(veluca): determine cutoffs?
-    std::vector<int32_t> cutoffs = {-255, -191, -127, -95, -63, -47, -31, -23,
-                                    -15,  -11,  -7,   -5,  -3,  -1,  0,   1,
-                                    3,    5,    7,    11,  15,  23,  31,  47,
-                                    63,   95,   127,  191, 255};
     size_t total_pixels = 0;
     for (const Image& img : stream_images) {
       for (const Channel& ch : img.channel) {
         total_pixels += ch.w * ch.h;
       }
     }
-    tree = MakeFixedTree(kNumNonrefProperties - weighted::kNumProperties,
-                         cutoffs, Predictor::Weighted, total_pixels);
+    if (cparams.speed_tier == SpeedTier::kFalcon) {
+      // TODO(veluca): determine cutoffs?
+      std::vector<int32_t> cutoffs = {
+          -255, -191, -127, -95, -63, -47, -31, -23, -15, -11,
+          -7,   -5,   -3,   -1,  0,   1,   3,   5,   7,   11,
+          15,   23,   31,   47,  63,  95,  127, 191, 255};
+      tree = MakeFixedTree(kNumNonrefProperties - weighted::kNumProperties,
+                           cutoffs, Predictor::Weighted, total_pixels);
+    } else {
+      // Contexts only depend on the gradient, see the corresponding fast path
+      // in EncodeModularChannelMAANS.
+      tree = PredefinedTree(ModularOptions::TreeKind::kGradientFixed,
+                            total_pixels);
+    }
   }
   // TODO(veluca): do this somewhere else.
   if (cparams.near_lossless) {
@@ -998,7 +1019,16 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
 
   // Write tree
   HistogramParams params;
-  if (cparams.speed_tier > SpeedTier::kKitten) {
+  if (cparams.speed_tier >= SpeedTier::kLightning) {
+    // Prefix codes with the cheapest histogram choices, as the data is
+    // written in a single forward pass.
+    params.clustering = HistogramParams::ClusteringType::kFastest;
+    params.ans_histogram_strategy =
+        HistogramParams::ANSHistogramStrategy::kFast;
+    params.lz77_method = HistogramParams::LZ77Method::kNone;
+    params.uint_method = HistogramParams::HybridUintMethod::kNone;
+    params.force_huffman = true;
+  } else if (cparams.speed_tier > SpeedTier::kKitten) {
     params.clustering = HistogramParams::ClusteringType::kFast;
     params.ans_histogram_strategy =
         HistogramParams::ANSHistogramStrategy::kApproximate;
@@ -1260,6 +1290,7 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
 
     size_t nb_rcts_to_try = 0;
     switch (cparams.speed_tier) {
+      case SpeedTier::kLightning:
       case SpeedTier::kFalcon:
         nb_rcts_to_try = 0;  // Just do global YCoCg
         break;
@@ -1316,6 +1347,7 @@ Status ModularFrameEncoder::PrepareStreamParams(const Rect& rect,
   }
   size_t nb_wp_modes = 0;
   switch (cparams.speed_tier) {
+    case SpeedTier::kLightning:
     case SpeedTier::kFalcon:
       nb_wp_modes = 1;
       break;
@@ -1378,7 +1410,13 @@ void ModularFrameEncoder::AddVarDCTDC(const Image3F& dc, size_t group_index,
   stream_options[stream_id].max_chan_size = 0xFFFFFF;
   stream_options[stream_id].predictor = Predictor::Weighted;
   stream_options[stream_id].wp_tree_mode = ModularOptions::WPTreeMode::kWPOnly;
-  if (cparams.speed_tier >= SpeedTier::kSquirrel) {
+  if (cparams.speed_tier >= SpeedTier::kLightning) {
+    // Avoids the weighted predictor, which is the slowest part of DC encoding.
+    stream_options[stream_id].predictor = Predictor::Gradient;
+    stream_options[stream_id].wp_tree_mode = ModularOptions::WPTreeMode::kNoWP;
+    stream_options[stream_id].tree_kind =
+        ModularOptions::TreeKind::kGradientFixed;
+  } else if (cparams.speed_tier >= SpeedTier::kSquirrel) {
     stream_options[stream_id].tree_kind = ModularOptions::TreeKind::kWPFixedDC;
   }
 
@@ -1482,7 +1520,7 @@ void ModularFrameEncoder::AddACMetadata(size_t group_index, bool jpeg_transcode,
   if (jpeg_transcode) {
     stream_options[stream_id].tree_kind =
         ModularOptions::TreeKind::kJpegTranscodeACMeta;
-  } else if (cparams.speed_tier == SpeedTier::kFalcon) {
+  } else if (cparams.speed_tier >= SpeedTier::kFalcon) {
     stream_options[stream_id].tree_kind =
         ModularOptions::TreeKind::kFalconACMeta;
   } else if (cparams.speed_tier > SpeedTier::kKitten) {
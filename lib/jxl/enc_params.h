@@ -45,12 +45,19 @@ enum class SpeedTier {
   // Turns on simple heuristics for AC strategy, quant field, and clustering;
   // also enables coefficient reordering.
   kCheetah = 6,
-  // Turns off most encoder features, for the fastest possible encoding time.
+  // Turns off most encoder features.
   kFalcon = 7,
+  // For the fastest possible encoding time, e.g. for real-time capture: uses
+  // the gradient predictor with a fixed tree for lossless and for DC, and
+  // prefix codes.
+  kLightning = 8,
 };
 
 inline bool ParseSpeedTier(const std::string& s, SpeedTier* out) {
-  if (s == "falcon") {
+  if (s == "lightning") {
+    *out = SpeedTier::kLightning;
+    return true;
+  } else if (s == "falcon") {
     *out = SpeedTier::kFalcon;
     return true;
   } else if (s == "cheetah") {
@@ -73,7 +80,7 @@ inline bool ParseSpeedTier(const std::string& s, SpeedTier* out) {
     return true;
   }
   size_t st = 10 - static_cast<size_t>(strtoull(s.c_str(), nullptr, 0));
-  if (st <= static_cast<size_t>(SpeedTier::kFalcon) &&
+  if (st <= static_cast<size_t>(SpeedTier::kLightning) &&
       st >= static_cast<size_t>(SpeedTier::kTortoise)) {
     *out = SpeedTier(st);
     return true;
@@ -83,6 +90,8 @@ inline bool ParseSpeedTier(const std::string& s, SpeedTier* out) {
 
 inline const char* SpeedTierName(SpeedTier speed_tier) {
   switch (speed_tier) {
+    case SpeedTier::kLightning:
+      return "lightning";
     case SpeedTier::kFalcon:
       return "falcon";
     case SpeedTier::kCheetah:
@@ -224,6 +233,12 @@ struct CompressParams {
 
   bool use_new_heuristics = false;
 
+  // Tokenizes the AC coefficients of each group right after computing them, if
+  // this gives the same tokens as the separate tokenization pass, see
+  // LossyFrameEncoder::CanTokenizeWithCoefficients. Only turned off to compare
+  // both.
+  bool tokenize_with_coefficients = true;
+
   // Down/upsample the image before encoding / after decoding by this factor.
   size_t resampling = 1;
 };
@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <iterator>
 
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/base/span.h"
@@ -89,14 +90,15 @@ constexpr unsigned char container_header[] = {
     0xa, 0,   0, 0,   0x14, 'f', 't', 'y', 'p', 'j', 'x',
     'l', ' ', 0, 0,   0,    0,   'j', 'x', 'l', ' '};
 
-namespace {
-// Extends vec with size, and returns a pointer to the beginning of the
-// extension.
-uint8_t* ExtendVector(std::vector<uint8_t>* vec, size_t size) {
-  vec->resize(vec->size() + size, 0);
-  return vec->data() + vec->size() - size;
+void JxlEncoderStruct::AppendOutput(jxl::PaddedBytes&& bytes) {
+  if (bytes.size() == 0) return;
+  output_chunks.emplace_back(std::move(bytes));
+}
+
+void JxlEncoderStruct::AppendOutput(jxl::BitWriter&& writer) {
+  writer.ZeroPadToByte();
+  AppendOutput(std::move(writer).TakeBytes());
 }
-}  // namespace
 
 void JxlEncoderStruct::AppendBoxHeader(const jxl::BoxType& type, size_t size,
                                        bool unbounded) {
@@ -109,34 +111,55 @@ void JxlEncoderStruct::AppendBoxHeader(const jxl::BoxType& type, size_t size,
     }
   }
 
-  StoreBE32(large_size ? 1 : box_size, ExtendVector(&output_byte_queue, 4));
+  jxl::PaddedBytes header(large_size ? 16 : 8);
+  StoreBE32(large_size ? 1 : box_size, header.data());
+  memcpy(header.data() + 4, type.data(), 4);
+  if (large_size) {
+    StoreBE64(box_size, header.data() + 8);
+  }
+  AppendOutput(std::move(header));
+}
 
-  output_byte_queue.insert(output_byte_queue.end(), type.data(),
-                           type.data() + 4);
+namespace {
 
-  if (large_size) {
-    StoreBE64(box_size, ExtendVector(&output_byte_queue, 8));
+// Returns the color encoding of pixels given in `pixel_format` to the encoder.
+jxl::ColorEncoding InputColorEncoding(const JxlEncoder* enc,
+                                      const JxlPixelFormat& pixel_format) {
+  if (!enc->metadata.m.xyb_encoded) return enc->metadata.m.color_encoding;
+  if (pixel_format.data_type == JXL_TYPE_FLOAT) {
+    return jxl::ColorEncoding::LinearSRGB(pixel_format.num_channels < 3);
   }
+  return jxl::ColorEncoding::SRGB(pixel_format.num_channels < 3);
 }
 
-JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
-  jxl::MemoryManagerUniquePtr<jxl::JxlEncoderQueuedFrame> input_frame =
-      std::move(input_frame_queue[0]);
-  input_frame_queue.erase(input_frame_queue.begin());
+void SetColorTransform(const jxl::CodecMetadata& metadata,
+                       jxl::CompressParams* cparams) {
+  if (metadata.m.xyb_encoded) {
+    cparams->color_transform = jxl::ColorTransform::kXYB;
+  } else {
+    // TODO(zond): Figure out when to use kYCbCr instead.
+    cparams->color_transform = jxl::ColorTransform::kNone;
+  }
+}
 
-  jxl::BitWriter writer;
+}  // namespace
 
+JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
   if (!wrote_headers) {
     if (use_container) {
-      output_byte_queue.insert(output_byte_queue.end(), container_header,
-                               container_header + sizeof(container_header));
+      jxl::PaddedBytes header;
+      header.append(container_header,
+                    container_header + sizeof(container_header));
+      AppendOutput(std::move(header));
       if (store_jpeg_metadata && jpeg_metadata.size() > 0) {
         AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_metadata.size(), false);
-        output_byte_queue.insert(output_byte_queue.end(), jpeg_metadata.begin(),
-                                 jpeg_metadata.end());
+        jxl::PaddedBytes box;
+        box.append(jpeg_metadata);
+        AppendOutput(std::move(box));
       }
       AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true);
     }
+    jxl::BitWriter writer;
     if (!WriteHeaders(&metadata, &writer, nullptr)) {
       return JXL_ENC_ERROR;
     }
@@ -150,38 +173,137 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
 
     // TODO(lode): preview should be added here if a preview image is added
 
+    // Each frame should start on byte boundaries.
+    AppendOutput(std::move(writer));
     wrote_headers = true;
   }
 
-  // Each frame should start on byte boundaries.
-  writer.ZeroPadToByte();
+  if (input_frame_queue[0]->strip_callback) return EncodeNextStrip();
+
+  // Frames added as strips are encoded on their own.
+  const size_t max_frames =
+      std::min(input_frame_queue.size(), max_parallel_frames);
+  size_t num_frames = 1;
+  while (num_frames < max_frames &&
+         !input_frame_queue[num_frames]->strip_callback) {
+    ++num_frames;
+  }
+  std::vector<jxl::MemoryManagerUniquePtr<jxl::JxlEncoderQueuedFrame>>
+      input_frames(std::make_move_iterator(input_frame_queue.begin()),
+                   std::make_move_iterator(input_frame_queue.begin() +
+                                           num_frames));
+  input_frame_queue.erase(input_frame_queue.begin(),
+                          input_frame_queue.begin() + num_frames);
 
   // TODO(zond): Handle progressive mode like EncodeFile does it.
   // TODO(zond): Handle animation like EncodeFile does it, by checking if
   //             JxlEncoderCloseInput has been called (to see if it's the
   //             last animation frame).
 
-  if (metadata.m.xyb_encoded) {
-    input_frame->option_values.cparams.color_transform =
-        jxl::ColorTransform::kXYB;
+  for (const auto& input_frame : input_frames) {
+    SetColorTransform(metadata, &input_frame->option_values.cparams);
+  }
+
+  // The frame headers and the sections of each frame, which are output as
+  // they are, without concatenating them first.
+  std::vector<jxl::BitWriter> frame_writers(num_frames);
+  std::vector<std::vector<jxl::BitWriter>> frame_sections(num_frames);
+  if (num_frames == 1) {
+    jxl::PassesEncoderState enc_state;
+    if (!jxl::EncodeFrame(input_frames[0]->option_values.cparams,
+                          jxl::FrameInfo{}, &metadata, input_frames[0]->frame,
+                          &enc_state, thread_pool.get(), &frame_writers[0],
+                          /*aux_out=*/nullptr, &frame_sections[0])) {
+      return JXL_ENC_ERROR;
+    }
   } else {
-    // TODO(zond): Figure out when to use kYCbCr instead.
-    input_frame->option_values.cparams.color_transform =
-        jxl::ColorTransform::kNone;
+    // The frames do not reference each other: encode each of them on a single
+    // thread, into its own writer, rather than one after the other with
+    // parallelism within the frames.
+    std::atomic<bool> ok{true};
+    const auto encode_frame = [&](const int task, const int thread) {
+      const jxl::JxlEncoderQueuedFrame& input_frame = *input_frames[task];
+      jxl::PassesEncoderState enc_state;
+      if (!jxl::EncodeFrame(input_frame.option_values.cparams,
+                            jxl::FrameInfo{}, &metadata, input_frame.frame,
+                            &enc_state, /*pool=*/nullptr, &frame_writers[task],
+                            /*aux_out=*/nullptr, &frame_sections[task])) {
+        ok.store(false, std::memory_order_relaxed);
+      }
+    };
+    if (!jxl::RunOnPool(thread_pool.get(), 0, num_frames,
+                        jxl::ThreadPool::SkipInit(), encode_frame,
+                        "EncodeFrames") ||
+        !ok.load(std::memory_order_relaxed)) {
+      return JXL_ENC_ERROR;
+    }
+  }
+  for (size_t i = 0; i < num_frames; ++i) {
+    AppendOutput(std::move(frame_writers[i]));
+    for (jxl::BitWriter& section : frame_sections[i]) {
+      AppendOutput(std::move(section));
+    }
   }
 
+  last_used_cparams = input_frames.back()->option_values.cparams;
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderStruct::EncodeNextStrip() {
+  jxl::JxlEncoderQueuedFrame& input_frame = *input_frame_queue[0];
+  const JxlPixelFormat& format = input_frame.strip_format;
+  const size_t xsize = metadata.xsize();
+  const size_t ysize = metadata.ysize();
+  const size_t y0 = input_frame.next_strip_y0;
+  const size_t strip_ysize = std::min(input_frame.strip_height, ysize - y0);
+  const bool is_last_strip = y0 + strip_ysize == ysize;
+
+  jxl::ImageBundle strip(&metadata.m);
+  {
+    size_t bytes_per_sample = format.data_type == JXL_TYPE_FLOAT    ? 4
+                              : format.data_type == JXL_TYPE_UINT16 ? 2
+                                                                    : 1;
+    jxl::PaddedBytes pixels(strip_ysize * xsize * format.num_channels *
+                            bytes_per_sample);
+    if (!input_frame.strip_callback(input_frame.strip_opaque, y0, strip_ysize,
+                                    pixels.data(), pixels.size())) {
+      return JXL_API_ERROR("strip callback failed");
+    }
+    if (!jxl::BufferToImageBundle(format, xsize, strip_ysize, pixels.data(),
+                                  pixels.size(), thread_pool.get(),
+                                  InputColorEncoding(this, format), &strip)) {
+      return JXL_ENC_ERROR;
+    }
+  }
+  strip.origin.y0 = static_cast<int32_t>(y0);
+
+  // Each strip replaces its rows of the previous strips, saved in slot 1, see
+  // MakeFrameHeader. A single strip is a regular frame.
+  jxl::FrameInfo frame_info;
+  if (!is_last_strip) {
+    frame_info.is_last = false;
+    frame_info.save_as_reference = 1;
+  }
+  SetColorTransform(metadata, &input_frame.option_values.cparams);
+
+  jxl::BitWriter writer;
+  std::vector<jxl::BitWriter> sections;
   jxl::PassesEncoderState enc_state;
-  if (!jxl::EncodeFrame(input_frame->option_values.cparams, jxl::FrameInfo{},
-                        &metadata, input_frame->frame, &enc_state,
-                        thread_pool.get(), &writer,
-                        /*aux_out=*/nullptr)) {
+  if (!jxl::EncodeFrame(input_frame.option_values.cparams, frame_info,
+                        &metadata, strip, &enc_state, thread_pool.get(),
+                        &writer, /*aux_out=*/nullptr, &sections)) {
     return JXL_ENC_ERROR;
   }
+  AppendOutput(std::move(writer));
+  for (jxl::BitWriter& section : sections) {
+    AppendOutput(std::move(section));
+  }
 
-  jxl::PaddedBytes bytes = std::move(writer).TakeBytes();
-  output_byte_queue.insert(output_byte_queue.end(), bytes.data(),
-                           bytes.data() + bytes.size());
-  last_used_cparams = input_frame->option_values.cparams;
+  input_frame.next_strip_y0 += strip_ysize;
+  if (is_last_strip) {
+    last_used_cparams = input_frame.option_values.cparams;
+    input_frame_queue.erase(input_frame_queue.begin());
+  }
   return JXL_ENC_SUCCESS;
 }
 
@@ -263,7 +385,7 @@ JxlEncoderStatus JxlEncoderOptionsSetLossless(JxlEncoderOptions* options,
 
 JxlEncoderStatus JxlEncoderOptionsSetEffort(JxlEncoderOptions* options,
                                             const int effort) {
-  if (effort < 3 || effort > 9) {
+  if (effort < 2 || effort > 9) {
     return JXL_ENC_ERROR;
   }
   options->values.cparams.speed_tier = static_cast<jxl::SpeedTier>(10 - effort);
@@ -290,6 +412,12 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
   if (!alloc) return nullptr;
   JxlEncoder* enc = new (alloc) JxlEncoder();
   enc->memory_manager = local_memory_manager;
+  enc->arena = jxl::MemoryManagerMakeUnique<jxl::CacheAlignedArena>(
+      &enc->memory_manager, enc->memory_manager);
+  if (!enc->arena) {
+    JxlEncoderDestroy(enc);
+    return nullptr;
+  }
   enc->wrote_headers = false;
 
   return enc;
@@ -297,12 +425,18 @@ JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager) {
 
 void JxlEncoderReset(JxlEncoder* enc) {
   enc->thread_pool.reset();
+  enc->async_executor = nullptr;
+  enc->async_executor_opaque = nullptr;
+  enc->async_state.store(jxl::AsyncState::kIdle, std::memory_order_relaxed);
   enc->input_frame_queue.clear();
   enc->encoder_options.clear();
-  enc->output_byte_queue.clear();
+  enc->output_chunks.clear();
+  enc->output_offset = 0;
+  enc->max_parallel_frames = 1;
   enc->wrote_headers = false;
   enc->metadata = jxl::CodecMetadata();
   enc->last_used_cparams = jxl::CompressParams();
+  enc->arena->ReleaseUnused();
 }
 
 void JxlEncoderDestroy(JxlEncoder* enc) {
@@ -337,6 +471,25 @@ JxlEncoderStatus JxlEncoderSetParallelRunner(JxlEncoder* enc,
   return JXL_ENC_SUCCESS;
 }
 
+JxlEncoderStatus JxlEncoderSetAsyncExecutor(JxlEncoder* enc,
+                                            JxlAsyncExecutor executor,
+                                            void* executor_opaque) {
+  if (enc->async_state.load(std::memory_order_acquire) !=
+      jxl::AsyncState::kIdle) {
+    return JXL_API_ERROR("encoding step in progress");
+  }
+  enc->async_executor = executor;
+  enc->async_executor_opaque = executor_opaque;
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderSetFrameParallelism(JxlEncoder* enc,
+                                               size_t max_frames) {
+  if (max_frames == 0) return JXL_API_ERROR("max_frames must be at least 1");
+  enc->max_parallel_frames = max_frames;
+  return JXL_ENC_SUCCESS;
+}
+
 JxlEncoderStatus JxlEncoderAddJPEGFrame(const JxlEncoderOptions* options,
                                         const uint8_t* buffer, size_t size) {
   // TODO(zond): Return error if basic info or color encoding isn't set.
@@ -347,6 +500,7 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(const JxlEncoderOptions* options,
     return JXL_ENC_ERROR;
   }
 
+  jxl::CacheAlignedArenaScope arena_scope(options->enc->arena.get());
   jxl::CodecInOut io;
   if (!jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(buffer, size), &io)) {
     return JXL_ENC_ERROR;
@@ -390,6 +544,7 @@ JxlEncoderStatus JxlEncoderAddImageFrame(const JxlEncoderOptions* options,
                                          const void* buffer, size_t size) {
   // TODO(zond): Return error if basic info or color encoding isn't set.
   // TODO(zond): Return error if the input has been closed.
+  jxl::CacheAlignedArenaScope arena_scope(options->enc->arena.get());
   auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
       &options->enc->memory_manager,
       // JxlEncoderQueuedFrame is a struct with no constructors, so we use the
@@ -400,21 +555,10 @@ JxlEncoderStatus JxlEncoderAddImageFrame(const JxlEncoderOptions* options,
     return JXL_ENC_ERROR;
   }
 
-  jxl::ColorEncoding c_current;
-  if (options->enc->metadata.m.xyb_encoded) {
-    if (pixel_format->data_type == JXL_TYPE_FLOAT) {
-      c_current =
-          jxl::ColorEncoding::LinearSRGB(pixel_format->num_channels < 3);
-    } else {
-      c_current = jxl::ColorEncoding::SRGB(pixel_format->num_channels < 3);
-    }
-  } else {
-    c_current = options->enc->metadata.m.color_encoding;
-  }
-
   if (!jxl::BufferToImageBundle(*pixel_format, options->enc->metadata.xsize(),
                                 options->enc->metadata.ysize(), buffer, size,
-                                options->enc->thread_pool.get(), c_current,
+                                options->enc->thread_pool.get(),
+                                InputColorEncoding(options->enc, *pixel_format),
                                 &(queued_frame->frame))) {
     return JXL_ENC_ERROR;
   }
@@ -427,35 +571,119 @@ JxlEncoderStatus JxlEncoderAddImageFrame(const JxlEncoderOptions* options,
   return JXL_ENC_SUCCESS;
 }
 
+JxlEncoderStatus JxlEncoderAddImageStrips(const JxlEncoderOptions* options,
+                                          const JxlPixelFormat* pixel_format,
+                                          uint32_t strip_height,
+                                          JxlEncoderStripCallback callback,
+                                          void* opaque) {
+  if (!callback) return JXL_API_ERROR("strip callback is required");
+  if (!options->values.lossless) {
+    // Each strip is a frame of its own, lossy strips would have seams.
+    return JXL_API_ERROR("strips are only supported for lossless encoding");
+  }
+  if (strip_height == 0 || strip_height % jxl::kGroupDim != 0) {
+    return JXL_API_ERROR("strip height must be a multiple of %zu",
+                         jxl::kGroupDim);
+  }
+  if (pixel_format->data_type != JXL_TYPE_FLOAT &&
+      pixel_format->data_type != JXL_TYPE_UINT8 &&
+      pixel_format->data_type != JXL_TYPE_UINT16) {
+    return JXL_API_ERROR("unsupported pixel data type");
+  }
+  auto queued_frame = jxl::MemoryManagerMakeUnique<jxl::JxlEncoderQueuedFrame>(
+      &options->enc->memory_manager,
+      jxl::JxlEncoderQueuedFrame{options->values,
+                                 jxl::ImageBundle(&options->enc->metadata.m)});
+  if (!queued_frame) {
+    return JXL_ENC_ERROR;
+  }
+  queued_frame->strip_callback = callback;
+  queued_frame->strip_opaque = opaque;
+  queued_frame->strip_format = *pixel_format;
+  queued_frame->strip_height = strip_height;
+  queued_frame->next_strip_y0 = 0;
+
+  queued_frame->option_values.cparams.SetLossless();
+
+  options->enc->input_frame_queue.emplace_back(std::move(queued_frame));
+  return JXL_ENC_SUCCESS;
+}
+
 void JxlEncoderCloseInput(JxlEncoder* enc) {
   // TODO(zond): Make this function mark the most recent frame as the last.
 }
 
-JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc, uint8_t** next_out,
-                                         size_t* avail_out) {
+namespace {
+
+// Body of JxlEncoderProcessOutput, run directly or on the async executor.
+JxlEncoderStatus ProcessOutputStep(JxlEncoder* enc, uint8_t** next_out,
+                                   size_t* avail_out) {
+  jxl::CacheAlignedArenaScope arena_scope(enc->arena.get());
   while (*avail_out > 0 &&
-         (!enc->output_byte_queue.empty() || !enc->input_frame_queue.empty())) {
-    if (!enc->output_byte_queue.empty()) {
-      size_t to_copy = std::min(*avail_out, enc->output_byte_queue.size());
-      memcpy(static_cast<void*>(*next_out), enc->output_byte_queue.data(),
+         (!enc->output_chunks.empty() || !enc->input_frame_queue.empty())) {
+    if (!enc->output_chunks.empty()) {
+      const jxl::PaddedBytes& chunk = enc->output_chunks.front();
+      size_t to_copy = std::min(*avail_out, chunk.size() - enc->output_offset);
+      memcpy(static_cast<void*>(*next_out), chunk.data() + enc->output_offset,
              to_copy);
       *next_out += to_copy;
       *avail_out -= to_copy;
-      enc->output_byte_queue.erase(enc->output_byte_queue.begin(),
-                                   enc->output_byte_queue.begin() + to_copy);
+      enc->output_offset += to_copy;
+      if (enc->output_offset == chunk.size()) {
+        // Frees each part of the encoded image as soon as it is output.
+        enc->output_chunks.pop_front();
+        enc->output_offset = 0;
+      }
     } else if (!enc->input_frame_queue.empty()) {
       if (enc->RefillOutputByteQueue() != JXL_ENC_SUCCESS) {
         return JXL_ENC_ERROR;
       }
+      // The buffers of the frame have been freed by now.
+      enc->arena->ReleaseUnused();
     }
   }
 
-  if (!enc->output_byte_queue.empty() || !enc->input_frame_queue.empty()) {
+  if (!enc->output_chunks.empty() || !enc->input_frame_queue.empty()) {
     return JXL_ENC_NEED_MORE_OUTPUT;
   }
   return JXL_ENC_SUCCESS;
 }
 
+void RunAsyncProcessOutput(void* work_opaque) {
+  JxlEncoder* enc = static_cast<JxlEncoder*>(work_opaque);
+  enc->async_result =
+      ProcessOutputStep(enc, enc->async_next_out, enc->async_avail_out);
+  enc->async_state.store(jxl::AsyncState::kDone, std::memory_order_release);
+}
+
+}  // namespace
+
+JxlEncoderStatus JxlEncoderProcessOutput(JxlEncoder* enc, uint8_t** next_out,
+                                         size_t* avail_out) {
+  if (!enc->async_executor) return ProcessOutputStep(enc, next_out, avail_out);
+  switch (enc->async_state.load(std::memory_order_acquire)) {
+    case jxl::AsyncState::kRunning:
+      return JXL_ENC_WORK_PENDING;
+    case jxl::AsyncState::kDone:
+      enc->async_state.store(jxl::AsyncState::kIdle,
+                             std::memory_order_relaxed);
+      return enc->async_result;
+    case jxl::AsyncState::kIdle:
+      break;
+  }
+  enc->async_next_out = next_out;
+  enc->async_avail_out = avail_out;
+  enc->async_state.store(jxl::AsyncState::kRunning, std::memory_order_relaxed);
+  enc->async_executor(enc->async_executor_opaque, &RunAsyncProcessOutput, enc);
+  // The executor may have run the step before returning.
+  if (enc->async_state.load(std::memory_order_acquire) ==
+      jxl::AsyncState::kDone) {
+    enc->async_state.store(jxl::AsyncState::kIdle, std::memory_order_relaxed);
+    return enc->async_result;
+  }
+  return JXL_ENC_WORK_PENDING;
+}
+
 JXL_EXPORT void JxlColorEncodingSetToSRGB(JxlColorEncoding* color_encoding,
                                           JXL_BOOL is_gray) {
   ConvertInternalToExternalColorEncoding(jxl::ColorEncoding::SRGB(is_gray),
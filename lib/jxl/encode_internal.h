@@ -16,13 +16,18 @@
 #ifndef LIB_JXL_ENCODE_INTERNAL_H_
 #define LIB_JXL_ENCODE_INTERNAL_H_
 
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include "jxl/encode.h"
 #include "jxl/memory_manager.h"
 #include "jxl/parallel_runner.h"
 #include "jxl/types.h"
+#include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/padded_bytes.h"
+#include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_frame.h"
 #include "lib/jxl/memory_manager_internal.h"
 
@@ -38,11 +43,26 @@ typedef struct JxlEncoderOptionsValuesStruct {
 typedef struct JxlEncoderQueuedFrame {
   JxlEncoderOptionsValues option_values;
   jxl::ImageBundle frame;
+  // Set for frames added with JxlEncoderAddImageStrips, whose `frame` is
+  // empty: the pixels are requested from strip_callback one strip at a time
+  // while encoding.
+  JxlEncoderStripCallback strip_callback;
+  void* strip_opaque;
+  JxlPixelFormat strip_format;
+  size_t strip_height;
+  // First row of the next strip to encode.
+  size_t next_strip_y0;
 } JxlEncoderQueuedFrame;
 
 Status ConvertExternalToInternalColorEncoding(const JxlColorEncoding& external,
                                               jxl::ColorEncoding* internal);
 
+enum class AsyncState : uint32_t {
+  kIdle,     // No encoding step submitted to the async executor
+  kRunning,  // An encoding step is running on the async executor
+  kDone,     // The step finished, its result is in async_result
+};
+
 typedef std::array<uint8_t, 4> BoxType;
 
 // Utility function that makes a BoxType from a null terminated string literal.
@@ -56,13 +76,34 @@ constexpr BoxType MakeBoxType(const char (&type)[5]) {
 
 struct JxlEncoderStruct {
   JxlMemoryManager memory_manager;
+  // Provides the image buffers and other internal allocations from
+  // memory_manager while the encoder runs. Unused blocks are released after
+  // each frame.
+  jxl::MemoryManagerUniquePtr<jxl::CacheAlignedArena> arena{
+      nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
   jxl::MemoryManagerUniquePtr<jxl::ThreadPool> thread_pool{
       nullptr, jxl::MemoryManagerDeleteHelper(&memory_manager)};
   std::vector<jxl::MemoryManagerUniquePtr<JxlEncoderOptions>> encoder_options;
 
+  // Set by JxlEncoderSetAsyncExecutor. When set, JxlEncoderProcessOutput runs
+  // on the executor with the output arguments of the call that submitted it,
+  // and async_state tells whether async_result is ready.
+  JxlAsyncExecutor async_executor = nullptr;
+  void* async_executor_opaque = nullptr;
+  std::atomic<jxl::AsyncState> async_state{jxl::AsyncState::kIdle};
+  JxlEncoderStatus async_result;
+  uint8_t** async_next_out;
+  size_t* async_avail_out;
+
   std::vector<jxl::MemoryManagerUniquePtr<jxl::JxlEncoderQueuedFrame>>
       input_frame_queue;
-  std::vector<uint8_t> output_byte_queue;
+  // Encoded bytes not yet output, in order. Each chunk is freed once it is
+  // output, the first output_offset bytes of the first one were output
+  // already.
+  std::deque<jxl::PaddedBytes> output_chunks;
+  size_t output_offset = 0;
+  // Set by JxlEncoderSetFrameParallelism, at least 1.
+  size_t max_parallel_frames = 1;
 
   bool use_container = false;
   bool store_jpeg_metadata = false;
@@ -72,12 +113,24 @@ struct JxlEncoderStruct {
   bool wrote_headers = false;
   jxl::CompressParams last_used_cparams;
 
-  // Takes the first frame in the input_frame_queue, encodes it, and appends the
-  // bytes to the output_byte_queue.
+  // Takes the first frames in the input_frame_queue, up to
+  // max_parallel_frames, encodes them, and appends the bytes to the
+  // output_chunks.
   JxlEncoderStatus RefillOutputByteQueue();
 
+  // Requests the next strip of the first frame in the input_frame_queue, which
+  // was added with JxlEncoderAddImageStrips, encodes it as a frame of its own,
+  // and appends the bytes to the output_chunks. Removes the frame from the
+  // queue after its last strip.
+  JxlEncoderStatus EncodeNextStrip();
+
+  // Appends `bytes`, or the bytes written to `writer` padded to a whole byte,
+  // to the output_chunks, without copying them.
+  void AppendOutput(jxl::PaddedBytes&& bytes);
+  void AppendOutput(jxl::BitWriter&& writer);
+
   // Appends the bytes of a JXL box header with the provided type and size to
-  // the end of the output_byte_queue. If unbounded is true, the size won't be
+  // the end of the output_chunks. If unbounded is true, the size won't be
   // added to the header and the box will be assumed to continue until EOF.
   void AppendBoxHeader(const jxl::BoxType& type, size_t size, bool unbounded);
 };
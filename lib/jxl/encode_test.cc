@@ -16,10 +16,12 @@
 
 #include "gtest/gtest.h"
 #include "jxl/encode_cxx.h"
+#include "jxl/thread_parallel_runner.h"
 #include "lib/extras/codec.h"
 #include "lib/jxl/dec_file.h"
 #include "lib/jxl/enc_butteraugli_comparator.h"
 #include "lib/jxl/encode_internal.h"
+#include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/jpeg/dec_jpeg_data.h"
 #include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
 #include "lib/jxl/test_utils.h"
@@ -129,6 +131,35 @@ TEST(EncodeTest, FrameEncodingTest) {
   VerifyFrameEncoding(enc.get(), JxlEncoderOptionsCreate(enc.get(), nullptr));
 }
 
+TEST(EncodeTest, CustomAllocImageBuffersTest) {
+  struct CalledCounters {
+    int allocs = 0;
+    int frees = 0;
+    size_t bytes = 0;
+  } counters;
+
+  JxlMemoryManager mm;
+  mm.opaque = &counters;
+  mm.alloc = [](void* opaque, size_t size) {
+    reinterpret_cast<CalledCounters*>(opaque)->allocs++;
+    reinterpret_cast<CalledCounters*>(opaque)->bytes += size;
+    return malloc(size);
+  };
+  mm.free = [](void* opaque, void* address) {
+    reinterpret_cast<CalledCounters*>(opaque)->frees++;
+    free(address);
+  };
+
+  {
+    JxlEncoderPtr enc = JxlEncoderMake(&mm);
+    EXPECT_NE(nullptr, enc.get());
+    VerifyFrameEncoding(enc.get(), JxlEncoderOptionsCreate(enc.get(), nullptr));
+  }
+  // The image planes of the encoder are allocated from the memory manager.
+  EXPECT_LE(63 * 129 * 3 * sizeof(float), counters.bytes);
+  EXPECT_EQ(counters.allocs, counters.frees);
+}
+
 TEST(EncodeTest, EncoderResetTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -141,6 +172,177 @@ TEST(EncodeTest, EncoderResetTest) {
                       JxlEncoderOptionsCreate(enc.get(), nullptr));
 }
 
+// Runs the submitted work before returning, like an executor that happens to
+// have an idle thread at hand would.
+void RunImmediately(void* opaque, JxlAsyncWorkFunction work,
+                    void* work_opaque) {
+  ++*static_cast<size_t*>(opaque);
+  work(work_opaque);
+}
+
+TEST(EncodeTest, AsyncExecutorTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  size_t num_submitted = 0;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetAsyncExecutor(
+                                 enc.get(), &RunImmediately, &num_submitted));
+  VerifyFrameEncoding(enc.get(), JxlEncoderOptionsCreate(enc.get(), nullptr));
+  EXPECT_GE(num_submitted, 1u);
+}
+
+// Encodes `num_frames` different frames with the given frame parallelism.
+// The output is requested `chunk_size` bytes at a time, or with a doubling
+// buffer if 0.
+std::vector<uint8_t> EncodeFramesWithParallelism(size_t num_frames,
+                                                 size_t max_frames,
+                                                 size_t chunk_size = 0) {
+  const size_t xsize = 64, ysize = 48;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT8, JXL_BIG_ENDIAN, 0};
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  void* runner = JxlThreadParallelRunnerCreate(
+      nullptr, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetParallelRunner(
+                                 enc.get(), JxlThreadParallelRunner, runner));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetFrameParallelism(enc.get(), max_frames));
+
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = false;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+  JxlEncoderOptions* options = JxlEncoderOptionsCreate(enc.get(), nullptr);
+  for (size_t i = 0; i < num_frames; ++i) {
+    std::vector<uint8_t> pixels =
+        jxl::test::GetSomeTestImage(xsize, ysize, 3, i);
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderAddImageFrame(options, &pixel_format, pixels.data(),
+                                      pixels.size()));
+  }
+  JxlEncoderCloseInput(enc.get());
+
+  std::vector<uint8_t> compressed(chunk_size ? chunk_size : 64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus process_result = JXL_ENC_NEED_MORE_OUTPUT;
+  while (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+    process_result = JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed.data();
+      compressed.resize(chunk_size ? offset + chunk_size
+                                   : compressed.size() * 2);
+      next_out = compressed.data() + offset;
+      avail_out = compressed.size() - offset;
+    }
+  }
+  EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
+  compressed.resize(next_out - compressed.data());
+  JxlThreadParallelRunnerDestroy(runner);
+  return compressed;
+}
+
+TEST(EncodeTest, FrameParallelismTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderSetFrameParallelism(enc.get(), 0));
+
+  // Concurrently encoded frames, including a last partial batch, are output
+  // in order and identical to frames encoded one after the other.
+  std::vector<uint8_t> serial = EncodeFramesWithParallelism(5, 1);
+  EXPECT_EQ(serial, EncodeFramesWithParallelism(5, 2));
+  EXPECT_EQ(serial, EncodeFramesWithParallelism(5, 8));
+}
+
+TEST(EncodeTest, SmallOutputChunksTest) {
+  // The output does not depend on how much of it is requested at a time.
+  std::vector<uint8_t> expected = EncodeFramesWithParallelism(3, 1);
+  EXPECT_EQ(expected, EncodeFramesWithParallelism(3, 1, /*chunk_size=*/1));
+  EXPECT_EQ(expected, EncodeFramesWithParallelism(3, 2, /*chunk_size=*/7));
+}
+
+TEST(EncodeTest, ImageStripsTest) {
+  const size_t xsize = 64;
+  const size_t ysize = 600;
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::CodecInOut input_io =
+      jxl::test::SomeTestImageToCodecInOut(pixels, 3, xsize, ysize);
+
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  JxlEncoderOptions* options = JxlEncoderOptionsCreate(enc.get(), nullptr);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderOptionsSetLossless(options, JXL_TRUE));
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = true;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc.get(), &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/false);
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetColorEncoding(enc.get(), &color_encoding));
+
+  struct Strips {
+    const std::vector<uint8_t>* pixels;
+    size_t row_size;
+    std::vector<size_t> requested;
+  } strips = {&pixels, xsize * 3 * 2, {}};
+  auto callback = [](void* opaque, size_t y0, size_t strip_ysize,
+                     void* buffer, size_t size) -> JXL_BOOL {
+    Strips* state = static_cast<Strips*>(opaque);
+    EXPECT_EQ(strip_ysize * state->row_size, size);
+    memcpy(buffer, state->pixels->data() + y0 * state->row_size, size);
+    state->requested.push_back(y0);
+    return JXL_TRUE;
+  };
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderAddImageStrips(options, &pixel_format, 100,
+                                                    callback, &strips));
+  // Lossy strips are not supported.
+  JxlEncoderOptions* lossy_options =
+      JxlEncoderOptionsCreate(enc.get(), nullptr);
+  EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderAddImageStrips(lossy_options,
+                                                    &pixel_format, 256,
+                                                    callback, &strips));
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderAddImageStrips(options, &pixel_format,
+                                                      256, callback, &strips));
+  JxlEncoderCloseInput(enc.get());
+
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size() - (next_out - compressed.data());
+  JxlEncoderStatus process_result = JXL_ENC_NEED_MORE_OUTPUT;
+  while (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+    process_result = JxlEncoderProcessOutput(enc.get(), &next_out, &avail_out);
+    if (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed.data();
+      compressed.resize(compressed.size() * 2);
+      next_out = compressed.data() + offset;
+      avail_out = compressed.size() - offset;
+    }
+  }
+  compressed.resize(next_out - compressed.data());
+  EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
+  EXPECT_EQ((std::vector<size_t>{0, 256, 512}), strips.requested);
+
+  // The strips are encoded as frames, composited by the decoder into the last
+  // one.
+  jxl::DecompressParams dparams;
+  jxl::CodecInOut decoded_io;
+  EXPECT_TRUE(jxl::DecodeFile(
+      dparams, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+      &decoded_io, /*aux_out=*/nullptr, /*pool=*/nullptr));
+  EXPECT_EQ(3u, decoded_io.frames.size());
+  const jxl::ImageBundle& decoded = decoded_io.frames.back();
+  EXPECT_EQ(xsize, decoded.xsize());
+  EXPECT_EQ(ysize, decoded.ysize());
+  jxl::VerifyRelativeError(*input_io.Main().color(), decoded.color(), 1E-6f,
+                           1E-6f);
+}
+
 TEST(EncodeTest, OptionsTest) {
   {
     JxlEncoderPtr enc = JxlEncoderMake(nullptr);
@@ -156,7 +358,7 @@ TEST(EncodeTest, OptionsTest) {
     EXPECT_NE(nullptr, enc.get());
     JxlEncoderOptions* options = JxlEncoderOptionsCreate(enc.get(), NULL);
     // Lower than currently supported values
-    EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderOptionsSetEffort(options, 2));
+    EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderOptionsSetEffort(options, 1));
     // Higher than currently supported values
     EXPECT_EQ(JXL_ENC_ERROR, JxlEncoderOptionsSetEffort(options, 10));
   }
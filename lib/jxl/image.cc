@@ -270,6 +270,31 @@ float DotProduct(const ImageF& a, const ImageF& b) {
   return sum;
 }
 
+void DownsampleImage(ImageF* image, size_t factor) {
+  JXL_ASSERT(factor != 1);
+  ImageF downsampled(DivCeil(image->xsize(), factor),
+                     DivCeil(image->ysize(), factor));
+  size_t in_stride = image->PixelsPerRow();
+  for (size_t y = 0; y < downsampled.ysize(); y++) {
+    float* row_out = downsampled.Row(y);
+    const float* row_in = image->Row(factor * y);
+    for (size_t x = 0; x < downsampled.xsize(); x++) {
+      size_t cnt = 0;
+      float sum = 0;
+      for (size_t iy = 0; iy < factor && iy + factor * y < image->ysize();
+           iy++) {
+        for (size_t ix = 0; ix < factor && ix + factor * x < image->xsize();
+             ix++) {
+          sum += row_in[iy * in_stride + x * factor + ix];
+          cnt++;
+        }
+      }
+      row_out[x] = sum / cnt;
+    }
+  }
+  *image = std::move(downsampled);
+}
+
 void DownsampleImage(Image3F* opsin, size_t factor) {
   JXL_ASSERT(factor != 1);
   // Allocate extra space to avoid a reallocation when padding.
@@ -67,6 +67,11 @@ struct PlaneBase {
     // better locality because that would invalidate the image contents.
   }
 
+  // Returns whether the storage is large enough for ShrinkTo(xsize, ysize).
+  bool CanShrinkTo(const size_t xsize, const size_t ysize) const {
+    return bytes_ != nullptr && xsize <= orig_xsize_ && ysize <= orig_ysize_;
+  }
+
   // How many pixels.
   JXL_INLINE size_t xsize() const { return xsize_; }
   JXL_INLINE size_t ysize() const { return ysize_; }
@@ -391,6 +396,14 @@ class Image3 {
     }
   }
 
+  // Returns whether the storage is large enough for ShrinkTo(xsize, ysize).
+  bool CanShrinkTo(const size_t xsize, const size_t ysize) const {
+    for (const PlaneT& plane : planes_) {
+      if (!plane.CanShrinkTo(xsize, ysize)) return false;
+    }
+    return true;
+  }
+
   // Sizes of all three images are guaranteed to be equal.
   JXL_INLINE size_t xsize() const { return planes_[0].xsize(); }
   JXL_INLINE size_t ysize() const { return planes_[0].ysize(); }
@@ -425,6 +438,19 @@ using Image3I = Image3<int32_t>;
 using Image3F = Image3<float>;
 using Image3D = Image3<double>;
 
+// Sets `image` to the given dimensions, keeping its storage if it is large
+// enough (see ShrinkTo) and allocating a new image otherwise. Avoids
+// reallocating buffers that are used again for each frame. The pixel values
+// are undefined afterwards.
+template <class ImageT>
+void ReuseOrAllocateImage(size_t xsize, size_t ysize, ImageT* image) {
+  if (image->CanShrinkTo(xsize, ysize)) {
+    image->ShrinkTo(xsize, ysize);
+  } else {
+    *image = ImageT(xsize, ysize);
+  }
+}
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_IMAGE_H_
@@ -787,6 +787,7 @@ Image3F PadImageToMultiple(const Image3F& in, size_t N);
 void PadImageToBlockMultipleInPlace(Image3F* JXL_RESTRICT in);
 
 // Downsamples an image by a given factor.
+void DownsampleImage(ImageF* image, size_t factor);
 void DownsampleImage(Image3F* opsin, size_t factor);
 
 }  // namespace jxl
@@ -338,6 +338,8 @@ static constexpr size_t kNumNonrefProperties =
     kNumStaticProperties + 13 + weighted::kNumProperties;
 
 constexpr size_t kWPProp = kNumNonrefProperties - weighted::kNumProperties;
+// W+N-NW, the unclamped gradient prediction.
+constexpr size_t kGradientProp = 9;
 
 // Clamps gradient to the min/max of n, w (and l, implicitly).
 static JXL_INLINE int32_t ClampedGradient(const int32_t n, const int32_t w,
@@ -45,6 +45,85 @@ namespace jxl {
 namespace {
 // Plot tree (if enabled) and predictor usage map.
 constexpr bool kWantDebug = false;
+
+// For a tree that only splits on a single non-static property, and whose
+// leaves use their predictor as is, fills `context_lookup` with the context of
+// each property value in [-kWPPropRange, kWPPropRange), values outside of that
+// range having the context of the closest value in the range. Returns false
+// for other trees, or if they split outside of the range.
+// TODO(veluca): de-duplicate code in Decode.
+bool ComputeContextLookup(const FlatTree &tree,
+                          uint16_t context_lookup[2 * kWPPropRange]) {
+  struct TreeRange {
+    // Begin *excluded*, end *included*. This works best with > vs <= decision
+    // nodes.
+    int begin, end;
+    size_t pos;
+  };
+  std::vector<TreeRange> ranges;
+  ranges.push_back(TreeRange{-kWPPropRange - 1, kWPPropRange - 1, 0});
+  while (!ranges.empty()) {
+    TreeRange cur = ranges.back();
+    ranges.pop_back();
+    if (cur.begin < -kWPPropRange - 1 || cur.begin >= kWPPropRange - 1 ||
+        cur.end > kWPPropRange - 1) {
+      // Tree is outside the allowed range, exit.
+      return false;
+    }
+    auto &node = tree[cur.pos];
+    // Leaf.
+    if (node.property0 == -1) {
+      if (node.predictor_offset < std::numeric_limits<int8_t>::min() ||
+          node.predictor_offset > std::numeric_limits<int8_t>::max() ||
+          node.multiplier != 1 || node.predictor_offset != 0) {
+        return false;
+      }
+      for (int i = cur.begin + 1; i < cur.end + 1; i++) {
+        context_lookup[i + kWPPropRange] = node.childID;
+      }
+      continue;
+    }
+    // > side of top node.
+    if (node.properties[0] >= kNumStaticProperties) {
+      ranges.push_back(TreeRange({node.splitvals[0], cur.end, node.childID}));
+      ranges.push_back(
+          TreeRange({node.splitval0, node.splitvals[0], node.childID + 1}));
+    } else {
+      ranges.push_back(TreeRange({node.splitval0, cur.end, node.childID}));
+    }
+    // <= side
+    if (node.properties[1] >= kNumStaticProperties) {
+      ranges.push_back(
+          TreeRange({node.splitvals[1], node.splitval0, node.childID + 2}));
+      ranges.push_back(
+          TreeRange({cur.begin, node.splitvals[1], node.childID + 3}));
+    } else {
+      ranges.push_back(
+          TreeRange({cur.begin, node.splitval0, node.childID + 2}));
+    }
+  }
+  return true;
+}
+
+// Returns whether all the decisions of `tree` are on the gradient property and
+// all its leaves use the gradient predictor.
+bool IsGradientOnly(const FlatTree &tree) {
+  for (const FlatDecisionNode &node : tree) {
+    if (node.property0 == -1) {
+      if (node.predictor != Predictor::Gradient) return false;
+      continue;
+    }
+    if (node.property0 != kGradientProp) return false;
+    for (size_t i = 0; i < 2; i++) {
+      // Dummy decisions on property 0 lead to two copies of a leaf.
+      if (node.properties[i] >= kNumStaticProperties &&
+          node.properties[i] != kGradientProp) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 }  // namespace
 
 void GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
@@ -114,7 +193,8 @@ void GatherTreeData(const Image &image, pixel_type chan, size_t group_id,
 Tree LearnTree(TreeSamples &&tree_samples, size_t total_pixels,
                const ModularOptions &options,
                const std::vector<ModularMultiplierInfo> &multiplier_info = {},
-               StaticPropRange static_prop_range = {}) {
+               StaticPropRange static_prop_range = {},
+               ThreadPool *pool = nullptr) {
   for (size_t i = 0; i < kNumStaticProperties; i++) {
     if (static_prop_range[i][1] == 0) {
       static_prop_range[i][1] = std::numeric_limits<uint32_t>::max();
@@ -136,7 +216,7 @@ Tree LearnTree(TreeSamples &&tree_samples, size_t total_pixels,
   ComputeBestTree(tree_samples,
                   options.splitting_heuristics_node_threshold * required_cost,
                   multiplier_info, static_prop_range,
-                  options.fast_decode_multiplier, &tree);
+                  options.fast_decode_multiplier, &tree, pool);
   return tree;
 }
 
@@ -192,63 +272,15 @@ Status EncodeModularChannelMAANS(const Image &image, pixel_type chan,
   MATreeLookup tree_lookup(tree);
   JXL_DEBUG_V(3, "Encoding using a MA tree with %zu nodes", tree.size());
 
-  // Check if this tree is a WP-only tree with a small enough property value
-  // range.
+  // Check if this tree is a WP-only or gradient-only tree with a small enough
+  // property value range.
   // Initialized to avoid clang-tidy complaining.
   uint16_t context_lookup[2 * kWPPropRange] = {};
-  // TODO(veluca): de-duplicate code in Decode.
   if (is_wp_only) {
-    struct TreeRange {
-      // Begin *excluded*, end *included*. This works best with > vs <= decision
-      // nodes.
-      int begin, end;
-      size_t pos;
-    };
-    std::vector<TreeRange> ranges;
-    ranges.push_back(TreeRange{-kWPPropRange - 1, kWPPropRange - 1, 0});
-    while (!ranges.empty()) {
-      TreeRange cur = ranges.back();
-      ranges.pop_back();
-      if (cur.begin < -kWPPropRange - 1 || cur.begin >= kWPPropRange - 1 ||
-          cur.end > kWPPropRange - 1) {
-        // Tree is outside the allowed range, exit.
-        is_wp_only = false;
-        break;
-      }
-      auto &node = tree[cur.pos];
-      // Leaf.
-      if (node.property0 == -1) {
-        if (node.predictor_offset < std::numeric_limits<int8_t>::min() ||
-            node.predictor_offset > std::numeric_limits<int8_t>::max() ||
-            node.multiplier != 1 || node.predictor_offset != 0) {
-          is_wp_only = false;
-          break;
-        }
-        for (int i = cur.begin + 1; i < cur.end + 1; i++) {
-          context_lookup[i + kWPPropRange] = node.childID;
-        }
-        continue;
-      }
-      // > side of top node.
-      if (node.properties[0] >= kNumStaticProperties) {
-        ranges.push_back(TreeRange({node.splitvals[0], cur.end, node.childID}));
-        ranges.push_back(
-            TreeRange({node.splitval0, node.splitvals[0], node.childID + 1}));
-      } else {
-        ranges.push_back(TreeRange({node.splitval0, cur.end, node.childID}));
-      }
-      // <= side
-      if (node.properties[1] >= kNumStaticProperties) {
-        ranges.push_back(
-            TreeRange({node.splitvals[1], node.splitval0, node.childID + 2}));
-        ranges.push_back(
-            TreeRange({cur.begin, node.splitvals[1], node.childID + 3}));
-      } else {
-        ranges.push_back(
-            TreeRange({cur.begin, node.splitval0, node.childID + 2}));
-      }
-    }
+    is_wp_only = ComputeContextLookup(tree, context_lookup);
   }
+  bool is_gradient_only = !use_wp && tree.size() > 1 && IsGradientOnly(tree) &&
+                          ComputeContextLookup(tree, context_lookup);
 
   tokens->reserve(tokens->size() + channel.w * channel.h);
   if (is_wp_only) {
@@ -281,6 +313,31 @@ Status EncodeModularChannelMAANS(const Image &image, pixel_type chan,
         wp_state.UpdateErrors(r[x], x, y, channel.w);
       }
     }
+  } else if (is_gradient_only) {
+    for (size_t c = 0; c < 3; c++) {
+      FillImage(static_cast<float>(PredictorColor(Predictor::Gradient)[c]),
+                &predictor_img.Plane(c));
+    }
+    // Single pass over the channel that only computes the gradient prediction
+    // and the context from the three neighbours, like PredictTreeNoWP does
+    // for this tree.
+    const intptr_t onerow = channel.plane.PixelsPerRow();
+    for (size_t y = 0; y < channel.h; y++) {
+      const pixel_type *JXL_RESTRICT r = channel.Row(y);
+      const pixel_type *JXL_RESTRICT rtop = y ? r - onerow : r;
+      for (size_t x = 0; x < channel.w; x++) {
+        pixel_type_w left = (x ? r[x - 1] : y ? rtop[x] : 0);
+        pixel_type_w top = (y ? rtop[x] : left);
+        pixel_type_w topleft = (x && y ? rtop[x - 1] : left);
+        pixel_type_w gradient = left + top - topleft;
+        uint32_t pos = kWPPropRange +
+                       std::min<pixel_type_w>(
+                           std::max<pixel_type_w>(-kWPPropRange, gradient),
+                           kWPPropRange - 1);
+        pixel_type_w guess = ClampedGradient(left, top, topleft);
+        tokens->emplace_back(context_lookup[pos], PackSigned(r[x] - guess));
+      }
+    }
   } else if (tree.size() == 1 && tree[0].predictor == Predictor::Zero &&
              tree[0].multiplier == 1 && tree[0].predictor_offset == 0) {
     for (size_t c = 0; c < 3; c++) {
@@ -41,7 +41,8 @@ void PrintTree(const Tree &tree, const std::string &path);
 Tree LearnTree(TreeSamples &&tree_samples, size_t total_pixels,
                const ModularOptions &options,
                const std::vector<ModularMultiplierInfo> &multiplier_info = {},
-               StaticPropRange static_prop_range = {});
+               StaticPropRange static_prop_range = {},
+               ThreadPool *pool = nullptr);
 
 // TODO(veluca): make cleaner interfaces.
 
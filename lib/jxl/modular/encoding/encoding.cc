@@ -391,7 +391,8 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
                      size_t group_id, ModularOptions *options,
                      const Tree *global_tree, const ANSCode *global_code,
                      const std::vector<uint8_t> *global_ctx_map,
-                     bool allow_truncated_group) {
+                     bool allow_truncated_group,
+                     CacheAlignedUniquePtr *lz77_window_storage) {
   if (image.nb_channels < 1) return true;
 
   // decode transforms
@@ -462,7 +463,7 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
     }
   }
   // Read channels
-  ANSSymbolReader reader(code, br, distance_multiplier);
+  ANSSymbolReader reader(code, br, distance_multiplier, lz77_window_storage);
   for (size_t i = options->skipchannels; i < nb_channels; i++) {
     Channel &channel = image.channel[i];
     if (!channel.w || !channel.h) {
@@ -493,7 +494,8 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 ModularOptions *options, int undo_transforms,
                                 const Tree *tree, const ANSCode *code,
                                 const std::vector<uint8_t> *ctx_map,
-                                bool allow_truncated_group) {
+                                bool allow_truncated_group,
+                                CacheAlignedUniquePtr *lz77_window_storage) {
 #ifdef JXL_ENABLE_ASSERT
   std::vector<std::pair<uint32_t, uint32_t>> req_sizes(image.channel.size());
   for (size_t c = 0; c < req_sizes.size(); c++) {
@@ -502,8 +504,9 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
 #endif
   GroupHeader local_header;
   if (header == nullptr) header = &local_header;
-  auto dec_status = ModularDecode(br, image, *header, group_id, options, tree,
-                                  code, ctx_map, allow_truncated_group);
+  auto dec_status =
+      ModularDecode(br, image, *header, group_id, options, tree, code, ctx_map,
+                    allow_truncated_group, lz77_window_storage);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) return dec_status;
   image.undo_transforms(header->wp_header, undo_transforms);
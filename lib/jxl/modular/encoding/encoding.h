@@ -74,14 +74,15 @@ FlatTree FilterTree(const Tree &global_tree,
 // undo_transforms == 0: undo all transforms
 // undo_transforms == -1: undo all transforms but don't clamp to range
 // undo_transforms == -2: don't undo any transform
-Status ModularGenericDecompress(BitReader *br, Image &image,
-                                GroupHeader *header, size_t group_id,
-                                ModularOptions *options,
-                                int undo_transforms = -1,
-                                const Tree *tree = nullptr,
-                                const ANSCode *code = nullptr,
-                                const std::vector<uint8_t> *ctx_map = nullptr,
-                                bool allow_truncated_group = false);
+// If not null, lz77_window_storage is passed to the ANSSymbolReader to reuse
+// its LZ77 window across calls.
+Status ModularGenericDecompress(
+    BitReader *br, Image &image, GroupHeader *header, size_t group_id,
+    ModularOptions *options, int undo_transforms = -1,
+    const Tree *tree = nullptr, const ANSCode *code = nullptr,
+    const std::vector<uint8_t> *ctx_map = nullptr,
+    bool allow_truncated_group = false,
+    CacheAlignedUniquePtr *lz77_window_storage = nullptr);
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_ENCODING_ENCODING_H_
@@ -51,6 +51,7 @@ struct Rng {
 }  // namespace
 #endif
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/fast_math-inl.h"
 #include "lib/jxl/modular/encoding/context_predict.h"
@@ -195,312 +196,464 @@ void SplitTreeSamples(TreeSamples &tree_samples, size_t begin, size_t pos,
   }
 }
 
+struct SplitInfo {
+  size_t prop = 0;
+  uint32_t val = 0;
+  size_t pos = 0;
+  float lcost = std::numeric_limits<float>::max();
+  float rcost = std::numeric_limits<float>::max();
+  Predictor lpred = Predictor::Zero;
+  Predictor rpred = Predictor::Zero;
+  float Cost() const { return lcost + rcost; }
+};
+
+// Best splits of a node, by kind of split.
+struct BestSplits {
+  SplitInfo static_constant;
+  SplitInfo static_split;
+  SplitInfo nonstatic;
+  SplitInfo nowp;
+};
+
+struct CostInfo {
+  float cost = std::numeric_limits<float>::max();
+  float extra_cost = 0;
+  float Cost() const { return cost + extra_cost; }
+  Predictor pred;  // will be uninitialized in some cases, but never used.
+};
+
+struct NodeInfo {
+  size_t pos;
+  size_t begin;
+  size_t end;
+  uint64_t used_properties;
+  StaticPropRange static_prop_range;
+};
+
+// A node whose best split is being searched for.
+struct PendingNode {
+  NodeInfo info;
+  size_t max_symbols;
+  // Token histogram and total number of extra bits of each predictor.
+  std::vector<int32_t> counts;
+  std::vector<uint32_t> tot_extra_bits;
+  // Cost of not splitting the node.
+  float base_bits;
+  // Set if the multiplier ranges cut through the node.
+  bool forced;
+  SplitInfo forced_split;
+  // Best splits along each of the properties.
+  std::vector<BestSplits> prop_splits;
+};
+
+// Per-thread temporary storage of the split search.
+struct SplitScratch {
+  std::vector<int32_t> rounded_counts;
+  std::vector<int> prop_value_used_count;
+  // Always all-zero outside of FindPropertySplits.
+  std::vector<int> count_increase;
+  std::vector<size_t> extra_bits_increase;
+  std::vector<CostInfo> costs_l;
+  std::vector<CostInfo> costs_r;
+  std::vector<int32_t> counts_above;
+  std::vector<int32_t> counts_below;
+};
+
+// Nodes in different subtrees only read their own range of samples, so the
+// splits of up to this many nodes are searched for at the same time.
+constexpr size_t kMaxPendingNodes = 256;
+
+// Computes the histograms and the cost of `node` as a leaf, and whether the
+// multiplier ranges force a split of it.
+void InitPendingNode(const TreeSamples &tree_samples, float threshold,
+                     const std::vector<ModularMultiplierInfo> &mul_info,
+                     SplitScratch *scratch, PendingNode *node, Tree *tree) {
+  size_t num_predictors = tree_samples.NumPredictors();
+  size_t pos = node->info.pos;
+  size_t begin = node->info.begin;
+  size_t end = node->info.end;
+
+  JXL_DASSERT(begin <= end);
+  JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
+
+  // Compute the maximum token in the range.
+  size_t max_symbols = 0;
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    for (size_t i = begin; i < end; i++) {
+      uint32_t tok = tree_samples.Token(pred, i);
+      max_symbols = max_symbols > tok + 1 ? max_symbols : tok + 1;
+    }
+  }
+  max_symbols = Padded(max_symbols);
+  node->max_symbols = max_symbols;
+  if (scratch->rounded_counts.size() < max_symbols) {
+    scratch->rounded_counts.resize(max_symbols);
+  }
+  std::vector<int32_t> &counts = node->counts;
+  std::vector<uint32_t> &tot_extra_bits = node->tot_extra_bits;
+  counts.assign(max_symbols * num_predictors, 0);
+  tot_extra_bits.assign(num_predictors, 0);
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    for (size_t i = begin; i < end; i++) {
+      counts[pred * max_symbols + tree_samples.Token(pred, i)] +=
+          tree_samples.Count(i);
+      tot_extra_bits[pred] +=
+          tree_samples.NBits(pred, i) * tree_samples.Count(i);
+    }
+  }
+
+  {
+    size_t pred = tree_samples.PredictorIndex((*tree)[pos].predictor);
+    node->base_bits =
+        EstimateBits(counts.data() + pred * max_symbols,
+                     scratch->rounded_counts.data(), max_symbols) +
+        tot_extra_bits[pred];
+  }
+
+  node->forced = false;
+  node->prop_splits.assign(tree_samples.NumProperties(), BestSplits());
+
+  // The multiplier ranges cut halfway through the current ranges of static
+  // properties. We do this even if the current node is not a leaf, to
+  // minimize the number of nodes in the resulting tree.
+  for (size_t i = 0; i < mul_info.size(); i++) {
+    uint32_t axis, val;
+    IntersectionType t = BoxIntersects(node->info.static_prop_range,
+                                       mul_info[i].range, axis, val);
+    if (t == IntersectionType::kNone) continue;
+    if (t == IntersectionType::kInside) {
+      (*tree)[pos].multiplier = mul_info[i].multiplier;
+      break;
+    }
+    if (t == IntersectionType::kPartial) {
+      SplitInfo *best = &node->forced_split;
+      *best = SplitInfo();
+      best->val = tree_samples.QuantizeProperty(axis, val);
+      best->prop = axis;
+      best->lcost = best->rcost = node->base_bits / 2 - threshold;
+      best->lpred = best->rpred = (*tree)[pos].predictor;
+      best->pos = begin;
+      JXL_ASSERT(best->prop == tree_samples.PropertyFromIndex(best->prop));
+      for (size_t x = begin; x < end; x++) {
+        if (tree_samples.Property(best->prop, x) <= best->val) {
+          best->pos++;
+        }
+      }
+      node->forced = true;
+      break;
+    }
+  }
+}
+
+// Finds the best splits of `node` of the form `prop > threshold`.
+void FindPropertySplits(const TreeSamples &tree_samples, float threshold,
+                        const Tree &tree, const PendingNode &node, size_t prop,
+                        SplitScratch *scratch, BestSplits *best_splits) {
+  size_t num_predictors = tree_samples.NumPredictors();
+  size_t pos = node.info.pos;
+  size_t begin = node.info.begin;
+  size_t end = node.info.end;
+  size_t max_symbols = node.max_symbols;
+  uint64_t used_properties = node.info.used_properties;
+  const std::vector<int32_t> &counts = node.counts;
+  const std::vector<uint32_t> &tot_extra_bits = node.tot_extra_bits;
+
+  std::vector<int> &prop_value_used_count = scratch->prop_value_used_count;
+  std::vector<int> &count_increase = scratch->count_increase;
+  std::vector<size_t> &extra_bits_increase = scratch->extra_bits_increase;
+  std::vector<CostInfo> &costs_l = scratch->costs_l;
+  std::vector<CostInfo> &costs_r = scratch->costs_r;
+  std::vector<int32_t> &counts_above = scratch->counts_above;
+  std::vector<int32_t> &counts_below = scratch->counts_below;
+  if (counts_above.size() < max_symbols) {
+    scratch->rounded_counts.resize(max_symbols);
+    counts_above.resize(max_symbols);
+    counts_below.resize(max_symbols);
+  }
+  int32_t *rounded_counts = scratch->rounded_counts.data();
+
+  // The lower the threshold, the higher the expected noisiness of the
+  // estimate. Thus, discourage changing predictors.
+  float change_pred_penalty = 800.0f / (100.0f + threshold);
+
+  // For the property, compute which of its values are used, and what tokens
+  // correspond to those usages. Then, iterate through the values, and compute
+  // the entropy of each side of the split (of the form `prop > threshold`).
+  // Finally, find the split that minimizes the cost.
+  costs_l.clear();
+  costs_r.clear();
+  size_t prop_size = tree_samples.NumPropertyValues(prop);
+  if (count_increase.size() < prop_size * max_symbols) {
+    count_increase.resize(prop_size * max_symbols);
+  }
+  if (extra_bits_increase.size() < prop_size) {
+    extra_bits_increase.resize(prop_size);
+  }
+  // Clear prop_value_used_count (which cannot be cleared "on the go")
+  prop_value_used_count.clear();
+  prop_value_used_count.resize(prop_size);
+
+  size_t first_used = prop_size;
+  size_t last_used = 0;
+
+  // TODO(veluca): consider finding multiple splits along a single
+  // property at the same time, possibly with a bottom-up approach.
+  for (size_t i = begin; i < end; i++) {
+    size_t p = tree_samples.Property(prop, i);
+    prop_value_used_count[p]++;
+    last_used = std::max(last_used, p);
+    first_used = std::min(first_used, p);
+  }
+  costs_l.resize(last_used - first_used);
+  costs_r.resize(last_used - first_used);
+  // For all predictors, compute the right and left costs of each split.
+  for (size_t pred = 0; pred < num_predictors; pred++) {
+    // Compute cost and histogram increments for each property value.
+    for (size_t i = begin; i < end; i++) {
+      size_t p = tree_samples.Property(prop, i);
+      size_t cnt = tree_samples.Count(i);
+      size_t sym = tree_samples.Token(pred, i);
+      count_increase[p * max_symbols + sym] += cnt;
+      extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
+    }
+    memcpy(counts_above.data(), counts.data() + pred * max_symbols,
+           max_symbols * sizeof counts_above[0]);
+    memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
+    size_t extra_bits_below = 0;
+    // Exclude last used: this ensures neither counts_above nor
+    // counts_below is empty.
+    for (size_t i = first_used; i < last_used; i++) {
+      if (!prop_value_used_count[i]) continue;
+      extra_bits_below += extra_bits_increase[i];
+      // The increase for this property value has been used, and will not
+      // be used again: clear it. Also below.
+      extra_bits_increase[i] = 0;
+      for (size_t sym = 0; sym < max_symbols; sym++) {
+        counts_above[sym] -= count_increase[i * max_symbols + sym];
+        counts_below[sym] += count_increase[i * max_symbols + sym];
+        count_increase[i * max_symbols + sym] = 0;
+      }
+      float rcost =
+          EstimateBits(counts_above.data(), rounded_counts, max_symbols) +
+          tot_extra_bits[pred] - extra_bits_below;
+      float lcost =
+          EstimateBits(counts_below.data(), rounded_counts, max_symbols) +
+          extra_bits_below;
+      JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
+      float penalty = 0;
+      // Never discourage moving away from the Weighted predictor.
+      if (tree_samples.PredictorFromIndex(pred) != tree[pos].predictor &&
+          tree[pos].predictor != Predictor::Weighted) {
+        penalty = change_pred_penalty;
+      }
+      // If everything else is equal, disfavour Weighted (slower) and
+      // favour Zero (faster if it's the only predictor used in a
+      // group+channel combination)
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
+        penalty += 1e-8;
+      }
+      if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
+        penalty -= 1e-8;
+      }
+      if (rcost + penalty < costs_r[i - first_used].Cost()) {
+        costs_r[i - first_used].cost = rcost;
+        costs_r[i - first_used].extra_cost = penalty;
+        costs_r[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
+      }
+      if (lcost + penalty < costs_l[i - first_used].Cost()) {
+        costs_l[i - first_used].cost = lcost;
+        costs_l[i - first_used].extra_cost = penalty;
+        costs_l[i - first_used].pred = tree_samples.PredictorFromIndex(pred);
+      }
+    }
+  }
+  // Iterate through the possible splits and find the one with minimum sum
+  // of costs of the two sides.
+  size_t split = begin;
+  for (size_t i = first_used; i < last_used; i++) {
+    if (!prop_value_used_count[i]) continue;
+    split += prop_value_used_count[i];
+    float rcost = costs_r[i - first_used].cost;
+    float lcost = costs_l[i - first_used].cost;
+    // WP was not used + we would use the WP property or predictor
+    bool adds_wp =
+        (tree_samples.PropertyFromIndex(prop) == kWPProp &&
+         (used_properties & (1LU << prop)) == 0) ||
+        ((costs_l[i - first_used].pred == Predictor::Weighted ||
+          costs_r[i - first_used].pred == Predictor::Weighted) &&
+         tree[pos].predictor != Predictor::Weighted);
+    bool zero_entropy_side = rcost == 0 || lcost == 0;
+
+    SplitInfo &best =
+        prop < kNumStaticProperties
+            ? (zero_entropy_side ? best_splits->static_constant
+                                 : best_splits->static_split)
+            : (adds_wp ? best_splits->nonstatic : best_splits->nowp);
+    if (lcost + rcost < best.Cost()) {
+      best.prop = prop;
+      best.val = i;
+      best.pos = split;
+      best.lcost = lcost;
+      best.lpred = costs_l[i - first_used].pred;
+      best.rcost = rcost;
+      best.rpred = costs_r[i - first_used].pred;
+    }
+  }
+  // Clear extra_bits_increase and cost_increase for last_used.
+  extra_bits_increase[last_used] = 0;
+  for (size_t sym = 0; sym < max_symbols; sym++) {
+    count_increase[last_used * max_symbols + sym] = 0;
+  }
+}
+
+// Only replaces `best` with a strictly cheaper split, so merging the splits of
+// each property in order picks the same split as a single search through all
+// the properties.
+void MergeSplit(const SplitInfo &split, SplitInfo *best) {
+  if (split.Cost() < best->Cost()) *best = split;
+}
+
 void FindBestSplit(TreeSamples &tree_samples, float threshold,
                    const std::vector<ModularMultiplierInfo> &mul_info,
                    StaticPropRange initial_static_prop_range,
-                   float fast_decode_multiplier, Tree *tree) {
-  struct NodeInfo {
-    size_t pos;
-    size_t begin;
-    size_t end;
-    uint64_t used_properties;
-    StaticPropRange static_prop_range;
-  };
+                   float fast_decode_multiplier, Tree *tree,
+                   ThreadPool *pool) {
   std::vector<NodeInfo> nodes;
   nodes.push_back(NodeInfo{0, 0, tree_samples.NumDistinctSamples(), 0,
                            initial_static_prop_range});
 
-  size_t num_predictors = tree_samples.NumPredictors();
   size_t num_properties = tree_samples.NumProperties();
 
-  // TODO(veluca): consider parallelizing the search (processing multiple nodes
-  // at a time).
+  std::vector<SplitScratch> scratch;
+  const auto init_scratch = [&](size_t num_threads) {
+    if (scratch.size() < num_threads) scratch.resize(num_threads);
+    return true;
+  };
+
+  struct SamplesSplit {
+    size_t begin;
+    size_t pos;
+    size_t end;
+    size_t prop;
+  };
+  std::vector<PendingNode> pending;
+  std::vector<SamplesSplit> samples_splits;
+
+  // The split of a node only depends on its own samples and on its ancestors,
+  // so the nodes can be processed in any order. Splitting the nodes in a
+  // different order only changes the numbering of the nodes of the tree, which
+  // TokenizeTree does not depend on.
   while (!nodes.empty()) {
-    size_t pos = nodes.back().pos;
-    size_t begin = nodes.back().begin;
-    size_t end = nodes.back().end;
-    uint64_t used_properties = nodes.back().used_properties;
-    StaticPropRange static_prop_range = nodes.back().static_prop_range;
-    nodes.pop_back();
-    if (begin == end) continue;
-
-    struct SplitInfo {
-      size_t prop = 0;
-      uint32_t val = 0;
-      size_t pos = 0;
-      float lcost = std::numeric_limits<float>::max();
-      float rcost = std::numeric_limits<float>::max();
-      Predictor lpred = Predictor::Zero;
-      Predictor rpred = Predictor::Zero;
-      float Cost() { return lcost + rcost; }
-    };
-
-    SplitInfo best_split_static_constant;
-    SplitInfo best_split_static;
-    SplitInfo best_split_nonstatic;
-    SplitInfo best_split_nowp;
-
-    JXL_DASSERT(begin <= end);
-    JXL_DASSERT(end <= tree_samples.NumDistinctSamples());
-
-    // Compute the maximum token in the range.
-    size_t max_symbols = 0;
-    for (size_t pred = 0; pred < num_predictors; pred++) {
-      for (size_t i = begin; i < end; i++) {
-        uint32_t tok = tree_samples.Token(pred, i);
-        max_symbols = max_symbols > tok + 1 ? max_symbols : tok + 1;
-      }
-    }
-    max_symbols = Padded(max_symbols);
-    std::vector<int32_t> rounded_counts(max_symbols);
-    std::vector<int32_t> counts(max_symbols * num_predictors);
-    std::vector<uint32_t> tot_extra_bits(num_predictors);
-    for (size_t pred = 0; pred < num_predictors; pred++) {
-      for (size_t i = begin; i < end; i++) {
-        counts[pred * max_symbols + tree_samples.Token(pred, i)] +=
-            tree_samples.Count(i);
-        tot_extra_bits[pred] +=
-            tree_samples.NBits(pred, i) * tree_samples.Count(i);
-      }
+    size_t num_pending = 0;
+    while (!nodes.empty() && num_pending < kMaxPendingNodes) {
+      NodeInfo info = nodes.back();
+      nodes.pop_back();
+      if (info.begin == info.end) continue;
+      if (pending.size() == num_pending) pending.emplace_back();
+      pending[num_pending++].info = info;
     }
+    if (num_pending == 0) break;
 
-    float base_bits;
-    {
-      size_t pred = tree_samples.PredictorIndex((*tree)[pos].predictor);
-      base_bits = EstimateBits(counts.data() + pred * max_symbols,
-                               rounded_counts.data(), max_symbols) +
-                  tot_extra_bits[pred];
-    }
+    JXL_CHECK(RunOnPool(
+        pool, 0, num_pending, init_scratch,
+        [&](size_t i, size_t thread) {
+          InitPendingNode(tree_samples, threshold, mul_info, &scratch[thread],
+                          &pending[i], tree);
+        },
+        "MA tree histograms"));
 
-    SplitInfo *best = &best_split_nonstatic;
-
-    SplitInfo forced_split;
-    // The multiplier ranges cut halfway through the current ranges of static
-    // properties. We do this even if the current node is not a leaf, to
-    // minimize the number of nodes in the resulting tree.
-    for (size_t i = 0; i < mul_info.size(); i++) {
-      uint32_t axis, val;
-      IntersectionType t =
-          BoxIntersects(static_prop_range, mul_info[i].range, axis, val);
-      if (t == IntersectionType::kNone) continue;
-      if (t == IntersectionType::kInside) {
-        (*tree)[pos].multiplier = mul_info[i].multiplier;
-        break;
-      }
-      if (t == IntersectionType::kPartial) {
-        forced_split.val = tree_samples.QuantizeProperty(axis, val);
-        forced_split.prop = axis;
-        forced_split.lcost = forced_split.rcost = base_bits / 2 - threshold;
-        forced_split.lpred = forced_split.rpred = (*tree)[pos].predictor;
-        best = &forced_split;
-        best->pos = begin;
-        JXL_ASSERT(best->prop == tree_samples.PropertyFromIndex(best->prop));
-        for (size_t x = begin; x < end; x++) {
-          if (tree_samples.Property(best->prop, x) <= best->val) {
-            best->pos++;
-          }
-        }
-        break;
-      }
-    }
+    // Search along each property of each node in parallel; this also uses all
+    // the threads for the first few nodes of the tree.
+    JXL_CHECK(RunOnPool(
+        pool, 0, num_pending * num_properties, init_scratch,
+        [&](size_t task, size_t thread) {
+          PendingNode &node = pending[task / num_properties];
+          size_t prop = task % num_properties;
+          if (node.forced || node.base_bits <= threshold) return;
+          FindPropertySplits(tree_samples, threshold, *tree, node, prop,
+                             &scratch[thread], &node.prop_splits[prop]);
+        },
+        "MA tree splits"));
 
-    if (best != &forced_split) {
-      std::vector<int> prop_value_used_count;
-      std::vector<int> count_increase;
-      std::vector<size_t> extra_bits_increase;
-      // For each property, compute which of its values are used, and what
-      // tokens correspond to those usages. Then, iterate through the values,
-      // and compute the entropy of each side of the split (of the form `prop >
-      // threshold`). Finally, find the split that minimizes the cost.
-      struct CostInfo {
-        float cost = std::numeric_limits<float>::max();
-        float extra_cost = 0;
-        float Cost() const { return cost + extra_cost; }
-        Predictor pred;  // will be uninitialized in some cases, but never used.
-      };
-      std::vector<CostInfo> costs_l;
-      std::vector<CostInfo> costs_r;
-
-      std::vector<int32_t> counts_above(max_symbols);
-      std::vector<int32_t> counts_below(max_symbols);
-
-      // The lower the threshold, the higher the expected noisiness of the
-      // estimate. Thus, discourage changing predictors.
-      float change_pred_penalty = 800.0f / (100.0f + threshold);
-      for (size_t prop = 0; prop < num_properties && base_bits > threshold;
-           prop++) {
-        costs_l.clear();
-        costs_r.clear();
-        size_t prop_size = tree_samples.NumPropertyValues(prop);
-        if (extra_bits_increase.size() < prop_size) {
-          count_increase.resize(prop_size * max_symbols);
-          extra_bits_increase.resize(prop_size);
-        }
-        // Clear prop_value_used_count (which cannot be cleared "on the go")
-        prop_value_used_count.clear();
-        prop_value_used_count.resize(prop_size);
-
-        size_t first_used = prop_size;
-        size_t last_used = 0;
-
-        // TODO(veluca): consider finding multiple splits along a single
-        // property at the same time, possibly with a bottom-up approach.
-        for (size_t i = begin; i < end; i++) {
-          size_t p = tree_samples.Property(prop, i);
-          prop_value_used_count[p]++;
-          last_used = std::max(last_used, p);
-          first_used = std::min(first_used, p);
+    samples_splits.clear();
+    for (size_t n = 0; n < num_pending; n++) {
+      const PendingNode &node = pending[n];
+      size_t pos = node.info.pos;
+      size_t begin = node.info.begin;
+      size_t end = node.info.end;
+      uint64_t used_properties = node.info.used_properties;
+      const StaticPropRange &static_prop_range = node.info.static_prop_range;
+      float base_bits = node.base_bits;
+
+      BestSplits merged;
+      const SplitInfo *best = &node.forced_split;
+      if (!node.forced) {
+        for (const BestSplits &splits : node.prop_splits) {
+          MergeSplit(splits.static_constant, &merged.static_constant);
+          MergeSplit(splits.static_split, &merged.static_split);
+          MergeSplit(splits.nonstatic, &merged.nonstatic);
+          MergeSplit(splits.nowp, &merged.nowp);
         }
-        costs_l.resize(last_used - first_used);
-        costs_r.resize(last_used - first_used);
-        // For all predictors, compute the right and left costs of each split.
-        for (size_t pred = 0; pred < num_predictors; pred++) {
-          // Compute cost and histogram increments for each property value.
-          for (size_t i = begin; i < end; i++) {
-            size_t p = tree_samples.Property(prop, i);
-            size_t cnt = tree_samples.Count(i);
-            size_t sym = tree_samples.Token(pred, i);
-            count_increase[p * max_symbols + sym] += cnt;
-            extra_bits_increase[p] += tree_samples.NBits(pred, i) * cnt;
-          }
-          memcpy(counts_above.data(), counts.data() + pred * max_symbols,
-                 max_symbols * sizeof counts_above[0]);
-          memset(counts_below.data(), 0, max_symbols * sizeof counts_below[0]);
-          size_t extra_bits_below = 0;
-          // Exclude last used: this ensures neither counts_above nor
-          // counts_below is empty.
-          for (size_t i = first_used; i < last_used; i++) {
-            if (!prop_value_used_count[i]) continue;
-            extra_bits_below += extra_bits_increase[i];
-            // The increase for this property value has been used, and will not
-            // be used again: clear it. Also below.
-            extra_bits_increase[i] = 0;
-            for (size_t sym = 0; sym < max_symbols; sym++) {
-              counts_above[sym] -= count_increase[i * max_symbols + sym];
-              counts_below[sym] += count_increase[i * max_symbols + sym];
-              count_increase[i * max_symbols + sym] = 0;
-            }
-            float rcost = EstimateBits(counts_above.data(),
-                                       rounded_counts.data(), max_symbols) +
-                          tot_extra_bits[pred] - extra_bits_below;
-            float lcost = EstimateBits(counts_below.data(),
-                                       rounded_counts.data(), max_symbols) +
-                          extra_bits_below;
-            JXL_DASSERT(extra_bits_below <= tot_extra_bits[pred]);
-            float penalty = 0;
-            // Never discourage moving away from the Weighted predictor.
-            if (tree_samples.PredictorFromIndex(pred) !=
-                    (*tree)[pos].predictor &&
-                (*tree)[pos].predictor != Predictor::Weighted) {
-              penalty = change_pred_penalty;
-            }
-            // If everything else is equal, disfavour Weighted (slower) and
-            // favour Zero (faster if it's the only predictor used in a
-            // group+channel combination)
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Weighted) {
-              penalty += 1e-8;
-            }
-            if (tree_samples.PredictorFromIndex(pred) == Predictor::Zero) {
-              penalty -= 1e-8;
-            }
-            if (rcost + penalty < costs_r[i - first_used].Cost()) {
-              costs_r[i - first_used].cost = rcost;
-              costs_r[i - first_used].extra_cost = penalty;
-              costs_r[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-            if (lcost + penalty < costs_l[i - first_used].Cost()) {
-              costs_l[i - first_used].cost = lcost;
-              costs_l[i - first_used].extra_cost = penalty;
-              costs_l[i - first_used].pred =
-                  tree_samples.PredictorFromIndex(pred);
-            }
-          }
+        best = &merged.nonstatic;
+        // Try to avoid introducing WP.
+        if (merged.nowp.Cost() + threshold < base_bits &&
+            merged.nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
+          best = &merged.nowp;
         }
-        // Iterate through the possible splits and find the one with minimum sum
-        // of costs of the two sides.
-        size_t split = begin;
-        for (size_t i = first_used; i < last_used; i++) {
-          if (!prop_value_used_count[i]) continue;
-          split += prop_value_used_count[i];
-          float rcost = costs_r[i - first_used].cost;
-          float lcost = costs_l[i - first_used].cost;
-          // WP was not used + we would use the WP property or predictor
-          bool adds_wp =
-              (tree_samples.PropertyFromIndex(prop) == kWPProp &&
-               (used_properties & (1LU << prop)) == 0) ||
-              ((costs_l[i - first_used].pred == Predictor::Weighted ||
-                costs_r[i - first_used].pred == Predictor::Weighted) &&
-               (*tree)[pos].predictor != Predictor::Weighted);
-          bool zero_entropy_side = rcost == 0 || lcost == 0;
-
-          SplitInfo &best =
-              prop < kNumStaticProperties
-                  ? (zero_entropy_side ? best_split_static_constant
-                                       : best_split_static)
-                  : (adds_wp ? best_split_nonstatic : best_split_nowp);
-          if (lcost + rcost < best.Cost()) {
-            best.prop = prop;
-            best.val = i;
-            best.pos = split;
-            best.lcost = lcost;
-            best.lpred = costs_l[i - first_used].pred;
-            best.rcost = rcost;
-            best.rpred = costs_r[i - first_used].pred;
-          }
+        // Split along static props if possible and not significantly more
+        // expensive.
+        if (merged.static_split.Cost() + threshold < base_bits &&
+            merged.static_split.Cost() <=
+                fast_decode_multiplier * best->Cost()) {
+          best = &merged.static_split;
         }
-        // Clear extra_bits_increase and cost_increase for last_used.
-        extra_bits_increase[last_used] = 0;
-        for (size_t sym = 0; sym < max_symbols; sym++) {
-          count_increase[last_used * max_symbols + sym] = 0;
+        // Split along static props to create constant nodes if possible.
+        if (merged.static_constant.Cost() + threshold < base_bits) {
+          best = &merged.static_constant;
         }
       }
 
-      // Try to avoid introducing WP.
-      if (best_split_nowp.Cost() + threshold < base_bits &&
-          best_split_nowp.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_nowp;
-      }
-      // Split along static props if possible and not significantly more
-      // expensive.
-      if (best_split_static.Cost() + threshold < base_bits &&
-          best_split_static.Cost() <= fast_decode_multiplier * best->Cost()) {
-        best = &best_split_static;
-      }
-      // Split along static props to create constant nodes if possible.
-      if (best_split_static_constant.Cost() + threshold < base_bits) {
-        best = &best_split_static_constant;
+      if (best->Cost() + threshold < base_bits) {
+        uint32_t p = tree_samples.PropertyFromIndex(best->prop);
+        pixel_type dequant =
+            tree_samples.UnquantizeProperty(best->prop, best->val);
+        // Split node and try to split children.
+        MakeSplitNode(pos, p, dequant, best->lpred, 0, best->rpred, 0, tree);
+        // "Sort" according to winning property
+        samples_splits.push_back(
+            SamplesSplit{begin, best->pos, end, best->prop});
+        if (p >= kNumStaticProperties) {
+          used_properties |= 1 << best->prop;
+        }
+        auto new_sp_range = static_prop_range;
+        if (p < kNumStaticProperties) {
+          JXL_ASSERT(static_cast<uint32_t>(dequant + 1) <= new_sp_range[p][1]);
+          new_sp_range[p][1] = dequant + 1;
+          JXL_ASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
+        }
+        nodes.push_back(NodeInfo{(*tree)[pos].rchild, begin, best->pos,
+                                 used_properties, new_sp_range});
+        new_sp_range = static_prop_range;
+        if (p < kNumStaticProperties) {
+          JXL_ASSERT(new_sp_range[p][0] <= static_cast<uint32_t>(dequant + 1));
+          new_sp_range[p][0] = dequant + 1;
+          JXL_ASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
+        }
+        nodes.push_back(NodeInfo{(*tree)[pos].lchild, best->pos, end,
+                                 used_properties, new_sp_range});
       }
     }
 
-    if (best->Cost() + threshold < base_bits) {
-      uint32_t p = tree_samples.PropertyFromIndex(best->prop);
-      pixel_type dequant =
-          tree_samples.UnquantizeProperty(best->prop, best->val);
-      // Split node and try to split children.
-      MakeSplitNode(pos, p, dequant, best->lpred, 0, best->rpred, 0, tree);
-      // "Sort" according to winning property
-      SplitTreeSamples(tree_samples, begin, best->pos, end, best->prop);
-      if (p >= kNumStaticProperties) {
-        used_properties |= 1 << best->prop;
-      }
-      auto new_sp_range = static_prop_range;
-      if (p < kNumStaticProperties) {
-        JXL_ASSERT(static_cast<uint32_t>(dequant + 1) <= new_sp_range[p][1]);
-        new_sp_range[p][1] = dequant + 1;
-        JXL_ASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
-      }
-      nodes.push_back(NodeInfo{(*tree)[pos].rchild, begin, best->pos,
-                               used_properties, new_sp_range});
-      new_sp_range = static_prop_range;
-      if (p < kNumStaticProperties) {
-        JXL_ASSERT(new_sp_range[p][0] <= static_cast<uint32_t>(dequant + 1));
-        new_sp_range[p][0] = dequant + 1;
-        JXL_ASSERT(new_sp_range[p][0] < new_sp_range[p][1]);
-      }
-      nodes.push_back(NodeInfo{(*tree)[pos].lchild, best->pos, end,
-                               used_properties, new_sp_range});
-    }
+    // The sample ranges of the nodes are disjoint, and SplitTreeSamples only
+    // moves samples within its range.
+    RunOnPool(
+        pool, 0, samples_splits.size(), ThreadPool::SkipInit(),
+        [&](size_t i, size_t _) {
+          const SamplesSplit &split = samples_splits[i];
+          SplitTreeSamples(tree_samples, split.begin, split.pos, split.end,
+                           split.prop);
+        },
+        "MA tree samples");
   }
 }
 
@@ -517,7 +670,8 @@ HWY_EXPORT(FindBestSplit);  // Local function.
 void ComputeBestTree(TreeSamples &tree_samples, float threshold,
                      const std::vector<ModularMultiplierInfo> &mul_info,
                      StaticPropRange static_prop_range,
-                     float fast_decode_multiplier, Tree *tree) {
+                     float fast_decode_multiplier, Tree *tree,
+                     ThreadPool *pool) {
   // TODO(veluca): take into account that different contexts can have different
   // uint configs.
   //
@@ -533,7 +687,7 @@ void ComputeBestTree(TreeSamples &tree_samples, float threshold,
              std::numeric_limits<uint32_t>::max());
   HWY_DYNAMIC_DISPATCH(FindBestSplit)
   (tree_samples, threshold, mul_info, static_prop_range, fast_decode_multiplier,
-   tree);
+   tree, pool);
 }
 
 constexpr int TreeSamples::kPropertyRange;
@@ -17,6 +17,7 @@
 
 #include <numeric>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/modular/modular_image.h"
 #include "lib/jxl/modular/options.h"
@@ -201,10 +202,12 @@ void CollectPixelSamples(const Image &image, const ModularOptions &options,
                          std::vector<pixel_type> &pixel_samples,
                          std::vector<pixel_type> &diff_samples);
 
+// The tree does not depend on the number of threads of `pool`.
 void ComputeBestTree(TreeSamples &tree_samples, float threshold,
                      const std::vector<ModularMultiplierInfo> &mul_info,
                      StaticPropRange static_prop_range,
-                     float fast_decode_multiplier, Tree *tree);
+                     float fast_decode_multiplier, Tree *tree,
+                     ThreadPool *pool = nullptr);
 
 }  // namespace jxl
 #endif  // LIB_JXL_MODULAR_ENCODING_MA_H_
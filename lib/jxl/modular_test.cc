@@ -14,6 +14,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <array>
 #include <random>
@@ -85,6 +86,88 @@ TEST(ModularTest, JXL_TSAN_SLOW_TEST(RoundtripLosslessGroups1024)) {
   TestLosslessGroups(3);
 }
 
+TEST(ModularTest, RoundtripLosslessLightning) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig =
+      ReadTestData("imagecompression.info/flower_foveon.png");
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.speed_tier = SpeedTier::kLightning;
+  DecompressParams dparams;
+
+  CodecInOut io_out;
+  size_t compressed_size;
+
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, pool));
+  io.ShrinkTo(io.xsize() / 4, io.ysize() / 4);
+
+  compressed_size = Roundtrip(&io, cparams, dparams, pool, &io_out);
+  EXPECT_LE(compressed_size, 340000);
+  EXPECT_LE(ButteraugliDistance(io, io_out, cparams.ba_params,
+                                /*distmap=*/nullptr, pool),
+            0.0);
+}
+
+// Define to nonzero in order to print the (new) golden size and hash of
+// TreeLearningIsDeterministic.
+#define PRINT_TREE_GOLDEN 0
+
+// Size and hash of the bitstream of TreeLearningIsDeterministic as written by
+// the serial tree learning (94d2079), which the multithreaded one must match.
+// Zero until recorded by running the test with PRINT_TREE_GOLDEN at that
+// revision; the check is skipped meanwhile.
+constexpr size_t kTreeGoldenSize = 0;
+constexpr uint64_t kTreeGoldenHash = 0;
+
+// 64-bit FNV-1a.
+uint64_t HashBytes(const PaddedBytes& bytes) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+TEST(ModularTest, TreeLearningIsDeterministic) {
+  const PaddedBytes orig =
+      ReadTestData("imagecompression.info/flower_foveon.png");
+  CompressParams cparams;
+  cparams.SetLossless();
+
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io));
+  io.ShrinkTo(io.xsize() / 8, io.ysize() / 8);
+
+  PaddedBytes compressed;
+  PassesEncoderState enc_state;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed,
+                         /*aux_out=*/nullptr, /*pool=*/nullptr));
+#if PRINT_TREE_GOLDEN
+  printf("kTreeGoldenSize = %zu, kTreeGoldenHash = 0x%016llXull\n",
+         compressed.size(),
+         static_cast<unsigned long long>(HashBytes(compressed)));
+#else
+  if (kTreeGoldenSize != 0) {
+    EXPECT_EQ(kTreeGoldenSize, compressed.size());
+    EXPECT_EQ(kTreeGoldenHash, HashBytes(compressed));
+  }
+#endif
+
+  // The learned tree, and thus the whole bitstream, must not depend on the
+  // number of threads.
+  for (size_t num_threads : {1, 3, 8}) {
+    ThreadPoolInternal pool(num_threads);
+    PaddedBytes compressed_mt;
+    PassesEncoderState enc_state_mt;
+    ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state_mt, &compressed_mt,
+                           /*aux_out=*/nullptr, &pool));
+    ASSERT_EQ(compressed.size(), compressed_mt.size());
+    EXPECT_EQ(0, memcmp(compressed.data(), compressed_mt.data(),
+                        compressed.size()));
+  }
+}
+
 TEST(ModularTest, RoundtripLossy) {
   ThreadPool* pool = nullptr;
   const PaddedBytes orig =
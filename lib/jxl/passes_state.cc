@@ -32,10 +32,10 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
 
   shared->ac_strategy =
       AcStrategyImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
-  shared->raw_quant_field =
-      ImageI(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
-  shared->epf_sharpness =
-      ImageB(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+  ReuseOrAllocateImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks,
+                       &shared->raw_quant_field);
+  ReuseOrAllocateImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks,
+                       &shared->epf_sharpness);
   shared->cmap = ColorCorrelationMap(frame_dim.xsize, frame_dim.ysize);
 
   shared->opsin_params =
@@ -53,10 +53,11 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
                                 kCoeffOrderMaxSize);
   }
 
-  shared->quant_dc = ImageB(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+  ReuseOrAllocateImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks,
+                       &shared->quant_dc);
   if (!(frame_header.flags & FrameHeader::kUseDcFrame) || encoder) {
-    shared->dc_storage =
-        Image3F(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+    ReuseOrAllocateImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks,
+                         &shared->dc_storage);
   } else {
     if (frame_header.dc_level == 4) {
       return JXL_FAILURE("Invalid DC level for kUseDcFrame: %u",
@@ -72,7 +73,8 @@ Status InitializePassesSharedState(const FrameHeader& frame_header,
     ZeroFillImage(&shared->quant_dc);
   }
 
-  shared->dc_storage = Image3F(frame_dim.xsize_blocks, frame_dim.ysize_blocks);
+  ReuseOrAllocateImage(frame_dim.xsize_blocks, frame_dim.ysize_blocks,
+                       &shared->dc_storage);
 
   return true;
 }
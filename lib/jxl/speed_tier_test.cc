@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "lib/extras/codec.h"
@@ -56,7 +57,11 @@ class SpeedTierTest : public testing::TestWithParam<SpeedTierTestParams> {};
 
 JXL_GTEST_INSTANTIATE_TEST_SUITE_P(
     SpeedTierTestInstantiation, SpeedTierTest,
-    testing::Values(SpeedTierTestParams{SpeedTier::kCheetah,
+    testing::Values(SpeedTierTestParams{SpeedTier::kLightning,
+                                        /*shrink8=*/true},
+                    SpeedTierTestParams{SpeedTier::kLightning,
+                                        /*shrink8=*/false},
+                    SpeedTierTestParams{SpeedTier::kCheetah,
                                         /*shrink8=*/true},
                     SpeedTierTestParams{SpeedTier::kCheetah,
                                         /*shrink8=*/false},
@@ -109,5 +114,35 @@ TEST_P(SpeedTierTest, Roundtrip) {
                                 /*distmap=*/nullptr, /*pool=*/nullptr),
             2.8);
 }
+
+// Tokenizing the AC coefficients of each group along with computing them, at
+// Falcon speed and faster, gives the same bitstream as tokenizing them in a
+// separate pass.
+TEST(SpeedTierTest, TokenizeWithCoefficients) {
+  const PaddedBytes orig =
+      ReadTestData("wesaturate/500px/u76c0g_bliznaca_srgb8.png");
+  CodecInOut io;
+  ThreadPoolInternal pool(8);
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+
+  for (SpeedTier speed_tier : {SpeedTier::kFalcon, SpeedTier::kLightning}) {
+    CompressParams cparams;
+    cparams.speed_tier = speed_tier;
+    PaddedBytes fused;
+    PassesEncoderState fused_state;
+    ASSERT_TRUE(EncodeFile(cparams, &io, &fused_state, &fused,
+                           /*aux_out=*/nullptr, &pool));
+
+    cparams.tokenize_with_coefficients = false;
+    PaddedBytes separate;
+    PassesEncoderState separate_state;
+    ASSERT_TRUE(EncodeFile(cparams, &io, &separate_state, &separate,
+                           /*aux_out=*/nullptr, &pool));
+
+    EXPECT_EQ(std::vector<uint8_t>(separate.begin(), separate.end()),
+              std::vector<uint8_t>(fused.begin(), fused.end()))
+        << SpeedTierName(speed_tier);
+  }
+}
 }  // namespace
 }  // namespace jxl
@@ -20,6 +20,7 @@ set(JPEGXL_INTERNAL_SOURCES_GBENCH
   jxl/enc_external_image_gbench.cc
   jxl/splines_gbench.cc
   jxl/tf_gbench.cc
+  threads/thread_parallel_runner_gbench.cc
 )
 
 # benchmark.h doesn't work in our MINGW set up since it ends up including the
@@ -39,6 +40,7 @@ if(benchmark_FOUND)
   target_link_libraries(jxl_gbench
     jxl_extras-static
     jxl-static
+    jxl_threads-static
     benchmark::benchmark
     benchmark::benchmark_main
   )
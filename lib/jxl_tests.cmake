@@ -66,7 +66,9 @@ set(TEST_FILES
   jxl/splines_test.cc
   jxl/toc_test.cc
   jxl/xorshift128plus_test.cc
+  threads/shared_runner_test.cc
   threads/thread_parallel_runner_test.cc
+  threads/work_stealing_runner_test.cc
   ### Files before this line are handled by build_cleaner.py
   # TODO(deymo): Move this to tools/
   ../tools/box/box_test.cc
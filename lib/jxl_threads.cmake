@@ -15,9 +15,16 @@
 find_package(Threads REQUIRED)
 
 set(JPEGXL_THREADS_SOURCES
+  threads/shared_runner.cc
+  threads/shared_runner_internal.cc
+  threads/shared_runner_internal.h
+  threads/thread_memory_manager_internal.h
   threads/thread_parallel_runner.cc
   threads/thread_parallel_runner_internal.cc
   threads/thread_parallel_runner_internal.h
+  threads/work_stealing_runner.cc
+  threads/work_stealing_runner_internal.cc
+  threads/work_stealing_runner_internal.h
 )
 
 ### Define the jxl_threads shared or static target library. The ${target}
@@ -0,0 +1,78 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jxl/shared_runner.h"
+
+#include "lib/threads/shared_runner_internal.h"
+#include "lib/threads/thread_memory_manager_internal.h"
+
+JxlParallelRetCode JxlSharedRunner(void* runner_opaque, void* jpegxl_opaque,
+                                   JxlParallelRunInit init,
+                                   JxlParallelRunFunction func,
+                                   uint32_t start_range, uint32_t end_range) {
+  return jpegxl::SharedRunnerClient::Runner(
+      runner_opaque, jpegxl_opaque, init, func, start_range, end_range);
+}
+
+void* JxlSharedRunnerPoolCreate(const JxlMemoryManager* memory_manager,
+                                size_t num_worker_threads) {
+  JxlMemoryManager local_memory_manager;
+  if (!jpegxl::ThreadMemoryManagerInit(&local_memory_manager, memory_manager))
+    return nullptr;
+
+  void* alloc = jpegxl::ThreadMemoryManagerAlloc(
+      &local_memory_manager, sizeof(jpegxl::SharedRunnerPool));
+  if (!alloc) return nullptr;
+  // Placement new constructor on allocated memory
+  jpegxl::SharedRunnerPool* pool =
+      new (alloc) jpegxl::SharedRunnerPool(num_worker_threads);
+  pool->memory_manager = local_memory_manager;
+
+  return pool;
+}
+
+void JxlSharedRunnerPoolDestroy(void* pool_opaque) {
+  jpegxl::SharedRunnerPool* pool =
+      reinterpret_cast<jpegxl::SharedRunnerPool*>(pool_opaque);
+  if (pool) {
+    // Call destructor directly since custom free function is used.
+    pool->~SharedRunnerPool();
+    jpegxl::ThreadMemoryManagerFree(&pool->memory_manager, pool);
+  }
+}
+
+void* JxlSharedRunnerClientCreate(void* pool_opaque,
+                                  JxlSharedRunnerPriority priority) {
+  jpegxl::SharedRunnerPool* pool =
+      reinterpret_cast<jpegxl::SharedRunnerPool*>(pool_opaque);
+  if (!pool) return nullptr;
+  if (priority != JXL_SHARED_RUNNER_PRIORITY_INTERACTIVE &&
+      priority != JXL_SHARED_RUNNER_PRIORITY_BATCH) {
+    return nullptr;
+  }
+  void* alloc = jpegxl::ThreadMemoryManagerAlloc(
+      &pool->memory_manager, sizeof(jpegxl::SharedRunnerClient));
+  if (!alloc) return nullptr;
+  return new (alloc) jpegxl::SharedRunnerClient(pool, priority);
+}
+
+void JxlSharedRunnerClientDestroy(void* client_opaque) {
+  jpegxl::SharedRunnerClient* client =
+      reinterpret_cast<jpegxl::SharedRunnerClient*>(client_opaque);
+  if (client) {
+    jpegxl::SharedRunnerPool* pool = client->pool();
+    client->~SharedRunnerClient();
+    jpegxl::ThreadMemoryManagerFree(&pool->memory_manager, client);
+  }
+}
@@ -0,0 +1,161 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/threads/shared_runner_internal.h"
+
+#include <algorithm>
+
+namespace jpegxl {
+
+constexpr size_t SharedRunnerPool::kNumPriorities;
+
+JxlParallelRetCode SharedRunnerPool::Run(JxlSharedRunnerPriority priority,
+                                         void* jpegxl_opaque,
+                                         JxlParallelRunInit init,
+                                         JxlParallelRunFunction func,
+                                         uint32_t start_range,
+                                         uint32_t end_range) {
+  if (start_range > end_range) return -1;
+  if (start_range == end_range) return 0;
+  const size_t priority_index = static_cast<size_t>(priority);
+  if (priority_index >= kNumPriorities) return -1;
+
+  int ret = init(jpegxl_opaque, NumThreads());
+  if (ret != 0) return ret;
+
+  // The calling thread uses the thread value after the ones of the workers.
+  const size_t caller_thread = threads_.size();
+
+  Job job;
+  job.func = func;
+  job.jpegxl_opaque = jpegxl_opaque;
+  job.next = start_range;
+  job.end = end_range;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!threads_.empty()) {
+    jobs_[priority_index].push_back(&job);
+    // Only wake up the workers that can get a task, the caller takes one.
+    const size_t num_wake =
+        std::min<size_t>(end_range - start_range - 1, num_sleeping_);
+    for (size_t i = 0; i < num_wake; ++i) {
+      work_cv_.notify_one();
+    }
+  }
+
+  while (job.next != job.end) {
+    uint32_t begin;
+    uint32_t end;
+    Reserve(&job, &begin, &end);
+    lock.unlock();
+    for (uint32_t task = begin; task < end; ++task) {
+      func(jpegxl_opaque, task, caller_thread);
+    }
+    lock.lock();
+    --job.num_running;
+  }
+  // Wait for the chunks still running on the workers.
+  while (job.num_running != 0) {
+    job.done_cv.wait(lock);
+  }
+  return 0;
+}
+
+SharedRunnerPool::Job* SharedRunnerPool::NextJob() {
+  for (size_t p = 0; p < kNumPriorities; ++p) {
+    std::vector<Job*>& jobs = jobs_[p];
+    if (jobs.empty()) continue;
+    next_job_[p] = (next_job_[p] + 1) % jobs.size();
+    return jobs[next_job_[p]];
+  }
+  return nullptr;
+}
+
+void SharedRunnerPool::Reserve(Job* job, uint32_t* begin, uint32_t* end) {
+  // "guided" schedule as in ThreadParallelRunner: the chunks get smaller
+  // towards the end of the job to balance the load.
+  const uint32_t num_remaining = job->end - job->next;
+  const uint32_t size = std::max<uint32_t>(
+      num_remaining / static_cast<uint32_t>(NumThreads() * 4), 1u);
+  *begin = job->next;
+  *end = job->next + size;
+  job->next = *end;
+  ++job->num_running;
+  if (job->next == job->end) {
+    for (std::vector<Job*>& jobs : jobs_) {
+      jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+    }
+  }
+}
+
+// static
+void SharedRunnerPool::ThreadFunc(SharedRunnerPool* self, const size_t thread) {
+  std::unique_lock<std::mutex> lock(self->mutex_);
+  for (;;) {
+    Job* job = self->NextJob();
+    if (job == nullptr) {
+      if (self->exit_) return;
+      ++self->num_sleeping_;
+      self->work_cv_.wait(lock);
+      --self->num_sleeping_;
+      continue;
+    }
+    uint32_t begin;
+    uint32_t end;
+    self->Reserve(job, &begin, &end);
+    lock.unlock();
+    for (uint32_t task = begin; task < end; ++task) {
+      job->func(job->jpegxl_opaque, task, thread);
+    }
+    lock.lock();
+    // The caller may destroy the job once it sees this, but not before we
+    // release mutex_.
+    if (--job->num_running == 0 && job->next == job->end) {
+      job->done_cv.notify_one();
+    }
+  }
+}
+
+SharedRunnerPool::SharedRunnerPool(const size_t num_worker_threads) {
+#if defined(__EMSCRIPTEN__)
+  (void)num_worker_threads;
+#else
+  threads_.reserve(num_worker_threads);
+  for (size_t i = 0; i < num_worker_threads; ++i) {
+    threads_.emplace_back(ThreadFunc, this, i);
+  }
+#endif
+}
+
+SharedRunnerPool::~SharedRunnerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+// static
+JxlParallelRetCode SharedRunnerClient::Runner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  SharedRunnerClient* self = static_cast<SharedRunnerClient*>(runner_opaque);
+  return self->pool_->Run(self->priority_, jpegxl_opaque, init, func,
+                          start_range, end_range);
+}
+
+}  // namespace jpegxl
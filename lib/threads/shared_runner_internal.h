@@ -0,0 +1,134 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Thread pool shared by many clients, using std::thread, with a
+// ::JxlParallelRunner per client.
+//
+// A SharedRunnerPool owns a fixed number of worker threads, which bounds the
+// number of threads used by all its clients together. Each decoder or encoder
+// uses its own SharedRunnerClient as the opaque runner of
+// SharedRunnerClient::Runner, and any number of them may run concurrently.
+//
+// The workers take chunks of tasks from the Runner() calls in progress in
+// round-robin order, so that concurrent calls get an equal share of the
+// workers, except that calls of clients with a higher priority are always
+// served first. The thread calling Runner() also runs tasks of its own call,
+// which guarantees progress even when all workers are busy with calls of
+// higher priority, and makes nested calls from within a task safe.
+//
+// Usage:
+//   SharedRunnerPool pool(num_worker_threads);
+//   SharedRunnerClient client(&pool, JXL_SHARED_RUNNER_PRIORITY_INTERACTIVE);
+//   JxlDecode(
+//       ... , &SharedRunnerClient::Runner, static_cast<void*>(&client));
+
+#ifndef LIB_THREADS_SHARED_RUNNER_INTERNAL_H_
+#define LIB_THREADS_SHARED_RUNNER_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>  //NOLINT
+#include <mutex>               //NOLINT
+#include <thread>              //NOLINT
+#include <vector>
+
+#include "jxl/memory_manager.h"
+#include "jxl/parallel_runner.h"
+#include "jxl/shared_runner.h"
+
+namespace jpegxl {
+
+class SharedRunnerPool {
+ public:
+  // Starts the given number of worker threads. If zero, all tasks run on the
+  // threads calling Run.
+  explicit SharedRunnerPool(size_t num_worker_threads);
+
+  // Waits for all threads to exit. There must be no Run() call in progress.
+  ~SharedRunnerPool();
+
+  // Number of threads that may run the tasks of a Run() call: the workers and
+  // the calling thread.
+  size_t NumThreads() const { return threads_.size() + 1; }
+
+  // Runs the tasks in [start_range, end_range) on the workers and the calling
+  // thread, with the given priority for the workers.
+  JxlParallelRetCode Run(JxlSharedRunnerPriority priority, void* jpegxl_opaque,
+                         JxlParallelRunInit init, JxlParallelRunFunction func,
+                         uint32_t start_range, uint32_t end_range);
+
+  JxlMemoryManager memory_manager;
+
+ private:
+  static constexpr size_t kNumPriorities = 2;
+
+  // State of a single Run() call, owned by the calling thread. All fields are
+  // guarded by mutex_.
+  struct Job {
+    JxlParallelRunFunction func;
+    void* jpegxl_opaque;
+    uint32_t next;  // first task not reserved yet.
+    uint32_t end;
+    uint32_t num_running = 0;  // number of reserved chunks not done yet.
+    // Notified when the last chunk is done after all tasks are reserved.
+    std::condition_variable done_cv;
+  };
+
+  // Returns the next job with tasks to reserve in round-robin order among the
+  // jobs of the highest priority, or nullptr if there is none.
+  // Must be called with mutex_ held.
+  Job* NextJob();
+
+  // Reserves a chunk of tasks of `job`, which must have tasks to reserve, and
+  // stops handing out the job to workers once all its tasks are reserved.
+  // Must be called with mutex_ held.
+  void Reserve(Job* job, uint32_t* begin, uint32_t* end);
+
+  static void ThreadFunc(SharedRunnerPool* self, size_t thread);
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;  // guards all the fields below and all jobs.
+  std::condition_variable work_cv_;
+  size_t num_sleeping_ = 0;
+  bool exit_ = false;
+  // Jobs with tasks to reserve, per priority.
+  std::vector<Job*> jobs_[kNumPriorities];
+  size_t next_job_[kNumPriorities] = {};
+};
+
+// Per-client ::JxlParallelRunner of a SharedRunnerPool.
+class SharedRunnerClient {
+ public:
+  // ::JxlParallelRunner interface.
+  static JxlParallelRetCode Runner(void* runner_opaque, void* jpegxl_opaque,
+                                   JxlParallelRunInit init,
+                                   JxlParallelRunFunction func,
+                                   uint32_t start_range, uint32_t end_range);
+
+  // `pool` must outlive the client.
+  SharedRunnerClient(SharedRunnerPool* pool, JxlSharedRunnerPriority priority)
+      : pool_(pool), priority_(priority) {}
+
+  SharedRunnerPool* pool() const { return pool_; }
+
+ private:
+  SharedRunnerPool* pool_;
+  JxlSharedRunnerPriority priority_;
+};
+
+}  // namespace jpegxl
+
+#endif  // LIB_THREADS_SHARED_RUNNER_INTERNAL_H_
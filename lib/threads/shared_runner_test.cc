@@ -0,0 +1,98 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jxl/shared_runner.h"
+
+#include <atomic>
+#include <thread>  //NOLINT
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lib/jxl/base/data_parallel.h"
+
+namespace jpegxl {
+namespace {
+
+// Runs many calls from concurrent clients of both priorities, checking that
+// every task runs exactly once with a valid thread value.
+TEST(SharedRunnerTest, TestConcurrentClients) {
+  for (size_t num_workers : {0, 1, 4}) {
+    void* pool = JxlSharedRunnerPoolCreate(nullptr, num_workers);
+    ASSERT_NE(nullptr, pool);
+    const size_t num_threads = num_workers + 1;
+
+    const int kNumClients = 8;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < kNumClients; ++c) {
+      threads.emplace_back([pool, c, num_threads]() {
+        void* client = JxlSharedRunnerClientCreate(
+            pool, c % 2 ? JXL_SHARED_RUNNER_PRIORITY_BATCH
+                        : JXL_SHARED_RUNNER_PRIORITY_INTERACTIVE);
+        ASSERT_NE(nullptr, client);
+        jxl::ThreadPool thread_pool(&JxlSharedRunner, client);
+        for (uint32_t num_tasks = 1; num_tasks < 100; num_tasks += 7) {
+          std::vector<std::atomic<int>> counts(num_tasks);
+          for (auto& count : counts) count.store(0);
+          size_t init_threads = 0;
+          EXPECT_TRUE(thread_pool.Run(
+              10, 10 + num_tasks,
+              [&init_threads](size_t n) -> bool {
+                init_threads = n;
+                return true;
+              },
+              [&counts, num_threads](const int task, const int thread) {
+                EXPECT_LT(static_cast<size_t>(thread), num_threads);
+                counts[task - 10].fetch_add(1);
+              }));
+          EXPECT_EQ(num_threads, init_threads);
+          for (auto& count : counts) EXPECT_EQ(1, count.load());
+        }
+        JxlSharedRunnerClientDestroy(client);
+      });
+    }
+    for (std::thread& thread : threads) thread.join();
+    JxlSharedRunnerPoolDestroy(pool);
+  }
+}
+
+// Calls the runner again from within its own tasks.
+TEST(SharedRunnerTest, TestNested) {
+  void* pool = JxlSharedRunnerPoolCreate(nullptr, 3);
+  void* client =
+      JxlSharedRunnerClientCreate(pool, JXL_SHARED_RUNNER_PRIORITY_BATCH);
+  jxl::ThreadPool thread_pool(&JxlSharedRunner, client);
+
+  std::atomic<int> num_calls{0};
+  thread_pool.Run(0, 8, jxl::ThreadPool::SkipInit(),
+                  [&](const int outer_task, const int outer_thread) {
+                    thread_pool.Run(0, 50, jxl::ThreadPool::SkipInit(),
+                                    [&](const int task, const int thread) {
+                                      num_calls.fetch_add(1);
+                                    });
+                  });
+  EXPECT_EQ(8 * 50, num_calls.load());
+
+  JxlSharedRunnerClientDestroy(client);
+  JxlSharedRunnerPoolDestroy(pool);
+}
+
+TEST(SharedRunnerTest, TestInvalidPriority) {
+  void* pool = JxlSharedRunnerPoolCreate(nullptr, 1);
+  EXPECT_EQ(nullptr, JxlSharedRunnerClientCreate(
+                         pool, static_cast<JxlSharedRunnerPriority>(7)));
+  JxlSharedRunnerPoolDestroy(pool);
+}
+
+}  // namespace
+}  // namespace jpegxl
@@ -0,0 +1,74 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Default JxlMemoryManager using malloc and free for the jpegxl_threads
+// library. Same as the default JxlMemoryManager for the jpegxl library
+// itself.
+
+#ifndef LIB_THREADS_THREAD_MEMORY_MANAGER_INTERNAL_H_
+#define LIB_THREADS_THREAD_MEMORY_MANAGER_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jxl/memory_manager.h"
+
+namespace jpegxl {
+
+// Default alloc and free functions.
+static inline void* ThreadMemoryManagerDefaultAlloc(void* opaque,
+                                                    size_t size) {
+  return malloc(size);
+}
+
+static inline void ThreadMemoryManagerDefaultFree(void* opaque,
+                                                  void* address) {
+  free(address);
+}
+
+// Initializes the memory manager instance with the passed one. The
+// MemoryManager passed in |memory_manager| may be NULL or contain NULL
+// functions which will be initialized with the default ones. If either alloc
+// or free are NULL, then both must be NULL, otherwise this function returns an
+// error.
+static inline bool ThreadMemoryManagerInit(
+    JxlMemoryManager* self, const JxlMemoryManager* memory_manager) {
+  if (memory_manager) {
+    *self = *memory_manager;
+  } else {
+    memset(self, 0, sizeof(*self));
+  }
+  if (!self->alloc != !self->free) {
+    return false;
+  }
+  if (!self->alloc) self->alloc = ThreadMemoryManagerDefaultAlloc;
+  if (!self->free) self->free = ThreadMemoryManagerDefaultFree;
+
+  return true;
+}
+
+static inline void* ThreadMemoryManagerAlloc(
+    const JxlMemoryManager* memory_manager, size_t size) {
+  return memory_manager->alloc(memory_manager->opaque, size);
+}
+
+static inline void ThreadMemoryManagerFree(
+    const JxlMemoryManager* memory_manager, void* address) {
+  return memory_manager->free(memory_manager->opaque, address);
+}
+
+}  // namespace jpegxl
+
+#endif  // LIB_THREADS_THREAD_MEMORY_MANAGER_INTERNAL_H_
@@ -0,0 +1,69 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/thread_pool_internal.h"
+
+namespace jpegxl {
+namespace {
+
+// One tiny task per row of a small square image, like the per-row RunOnPool
+// calls of the external image conversions. The third argument is 1 for the
+// adaptive minimum chunk size and 0 for the plain "guided" schedule, whose
+// chunks shrink to a single task.
+void BM_ThreadParallelRunner_RowTasks(benchmark::State& state) {
+  const size_t xsize = state.range(0);
+  const size_t ysize = state.range(0);
+  jxl::ThreadPoolInternal pool(state.range(1));
+  pool.SetAdaptiveChunks(state.range(2) != 0);
+
+  std::vector<float> in(xsize * ysize, 0.5f);
+  std::vector<uint32_t> out(xsize * ysize);
+
+  for (auto _ : state) {
+    pool.Run(0, ysize, jxl::ThreadPool::SkipInit(),
+             [&](const int task, const int thread) {
+               const float* JXL_RESTRICT row_in = in.data() + task * xsize;
+               uint32_t* JXL_RESTRICT row_out = out.data() + task * xsize;
+               for (size_t x = 0; x < xsize; ++x) {
+                 row_out[x] = static_cast<uint32_t>(row_in[x] * 65535.0f);
+               }
+             });
+    benchmark::DoNotOptimize(out.data());
+  }
+
+  // Pixels per second.
+  state.SetItemsProcessed(state.iterations() * xsize * ysize);
+}
+
+BENCHMARK(BM_ThreadParallelRunner_RowTasks)
+    ->Args({64, 4, 0})
+    ->Args({64, 4, 1})
+    ->Args({256, 4, 0})
+    ->Args({256, 4, 1})
+    ->Args({1024, 4, 0})
+    ->Args({1024, 4, 1})
+    ->Args({64, 16, 0})
+    ->Args({64, 16, 1})
+    ->Args({256, 16, 0})
+    ->Args({256, 16, 1})
+    ->Args({1024, 16, 0})
+    ->Args({1024, 16, 1});
+
+}  // namespace
+}  // namespace jpegxl
@@ -19,11 +19,27 @@
 #include "sanitizer/common_interface_defs.h"  // __sanitizer_print_stack_trace
 #endif                                        // defined(*_SANITIZER)
 
+#include <stdio.h>
+
+#include <chrono>  //NOLINT
+
+#if defined(__linux__) && !defined(__ANDROID__) && !defined(__EMSCRIPTEN__)
+#define JXL_THREADS_HAVE_AFFINITY 1
+#include <pthread.h>
+#include <sched.h>
+#else
+#define JXL_THREADS_HAVE_AFFINITY 0
+#endif
+
 #include "jxl/thread_parallel_runner.h"
 #include "lib/jxl/base/profiler.h"
 
 namespace {
 
+// Minimum duration of the tasks reserved at once by RunRange, short enough to
+// keep the load balanced, and long enough to amortize the reservation.
+constexpr int64_t kMinChunkNanoseconds = 10000;
+
 // Exits the program after printing a stack trace when possible.
 bool Abort() {
 #if defined(ADDRESS_SANITIZER) || defined(MEMORY_SANITIZER) || \
@@ -120,6 +136,13 @@ void ThreadParallelRunner::RunRange(ThreadParallelRunner* self,
   // "guided" (allocates k tasks, decreases k): computing k = remaining/n
   //   is faster than halving k each iteration. We prefer this strategy
   //   because it avoids user-specified parameters.
+  //
+  // With tiny tasks, such as one row of a small image, the "guided" chunks
+  // quickly shrink to a single task and the threads spend more time
+  // contending for num_reserved_ than running tasks. Each thread therefore
+  // also measures how long its tasks take, and reserves at least as many
+  // tasks as run in kMinChunkNanoseconds.
+  uint32_t min_size = 1;
 
   for (;;) {
 #if 0
@@ -129,9 +152,13 @@ void ThreadParallelRunner::RunRange(ThreadParallelRunner* self,
     // guided
     const uint32_t num_reserved =
         self->num_reserved_.load(std::memory_order_relaxed);
+    // Another thread already reserved the last task.
+    if (num_reserved >= num_tasks) {
+      break;
+    }
     const uint32_t num_remaining = num_tasks - num_reserved;
     const uint32_t my_size =
-        std::max(num_remaining / (num_worker_threads * 4), 1u);
+        std::max(num_remaining / (num_worker_threads * 4), min_size);
 #endif
     const uint32_t my_begin = begin + self->num_reserved_.fetch_add(
                                           my_size, std::memory_order_relaxed);
@@ -140,9 +167,29 @@ void ThreadParallelRunner::RunRange(ThreadParallelRunner* self,
     if (my_begin >= my_end) {
       break;
     }
+    if (!self->adaptive_chunks_) {
+      for (uint32_t task = my_begin; task < my_end; ++task) {
+        self->data_func_(self->jpegxl_opaque_, task, thread);
+      }
+      continue;
+    }
+    const auto chunk_start = std::chrono::steady_clock::now();
     for (uint32_t task = my_begin; task < my_end; ++task) {
       self->data_func_(self->jpegxl_opaque_, task, thread);
     }
+    const int64_t chunk_nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - chunk_start)
+            .count();
+    // Tasks of the same call usually take similar times; adapt to the last
+    // chunk so that a change in task duration is followed quickly.
+    const uint64_t chunk_tasks = my_end - my_begin;
+    min_size = static_cast<uint32_t>(std::min<uint64_t>(
+        std::max<uint64_t>(
+            kMinChunkNanoseconds * chunk_tasks /
+                std::max<int64_t>(chunk_nanoseconds, 1),
+            1),
+        num_tasks));
   }
 }
 
@@ -211,6 +258,56 @@ ThreadParallelRunner::ThreadParallelRunner(const int num_worker_threads)
       [](const int task, const int thread) { PROFILER_ZONE("@InitWorkers"); });
 }
 
+bool ThreadParallelRunner::SetAffinity(const size_t* cpus,
+                                       const size_t num_cpus) {
+  if (num_cpus == 0) return false;
+#if JXL_THREADS_HAVE_AFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < num_cpus; ++i) {
+    if (cpus[i] >= CPU_SETSIZE) return false;
+    CPU_SET(cpus[i], &set);
+  }
+  for (std::thread& thread : threads_) {
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) !=
+        0) {
+      return false;
+    }
+  }
+  return true;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+bool ThreadParallelRunner::SetNumaNode(const size_t node) {
+#if JXL_THREADS_HAVE_AFFINITY
+  // The CPUs of the node are listed as ranges, such as "0-7,16-23".
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist",
+           node);
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) return false;
+  std::vector<size_t> cpus;
+  unsigned long first, last;  // NOLINT
+  int num_read;
+  while ((num_read = fscanf(file, "%lu-%lu", &first, &last)) >= 1) {
+    if (num_read == 1) last = first;
+    if (last >= CPU_SETSIZE) break;
+    for (unsigned long cpu = first; cpu <= last; ++cpu) {  // NOLINT
+      cpus.push_back(cpu);
+    }
+    if (fgetc(file) != ',') break;
+  }
+  fclose(file);
+  return SetAffinity(cpus.data(), cpus.size());
+#else
+  (void)node;
+  return false;
+#endif
+}
+
 ThreadParallelRunner::~ThreadParallelRunner() {
   if (num_worker_threads_ != 0) {
     StartWorkers(kWorkerExit);
@@ -83,6 +83,23 @@ class ThreadParallelRunner {
   // for allocating per-thread storage.
   size_t NumThreads() const { return num_threads_; }
 
+  // Restricts the worker threads to the CPUs with the given operating system
+  // indices. Returns false if the set is empty or invalid, or if setting the
+  // thread affinity is not supported on this platform. Must not be called
+  // concurrently with Run.
+  bool SetAffinity(const size_t* cpus, size_t num_cpus);
+
+  // Restricts the worker threads to the CPUs of the given NUMA node, so that
+  // the memory they first touch is allocated on that node. Only supported on
+  // Linux.
+  bool SetNumaNode(size_t node);
+
+  // Enables (default) or disables the minimum number of tasks reserved at once
+  // by each thread, which is derived from the measured task duration. When
+  // disabled, the chunks shrink down to a single task as in the plain "guided"
+  // schedule. Must not be called concurrently with Run.
+  void SetAdaptiveChunks(bool enabled) { adaptive_chunks_ = enabled; }
+
   // Runs func(thread, thread) on all thread(s) that may participate in Run.
   // If NumThreads() == 0, runs on the main thread with thread == 0, otherwise
   // concurrently called by each worker thread in [0, NumThreads()).
@@ -169,6 +186,7 @@ class ThreadParallelRunner {
   // Written by main thread, read by workers (after mutex lock/unlock).
   JxlParallelRunFunction data_func_;
   void* jpegxl_opaque_;
+  bool adaptive_chunks_ = true;
 
   // Updated by workers; padding avoids false sharing.
   uint8_t padding1[64];
@@ -12,7 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#endif
+
 #include "gtest/gtest.h"
+#include "jxl/thread_parallel_runner.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/thread_pool_internal.h"
 
@@ -120,5 +125,32 @@ TEST(ThreadParallelRunnerTest, TestCounter) {
   EXPECT_EQ(expected, counters[0].counter);
 }
 
+TEST(ThreadParallelRunnerTest, TestAffinity) {
+  void* runner = JxlThreadParallelRunnerCreate(nullptr, 4);
+  ASSERT_NE(nullptr, runner);
+  EXPECT_EQ(-1, JxlThreadParallelRunnerSetAffinity(runner, nullptr, 0));
+
+#if defined(__linux__) && !defined(__ANDROID__)
+  // Pin the workers to the first CPU this process may run on.
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  size_t cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) ++cpu;
+  ASSERT_EQ(0, JxlThreadParallelRunnerSetAffinity(runner, &cpu, 1));
+
+  jxl::ThreadPool pool(&JxlThreadParallelRunner, runner);
+  std::atomic<int> num_elsewhere{0};
+  pool.Run(0, 100, jxl::ThreadPool::SkipInit(),
+           [cpu, &num_elsewhere](const int task, const int thread) {
+             if (sched_getcpu() != static_cast<int>(cpu)) {
+               num_elsewhere.fetch_add(1);
+             }
+           });
+  EXPECT_EQ(0, num_elsewhere.load());
+#endif
+
+  JxlThreadParallelRunnerDestroy(runner);
+}
+
 }  // namespace
 }  // namespace jpegxl
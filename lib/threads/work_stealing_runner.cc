@@ -0,0 +1,52 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jxl/work_stealing_runner.h"
+
+#include "lib/threads/thread_memory_manager_internal.h"
+#include "lib/threads/work_stealing_runner_internal.h"
+
+JxlParallelRetCode JxlWorkStealingRunner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  return jpegxl::WorkStealingRunner::Runner(
+      runner_opaque, jpegxl_opaque, init, func, start_range, end_range);
+}
+
+void* JxlWorkStealingRunnerCreate(const JxlMemoryManager* memory_manager,
+                                  size_t num_worker_threads) {
+  JxlMemoryManager local_memory_manager;
+  if (!jpegxl::ThreadMemoryManagerInit(&local_memory_manager, memory_manager))
+    return nullptr;
+
+  void* alloc = jpegxl::ThreadMemoryManagerAlloc(
+      &local_memory_manager, sizeof(jpegxl::WorkStealingRunner));
+  if (!alloc) return nullptr;
+  // Placement new constructor on allocated memory
+  jpegxl::WorkStealingRunner* runner =
+      new (alloc) jpegxl::WorkStealingRunner(num_worker_threads);
+  runner->memory_manager = local_memory_manager;
+
+  return runner;
+}
+
+void JxlWorkStealingRunnerDestroy(void* runner_opaque) {
+  jpegxl::WorkStealingRunner* runner =
+      reinterpret_cast<jpegxl::WorkStealingRunner*>(runner_opaque);
+  if (runner) {
+    // Call destructor directly since custom free function is used.
+    runner->~WorkStealingRunner();
+    jpegxl::ThreadMemoryManagerFree(&runner->memory_manager, runner);
+  }
+}
@@ -0,0 +1,222 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/threads/work_stealing_runner_internal.h"
+
+namespace jpegxl {
+
+thread_local WorkStealingRunner::ThreadState WorkStealingRunner::thread_state_ =
+    {nullptr, 0};
+
+// static
+JxlParallelRetCode WorkStealingRunner::Runner(
+    void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+    JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+  WorkStealingRunner* self = static_cast<WorkStealingRunner*>(runner_opaque);
+  if (start_range > end_range) return -1;
+  if (start_range == end_range) return 0;
+
+  int ret = init(jpegxl_opaque, self->NumThreads());
+  if (ret != 0) return ret;
+
+  // Use a sequential run when there are no worker threads.
+  if (self->workers_.empty()) {
+    const size_t thread = 0;
+    for (uint32_t task = start_range; task < end_range; ++task) {
+      func(jpegxl_opaque, task, thread);
+    }
+    return 0;
+  }
+
+  const uint32_t num_tasks = end_range - start_range;
+  const uint32_t num_workers = static_cast<uint32_t>(self->workers_.size());
+
+  Job job;
+  job.func = func;
+  job.jpegxl_opaque = jpegxl_opaque;
+  // Same granularity as the "guided" schedule of ThreadParallelRunner for the
+  // first reservation.
+  job.grain = std::max(num_tasks / (num_workers * 4), 1u);
+  // Published to the other workers by the deque mutex in Push.
+  job.remaining.store(num_tasks, std::memory_order_relaxed);
+
+  const ThreadState state = thread_state_;
+  if (state.runner == self) {
+    // Nested call from a task running on one of our workers: split the tasks
+    // on this worker, where the others can steal them, and help until done.
+    self->RunRange(state.index, Range{&job, start_range, end_range});
+    self->HelpUntilDone(state.index, &job);
+    return 0;
+  }
+
+  // Hand out at most one range per worker. Each Push only wakes up a single
+  // sleeping worker, so a call with few tasks only wakes a few workers.
+  const uint32_t num_ranges = std::min(num_tasks, num_workers);
+  const uint32_t first_worker =
+      self->next_worker_.fetch_add(num_ranges, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < num_ranges; ++i) {
+    const uint32_t begin = static_cast<uint32_t>(
+        static_cast<uint64_t>(num_tasks) * i / num_ranges);
+    const uint32_t end = static_cast<uint32_t>(
+        static_cast<uint64_t>(num_tasks) * (i + 1) / num_ranges);
+    self->Push((first_worker + i) % num_workers,
+               Range{&job, start_range + begin, start_range + end});
+  }
+
+  std::unique_lock<std::mutex> lock(job.mutex);
+  while (!job.done) {
+    job.done_cv.wait(lock);
+  }
+  return 0;
+}
+
+void WorkStealingRunner::Push(uint32_t index, const Range& range) {
+  Worker& worker = *workers_[index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.deque.push_back(range);
+  }
+  // Sequentially consistent with the num_sleeping_ increment and num_pending_
+  // check of ThreadFunc: either the worker sees this range, or we see it is
+  // about to sleep and wake it up.
+  num_pending_.fetch_add(1);
+  if (num_sleeping_.load() != 0) {
+    // Synchronize with a worker between its num_pending_ check and its wait.
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    work_cv_.notify_one();
+  }
+}
+
+bool WorkStealingRunner::TakeRange(uint32_t index, const Job* job,
+                                   bool newest, Range* range) {
+  Worker& worker = *workers_[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  std::deque<Range>& deque = worker.deque;
+  const size_t size = deque.size();
+  for (size_t i = 0; i < size; ++i) {
+    const size_t pos = newest ? size - 1 - i : i;
+    if (job != nullptr && deque[pos].job != job) continue;
+    *range = deque[pos];
+    deque.erase(deque.begin() + pos);
+    num_pending_.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
+
+bool WorkStealingRunner::Steal(uint32_t index, const Job* job, Range* range) {
+  const uint32_t num_workers = static_cast<uint32_t>(workers_.size());
+  for (uint32_t i = 1; i < num_workers; ++i) {
+    if (TakeRange((index + i) % num_workers, job, /*newest=*/false, range)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingRunner::RunRange(uint32_t index, Range range) {
+  Job* job = range.job;
+  // Keep the first half and leave the second one to be stolen, so that thieves
+  // take large ranges and split them on their own deque.
+  while (range.end - range.begin > job->grain) {
+    const uint32_t middle = range.begin + (range.end - range.begin) / 2;
+    Push(index, Range{job, middle, range.end});
+    range.end = middle;
+  }
+  for (uint32_t task = range.begin; task < range.end; ++task) {
+    job->func(job->jpegxl_opaque, task, index);
+  }
+  FinishTasks(job, range.end - range.begin);
+}
+
+// static
+void WorkStealingRunner::FinishTasks(Job* job, uint32_t num_tasks) {
+  if (job->remaining.fetch_sub(num_tasks, std::memory_order_acq_rel) !=
+      num_tasks) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(job->mutex);
+  job->done = true;
+  job->done_cv.notify_all();
+}
+
+void WorkStealingRunner::HelpUntilDone(uint32_t index, Job* job) {
+  Range range{nullptr, 0, 0};
+  while (job->remaining.load(std::memory_order_acquire) != 0) {
+    // Only run tasks of this job: the tasks of the outer jobs may use the same
+    // `thread` value as the task that is waiting here.
+    if (TakeRange(index, job, /*newest=*/true, &range) ||
+        Steal(index, job, &range)) {
+      RunRange(index, range);
+    } else {
+      // The remaining tasks are running on other workers.
+      std::this_thread::yield();
+    }
+  }
+  // Wait for FinishTasks to be done with `job`.
+  std::unique_lock<std::mutex> lock(job->mutex);
+  while (!job->done) {
+    job->done_cv.wait(lock);
+  }
+}
+
+// static
+void WorkStealingRunner::ThreadFunc(WorkStealingRunner* self,
+                                    const uint32_t index) {
+  thread_state_ = ThreadState{self, index};
+  Range range{nullptr, 0, 0};
+  for (;;) {
+    if (self->TakeRange(index, nullptr, /*newest=*/true, &range) ||
+        self->Steal(index, nullptr, &range)) {
+      self->RunRange(index, range);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(self->mutex_);
+    self->num_sleeping_.fetch_add(1);
+    while (self->num_pending_.load() <= 0 && !self->exit_) {
+      self->work_cv_.wait(lock);
+    }
+    self->num_sleeping_.fetch_sub(1);
+    if (self->exit_) return;
+  }
+}
+
+WorkStealingRunner::WorkStealingRunner(const int num_worker_threads) {
+#if defined(__EMSCRIPTEN__)
+  (void)num_worker_threads;
+#else
+  // All the deques must exist before any worker starts stealing.
+  for (int i = 0; i < num_worker_threads; ++i) {
+    workers_.emplace_back(new Worker());
+    // Suppress "unused-private-field" warning.
+    (void)workers_.back()->padding;
+  }
+  for (int i = 0; i < num_worker_threads; ++i) {
+    workers_[i]->thread = std::thread(ThreadFunc, this, i);
+  }
+#endif
+}
+
+WorkStealingRunner::~WorkStealingRunner() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  work_cv_.notify_all();
+  for (const std::unique_ptr<Worker>& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+}  // namespace jpegxl
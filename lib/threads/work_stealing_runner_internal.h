@@ -0,0 +1,168 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Work-stealing implementation using std::thread of a ::JxlParallelRunner.
+//
+// Unlike ThreadParallelRunner, which hands out the tasks of a single Run call
+// from one global counter and wakes every worker for each call, this runner
+// keeps a deque of task ranges per worker thread. A worker pops ranges from
+// the back of its own deque and splits them in halves until they are small
+// enough to run, pushing the other half back so that idle workers can steal
+// it from the front. Sleeping workers are only woken up when there is work
+// for them, so short Run calls with few tasks do not wake the whole pool.
+//
+// Runner() may be called concurrently from several threads, and re-entered
+// from within a task (nested parallelism): the worker thread running the task
+// pushes the nested tasks to its own deque and helps running them until they
+// are all done, so nested calls can not deadlock even if every worker is busy.
+// While waiting, a worker only runs tasks of the nested call, so the `thread`
+// value passed to each task is never in use by another task of the same Run
+// call at the same time. Threads that are not workers of the runner only wait
+// for the workers to run the tasks.
+//
+// Usage:
+//   WorkStealingRunner runner;
+//   JxlDecode(
+//       ... , &WorkStealingRunner::Runner, static_cast<void*>(&runner));
+
+#ifndef LIB_THREADS_WORK_STEALING_RUNNER_INTERNAL_H_
+#define LIB_THREADS_WORK_STEALING_RUNNER_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>  //NOLINT
+#include <deque>
+#include <memory>
+#include <mutex>   //NOLINT
+#include <thread>  //NOLINT
+#include <vector>
+
+#include "jxl/memory_manager.h"
+#include "jxl/parallel_runner.h"
+
+namespace jpegxl {
+
+// Main helper class implementing the ::JxlParallelRunner interface.
+class WorkStealingRunner {
+ public:
+  // ::JxlParallelRunner interface.
+  static JxlParallelRetCode Runner(void* runner_opaque, void* jpegxl_opaque,
+                                   JxlParallelRunInit init,
+                                   JxlParallelRunFunction func,
+                                   uint32_t start_range, uint32_t end_range);
+
+  // Starts the given number of worker threads. "num_worker_threads" defaults
+  // to one per hyperthread. If zero, all tasks run on the calling thread.
+  explicit WorkStealingRunner(
+      int num_worker_threads = std::thread::hardware_concurrency());
+
+  // Waits for all threads to exit. There must be no Runner() call in progress.
+  ~WorkStealingRunner();
+
+  // Returns number of worker threads created; 0 means "run on the calling
+  // thread".
+  size_t NumWorkerThreads() const { return workers_.size(); }
+
+  // Returns maximum number of threads that may call the task function of a
+  // single Runner() call. Useful for allocating per-thread storage.
+  size_t NumThreads() const { return std::max<size_t>(workers_.size(), 1); }
+
+  JxlMemoryManager memory_manager;
+
+ private:
+  // State of a single Runner() call, owned by the calling thread.
+  struct Job {
+    JxlParallelRunFunction func;
+    void* jpegxl_opaque;
+    // Ranges with at most this many tasks are run without splitting them.
+    uint32_t grain;
+    // Number of tasks not yet run to completion.
+    std::atomic<uint32_t> remaining;
+
+    // Set by the thread that completes the last task, see FinishTasks.
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+  };
+
+  struct Range {
+    Job* job;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  struct Worker {
+    std::mutex mutex;  // guards deque.
+    std::deque<Range> deque;
+    std::thread thread;
+    // Avoids false sharing between the deques of different workers.
+    uint8_t padding[64];
+  };
+
+  // Identifies the runner and worker index of a worker thread, used to
+  // detect nested Runner() calls.
+  struct ThreadState {
+    const WorkStealingRunner* runner;
+    uint32_t index;
+  };
+  static thread_local ThreadState thread_state_;
+
+  // Adds `range` to the back of the deque of worker `index` and wakes up a
+  // sleeping worker, if any.
+  void Push(uint32_t index, const Range& range);
+
+  // Removes a range of `job`, or of any job if `job` is nullptr, from the
+  // deque of worker `index`: the most recently pushed one if `newest`, which
+  // is what the worker itself takes, otherwise the oldest one, which is what
+  // other workers steal.
+  bool TakeRange(uint32_t index, const Job* job, bool newest, Range* range);
+
+  // Steals the oldest range of `job`, or of any job if `job` is nullptr, from
+  // the deque of a worker other than `index`.
+  bool Steal(uint32_t index, const Job* job, Range* range);
+
+  // Runs `range` on worker `index`, splitting off and pushing halves larger
+  // than the grain of its job to the deque of that worker first.
+  void RunRange(uint32_t index, Range range);
+
+  // Records that `num_tasks` tasks of `job` completed. `job` may be destroyed
+  // by its owner as soon as this returns for its last tasks.
+  static void FinishTasks(Job* job, uint32_t num_tasks);
+
+  // Runs tasks of `job` on worker `index` until all of them are done.
+  void HelpUntilDone(uint32_t index, Job* job);
+
+  static void ThreadFunc(WorkStealingRunner* self, uint32_t index);
+
+  // Unmodified after ctor, except for the deques.
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Number of ranges in all deques; may be briefly off by the ranges being
+  // pushed or taken. Together with num_sleeping_, allows workers to sleep
+  // without missing a Push.
+  std::atomic<int32_t> num_pending_{0};
+  std::atomic<uint32_t> num_sleeping_{0};
+  std::atomic<uint32_t> next_worker_{0};
+
+  std::mutex mutex_;  // guards work_cv_ and exit_.
+  std::condition_variable work_cv_;
+  bool exit_ = false;
+};
+
+}  // namespace jpegxl
+
+#endif  // LIB_THREADS_WORK_STEALING_RUNNER_INTERNAL_H_
@@ -0,0 +1,127 @@
+// Copyright (c) the JPEG XL Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <thread>  //NOLINT
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "jxl/work_stealing_runner.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/threads/work_stealing_runner_internal.h"
+
+namespace jpegxl {
+namespace {
+
+// Ensures task parameter is in bounds, every parameter is reached,
+// runner can be reused, runner can be destroyed (joining with its threads),
+// num_threads=0 works (runs on current thread).
+TEST(WorkStealingRunnerTest, TestPool) {
+  for (int num_threads = 0; num_threads <= 18; ++num_threads) {
+    WorkStealingRunner runner(num_threads);
+    jxl::ThreadPool pool(&WorkStealingRunner::Runner, &runner);
+    for (int num_tasks = 0; num_tasks < 32; ++num_tasks) {
+      std::vector<int> mementos(num_tasks);
+      for (int begin = 0; begin < 32; ++begin) {
+        std::fill(mementos.begin(), mementos.end(), 0);
+        pool.Run(
+            begin, begin + num_tasks, jxl::ThreadPool::SkipInit(),
+            [begin, num_tasks, &mementos](const int task, const int thread) {
+              // Parameter is in the given range
+              EXPECT_GE(task, begin);
+              EXPECT_LT(task, begin + num_tasks);
+
+              // Store mementos to be sure we visited each task.
+              mementos.at(task - begin) = 1000 + task;
+            });
+        for (int task = begin; task < begin + num_tasks; ++task) {
+          EXPECT_EQ(1000 + task, mementos.at(task - begin));
+        }
+      }
+    }
+  }
+}
+
+// Runs nested calls from within the tasks, and checks that no two tasks of
+// the same call use the same "thread" value at the same time.
+TEST(WorkStealingRunnerTest, TestNested) {
+  const int kNumThreads = 4;
+  const int kNumOuterTasks = 16;
+  const int kNumInnerTasks = 64;
+  WorkStealingRunner runner(kNumThreads);
+  jxl::ThreadPool pool(&WorkStealingRunner::Runner, &runner);
+
+  std::atomic<int> outer_in_use[kNumThreads] = {};
+  std::atomic<int> num_inner_calls{0};
+  std::vector<int> inner_sums(kNumOuterTasks);
+  pool.Run(0, kNumOuterTasks, jxl::ThreadPool::SkipInit(),
+           [&](const int outer_task, const int outer_thread) {
+             ASSERT_LT(outer_thread, kNumThreads);
+             EXPECT_EQ(0, outer_in_use[outer_thread].fetch_add(1));
+
+             std::atomic<int> inner_in_use[kNumThreads] = {};
+             std::atomic<int> sum{0};
+             pool.Run(0, kNumInnerTasks, jxl::ThreadPool::SkipInit(),
+                      [&](const int task, const int thread) {
+                        ASSERT_LT(thread, kNumThreads);
+                        EXPECT_EQ(0, inner_in_use[thread].fetch_add(1));
+                        sum.fetch_add(task);
+                        num_inner_calls.fetch_add(1);
+                        inner_in_use[thread].fetch_sub(1);
+                      });
+             inner_sums[outer_task] = sum.load();
+
+             outer_in_use[outer_thread].fetch_sub(1);
+           });
+
+  EXPECT_EQ(kNumOuterTasks * kNumInnerTasks, num_inner_calls.load());
+  for (int outer_task = 0; outer_task < kNumOuterTasks; ++outer_task) {
+    EXPECT_EQ(kNumInnerTasks * (kNumInnerTasks - 1) / 2,
+              inner_sums[outer_task]);
+  }
+}
+
+// Calls the same runner from several threads at the same time, through the C
+// interface.
+TEST(WorkStealingRunnerTest, TestConcurrentCallers) {
+  const int kNumCallers = 6;
+  const int kNumTasks = 1000;
+  void* runner = JxlWorkStealingRunnerCreate(nullptr, 3);
+  ASSERT_NE(nullptr, runner);
+
+  std::atomic<int> sums[kNumCallers] = {};
+  std::vector<std::thread> callers;
+  for (int caller = 0; caller < kNumCallers; ++caller) {
+    callers.emplace_back([runner, caller, &sums]() {
+      jxl::ThreadPool pool(&JxlWorkStealingRunner, runner);
+      for (int i = 0; i < 10; ++i) {
+        pool.Run(0, kNumTasks, jxl::ThreadPool::SkipInit(),
+                 [caller, &sums](const int task, const int thread) {
+                   sums[caller].fetch_add(1);
+                 });
+      }
+    });
+  }
+  for (std::thread& caller : callers) {
+    caller.join();
+  }
+  for (int caller = 0; caller < kNumCallers; ++caller) {
+    EXPECT_EQ(10 * kNumTasks, sums[caller].load());
+  }
+
+  JxlWorkStealingRunnerDestroy(runner);
+}
+
+}  // namespace
+}  // namespace jpegxl
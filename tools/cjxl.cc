@@ -332,8 +332,8 @@ void CompressArgs::AddCommandLineOptions(CommandLineParser* cmdline) {
   cmdline->AddOptionValue(
       's', "speed", "SPEED",
       "Encoder effort/speed setting. Valid values are:\n"
-      "    3|falcon| 4|cheetah| 5|hare| 6|wombat| 7|squirrel| 8|kitten| "
-      "9|tortoise\n"
+      "    2|lightning| 3|falcon| 4|cheetah| 5|hare| 6|wombat| 7|squirrel| "
+      "8|kitten| 9|tortoise\n"
       "    Default: squirrel (7). Values are in order from faster to slower.",
       &params.speed_tier, &ParseSpeedTier);
 
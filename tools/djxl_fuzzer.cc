@@ -27,9 +27,6 @@
 #include "jxl/thread_parallel_runner.h"
 #include "jxl/thread_parallel_runner_cxx.h"
 
-// Unpublised API.
-void SetDecoderMemoryLimitBase_(size_t memory_limit_base);
-
 namespace {
 
 // Externally visible value to ensure pixels are used in the fuzzer.
@@ -52,7 +49,6 @@ bool DecodeJpegXl(const uint8_t* jxl, size_t size, size_t max_pixels,
                   const FuzzSpec& spec, std::vector<uint8_t>* pixels,
                   size_t* xsize, size_t* ysize,
                   std::vector<uint8_t>* icc_profile) {
-  SetDecoderMemoryLimitBase_(0x100000);
   // Multi-threaded parallel runner. Limit to max 2 threads since the fuzzer
   // itself is already multithreded.
   size_t num_threads =
@@ -63,6 +59,10 @@ bool DecodeJpegXl(const uint8_t* jxl, size_t size, size_t max_pixels,
   std::exponential_distribution<> dis(kStreamingTargetNumberOfChunks);
 
   auto dec = JxlDecoderMake(nullptr);
+  // Fail early on images that would need large allocations.
+  if (JXL_DEC_SUCCESS != JxlDecoderSetMemoryLimit(dec.get(), 1 << 26)) {
+    return false;
+  }
   if (JXL_DEC_SUCCESS !=
       JxlDecoderSubscribeEvents(dec.get(),
                                 JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING |
@@ -105,7 +105,7 @@ bool DecodeJpegXl(const uint8_t* jxl, size_t size, size_t max_pixels,
   for (;;) {
     JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
 
-    if (status == JXL_DEC_ERROR) {
+    if (status == JXL_DEC_ERROR || status == JXL_DEC_MEMORY_LIMIT_EXCEEDED) {
       return false;
     } else if (status == JXL_DEC_NEED_MORE_INPUT) {
       if (spec.use_streaming) {